@@ -24,6 +24,7 @@
 #include "buttons.h"
 #include "joystick.h"
 #include "tcp_socket.h"
+#include "udp_socket.h"
 #include "led.h"
 #include "usb_device.h"
 #include "pairing.h"
@@ -31,6 +32,10 @@
 #include "serializer.h"
 #include "lcm_types.h"
 #include "direct.h"
+#include "metrics.h"
+#include "profiling.h"
+#include "task_topology.h"
+#include "robots.h"
 
 #define BUTTONS_UP_PIN          10                      /**< Controller button 1 (Up) pin on board (GPIO)*/
 #define BUTTONS_RIGHT_PIN       9                       /**< Controller Button 2 (Right) pin on board (GPIO)*/
@@ -52,8 +57,20 @@
 
 #define AP_IS_HIDDEN            1
 #define AP_CHANNEL              11
-#define AP_MAX_CONN             3
-#define AP_PORT                 8000
+#define AP_MAX_CONN             ESP_WIFI_MAX_CONN_NUM   /**< Soft-AP station limit of the ESP32, robot state is only allocated on connect */
+#define AP_PORT                 8000                    /**< TCP port robots connect to, and UDP port their sensor streams are sent to */
+#define ROBOT_LINK_OPTIONS      { .nodelay = 1, .keepalive = 1, .keepalive_idle_s = 2, .keepalive_interval_s = 1, \
+                                  .keepalive_count = 3, .tos = tcp_TOS(tcp_DSCP_EF) }
+                                                        /**< Control profile of every robot connection, velocity commands are small and must not wait for Nagle */
+
+#define CONNECTION_WAIT_MS      100                     /**< Longest connection_task sleeps, robots_send wakes it so this only paces housekeeping */
+#define METRICS_PERIOD_MS       5000                    /**< Period at which metrics are sent to the host */
+#define PROFILING_PERIOD_MS     10000                   /**< Period at which task and heap diagnostics are sent to the host */
+
+#define COMMAND_LINK_ID         0xFF                    /**< Robot id used for packets originating from the command link itself */
+#define USB_CTRL_QUEUE_LEN      64                      /**< Depth of the control port TX queue (packets) */
+#define USB_BULK_QUEUE_LEN      8                       /**< Depth of the bulk port TX queue (packets), kept short so data stays fresh */
+#define USB_CTRL_TX_TIMEOUT_MS  10                      /**< Maximum time spent waiting for room in the control port TX queue */
 
 typedef enum {
     PILOT,
@@ -67,14 +84,20 @@ typedef enum {
     SERIAL_CONFIRM = BIT3
 } control_mode_t;
 
-#pragma pack(push, 1)
-typedef struct packet_t {
-    uint8_t *data;
-    uint16_t len;
-} packet_t;
-#pragma pack(pop)
+typedef enum {
+    TASKS_USB,                  /**< Started first so the host hears from the command link while Wi-Fi comes up */
+    TASKS_NETWORK,              /**< Started once the access point is up */
+    TASKS_CONTROL,              /**< Started last, in pilot mode */
+    TASKS_ON_DEMAND             /**< Started on mode switches */
+} task_group_t;
+
+typedef struct usb_port_t {
+    usb_device_t *dev;
+    QueueHandle_t tx_queue;
+} usb_port_t;
 
 void connection_task(void *args);
-void server_task(void *args);
 void serial_task(void *args);
-void pilot_task(void *args);
\ No newline at end of file
+void pilot_task(void *args);
+void usb_tx_task(void *args);
+void heartbeat_task(void *args);
\ No newline at end of file
@@ -0,0 +1,171 @@
+/**
+ * @file robots.h
+ * @brief Per-robot state of the command link.
+ *
+ * A robot's state (connection, TX queue, stream parser and statistics) is allocated when its
+ * connection is accepted and freed when it disconnects, so memory scales with the number of
+ * robots actually connected instead of the number of slots. Only the pointer table is sized
+ * for the maximum number of robots.
+ *
+ * robots_wait() and robots_service() must be called from a single task, which owns every
+ * connection and the server they are accepted from. Any task may queue packets for a robot
+ * with robots_send(). Robots may also send sensor streams as UDP
+ * datagrams, which are matched to a robot by its IP address and merged into its stream by
+ * robots_recv_datagram() from the same task.
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+#include "tcp_socket.h"
+#include "serializer.h"
+
+#define ROBOT_TX_QUEUE_LEN      16                      /**< Packets queued per robot on their way to it */
+#define ROBOT_TX_BURST          4                       /**< Packets sent to a robot per robots_service pass */
+#define ROBOT_RX_BUDGET         4096                    /**< Bytes read from a robot per robots_service pass */
+#define ROBOT_FRAME_HEADER_LEN  4                       /**< [SYNC_FLAG, ROBOT_ID, LEN_LSB, LEN_MSB] prepended for the host */
+#define ROBOT_SEQ_RESTART_GAP   1024                    /**< A datagram this far behind means the robot restarted its sequence */
+
+#define ROBOTS_ACCEPT           (1 << 0)                /**< robots_wait: a robot is waiting to be accepted */
+#define ROBOTS_DATAGRAMS        (1 << 1)                /**< robots_wait: a datagram is waiting */
+
+#pragma pack(push, 1)
+typedef struct packet_t {
+    uint8_t *data;
+    uint32_t len;
+} packet_t;
+#pragma pack(pop)
+
+/**
+ * @brief Statistics of a single robot connection.
+ */
+typedef struct robot_stats_t {
+    uint32_t packets_recv;
+    uint32_t bytes_recv;
+    uint32_t packets_sent;
+    uint32_t checksum_errors;
+    uint32_t sync_errors;
+    uint32_t tx_drops;
+    uint32_t datagrams_recv;
+    uint32_t datagrams_lost;        /**< Gaps in the datagram sequence */
+    uint32_t datagrams_stale;       /**< Datagrams dropped for arriving after a newer one */
+    int64_t connected_time;
+} robot_stats_t;
+
+/**
+ * @brief Callback invoked for every packet received from a robot.
+ *
+ * The frame is [SYNC_FLAG, ROBOT_ID, LEN_LSB, LEN_MSB, [ROS PACKET]], ready to be forwarded
+ * to the host. Ownership of the frame passes to the callback, which must free it.
+ *
+ * @param robot_id The id of the robot the packet came from.
+ * @param topic The topic of the packet.
+ * @param frame The heap allocated frame.
+ * @param frame_len The length of the frame in bytes.
+ * @param ctx The context pointer passed to robots_init.
+ */
+typedef void (*robot_packet_cb_t)(uint8_t robot_id, uint16_t topic, uint8_t *frame, uint32_t frame_len, void *ctx);
+
+/**
+ * @brief Initializes the robot table.
+ *
+ * @param max_robots The maximum number of robots connected at once.
+ * @param packet_cb The callback invoked for every packet received from a robot.
+ * @param ctx An optional context pointer passed to the callback.
+ * @return 0 if successful, 1 otherwise.
+ */
+uint8_t robots_init(uint8_t max_robots, robot_packet_cb_t packet_cb, void *ctx);
+
+/**
+ * @brief Allocates the state of a newly connected robot.
+ *
+ * @param connection The robot's connection. Ownership passes to the robot table on success.
+ * @return The id assigned to the robot, or -1 if the table is full or allocation failed.
+ */
+int16_t robots_add(tcp_connection_t *connection);
+
+/**
+ * @brief Queues a packet to be sent to a robot, without waiting for room in its queue.
+ *
+ * @param robot_id The id of the robot.
+ * @param packet The packet. Ownership of packet->data passes to the robot table on success only.
+ * @return 0 if the packet was queued, 1 if the robot is not connected or its queue is full.
+ */
+uint8_t robots_send(uint8_t robot_id, packet_t *packet);
+
+/**
+ * @brief Waits until a robot sends, connects, has room for data it could not take earlier, or a datagram arrives.
+ *
+ * One select covers the server, every robot and the datagram socket. Robots with data to
+ * read are marked for the next robots_service pass. Returns at once while packets are queued
+ * for a robot that can take them; packets queued by other tasks during the wait go out once
+ * it ends, so timeout_ms bounds their latency.
+ *
+ * @param server The server robots connect to, NULL to not watch for new robots.
+ * @param udp The socket robots send datagrams to, NULL if none.
+ * @param timeout_ms The maximum time to wait.
+ * @return ROBOTS_ACCEPT and ROBOTS_DATAGRAMS flags of what else needs service, 0 if only robots do or on timeout.
+ */
+uint8_t robots_wait(tcp_server_t *server, udp_socket_t *udp, uint32_t timeout_ms);
+
+/**
+ * @brief Sends queued packets to every connected robot and reads from those robots_wait found readable.
+ *
+ * Never blocks on a single robot. Robots whose connection closed or timed out are freed.
+ *
+ * @return The number of bytes moved in either direction, 0 if there was nothing to do.
+ */
+uint32_t robots_service(void);
+
+/**
+ * @brief Forwards a datagram from a robot like a packet received on its connection.
+ *
+ * Datagrams older than one already forwarded for the robot are dropped, a late sensor
+ * message is worth less than nothing. Must be called from the task calling robots_service.
+ *
+ * @param source_ip The IPv4 address the datagram came from, in network byte order.
+ * @param data The datagram, [SEQ (DATAGRAM_HEADER_LEN bytes), [ROS PACKET]].
+ * @param len The length of the datagram in bytes.
+ * @return 0 if the datagram was forwarded, 1 if it was dropped.
+ */
+uint8_t robots_recv_datagram(uint32_t source_ip, const uint8_t *data, uint32_t len);
+
+/**
+ * @brief Checks whether a robot is connected.
+ *
+ * @param robot_id The id of the robot.
+ * @return 1 if connected, 0 otherwise.
+ */
+uint8_t robots_is_connected(uint8_t robot_id);
+
+/**
+ * @brief Gets the number of connected robots.
+ *
+ * @return The number of connected robots.
+ */
+uint8_t robots_count(void);
+
+/**
+ * @brief Gets the maximum number of robots, one more than the largest valid id.
+ *
+ * @return The maximum number of robots.
+ */
+uint8_t robots_max(void);
+
+/**
+ * @brief Copies the statistics of a robot.
+ *
+ * @param robot_id The id of the robot.
+ * @param stats The structure to copy the statistics into.
+ * @return 0 if successful, 1 if the robot is not connected.
+ */
+uint8_t robots_get_stats(uint8_t robot_id, robot_stats_t *stats);
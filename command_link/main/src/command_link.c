@@ -22,26 +22,27 @@
 #include "buttons.h"
 #include "joystick.h"
 #include "tcp_socket.h"
+#include "udp_socket.h"
 #include "led.h"
 #include "usb_device.h"
 #include "pairing.h"
 #include "wifi.h"
 #include "serializer.h"
 #include "lcm_types.h"
+#include "metrics.h"
+#include "profiling.h"
+#include "task_topology.h"
+#include "robots.h"
 
 #include "command_link.h"
 
 #define MAX_EMPTY_READS 64
 #define BUFFER_SIZE 64
 
-static tcp_connection_t *connections[AP_MAX_CONN];
-static int num_connections_socket = 0;
-
 static host_state_t state;
 
 tcp_server_t *server;
-
-QueueHandle_t usb_recv_queue[AP_MAX_CONN];
+udp_socket_t *udp;
 
 static EventGroupHandle_t control_mode_event_group;
 
@@ -52,195 +53,188 @@ static led_t *led2;
 static button_t *pair_btn;
 static button_t *pilot_btn;
 static joystick_t *js;
-static usb_device_t *usb_dev;
-
-// There is a bug that is causing the socket to disconnect
-// This could be one of two issues: either signal stregth/interference (which isn't something we can control, unless it is being caused by power supply issues)
-// or the socket send/recv are blocking when they shouldn't be, which is causing the client socket to timeout and disconnect
-// This bug is probably the result of an invalid packet being sent and then the sync flag detection takes a long time to parse the rest of the invalid packet
-// This could be resolved by implementing a larger buffer for the sync flag so that it reads more bytes per recv call
-// To improve speed once more, we could create a separte task for the sockets so that we poll the recv function and store the bytes into the buffer so that when a user calls
-//     socket_xxx_recv(), it will just read from the buffer instead of the socket
 
+static usb_port_t ctrl_port;
+static usb_port_t bulk_port;
+
+static metrics_counter_t *lidar_scans_recv;
+static metrics_counter_t *bulk_drops;
+
+TASK_STATIC_BUFFERS(usb_ctrl_task, 4096);
+TASK_STATIC_BUFFERS(usb_bulk_task, 4096);
+TASK_STATIC_BUFFERS(connection_task, 4096);
+TASK_STATIC_BUFFERS(heartbeat_task, 4096);
+
+/**
+ * @brief Every task of the command link. The robot sockets are accepted and serviced by one task
+ * on core 0 next to Wi-Fi and lwIP, USB and the controls run on core 1. The pilot and serial tasks replace each other on
+ * mode switches and are allocated from the heap, the rest live for the whole run and are static.
+ */
+static const task_spec_t command_link_tasks[] = {
+    { .name = "usb_ctrl_task", .entry = usb_tx_task, .args = &ctrl_port, .priority = 6, .core = 1, .group = TASKS_USB, TASK_STATIC(usb_ctrl_task) },
+    { .name = "usb_bulk_task", .entry = usb_tx_task, .args = &bulk_port, .priority = 3, .core = 1, .group = TASKS_USB, TASK_STATIC(usb_bulk_task) },
+    { .name = "connection_task", .entry = connection_task, .priority = 4, .core = 0, .group = TASKS_NETWORK, TASK_STATIC(connection_task) },
+    { .name = "heartbeat_task", .entry = heartbeat_task, .priority = 5, .core = 0, .group = TASKS_NETWORK, TASK_STATIC(heartbeat_task) },
+    { .name = "pilot_task", .entry = pilot_task, .stack_size = 4096, .priority = 4, .core = 1, .group = TASKS_CONTROL },
+    { .name = "serial_task", .entry = serial_task, .stack_size = 4096, .priority = 4, .core = 1, .group = TASKS_ON_DEMAND },
+};
+
+#define NUM_TASKS (sizeof(command_link_tasks) / sizeof(command_link_tasks[0]))
+
+/**
+ * @brief Returns the USB port a robot topic is forwarded to.
+ *
+ * Sensor streams go to the bulk port so a camera frame queued behind another never
+ * delays a command, heartbeat or stats packet on the control port.
+ */
+static usb_port_t *usb_port_for_topic(uint16_t topic)
+{
+    switch (topic)
+    {
+        case MBOT_LIDAR_SCAN:
+        case MBOT_CAMERA_FRAME:
+            return &bulk_port;
+        default:
+            return &ctrl_port;
+    }
+}
 
-// There is another bug where if the client disconnects and reconnects before we detect the disconnect, we assign a new robot_id to the same client before deleting its connection task
-// This should be resolved by dynamically allocating connection pointers for each unique MAC address that connects to the access point
-// This would allow the connection task to resume on the same client if it disconnects and reconnects without uncertainty in robot_id maintainence
-
-uint8_t read_exact(tcp_connection_t *connection, uint8_t *buffer, uint32_t len)
+/**
+ * @brief Queues a framed packet on a USB port. Takes ownership of packet->data.
+ *
+ * The bulk port never blocks the caller, if its queue is full the packet is dropped since
+ * a newer scan or frame will follow. The control port waits up to USB_CTRL_TX_TIMEOUT_MS.
+ */
+static void usb_port_enqueue(usb_port_t *port, packet_t *packet)
 {
-    uint32_t bytes_read = 0;
-    while (bytes_read < len)
+    TickType_t timeout = (port == &bulk_port) ? 0 : USB_CTRL_TX_TIMEOUT_MS / portTICK_PERIOD_MS;
+    if (port->dev == NULL || xQueueSend(port->tx_queue, packet, timeout) != pdTRUE)
     {
-        bytes_read += tcp_connection_recv(connection, buffer + bytes_read, len - bytes_read);
-        if (tcp_connection_is_closed(connection))
+        if (port == &bulk_port)
         {
-            return 1;
+            metrics_counter_inc(bulk_drops);
         }
+        free(packet->data);
     }
-    return 0;
 }
 
-void connection_task(void *args)
+// Each port is drained by its own task so the two CDC-ACM pipes are scheduled independently
+void usb_tx_task(void *args)
 {
-    tcp_connection_t *connection;
-    uint8_t robot_id = 0;
-
-    TickType_t count = 0;
-    TickType_t start_time = xTaskGetTickCount();
-
+    usb_port_t *port = (usb_port_t *)args;
+    packet_t packet;
     while (true)
     {
-        while (true)
+        if (xQueueReceive(port->tx_queue, &packet, portMAX_DELAY) != pdTRUE)
         {
-            if (num_connections_socket == 0)
-            {
-                vTaskDelay(500 / portTICK_PERIOD_MS);
-                continue;
-            }
-
-            robot_id = (robot_id + 1) % num_connections_socket;
-            connection = connections[robot_id];
-
-            packet_t usb_packet;
-            if (xQueueReceive(usb_recv_queue[robot_id], &usb_packet, 0) == pdTRUE)
-            {
-                tcp_connection_send(connection, usb_packet.data, usb_packet.len);
-                free(usb_packet.data);
-                if (tcp_connection_is_closed(connection))
-                {
-                    goto end;
-                }
-                // ESP_LOGI("HOST", "Sent %lu bytes to client with id %d", bytes_sent, robot_id);
-            }
-
-            uint8_t header[ROS_HEADER_LEN];
-            uint8_t err = read_exact(connection, header, ROS_HEADER_LEN);
-            if (err)
-            {
-                goto end;
-            }
-
-            // if (header[0] != SYNC_FLAG) continue;
-
-            // err = read_exact(connection, header + 1, ROS_HEADER_LEN - 1);
-            // if (err)
-            // {
-            //     goto end;
-            // }
-
-            uint8_t start_idx = 0;
-            uint8_t trigger = 0x0;
-            for (; start_idx < ROS_HEADER_LEN; start_idx++) {
-                if (header[start_idx] == SYNC_FLAG) {
-                    trigger = SYNC_FLAG;
-                    break;
-                }
-            }
-            if (trigger != SYNC_FLAG) {
-                continue;
-            }
-
-            // ESP_LOGI("HOST", "start_idx %d", start_idx);
-            if (start_idx != 0) {
-                uint8_t temp[ROS_HEADER_LEN];
-                memcpy(temp, header + start_idx, ROS_HEADER_LEN - start_idx);
-                err = read_exact(connection, temp + ROS_HEADER_LEN - start_idx, start_idx);
-                if (err)
-                {
-                    goto end;
-                }
-                memcpy(header, temp, ROS_HEADER_LEN);
-            }
-            // ESP_LOGI("HOST", "header[0]: %d", header[0]);
-            // ESP_LOGI("HOST", "header[1]: %d", header[1]);
-
-            uint8_t version = header[1];
-            if (version != VERSION_FLAG) {
-                ESP_LOGE("server_task", "Error: Version flag is incompatible.");
-                continue;
-            }
-
-            uint16_t msg_len = header[2] + ((uint16_t)header[3] << 8);
-            uint16_t topic = header[5] + ((uint16_t)header[6] << 8);
-            uint8_t cs = header[4];
-            uint8_t calc_cs = checksum(header + 2, 2);
-
-            if (topic == MBOT_LIDAR_SCAN) {
-                count += 1;
-                ESP_LOGI("HOST", "Receiving lidar at %f Hz", (float)count / (((xTaskGetTickCount() - start_time) * portTICK_PERIOD_MS) / 1000.0));
-            }
+            continue;
+        }
+        usb_device_send(port->dev, packet.data, packet.len);
+        free(packet.data);
+    }
+}
 
-            // ESP_LOGI("HOST", "msg_len: %d", msg_len);
-            // ESP_LOGI("HOST", "topic: %d", topic);
-            // ESP_LOGI("HOST", "cs: %d", cs);
-            // ESP_LOGI("HOST", "calc_cs: %d", calc_cs);
+/**
+ * @brief Queues one of the command link's own reports on the control port.
+ */
+static void usb_report(uint16_t topic, uint8_t *data, uint16_t len)
+{
+    packet_t packet;
+    packet.len = len + 4 + ROS_PKG_LEN;
+    packet.data = (uint8_t *)malloc(packet.len);
+    if (packet.data == NULL)
+    {
+        return;
+    }
 
-            if (cs != calc_cs) {
-                ESP_LOGE("server_task", "Error: Checksum over message length failed.");
-                continue;
-            }
-            // else if (version != VERSION_FLAG) {
-            //     ESP_LOGE("server_task", "Error: Version flag is incompatible.");
-            //     goto delay;
-            // }
+    packet.data[0] = SYNC_FLAG;
+    packet.data[1] = COMMAND_LINK_ID;
+    packet.data[2] = (len + ROS_PKG_LEN) & 0xFF;
+    packet.data[3] = ((len + ROS_PKG_LEN) >> 8) & 0xFF;
+    encode_rospkt(data, len, topic, packet.data + 4);
+    usb_port_enqueue(&ctrl_port, &packet);
+}
 
-            uint8_t *packet = (uint8_t *)malloc(msg_len + 4 + ROS_PKG_LEN);
+void usb_metrics_sink(uint8_t *data, uint16_t len, void *ctx)
+{
+    usb_report(MBOT_METRICS, data, len);
+}
 
-            packet[0] = SYNC_FLAG;
-            packet[1] = robot_id;
-            packet[2] = (msg_len + ROS_PKG_LEN) & 0xFF; // LSB
-            packet[3] = ((msg_len + ROS_PKG_LEN) >> 8) & 0xFF; // MSB
+void usb_diagnostics_sink(uint8_t *data, uint16_t len, void *ctx)
+{
+    usb_report(MBOT_DIAGNOSTICS, data, len);
+}
 
-            memcpy(packet + 4, header, ROS_HEADER_LEN);
+// Forwards every packet received from a robot to the host on the port for its topic
+void robot_packet_callback(uint8_t robot_id, uint16_t topic, uint8_t *frame, uint32_t frame_len, void *ctx)
+{
+    if (topic == MBOT_LIDAR_SCAN)
+    {
+        metrics_counter_inc(lidar_scans_recv);
+    }
 
-            err = read_exact(connection, packet + 4 + ROS_HEADER_LEN, msg_len);
-            if (err)
-            {
-                free(packet);
-                goto end;
-            }
+    packet_t usb_packet = { .data = frame, .len = frame_len };
+    usb_port_enqueue(usb_port_for_topic(topic), &usb_packet);
+}
 
-            // usb_device_send(usb_dev, packet, msg_len + 4 + ROS_PKG_LEN);
+/**
+ * @brief Forwards the datagrams waiting on the UDP socket, up to ROBOT_RX_BUDGET bytes.
+ *
+ * @return The number of bytes received.
+ */
+static uint32_t datagrams_service(void)
+{
+    static uint8_t datagram[udp_MAX_DATAGRAM_LEN];
+    uint32_t total = 0;
+    while (total < ROBOT_RX_BUDGET)
+    {
+        uint32_t source_ip;
+        uint32_t len = udp_socket_recv(udp, datagram, sizeof(datagram), &source_ip);
+        if (len == 0)
+        {
+            break;
+        }
+        robots_recv_datagram(source_ip, datagram, len);
+        total += len;
+    }
+    return total;
+}
 
-            // ESP_LOGI("HOST", "Received %d bytes from client with id %d", msg_len + 4 + ROS_PKG_LEN, robot_id);
-            free(packet);
-            // vTaskDelay(10 / portTICK_PERIOD_MS);
+/**
+ * @brief Accepts every pending robot connection.
+ */
+static void accept_robots(void)
+{
+    tcp_connection_t *connection;
+    while ((connection = tcp_server_accept(server)) != NULL)
+    {
+        int16_t robot_id = robots_add(connection);
+        if (robot_id < 0)
+        {
+            ESP_LOGI("HOST", "Max number of connections reached.");
+            tcp_connection_free(connection);
+            continue;
         }
-        end:
-        ESP_LOGW("HOST", "Client disconnected. Closing connection...");
-        num_connections_socket--;
-        tcp_connection_free(connection);
-        connections[robot_id] = NULL;
+        ESP_LOGI("HOST", "Client connected with id %d", robot_id);
     }
 }
 
-void server_task(void *args)
+// Accepts and services every robot connection and the robots' datagrams from a single task, a slow robot never stalls the others.
+// Sleeps in one select over all of them, so a robot is accepted or read as soon as it connects or sends.
+void connection_task(void *args)
 {
     while (true)
     {
-        tcp_connection_t *connection = tcp_server_accept(server);
-        if (connection != NULL)
+        uint8_t events = robots_wait(server, udp, CONNECTION_WAIT_MS);
+        if (events & ROBOTS_ACCEPT)
         {
-            if (num_connections_socket == AP_MAX_CONN) {
-                tcp_connection_close(connection);
-                ESP_LOGI("HOST", "Max number of connections reached.");
-                vTaskDelay(500 / portTICK_PERIOD_MS);
-                continue;
-            }
-
-            ESP_LOGI("HOST", "Client connected.");
-
-            for (int i = 0; i < AP_MAX_CONN; ++i) {
-                if (connections[i] == NULL) {
-                    connections[i] = connection;
-                    ESP_LOGI("HOST", "Creating connection task for client with id %d", i);
-                    num_connections_socket++;
-                    break;
-                }
-            }
+            accept_robots();
+        }
+        robots_service();
+        if (events & ROBOTS_DATAGRAMS)
+        {
+            datagrams_service();
         }
-        vTaskDelay(500 / portTICK_PERIOD_MS);
     }
 }
 
@@ -256,11 +250,11 @@ void serial_task(void *args)
         {
             xEventGroupClearBits(control_mode_event_group, SERIAL_STOP);
             state = PILOT;
-            xTaskCreate(pilot_task, "pilot_task", 4096, NULL, 4, NULL);
+            task_topology_start_task(command_link_tasks, NUM_TASKS, "pilot_task");
             vTaskDelete(NULL);
         }
 
-        int bytes_read = usb_device_read(usb_dev, &trigger, 1);
+        int bytes_read = usb_device_read(ctrl_port.dev, &trigger, 1);
         if (bytes_read < 0)
         {
             ESP_LOGE("SERIAL_TASK", "Error: Failed to read data from USB.");
@@ -279,7 +273,7 @@ void serial_task(void *args)
             bytes_read = 0;
             while (bytes_read < 3)
             {
-                int bytes = usb_device_read(usb_dev, header + 1 + bytes_read, 3 - bytes_read);
+                int bytes = usb_device_read(ctrl_port.dev, header + 1 + bytes_read, 3 - bytes_read);
                 if (bytes < 0)
                 {
                     break;
@@ -296,7 +290,7 @@ void serial_task(void *args)
             bytes_read = 0;
             while (bytes_read < msg_len)
             {
-                int bytes = usb_device_read(usb_dev, packet.data + bytes_read, msg_len - bytes_read);
+                int bytes = usb_device_read(ctrl_port.dev, packet.data + bytes_read, msg_len - bytes_read);
                 if (bytes < 0)
                 {
                     break;
@@ -304,10 +298,9 @@ void serial_task(void *args)
                 bytes_read += bytes;
             }
 
-            BaseType_t err = xQueueSend(usb_recv_queue[robot_id], &packet, portMAX_DELAY);
-            if (err != pdTRUE)
+            if (robots_send(robot_id, &packet))
             {
-                ESP_LOGE("SERIAL_TASK", "Error: Failed to send packet to message queue.");
+                ESP_LOGE("SERIAL_TASK", "Error: Failed to send packet to robot %d.", robot_id);
                 free(packet.data);
             }
         }
@@ -325,7 +318,7 @@ void pilot_task(void *args)
         {
             xEventGroupClearBits(control_mode_event_group, PILOT_STOP);
             state = SERIAL; 
-            xTaskCreate(serial_task, "serial_task", 4096, NULL, 4, NULL);
+            task_topology_start_task(command_link_tasks, NUM_TASKS, "serial_task");
             vTaskDelete(NULL);
         }
 
@@ -360,10 +353,9 @@ void pilot_task(void *args)
 
         encode_rospkt(msg, sizeof(serial_twist2D_t), MBOT_VEL_CMD, packet.data);
 
-        BaseType_t err = xQueueSend(usb_recv_queue[curr_robot_id], &packet, portMAX_DELAY);
-        if (err != pdTRUE)
+        if (robots_send(curr_robot_id, &packet))
         {
-            ESP_LOGE("PILOT_TASK", "Error: Failed to send packet to message queue.");
+            ESP_LOGE("PILOT_TASK", "Error: Failed to send packet to robot %d.", curr_robot_id);
             free(packet.data);
         }
 
@@ -381,8 +373,8 @@ void heartbeat_task(void *args)
     {
         xLastWakeTime = xTaskGetTickCount();
 
-        for (int i = 0; i < AP_MAX_CONN; i++) {
-            if (connections[i] == NULL) {
+        for (int i = 0; i < robots_max(); i++) {
+            if (!robots_is_connected(i)) {
                 continue;
             }
 
@@ -401,10 +393,9 @@ void heartbeat_task(void *args)
 
             encode_rospkt(msg, sizeof(serial_timestamp_t), MBOT_TIMESYNC, packet.data);
 
-            BaseType_t err = xQueueSend(usb_recv_queue[i], &packet, portMAX_DELAY);
-            if (err != pdTRUE)
+            if (robots_send(i, &packet))
             {
-                ESP_LOGE("HEARTBEAT_TASK", "Error: Failed to send packet to message queue.");
+                ESP_LOGE("HEARTBEAT_TASK", "Error: Failed to send heartbeat to robot %d.", i);
                 free(packet.data);
             }
             // ESP_LOGI("HEARTBEAT_TASK", "Sent heartbeat to client with id %d", i);
@@ -419,7 +410,7 @@ pair_config_t pair_wifi() {
     uint8_t ack_recv;
     int bytes_read = 0;
     while (!bytes_read) {
-        bytes_read = usb_device_read(usb_dev, &ack_recv, 1);
+        bytes_read = usb_device_read(ctrl_port.dev, &ack_recv, 1);
         vTaskDelay(100 / portTICK_PERIOD_MS);
     }
 
@@ -429,27 +420,27 @@ pair_config_t pair_wifi() {
     button_wait_for_release(pair_btn);
 
     if (strlen(pair_cfg.ssid) >= 3 || strlen(pair_cfg.password) != 0) {
-        usb_device_send(usb_dev, (uint8_t*)pair_cfg.ssid, sizeof(pair_cfg.ssid));
+        usb_device_send(ctrl_port.dev, (uint8_t*)pair_cfg.ssid, sizeof(pair_cfg.ssid));
     }
 
     pair_config_t new_pair_cfg = {0};
     uint8_t ack_send = 0xFF;
     while (true) {
-        usb_device_send(usb_dev, &ack_send, 1);
+        usb_device_send(ctrl_port.dev, &ack_send, 1);
 
         vTaskDelay(500 / portTICK_PERIOD_MS);
         
         uint8_t buffer[sizeof(pair_config_t)];
-        usb_device_read(usb_dev, buffer, sizeof(pair_config_t));
+        usb_device_read(ctrl_port.dev, buffer, sizeof(pair_config_t));
         memcpy(&new_pair_cfg, buffer, sizeof(pair_config_t));
 
         vTaskDelay(500 / portTICK_PERIOD_MS);
 
-        usb_device_send(usb_dev, buffer, sizeof(pair_config_t));
+        usb_device_send(ctrl_port.dev, buffer, sizeof(pair_config_t));
 
         vTaskDelay(500 / portTICK_PERIOD_MS);
         
-        usb_device_read(usb_dev, &ack_recv, 1);
+        usb_device_read(ctrl_port.dev, &ack_recv, 1);
 
         if (ack_recv == 0xFF) {
             break;
@@ -478,14 +469,23 @@ void app_main(void)
     }
     ESP_ERROR_CHECK(ret);
 
-    for (int i = 0; i < AP_MAX_CONN; i++)
-    {
-        usb_recv_queue[i] = xQueueCreate(128, sizeof(packet_t));
-    }
-
     control_mode_event_group = xEventGroupCreate();
 
-    // usb_dev = usb_device_create(); 
+    robots_init(AP_MAX_CONN, robot_packet_callback, NULL);
+    lidar_scans_recv = metrics_counter_register("lidar_scans");
+
+    bulk_drops = metrics_counter_register("bulk_drops");
+
+    // CDC-ACM 0 carries commands, heartbeats and stats, CDC-ACM 1 carries sensor streams
+    ctrl_port.dev = usb_device_create();
+    ctrl_port.tx_queue = xQueueCreate(USB_CTRL_QUEUE_LEN, sizeof(packet_t));
+    bulk_port.dev = usb_device_create();
+    bulk_port.tx_queue = xQueueCreate(USB_BULK_QUEUE_LEN, sizeof(packet_t));
+    if (ctrl_port.dev == NULL || bulk_port.dev == NULL)
+    {
+        ESP_LOGE("HOST", "Failed to create USB ports.");
+    }
+    task_topology_start(command_link_tasks, NUM_TASKS, TASKS_USB);
 
     js = joystick_create(JOYSTICK_X_PIN, JOYSTICK_Y_PIN);
 
@@ -522,19 +522,17 @@ void app_main(void)
 
     wifi_config_t *wifi_ap_cfg = access_point_init(pair_cfg.ssid, pair_cfg.password, AP_CHANNEL, AP_IS_HIDDEN, AP_MAX_CONN);
 
-    for (int i = 0; i < AP_MAX_CONN; i++)
-    {
-        connections[i] = NULL;
-    }
-
+    static const tcp_options_t robot_link_options = ROBOT_LINK_OPTIONS;
     server = tcp_server_create(AP_PORT);
-    xTaskCreate(server_task, "server_task", 4096, NULL, 4, NULL);
-    xTaskCreate(connection_task, "connection_task", 4096, NULL, 4, NULL);
+    tcp_server_set_options(server, &robot_link_options);
+    udp = udp_socket_create(AP_PORT);
+    task_topology_start(command_link_tasks, NUM_TASKS, TASKS_NETWORK);
 
-    xTaskCreate(heartbeat_task, "heartbeat_task", 4096, NULL, 5, NULL);
+    metrics_reporter_start(METRICS_PERIOD_MS, usb_metrics_sink, NULL);
+    profiling_reporter_start(PROFILING_PERIOD_MS, usb_diagnostics_sink, NULL);
 
     state = PILOT;
-    xTaskCreate(pilot_task, "pilot_task", 4096, NULL, 4, NULL);
+    task_topology_start(command_link_tasks, NUM_TASKS, TASKS_CONTROL);
 
     button_set_held_threshold(pilot_btn, 1000);
     button_on_pressed_for(pilot_btn, pilot_btn_callback, NULL);
@@ -0,0 +1,636 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_vfs_eventfd.h"
+
+#include "tcp_socket.h"
+#include "serializer.h"
+#include "metrics.h"
+
+#include "robots.h"
+
+#define ROBOTS_TAG "ROBOTS"
+
+typedef enum {
+    ROBOT_RX_HEADER,
+    ROBOT_RX_BODY
+} robot_rx_state_t;
+
+typedef struct robot_t
+{
+    uint8_t id;
+    tcp_connection_t *connection;
+    uint32_t peer_ip;
+    QueueHandle_t tx_queue;
+    uint8_t ready;              /**< tcp_READY_ flags found by the last robots_wait */
+
+    // Stream parser, resumes wherever the last robots_service pass stopped
+    robot_rx_state_t rx_state;
+    uint8_t header[ROS_HEADER_LEN];
+    uint16_t topic;
+    uint8_t *frame;
+    uint32_t frame_len;
+    uint32_t frame_fill;
+
+    // Sequence number of the last datagram forwarded
+    uint8_t has_seq;
+    uint32_t last_seq;
+
+    robot_stats_t stats;
+} robot_t;
+
+static robot_t **robots = NULL;
+static uint8_t max_robots = 0;
+static uint8_t num_robots = 0;
+static SemaphoreHandle_t robots_lock = NULL;
+
+// Handed to tcp_server_wait, indexed by robot id
+static tcp_connection_t **wait_connections = NULL;
+static uint8_t *wait_ready = NULL;
+static int wake_fd = -1;        // Signalled by robots_send so queued packets go out without waiting for the select timeout
+
+static robot_packet_cb_t packet_callback = NULL;
+static void *packet_callback_ctx = NULL;
+
+static metrics_counter_t *robot_packets_recv;
+static metrics_counter_t *robot_bytes_recv;
+static metrics_counter_t *checksum_errors;
+static metrics_counter_t *robot_tx_drops;
+static metrics_counter_t *datagrams_recv;
+static metrics_counter_t *datagrams_lost;
+static metrics_counter_t *datagrams_stale;
+static metrics_gauge_t *robots_connected;
+
+/**
+ * @brief Gets a robot by id, or NULL if it is not connected.
+ */
+static robot_t *_robots_get(uint8_t robot_id)
+{
+    if (robot_id >= max_robots)
+    {
+        return NULL;
+    }
+    xSemaphoreTake(robots_lock, portMAX_DELAY);
+    robot_t *robot = robots[robot_id];
+    xSemaphoreGive(robots_lock);
+    return robot;
+}
+
+static void _robot_free(robot_t *robot)
+{
+    packet_t packet;
+    while (xQueueReceive(robot->tx_queue, &packet, 0) == pdTRUE)
+    {
+        free(packet.data);
+    }
+    vQueueDelete(robot->tx_queue);
+    free(robot->frame);
+    tcp_connection_free(robot->connection);
+    free(robot);
+}
+
+static void _robots_remove(uint8_t robot_id)
+{
+    xSemaphoreTake(robots_lock, portMAX_DELAY);
+    robot_t *robot = robots[robot_id];
+    robots[robot_id] = NULL;
+    num_robots--;
+    metrics_gauge_set(robots_connected, num_robots);
+    xSemaphoreGive(robots_lock);
+
+    // Senders only touch the TX queue while holding the lock, so nobody can still be using it
+    _robot_free(robot);
+}
+
+/**
+ * @brief Drops the sync flag of a bad header, the next pass looks for the following one.
+ */
+static void _robot_resync(robot_t *robot)
+{
+    uint8_t flag;
+    tcp_connection_recv(robot->connection, &flag, 1);
+    robot->stats.sync_errors++;
+}
+
+/**
+ * @brief Validates a peeked header and starts receiving the packet body.
+ *
+ * @return 0 if the header is valid, 1 if it was discarded.
+ */
+static uint8_t _robot_accept_header(robot_t *robot)
+{
+    if (robot->header[1] != VERSION_FLAG)
+    {
+        _robot_resync(robot);
+        return 1;
+    }
+
+    if (robot->header[4] != checksum(robot->header + 2, 2))
+    {
+        ESP_LOGE(ROBOTS_TAG, "Error: Checksum over message length failed for robot %d.", robot->id);
+        robot->stats.checksum_errors++;
+        metrics_counter_inc(checksum_errors);
+        _robot_resync(robot);
+        return 1;
+    }
+
+    uint16_t msg_len = robot->header[2] + ((uint16_t)robot->header[3] << 8);
+    robot->topic = robot->header[5] + ((uint16_t)robot->header[6] << 8);
+    robot->frame_len = ROBOT_FRAME_HEADER_LEN + ROS_PKG_LEN + msg_len;
+    robot->frame = (uint8_t *)malloc(robot->frame_len);
+    if (robot->frame == NULL)
+    {
+        ESP_LOGE(ROBOTS_TAG, "Error: Failed to allocate %lu bytes for a packet from robot %d.", (unsigned long)robot->frame_len, robot->id);
+        _robot_resync(robot);
+        return 1;
+    }
+
+    robot->frame[0] = SYNC_FLAG;
+    robot->frame[1] = robot->id;
+    robot->frame[2] = (msg_len + ROS_PKG_LEN) & 0xFF; // LSB
+    robot->frame[3] = ((msg_len + ROS_PKG_LEN) >> 8) & 0xFF; // MSB
+    // The header was only peeked, it is read along with the body
+    robot->frame_fill = ROBOT_FRAME_HEADER_LEN;
+    robot->rx_state = ROBOT_RX_BODY;
+    return 0;
+}
+
+static void _robot_deliver(robot_t *robot)
+{
+    uint8_t *frame = robot->frame;
+    uint32_t frame_len = robot->frame_len;
+    robot->frame = NULL;
+    robot->rx_state = ROBOT_RX_HEADER;
+
+    robot->stats.packets_recv++;
+    robot->stats.bytes_recv += frame_len - ROBOT_FRAME_HEADER_LEN;
+    metrics_counter_inc(robot_packets_recv);
+    metrics_counter_add(robot_bytes_recv, frame_len - ROBOT_FRAME_HEADER_LEN);
+
+    if (packet_callback != NULL)
+    {
+        packet_callback(robot->id, robot->topic, frame, frame_len, packet_callback_ctx);
+    }
+    else
+    {
+        free(frame);
+    }
+}
+
+/**
+ * @brief Reads whatever a robot has sent, up to ROBOT_RX_BUDGET bytes.
+ *
+ * The connection reads ahead in large chunks, so headers are found and checked in its RX buffer
+ * and only a packet's body costs a copy.
+ *
+ * @return The number of bytes read.
+ */
+static uint32_t _robot_poll_rx(robot_t *robot)
+{
+    uint32_t total = 0;
+    while (total < ROBOT_RX_BUDGET)
+    {
+        uint32_t bytes_read;
+        if (robot->rx_state == ROBOT_RX_HEADER)
+        {
+            bytes_read = tcp_connection_skip_until(robot->connection, SYNC_FLAG);
+            robot->stats.sync_errors += bytes_read;
+            if (tcp_connection_peek(robot->connection, robot->header, ROS_HEADER_LEN) < ROS_HEADER_LEN)
+            {
+                total += bytes_read;
+                break;
+            }
+            if (_robot_accept_header(robot))
+            {
+                bytes_read++;
+            }
+        }
+        else
+        {
+            // The header, then the message followed by the checksum over topic and message
+            bytes_read = tcp_connection_recv(robot->connection, robot->frame + robot->frame_fill, robot->frame_len - robot->frame_fill);
+            if (bytes_read == 0)
+            {
+                break;
+            }
+            robot->frame_fill += bytes_read;
+            if (robot->frame_fill == robot->frame_len)
+            {
+                _robot_deliver(robot);
+            }
+        }
+        total += bytes_read;
+    }
+    return total;
+}
+
+/**
+ * @brief Sends up to ROBOT_TX_BURST queued packets to a robot.
+ *
+ * @return The number of bytes sent.
+ */
+static uint32_t _robot_poll_tx(robot_t *robot)
+{
+    // Packets stay queued while the robot's send window is full, robots_send drops once the queue is
+    if (tcp_connection_flush(robot->connection, 0) > 0)
+    {
+        return 0;
+    }
+
+    uint32_t total = 0;
+    packet_t packet;
+    for (int i = 0; i < ROBOT_TX_BURST; i++)
+    {
+        if (xQueueReceive(robot->tx_queue, &packet, 0) != pdTRUE)
+        {
+            break;
+        }
+        // A packet the connection had no room to buffer is dropped whole
+        uint32_t sent = tcp_connection_send(robot->connection, packet.data, packet.len);
+        if (sent > 0)
+        {
+            robot->stats.packets_sent++;
+            total += sent;
+        }
+        else
+        {
+            robot->stats.tx_drops++;
+            metrics_counter_inc(robot_tx_drops);
+        }
+        free(packet.data);
+    }
+    return total;
+}
+
+uint8_t robots_init(uint8_t max, robot_packet_cb_t packet_cb, void *ctx)
+{
+    robots = (robot_t **)calloc(max, sizeof(robot_t *));
+    wait_connections = (tcp_connection_t **)calloc(max, sizeof(tcp_connection_t *));
+    wait_ready = (uint8_t *)calloc(max, sizeof(uint8_t));
+    if (robots == NULL || wait_connections == NULL || wait_ready == NULL)
+    {
+        ESP_LOGE(ROBOTS_TAG, "Failed to allocate memory for robot table");
+        free(robots);
+        free(wait_connections);
+        free(wait_ready);
+        robots = NULL;
+        return 1;
+    }
+
+    robots_lock = xSemaphoreCreateMutex();
+    if (robots_lock == NULL)
+    {
+        ESP_LOGE(ROBOTS_TAG, "Failed to create robot table lock");
+        free(robots);
+        free(wait_connections);
+        free(wait_ready);
+        robots = NULL;
+        return 1;
+    }
+
+    // Already registered is fine, another component may use eventfds too
+    esp_vfs_eventfd_config_t eventfd_config = ESP_VFS_EVENTD_CONFIG_DEFAULT();
+    esp_err_t err = esp_vfs_eventfd_register(&eventfd_config);
+    wake_fd = (err == ESP_OK || err == ESP_ERR_INVALID_STATE) ? eventfd(0, 0) : -1;
+    if (wake_fd < 0)
+    {
+        ESP_LOGW(ROBOTS_TAG, "No wakeup eventfd, queued packets wait for the select timeout");
+    }
+
+    max_robots = max;
+    packet_callback = packet_cb;
+    packet_callback_ctx = ctx;
+
+    robot_packets_recv = metrics_counter_register("robot_pkts");
+    robot_bytes_recv = metrics_counter_register("robot_bytes");
+    checksum_errors = metrics_counter_register("cs_errs");
+    robot_tx_drops = metrics_counter_register("robot_tx_drops");
+    datagrams_recv = metrics_counter_register("udp_pkts");
+    datagrams_lost = metrics_counter_register("udp_lost");
+    datagrams_stale = metrics_counter_register("udp_stale");
+    robots_connected = metrics_gauge_register("robots");
+    return 0;
+}
+
+int16_t robots_add(tcp_connection_t *connection)
+{
+    if (connection == NULL || robots == NULL)
+    {
+        return -1;
+    }
+
+    robot_t *robot = (robot_t *)calloc(1, sizeof(robot_t));
+    if (robot == NULL)
+    {
+        ESP_LOGE(ROBOTS_TAG, "Failed to allocate memory for robot");
+        return -1;
+    }
+
+    robot->tx_queue = xQueueCreate(ROBOT_TX_QUEUE_LEN, sizeof(packet_t));
+    if (robot->tx_queue == NULL)
+    {
+        ESP_LOGE(ROBOTS_TAG, "Failed to create robot TX queue");
+        free(robot);
+        return -1;
+    }
+    robot->connection = connection;
+    robot->peer_ip = tcp_connection_get_peer_ip(connection);
+
+    // One task serves every robot, a slow one must not hold up the rest
+    tcp_connection_set_send_timeout(connection, 0);
+    robot->rx_state = ROBOT_RX_HEADER;
+    // It may have sent something before it was accepted
+    robot->ready = tcp_READY_READABLE;
+    robot->stats.connected_time = esp_timer_get_time();
+
+    int16_t robot_id = -1;
+    xSemaphoreTake(robots_lock, portMAX_DELAY);
+    for (int i = 0; i < max_robots; i++)
+    {
+        if (robots[i] == NULL)
+        {
+            robot->id = i;
+            robots[i] = robot;
+            robot_id = i;
+            num_robots++;
+            metrics_gauge_set(robots_connected, num_robots);
+            break;
+        }
+    }
+    xSemaphoreGive(robots_lock);
+
+    if (robot_id < 0)
+    {
+        // Leave the connection to the caller
+        vQueueDelete(robot->tx_queue);
+        free(robot);
+    }
+    return robot_id;
+}
+
+uint8_t robots_send(uint8_t robot_id, packet_t *packet)
+{
+    if (robot_id >= max_robots || packet == NULL)
+    {
+        return 1;
+    }
+
+    uint8_t err = 1;
+    xSemaphoreTake(robots_lock, portMAX_DELAY);
+    robot_t *robot = robots[robot_id];
+    if (robot != NULL)
+    {
+        // Never wait here, the connection task needs the lock to drain the queue
+        err = (xQueueSend(robot->tx_queue, packet, 0) != pdTRUE);
+        if (err)
+        {
+            robot->stats.tx_drops++;
+            metrics_counter_inc(robot_tx_drops);
+        }
+    }
+    xSemaphoreGive(robots_lock);
+
+    if (!err && wake_fd >= 0)
+    {
+        uint64_t one = 1;
+        write(wake_fd, &one, sizeof(one));
+    }
+    return err;
+}
+
+uint8_t robots_wait(tcp_server_t *server, udp_socket_t *udp, uint32_t timeout_ms)
+{
+    if (robots == NULL)
+    {
+        return 0;
+    }
+
+    // Packets left queued after a burst go out without waiting, unless the robot's window is full
+    uint8_t tx_pending = 0;
+    xSemaphoreTake(robots_lock, portMAX_DELAY);
+    for (uint8_t i = 0; i < max_robots; i++)
+    {
+        robot_t *robot = robots[i];
+        wait_connections[i] = (robot != NULL) ? robot->connection : NULL;
+        if (robot != NULL && uxQueueMessagesWaiting(robot->tx_queue) > 0 &&
+            tcp_connection_flush(robot->connection, 0) == 0)
+        {
+            tx_pending = 1;
+        }
+    }
+    xSemaphoreGive(robots_lock);
+
+    tcp_wait_t wait = {
+        .connections = wait_connections,
+        .count = max_robots,
+        .udp = udp,
+        .ready = wait_ready,
+        .wake_fd = (wake_fd > 0) ? wake_fd : 0,
+    };
+    if (tcp_server_wait(server, &wait, tx_pending ? 0 : timeout_ms) < 0)
+    {
+        // Do not spin on a broken select
+        vTaskDelay(pdMS_TO_TICKS(timeout_ms));
+        return 0;
+    }
+
+    if (wait.woken)
+    {
+        // Queued packets are sent by the robots_service pass that follows
+        uint64_t count;
+        read(wake_fd, &count, sizeof(count));
+    }
+
+    // Only this task adds or removes robots, the table still matches the one waited on
+    for (uint8_t i = 0; i < max_robots; i++)
+    {
+        robot_t *robot = _robots_get(i);
+        if (robot != NULL)
+        {
+            robot->ready |= wait_ready[i];
+        }
+    }
+    return (wait.acceptable ? ROBOTS_ACCEPT : 0) | (wait.datagrams ? ROBOTS_DATAGRAMS : 0);
+}
+
+uint32_t robots_service(void)
+{
+    uint32_t progress = 0;
+    for (uint8_t robot_id = 0; robot_id < max_robots; robot_id++)
+    {
+        // Only this task removes robots, so the pointer stays valid for the whole pass
+        robot_t *robot = _robots_get(robot_id);
+        if (robot == NULL)
+        {
+            continue;
+        }
+
+        progress += _robot_poll_tx(robot);
+        if (robot->ready & (tcp_READY_READABLE | tcp_READY_CLOSED))
+        {
+            progress += _robot_poll_rx(robot);
+        }
+        robot->ready = 0;
+
+        if (tcp_connection_is_closed(robot->connection))
+        {
+            ESP_LOGW(ROBOTS_TAG, "Robot %d disconnected. Closing connection...", robot_id);
+            _robots_remove(robot_id);
+        }
+    }
+    return progress;
+}
+
+/**
+ * @brief Gets the robot connected from an address, or NULL if there is none.
+ *
+ * A robot that reconnects before its old connection has timed out holds two slots for a while,
+ * its datagrams belong to the newest one.
+ */
+static robot_t *_robots_find_ip(uint32_t ip)
+{
+    robot_t *found = NULL;
+    xSemaphoreTake(robots_lock, portMAX_DELAY);
+    for (uint8_t i = 0; i < max_robots; i++)
+    {
+        if (robots[i] != NULL && robots[i]->peer_ip == ip &&
+            (found == NULL || robots[i]->stats.connected_time > found->stats.connected_time))
+        {
+            found = robots[i];
+        }
+    }
+    xSemaphoreGive(robots_lock);
+    return found;
+}
+
+/**
+ * @brief Checks a datagram's sequence number against the last one forwarded for its robot.
+ *
+ * @return 1 if the datagram is newer and should be forwarded, 0 if it is stale.
+ */
+static uint8_t _robot_accept_seq(robot_t *robot, uint32_t seq)
+{
+    int32_t ahead = (int32_t)(seq - robot->last_seq);
+    if (robot->has_seq && ahead <= 0 && ahead > -ROBOT_SEQ_RESTART_GAP)
+    {
+        robot->stats.datagrams_stale++;
+        metrics_counter_inc(datagrams_stale);
+        return 0;
+    }
+
+    if (robot->has_seq && ahead > 1)
+    {
+        robot->stats.datagrams_lost += ahead - 1;
+        metrics_counter_add(datagrams_lost, ahead - 1);
+    }
+    robot->has_seq = 1;
+    robot->last_seq = seq;
+    return 1;
+}
+
+uint8_t robots_recv_datagram(uint32_t source_ip, const uint8_t *data, uint32_t len)
+{
+    if (data == NULL || source_ip == 0 || len < DATAGRAM_HEADER_LEN + ROS_PKG_LEN)
+    {
+        return 1;
+    }
+
+    // Only this task removes robots, so the robot stays valid until we return
+    robot_t *robot = _robots_find_ip(source_ip);
+    if (robot == NULL)
+    {
+        return 1;
+    }
+
+    // A datagram holds exactly one packet, anything else is dropped whole
+    const uint8_t *pkt = data + DATAGRAM_HEADER_LEN;
+    uint32_t pkt_len = len - DATAGRAM_HEADER_LEN;
+    uint16_t msg_len = pkt[2] + ((uint16_t)pkt[3] << 8);
+    if (pkt[0] != SYNC_FLAG || pkt[1] != VERSION_FLAG || pkt[4] != checksum((uint8_t *)pkt + 2, 2) || msg_len + ROS_PKG_LEN != pkt_len ||
+        pkt[pkt_len - 1] != checksum((uint8_t *)pkt + 5, msg_len + 2))
+    {
+        robot->stats.checksum_errors++;
+        metrics_counter_inc(checksum_errors);
+        return 1;
+    }
+
+    uint32_t seq = data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+    robot->stats.datagrams_recv++;
+    metrics_counter_inc(datagrams_recv);
+    if (!_robot_accept_seq(robot, seq))
+    {
+        return 1;
+    }
+
+    uint32_t frame_len = ROBOT_FRAME_HEADER_LEN + pkt_len;
+    uint8_t *frame = (uint8_t *)malloc(frame_len);
+    if (frame == NULL)
+    {
+        ESP_LOGE(ROBOTS_TAG, "Error: Failed to allocate %lu bytes for a datagram from robot %d.", (unsigned long)frame_len, robot->id);
+        return 1;
+    }
+    frame[0] = SYNC_FLAG;
+    frame[1] = robot->id;
+    frame[2] = pkt_len & 0xFF; // LSB
+    frame[3] = (pkt_len >> 8) & 0xFF; // MSB
+    memcpy(frame + ROBOT_FRAME_HEADER_LEN, pkt, pkt_len);
+
+    robot->stats.packets_recv++;
+    robot->stats.bytes_recv += pkt_len;
+    metrics_counter_inc(robot_packets_recv);
+    metrics_counter_add(robot_bytes_recv, pkt_len);
+
+    if (packet_callback != NULL)
+    {
+        packet_callback(robot->id, pkt[5] + ((uint16_t)pkt[6] << 8), frame, frame_len, packet_callback_ctx);
+    }
+    else
+    {
+        free(frame);
+    }
+    return 0;
+}
+
+uint8_t robots_is_connected(uint8_t robot_id)
+{
+    return _robots_get(robot_id) != NULL;
+}
+
+uint8_t robots_count(void)
+{
+    return num_robots;
+}
+
+uint8_t robots_max(void)
+{
+    return max_robots;
+}
+
+uint8_t robots_get_stats(uint8_t robot_id, robot_stats_t *stats)
+{
+    if (stats == NULL)
+    {
+        return 1;
+    }
+
+    uint8_t err = 1;
+    xSemaphoreTake(robots_lock, portMAX_DELAY);
+    robot_t *robot = (robot_id < max_robots) ? robots[robot_id] : NULL;
+    if (robot != NULL)
+    {
+        memcpy(stats, &robot->stats, sizeof(robot_stats_t));
+        err = 0;
+    }
+    xSemaphoreGive(robots_lock);
+    return err;
+}
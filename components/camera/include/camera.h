@@ -3,6 +3,10 @@
 
 #include "esp_camera.h"
 
+#include "camera_source.h"
+
+#define CAMERA_FB_COUNT     3       /**< Frame buffers, one held by the sink, one waiting and one being captured */
+
 typedef struct camera_pins_t {
     int xclk;
     int sda;
@@ -25,4 +29,12 @@ esp_err_t camera_deinit();
 void camera_capture_frame(camera_fb_t** frame);
 void camera_return_frame(camera_fb_t* frame);
 
+/**
+ * @brief Initializes the camera and wraps it as a frame source. Freeing the source deinitializes it.
+ *
+ * @param pins The pins the camera is connected to.
+ * @return A pointer to the source, or NULL on failure.
+ */
+camera_source_t *camera_source_esp_create(camera_pins_t *pins);
+
 #endif
@@ -0,0 +1,92 @@
+/**
+ * @file camera_source.h
+ * @brief A source of camera frames: the camera itself, or a stand-in for running on a host.
+ *
+ * A source hands out frames with grab and takes them back with release. Several frames may be
+ * held at once, up to the number of frame buffers of the source, which is what lets capture of
+ * the next frame overlap with sending the current one.
+ */
+
+#pragma once
+#include <stdint.h>
+
+#define CAMERA_FORMAT_JPEG      4       /**< Same value as PIXFORMAT_JPEG of esp32-camera */
+
+/**
+ * @brief A grabbed frame. The buffer belongs to the source until the frame is released.
+ */
+typedef struct camera_frame_t {
+    const uint8_t *buf;
+    uint32_t len;
+    uint16_t width;
+    uint16_t height;
+    uint8_t format;
+    int64_t utime;                      /**< Time the frame was captured */
+    void *_handle;
+} camera_frame_t;
+
+/**
+ * @brief The operations every frame source implements.
+ */
+typedef struct camera_source_t {
+    void *ctx;
+
+    /**
+     * @brief Waits for the newest frame not handed out yet.
+     *
+     * @return 0 if a frame was grabbed, 1 on timeout or error.
+     */
+    uint8_t (*grab)(void *ctx, camera_frame_t *frame, uint32_t timeout_ms);
+    void (*release)(void *ctx, camera_frame_t *frame);
+    void (*free)(void *ctx);
+} camera_source_t;
+
+/**
+ * @brief Grabs a frame from a source.
+ *
+ * @param source A pointer to the source.
+ * @param frame Receives the frame.
+ * @param timeout_ms The maximum time to wait for a frame.
+ * @return 0 if a frame was grabbed, 1 otherwise.
+ */
+uint8_t camera_source_grab(camera_source_t *source, camera_frame_t *frame, uint32_t timeout_ms);
+
+/**
+ * @brief Gives a grabbed frame back to its source.
+ */
+void camera_source_release(camera_source_t *source, camera_frame_t *frame);
+
+/**
+ * @brief Frees a source. Every frame must have been released.
+ */
+void camera_source_free(camera_source_t *source);
+
+/**
+ * @brief Creates a source generating frames of a fixed size, modelling the camera's timing.
+ *
+ * With one frame buffer the sensor only starts the next capture once the held frame is
+ * released. With more it captures continuously and grab returns the newest complete frame,
+ * like esp32-camera with CAMERA_GRAB_LATEST. Each frame starts with its 32-bit sequence number.
+ *
+ * @param width The reported frame width.
+ * @param height The reported frame height.
+ * @param frame_len The size of every frame in bytes, at least 4.
+ * @param period_ms The time the sensor takes to capture a frame.
+ * @param fb_count The number of frame buffers.
+ * @return A pointer to the source, or NULL on failure.
+ */
+camera_source_t *camera_source_synthetic_create(uint16_t width, uint16_t height, uint32_t frame_len, uint32_t period_ms, uint8_t fb_count);
+
+/**
+ * @brief Creates a source replaying the JPEG images found in a file, in a loop.
+ *
+ * The file is read into memory at creation and split on JPEG start and end of image markers,
+ * so a recording made by concatenating frames works as is. Frames are paced at period_ms.
+ *
+ * @param path The path of the file.
+ * @param width The reported frame width.
+ * @param height The reported frame height.
+ * @param period_ms The time between frames.
+ * @return A pointer to the source, or NULL if the file holds no JPEG image.
+ */
+camera_source_t *camera_source_file_create(const char *path, uint16_t width, uint16_t height, uint32_t period_ms);
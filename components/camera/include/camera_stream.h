@@ -0,0 +1,60 @@
+/**
+ * @file camera_stream.h
+ * @brief Streams frames from a camera source to a sink with capture and sending overlapped.
+ *
+ * A capture task keeps grabbing the newest frame from the source while a publish task hands
+ * the previous one to the sink. Only the newest captured frame waits for the sink: if the sink
+ * is slower than the camera, older frames are released unsent instead of queueing up, so the
+ * frames that are sent are as fresh as possible.
+ */
+
+#pragma once
+#include <stdint.h>
+
+#include "camera_source.h"
+
+#define CAMERA_STREAM_GRAB_TIMEOUT_MS   100     /**< Longest a grab blocks before the capture task checks for stop */
+#define CAMERA_STREAM_STACK_SIZE        4096
+#define CAMERA_STREAM_CAPTURE_PRIORITY  3
+#define CAMERA_STREAM_PUBLISH_PRIORITY  3
+#define CAMERA_STREAM_CORE              0       /**< Core of both tasks, away from the UART parsing on core 1, tskNO_AFFINITY to not pin */
+
+typedef struct camera_stream_t camera_stream_t;
+
+/**
+ * @brief Called from the publish task with every frame to send. The frame is released afterwards.
+ */
+typedef void (*camera_stream_sink_t)(const camera_frame_t *frame, void *ctx);
+
+/**
+ * @brief Counters of a camera stream.
+ */
+typedef struct camera_stream_stats_t {
+    uint32_t captured;
+    uint32_t published;
+    uint32_t dropped;           /**< Frames replaced by a newer one before the sink got to them */
+    uint32_t grab_errors;       /**< Grabs that timed out or failed */
+} camera_stream_stats_t;
+
+/**
+ * @brief Starts streaming.
+ *
+ * @param source The source to capture from, it stays owned by the caller. Capture overlaps with
+ *               the sink from two frame buffers on, with three the sensor keeps capturing
+ *               while a frame waits for the sink.
+ * @param sink The sink to send frames to.
+ * @param ctx An optional context pointer passed to the sink.
+ * @param min_period_ms The minimum time between frames handed to the sink, 0 for no limit.
+ * @return A pointer to the stream, or NULL on failure.
+ */
+camera_stream_t *camera_stream_start(camera_source_t *source, camera_stream_sink_t sink, void *ctx, uint32_t min_period_ms);
+
+/**
+ * @brief Stops streaming, waits for both tasks to exit, releases any held frame and frees the stream.
+ */
+void camera_stream_stop(camera_stream_t *stream);
+
+/**
+ * @brief Copies the counters of a stream.
+ */
+void camera_stream_get_stats(camera_stream_t *stream, camera_stream_stats_t *stats);
@@ -1,4 +1,8 @@
 #include <stdio.h>
+#include <stdlib.h>
+
+#include "esp_timer.h"
+
 #include "camera.h"
 
 esp_err_t camera_init(camera_pins_t *pins) {
@@ -26,12 +30,12 @@ esp_err_t camera_init(camera_pins_t *pins) {
         .ledc_timer = LEDC_TIMER_0,
         .ledc_channel = LEDC_CHANNEL_0,
 
-        .pixel_format = PIXFORMAT_RGB565, //YUV422,GRAYSCALE,RGB565,JPEG
+        .pixel_format = PIXFORMAT_JPEG, //YUV422,GRAYSCALE,RGB565,JPEG. A raw QVGA frame is 150 kB, too big for a single packet
         .frame_size = FRAMESIZE_QVGA,    //QQVGA-UXGA, For ESP32, do not use sizes above QVGA when not JPEG. The performance of the ESP32-S series has improved a lot, but JPEG mode always gives better frame rates.
 
         .jpeg_quality = 12, //0-63, for OV series camera sensors, lower number means higher quality
-        .fb_count = 1,       //When jpeg mode is used, if fb_count more than one, the driver will work in continuous mode.
-        .grab_mode = CAMERA_GRAB_WHEN_EMPTY
+        .fb_count = CAMERA_FB_COUNT,       //When jpeg mode is used, if fb_count more than one, the driver will work in continuous mode.
+        .grab_mode = CAMERA_GRAB_LATEST   //Always hand out the newest frame, older ones are overwritten while the sink is busy
     };
     return esp_camera_init(&camera_config);
 }
@@ -46,4 +50,44 @@ void camera_capture_frame(camera_fb_t** frame) {
 
 void camera_return_frame(camera_fb_t* frame) {
     esp_camera_fb_return(frame);
-}
\ No newline at end of file
+}
+
+static uint8_t _esp_source_grab(void *ctx, camera_frame_t *frame, uint32_t timeout_ms) {
+    // The driver applies its own timeout
+    camera_fb_t *fb = esp_camera_fb_get();
+    if (fb == NULL) {
+        return 1;
+    }
+    frame->buf = fb->buf;
+    frame->len = fb->len;
+    frame->width = fb->width;
+    frame->height = fb->height;
+    frame->format = fb->format;
+    frame->utime = esp_timer_get_time();
+    frame->_handle = fb;
+    return 0;
+}
+
+static void _esp_source_release(void *ctx, camera_frame_t *frame) {
+    esp_camera_fb_return((camera_fb_t *)frame->_handle);
+    frame->_handle = NULL;
+}
+
+static void _esp_source_free(void *ctx) {
+    camera_deinit();
+}
+
+camera_source_t *camera_source_esp_create(camera_pins_t *pins) {
+    camera_source_t *source = calloc(1, sizeof(camera_source_t));
+    if (source == NULL) {
+        return NULL;
+    }
+    if (camera_init(pins) != ESP_OK) {
+        free(source);
+        return NULL;
+    }
+    source->grab = _esp_source_grab;
+    source->release = _esp_source_release;
+    source->free = _esp_source_free;
+    return source;
+}
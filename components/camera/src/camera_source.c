@@ -0,0 +1,324 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "camera_source.h"
+
+#define CAMERA_SOURCE_TAG "CAMERA_SOURCE"
+
+typedef struct synthetic_source_t {
+    uint16_t width;
+    uint16_t height;
+    uint32_t frame_len;
+    int64_t period_us;
+    uint8_t fb_count;
+    uint8_t held;
+    int64_t start_time;         /**< Start of the continuous capture, or of the pending capture with one buffer */
+    uint32_t next_seq;          /**< Sequence number of the oldest frame not handed out yet */
+    SemaphoreHandle_t lock;
+} synthetic_source_t;
+
+typedef struct file_source_t {
+    uint8_t *data;
+    uint32_t *offsets;
+    uint32_t *lens;
+    uint32_t num_frames;
+    uint32_t next_frame;
+    uint16_t width;
+    uint16_t height;
+    int64_t period_us;
+    int64_t next_time;
+} file_source_t;
+
+/**
+ * @brief Sleeps for at least us microseconds, rounded up to whole ticks.
+ */
+static void _camera_source_sleep_us(int64_t us) {
+    TickType_t ticks = ((us + 999) / 1000 + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS;
+    vTaskDelay(ticks > 0 ? ticks : 1);
+}
+
+/**
+ * @brief Sleeps until time_us, unless deadline_us comes first.
+ *
+ * @return 0 if time_us was reached, 1 if the deadline passed.
+ */
+static uint8_t _camera_source_sleep_until(int64_t time_us, int64_t deadline_us) {
+    int64_t now = esp_timer_get_time();
+    if (time_us > deadline_us) {
+        if (deadline_us > now) {
+            _camera_source_sleep_us(deadline_us - now);
+        }
+        return 1;
+    }
+    while (now < time_us) {
+        _camera_source_sleep_us(time_us - now);
+        now = esp_timer_get_time();
+    }
+    return 0;
+}
+
+uint8_t camera_source_grab(camera_source_t *source, camera_frame_t *frame, uint32_t timeout_ms) {
+    if (source == NULL || frame == NULL) {
+        return 1;
+    }
+    return source->grab(source->ctx, frame, timeout_ms);
+}
+
+void camera_source_release(camera_source_t *source, camera_frame_t *frame) {
+    if (source == NULL || frame == NULL) {
+        return;
+    }
+    source->release(source->ctx, frame);
+}
+
+void camera_source_free(camera_source_t *source) {
+    if (source == NULL) {
+        return;
+    }
+    source->free(source->ctx);
+    free(source);
+}
+
+static uint8_t _synthetic_grab(void *ctx, camera_frame_t *frame, uint32_t timeout_ms) {
+    synthetic_source_t *synth = (synthetic_source_t *)ctx;
+    int64_t deadline = esp_timer_get_time() + (int64_t)timeout_ms * 1000;
+
+    while (true) {
+        xSemaphoreTake(synth->lock, portMAX_DELAY);
+        int64_t now = esp_timer_get_time();
+        int64_t ready_time;
+        uint32_t seq = synth->next_seq;
+        if (synth->held >= synth->fb_count) {
+            // Every buffer is held, nothing can be captured until one comes back
+            ready_time = now + 1000;
+        }
+        else if (synth->fb_count == 1) {
+            ready_time = synth->start_time + synth->period_us;
+        }
+        else {
+            // Continuous capture, frame k completes at start_time + (k + 1) * period
+            int64_t completed = (now - synth->start_time) / synth->period_us;
+            if (completed > synth->next_seq) {
+                seq = completed - 1;
+            }
+            ready_time = synth->start_time + ((int64_t)seq + 1) * synth->period_us;
+        }
+
+        if (ready_time <= now) {
+            uint8_t *buf = malloc(synth->frame_len);
+            if (buf == NULL) {
+                xSemaphoreGive(synth->lock);
+                ESP_LOGE(CAMERA_SOURCE_TAG, "Failed to allocate a %lu byte frame", (unsigned long)synth->frame_len);
+                return 1;
+            }
+            synth->held++;
+            synth->next_seq = seq + 1;
+            xSemaphoreGive(synth->lock);
+
+            memcpy(buf, &seq, sizeof(seq));
+            memset(buf + sizeof(seq), seq & 0xFF, synth->frame_len - sizeof(seq));
+            frame->buf = buf;
+            frame->len = synth->frame_len;
+            frame->width = synth->width;
+            frame->height = synth->height;
+            frame->format = CAMERA_FORMAT_JPEG;
+            frame->utime = ready_time;
+            frame->_handle = buf;
+            return 0;
+        }
+        xSemaphoreGive(synth->lock);
+
+        if (_camera_source_sleep_until(ready_time, deadline)) {
+            return 1;
+        }
+    }
+}
+
+static void _synthetic_release(void *ctx, camera_frame_t *frame) {
+    synthetic_source_t *synth = (synthetic_source_t *)ctx;
+    free(frame->_handle);
+    frame->_handle = NULL;
+
+    xSemaphoreTake(synth->lock, portMAX_DELAY);
+    synth->held--;
+    if (synth->fb_count == 1) {
+        synth->start_time = esp_timer_get_time();
+    }
+    xSemaphoreGive(synth->lock);
+}
+
+static void _synthetic_free(void *ctx) {
+    synthetic_source_t *synth = (synthetic_source_t *)ctx;
+    vSemaphoreDelete(synth->lock);
+    free(synth);
+}
+
+camera_source_t *camera_source_synthetic_create(uint16_t width, uint16_t height, uint32_t frame_len, uint32_t period_ms, uint8_t fb_count) {
+    if (frame_len < sizeof(uint32_t) || period_ms == 0 || fb_count == 0) {
+        return NULL;
+    }
+
+    camera_source_t *source = calloc(1, sizeof(camera_source_t));
+    synthetic_source_t *synth = calloc(1, sizeof(synthetic_source_t));
+    SemaphoreHandle_t lock = xSemaphoreCreateMutex();
+    if (source == NULL || synth == NULL || lock == NULL) {
+        ESP_LOGE(CAMERA_SOURCE_TAG, "Failed to allocate synthetic source");
+        if (lock != NULL) {
+            vSemaphoreDelete(lock);
+        }
+        free(synth);
+        free(source);
+        return NULL;
+    }
+
+    synth->width = width;
+    synth->height = height;
+    synth->frame_len = frame_len;
+    synth->period_us = (int64_t)period_ms * 1000;
+    synth->fb_count = fb_count;
+    synth->start_time = esp_timer_get_time();
+    synth->lock = lock;
+
+    source->ctx = synth;
+    source->grab = _synthetic_grab;
+    source->release = _synthetic_release;
+    source->free = _synthetic_free;
+    return source;
+}
+
+static uint8_t _file_grab(void *ctx, camera_frame_t *frame, uint32_t timeout_ms) {
+    file_source_t *file = (file_source_t *)ctx;
+    int64_t now = esp_timer_get_time();
+    if (file->next_time < now - file->period_us) {
+        // Fell behind, do not try to catch up with a burst
+        file->next_time = now;
+    }
+    if (_camera_source_sleep_until(file->next_time, now + (int64_t)timeout_ms * 1000)) {
+        return 1;
+    }
+
+    frame->buf = file->data + file->offsets[file->next_frame];
+    frame->len = file->lens[file->next_frame];
+    frame->width = file->width;
+    frame->height = file->height;
+    frame->format = CAMERA_FORMAT_JPEG;
+    frame->utime = esp_timer_get_time();
+    frame->_handle = NULL;
+
+    file->next_frame = (file->next_frame + 1) % file->num_frames;
+    file->next_time += file->period_us;
+    return 0;
+}
+
+static void _file_release(void *ctx, camera_frame_t *frame) {
+    // Frames point into the file contents, which live as long as the source
+    frame->buf = NULL;
+}
+
+static void _file_free(void *ctx) {
+    file_source_t *file = (file_source_t *)ctx;
+    free(file->data);
+    free(file->offsets);
+    free(file->lens);
+    free(file);
+}
+
+/**
+ * @brief Finds the JPEG images in a buffer.
+ *
+ * @return The number of images found, offsets and lens are allocated to hold them.
+ */
+static uint32_t _file_split_jpeg(const uint8_t *data, uint32_t len, uint32_t **offsets, uint32_t **lens) {
+    uint32_t count = 0, capacity = 0;
+    *offsets = NULL;
+    *lens = NULL;
+
+    uint32_t i = 0;
+    while (i + 1 < len) {
+        if (data[i] != 0xFF || data[i + 1] != 0xD8) {
+            i++;
+            continue;
+        }
+
+        uint32_t start = i;
+        i += 2;
+        while (i + 1 < len && (data[i] != 0xFF || data[i + 1] != 0xD9)) {
+            i++;
+        }
+        if (i + 1 >= len) {
+            break;
+        }
+        i += 2;
+
+        if (count == capacity) {
+            capacity = (capacity == 0) ? 16 : capacity * 2;
+            uint32_t *new_offsets = realloc(*offsets, capacity * sizeof(uint32_t));
+            uint32_t *new_lens = realloc(*lens, capacity * sizeof(uint32_t));
+            if (new_offsets != NULL) {
+                *offsets = new_offsets;
+            }
+            if (new_lens != NULL) {
+                *lens = new_lens;
+            }
+            if (new_offsets == NULL || new_lens == NULL) {
+                break;
+            }
+        }
+        (*offsets)[count] = start;
+        (*lens)[count] = i - start;
+        count++;
+    }
+    return count;
+}
+
+camera_source_t *camera_source_file_create(const char *path, uint16_t width, uint16_t height, uint32_t period_ms) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        ESP_LOGE(CAMERA_SOURCE_TAG, "Failed to open %s", path);
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    camera_source_t *source = calloc(1, sizeof(camera_source_t));
+    file_source_t *file = calloc(1, sizeof(file_source_t));
+    uint8_t *data = (size > 0) ? malloc(size) : NULL;
+    if (source == NULL || file == NULL || data == NULL || fread(data, 1, size, fp) != (size_t)size) {
+        ESP_LOGE(CAMERA_SOURCE_TAG, "Failed to read %s", path);
+        fclose(fp);
+        free(data);
+        free(file);
+        free(source);
+        return NULL;
+    }
+    fclose(fp);
+
+    file->data = data;
+    file->num_frames = _file_split_jpeg(data, size, &file->offsets, &file->lens);
+    if (file->num_frames == 0) {
+        ESP_LOGE(CAMERA_SOURCE_TAG, "No JPEG image found in %s", path);
+        _file_free(file);
+        free(source);
+        return NULL;
+    }
+    file->width = width;
+    file->height = height;
+    file->period_us = (int64_t)period_ms * 1000;
+    file->next_time = esp_timer_get_time();
+
+    source->ctx = file;
+    source->grab = _file_grab;
+    source->release = _file_release;
+    source->free = _file_free;
+    return source;
+}
@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "camera_stream.h"
+
+#define CAMERA_STREAM_TAG "CAMERA_STREAM"
+
+struct camera_stream_t {
+    camera_source_t *source;
+    camera_stream_sink_t sink;
+    void *ctx;
+    int64_t min_period_us;
+
+    QueueHandle_t latest;           /**< Holds at most one frame, the newest one not yet published */
+    SemaphoreHandle_t exited;       /**< Given by each task as it exits */
+    volatile uint8_t stop;
+
+    SemaphoreHandle_t stats_lock;
+    camera_stream_stats_t stats;
+};
+
+static void _camera_stream_count(camera_stream_t *stream, uint32_t *counter) {
+    xSemaphoreTake(stream->stats_lock, portMAX_DELAY);
+    (*counter)++;
+    xSemaphoreGive(stream->stats_lock);
+}
+
+static void _camera_stream_capture_task(void *args) {
+    camera_stream_t *stream = (camera_stream_t *)args;
+    while (!stream->stop) {
+        camera_frame_t frame;
+        if (camera_source_grab(stream->source, &frame, CAMERA_STREAM_GRAB_TIMEOUT_MS)) {
+            _camera_stream_count(stream, &stream->stats.grab_errors);
+            continue;
+        }
+        _camera_stream_count(stream, &stream->stats.captured);
+
+        // Replace the waiting frame, if the publisher has not taken it yet it is stale now
+        camera_frame_t stale;
+        if (xQueueReceive(stream->latest, &stale, 0) == pdTRUE) {
+            camera_source_release(stream->source, &stale);
+            _camera_stream_count(stream, &stream->stats.dropped);
+        }
+        xQueueSend(stream->latest, &frame, portMAX_DELAY);
+    }
+    xSemaphoreGive(stream->exited);
+    vTaskDelete(NULL);
+}
+
+static void _camera_stream_publish_task(void *args) {
+    camera_stream_t *stream = (camera_stream_t *)args;
+    int64_t last_published = 0;
+    while (!stream->stop) {
+        camera_frame_t frame;
+        if (xQueueReceive(stream->latest, &frame, CAMERA_STREAM_GRAB_TIMEOUT_MS / portTICK_PERIOD_MS) != pdTRUE) {
+            continue;
+        }
+        if (stream->min_period_us > 0 && frame.utime - last_published < stream->min_period_us) {
+            camera_source_release(stream->source, &frame);
+            _camera_stream_count(stream, &stream->stats.dropped);
+            continue;
+        }
+
+        stream->sink(&frame, stream->ctx);
+        camera_source_release(stream->source, &frame);
+        last_published = frame.utime;
+        _camera_stream_count(stream, &stream->stats.published);
+    }
+    xSemaphoreGive(stream->exited);
+    vTaskDelete(NULL);
+}
+
+camera_stream_t *camera_stream_start(camera_source_t *source, camera_stream_sink_t sink, void *ctx, uint32_t min_period_ms) {
+    if (source == NULL || sink == NULL) {
+        return NULL;
+    }
+
+    camera_stream_t *stream = calloc(1, sizeof(camera_stream_t));
+    if (stream == NULL) {
+        ESP_LOGE(CAMERA_STREAM_TAG, "Failed to allocate camera stream");
+        return NULL;
+    }
+    stream->source = source;
+    stream->sink = sink;
+    stream->ctx = ctx;
+    stream->min_period_us = (int64_t)min_period_ms * 1000;
+    stream->latest = xQueueCreate(1, sizeof(camera_frame_t));
+    stream->exited = xSemaphoreCreateCounting(2, 0);
+    stream->stats_lock = xSemaphoreCreateMutex();
+    if (stream->latest == NULL || stream->exited == NULL || stream->stats_lock == NULL) {
+        ESP_LOGE(CAMERA_STREAM_TAG, "Failed to create camera stream queue");
+        goto error;
+    }
+
+    if (xTaskCreatePinnedToCore(_camera_stream_publish_task, "camera_publish", CAMERA_STREAM_STACK_SIZE, stream, CAMERA_STREAM_PUBLISH_PRIORITY, NULL, CAMERA_STREAM_CORE) != pdPASS) {
+        ESP_LOGE(CAMERA_STREAM_TAG, "Failed to create camera publish task");
+        goto error;
+    }
+    if (xTaskCreatePinnedToCore(_camera_stream_capture_task, "camera_capture", CAMERA_STREAM_STACK_SIZE, stream, CAMERA_STREAM_CAPTURE_PRIORITY, NULL, CAMERA_STREAM_CORE) != pdPASS) {
+        ESP_LOGE(CAMERA_STREAM_TAG, "Failed to create camera capture task");
+        stream->stop = 1;
+        xSemaphoreTake(stream->exited, portMAX_DELAY);
+        goto error;
+    }
+    return stream;
+
+    error:
+        if (stream->latest != NULL) {
+            vQueueDelete(stream->latest);
+        }
+        if (stream->exited != NULL) {
+            vSemaphoreDelete(stream->exited);
+        }
+        if (stream->stats_lock != NULL) {
+            vSemaphoreDelete(stream->stats_lock);
+        }
+        free(stream);
+        return NULL;
+}
+
+void camera_stream_stop(camera_stream_t *stream) {
+    if (stream == NULL) {
+        return;
+    }
+
+    stream->stop = 1;
+    xSemaphoreTake(stream->exited, portMAX_DELAY);
+    xSemaphoreTake(stream->exited, portMAX_DELAY);
+
+    camera_frame_t frame;
+    while (xQueueReceive(stream->latest, &frame, 0) == pdTRUE) {
+        camera_source_release(stream->source, &frame);
+    }
+    vQueueDelete(stream->latest);
+    vSemaphoreDelete(stream->exited);
+    vSemaphoreDelete(stream->stats_lock);
+    free(stream);
+}
+
+void camera_stream_get_stats(camera_stream_t *stream, camera_stream_stats_t *stats) {
+    if (stream == NULL || stats == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(stream->stats_lock, portMAX_DELAY);
+    memcpy(stats, &stream->stats, sizeof(camera_stream_stats_t));
+    xSemaphoreGive(stream->stats_lock);
+}
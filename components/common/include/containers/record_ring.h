@@ -0,0 +1,125 @@
+/**
+ * @file record_ring.h
+ * @brief A byte ring buffer of variable-length records, shared by many producers and one consumer.
+ *
+ * A producer reserves room for a record, writes (serializes) straight into the ring and then
+ * commits it. The consumer peeks at committed records in FIFO order, uses them in place and
+ * releases them. Records never wrap: when a record does not fit before the end of the buffer
+ * the tail end is skipped. Memory use is bounded by the capacity given at creation.
+ */
+
+#pragma once
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "common.h"
+
+typedef struct record_ring_t record_ring_t;
+
+/**
+ * @brief A reserved or peeked record. The data pointer points into the ring.
+ */
+typedef struct record_t {
+    uint8_t *data;
+    uint32_t len;
+    uint8_t tag;            /**< Free for the user, e.g. the destination of the record. */
+    uint32_t _offset;
+} record_t;
+
+/**
+ * @brief Creates a record ring.
+ *
+ * @param capacity The size of the ring in bytes, rounded up to 8. Every record uses 8 bytes plus its length rounded up to 8.
+ * @return A pointer to the ring, or NULL on failure.
+ */
+record_ring_t *record_ring_create(uint32_t capacity);
+
+/**
+ * @brief Frees a record ring. No task may be using it.
+ */
+void record_ring_free(record_ring_t *ring);
+
+/**
+ * @brief Reserves room for a record.
+ *
+ * @param ring A pointer to the ring.
+ * @param len The length of the record in bytes.
+ * @param tag The tag of the record.
+ * @param ticks_to_wait The maximum time to wait for room.
+ * @param record Receives the reserved record.
+ * @return A pointer to write the record to, or NULL if there was no room in time.
+ */
+uint8_t *record_ring_reserve(record_ring_t *ring, uint32_t len, uint8_t tag, TickType_t ticks_to_wait, record_t *record);
+
+/**
+ * @brief Publishes a reserved record to the consumer.
+ */
+void record_ring_commit(record_ring_t *ring, record_t *record);
+
+/**
+ * @brief Gives up a reserved record, the consumer skips it.
+ */
+void record_ring_abort(record_ring_t *ring, record_t *record);
+
+/**
+ * @brief Gets the oldest record without removing it. Only one task may consume from a ring.
+ *
+ * @param ring A pointer to the ring.
+ * @param record Receives the record.
+ * @param ticks_to_wait The maximum time to wait for a committed record.
+ * @return 0 if a record was peeked, 1 on timeout.
+ */
+uint8_t record_ring_peek(record_ring_t *ring, record_t *record, TickType_t ticks_to_wait);
+
+/**
+ * @brief Gets the committed record following a peeked one without waiting.
+ *
+ * Lets the consumer batch several records before releasing them all at once.
+ *
+ * @param ring A pointer to the ring.
+ * @param prev A record returned by record_ring_peek or record_ring_peek_next.
+ * @param next Receives the next record.
+ * @return 0 if there is a next committed record, 1 otherwise.
+ */
+uint8_t record_ring_peek_next(record_ring_t *ring, const record_t *prev, record_t *next);
+
+/**
+ * @brief Gets a batch of consecutive committed records without removing them.
+ *
+ * Waits up to ticks_to_wait for the first record, then keeps collecting records as they are
+ * committed until max_records or max_bytes is reached or linger_ticks have passed since the
+ * first one. Release the whole batch with record_ring_release on its last record.
+ *
+ * @param ring A pointer to the ring.
+ * @param records Receives the records.
+ * @param max_records The maximum number of records to collect.
+ * @param max_bytes Stop collecting once the records add up to this many bytes.
+ * @param ticks_to_wait The maximum time to wait for the first record.
+ * @param linger_ticks The maximum time to wait for more records after the first.
+ * @return The number of records collected, 0 on timeout.
+ */
+uint32_t record_ring_peek_batch(record_ring_t *ring, record_t *records, uint32_t max_records, uint32_t max_bytes, TickType_t ticks_to_wait, TickType_t linger_ticks);
+
+/**
+ * @brief Removes every record up to and including the given peeked record.
+ */
+void record_ring_release(record_ring_t *ring, const record_t *record);
+
+/**
+ * @brief Drops every committed record, stopping at the first one still being written.
+ */
+void record_ring_clear(record_ring_t *ring);
+
+/**
+ * @brief Gets the number of bytes in use, including record headers and skipped space.
+ */
+uint32_t record_ring_used(record_ring_t *ring);
+
+/**
+ * @brief Gets the capacity of the ring in bytes.
+ */
+uint32_t record_ring_capacity(record_ring_t *ring);
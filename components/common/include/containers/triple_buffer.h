@@ -0,0 +1,56 @@
+/**
+ * @file triple_buffer.h
+ * @brief A lock-free triple buffer handing the newest complete snapshot from one writer to one reader.
+ *
+ * The writer fills its own back buffer for as long as it likes and publishes it with a single
+ * atomic swap, so it never waits on the reader. The reader swaps in the most recently published
+ * buffer, also without waiting, and may skip snapshots that were overwritten in between.
+ */
+
+#pragma once
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "common.h"
+
+typedef struct triple_buffer_t triple_buffer_t;
+
+/**
+ * @brief Creates a triple buffer. All three buffers start zeroed.
+ *
+ * @param size The size of a single snapshot in bytes.
+ * @return A pointer to the triple buffer, or NULL on failure.
+ */
+triple_buffer_t *triple_buffer_create(uint32_t size);
+
+/**
+ * @brief Frees a triple buffer. Neither side may be using it.
+ */
+void triple_buffer_free(triple_buffer_t *tb);
+
+/**
+ * @brief Gets the buffer owned by the writer. Only the writer may call this.
+ *
+ * The buffer stays with the writer until the next triple_buffer_publish. Its content is
+ * whatever was left in it, not the last published snapshot.
+ */
+void *triple_buffer_write_buffer(triple_buffer_t *tb);
+
+/**
+ * @brief Publishes the writer's buffer as the newest snapshot and hands the writer a free one.
+ */
+void triple_buffer_publish(triple_buffer_t *tb);
+
+/**
+ * @brief Gets the newest published snapshot. Only the reader may call this.
+ *
+ * @param tb A pointer to the triple buffer.
+ * @param is_new Optional, set to 1 if a snapshot was published since the last read, 0 otherwise.
+ * @return The snapshot, valid until the next triple_buffer_read.
+ */
+const void *triple_buffer_read(triple_buffer_t *tb, uint8_t *is_new);
+
+/**
+ * @brief Gets the size of a snapshot in bytes.
+ */
+uint32_t triple_buffer_size(triple_buffer_t *tb);
@@ -0,0 +1,69 @@
+/**
+ * @file task_topology.h
+ * @brief Creates a firmware's tasks from one table of names, entries, stacks, priorities and cores.
+ *
+ * Each firmware lists every task it runs in a single table so the layout across the two cores
+ * of the ESP32-S3 can be read and changed in one place. Tasks are created pinned to their core,
+ * with their stack and control block either from the heap or from static buffers reserved at
+ * link time. Tasks are grouped so a firmware can start its tasks in stages, e.g. the network
+ * tasks only once the access point is up.
+ */
+
+#pragma once
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define TASK_TOPOLOGY_PINNED    1           /**< Pin tasks to the core in their table entry, 0 leaves every task unpinned to compare layouts */
+
+/**
+ * @brief Declares the static stack and control block of a task, use at file scope.
+ */
+#define TASK_STATIC_BUFFERS(task, stack_size) \
+    static StackType_t task##_stack[(stack_size) / sizeof(StackType_t)]; \
+    static StaticTask_t task##_tcb
+
+/**
+ * @brief Points a table entry at the buffers declared by TASK_STATIC_BUFFERS and sets its stack size
+ * from them, so the size is only written once.
+ */
+#define TASK_STATIC(task)       .stack_size = sizeof(task##_stack), .static_stack = task##_stack, .static_tcb = &task##_tcb
+
+/**
+ * @brief An entry of a task topology table.
+ */
+typedef struct task_spec_t {
+    const char *name;
+    TaskFunction_t entry;
+    void *args;
+    uint32_t stack_size;        /**< Bytes */
+    UBaseType_t priority;
+    BaseType_t core;            /**< 0, 1 or tskNO_AFFINITY */
+    uint8_t group;              /**< Tasks started together by task_topology_start */
+    StackType_t *static_stack;  /**< Stack of stack_size bytes, NULL allocates the stack and control block from the heap */
+    StaticTask_t *static_tcb;
+} task_spec_t;
+
+/**
+ * @brief Creates every task of a group.
+ *
+ * @param tasks The topology table.
+ * @param count The number of entries in the table.
+ * @param group The group to start.
+ * @return The number of tasks that failed to start, 0 on success.
+ */
+uint8_t task_topology_start(const task_spec_t *tasks, uint32_t count, uint8_t group);
+
+/**
+ * @brief Creates a single task of a table, for tasks that are started and deleted at runtime.
+ *
+ * Such tasks should be allocated from the heap: a deleted task's static buffers stay in use
+ * until the idle task has cleaned it up.
+ *
+ * @param tasks The topology table.
+ * @param count The number of entries in the table.
+ * @param name The name of the task.
+ * @return 0 on success, 1 if the task is not in the table or failed to start.
+ */
+uint8_t task_topology_start_task(const task_spec_t *tasks, uint32_t count, const char *name);
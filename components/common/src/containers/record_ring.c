@@ -0,0 +1,356 @@
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "common.h"
+
+#include "containers/record_ring.h"
+
+typedef enum {
+    RECORD_RESERVED,
+    RECORD_COMMITTED,
+    RECORD_SKIP
+} record_state_t;
+
+typedef struct record_header_t {
+    uint32_t len;
+    uint8_t tag;
+    uint8_t state;
+    uint16_t _reserved;
+} record_header_t;
+
+// Spans and the capacity are multiples of a header, so the gap left at the end of the buffer
+// is either empty or large enough for the header of a skip record
+#define RECORD_ALIGN(len)   (((len) + sizeof(record_header_t) - 1) & ~(uint32_t)(sizeof(record_header_t) - 1))
+
+struct record_ring_t {
+    uint8_t *buffer;
+    uint32_t capacity;
+    uint32_t head;
+    uint32_t tail;
+    uint32_t used;
+    SemaphoreHandle_t lock;
+    SemaphoreHandle_t data_ready;
+    SemaphoreHandle_t space_ready;
+};
+
+static inline record_header_t *_record_ring_header(record_ring_t *ring, uint32_t offset) {
+    return (record_header_t *)(ring->buffer + offset);
+}
+
+static inline uint32_t _record_ring_span(record_header_t *header) {
+    return sizeof(record_header_t) + RECORD_ALIGN(header->len);
+}
+
+static inline uint32_t _record_ring_wrap(record_ring_t *ring, uint32_t offset) {
+    return (offset >= ring->capacity) ? offset - ring->capacity : offset;
+}
+
+static void _record_ring_fill(record_ring_t *ring, uint32_t offset, record_t *record) {
+    record_header_t *header = _record_ring_header(ring, offset);
+    record->data = ring->buffer + offset + sizeof(record_header_t);
+    record->len = header->len;
+    record->tag = header->tag;
+    record->_offset = offset;
+}
+
+/**
+ * @brief Finds room for span bytes at the head. Must be called with the lock held.
+ *
+ * @return The offset of the room, or -1 if there is not enough contiguous space.
+ */
+static int64_t _record_ring_place(record_ring_t *ring, uint32_t span) {
+    if (ring->capacity - ring->used < span) {
+        return -1;
+    }
+    if (ring->used == 0) {
+        ring->head = ring->tail = 0;
+    }
+
+    if (ring->head < ring->tail) {
+        return (ring->tail - ring->head >= span) ? ring->head : -1;
+    }
+    if (ring->capacity - ring->head >= span) {
+        return ring->head;
+    }
+    if (ring->tail < span) {
+        return -1;
+    }
+
+    // Skip the end of the buffer, head < capacity and both are aligned so the skip header fits
+    uint32_t skip = ring->capacity - ring->head;
+    record_header_t *header = _record_ring_header(ring, ring->head);
+    header->len = skip - sizeof(record_header_t);
+    header->tag = 0;
+    header->state = RECORD_SKIP;
+    ring->used += skip;
+    ring->head = 0;
+    return 0;
+}
+
+record_ring_t *record_ring_create(uint32_t capacity) {
+    capacity = RECORD_ALIGN(capacity);
+    if (capacity < 2 * sizeof(record_header_t)) {
+        return NULL;
+    }
+
+    record_ring_t *ring = calloc(1, sizeof(record_ring_t));
+    if (ring == NULL) {
+        return NULL;
+    }
+
+    ring->buffer = malloc(capacity);
+    ring->lock = xSemaphoreCreateMutex();
+    ring->data_ready = xSemaphoreCreateBinary();
+    ring->space_ready = xSemaphoreCreateBinary();
+    if (ring->buffer == NULL || ring->lock == NULL || ring->data_ready == NULL || ring->space_ready == NULL) {
+        record_ring_free(ring);
+        return NULL;
+    }
+    ring->capacity = capacity;
+    return ring;
+}
+
+void record_ring_free(record_ring_t *ring) {
+    if (ring == NULL) {
+        return;
+    }
+
+    if (ring->lock != NULL) {
+        vSemaphoreDelete(ring->lock);
+    }
+    if (ring->data_ready != NULL) {
+        vSemaphoreDelete(ring->data_ready);
+    }
+    if (ring->space_ready != NULL) {
+        vSemaphoreDelete(ring->space_ready);
+    }
+    free(ring->buffer);
+    free(ring);
+}
+
+uint8_t *record_ring_reserve(record_ring_t *ring, uint32_t len, uint8_t tag, TickType_t ticks_to_wait, record_t *record) {
+    if (ring == NULL || record == NULL) {
+        return NULL;
+    }
+
+    uint32_t span = sizeof(record_header_t) + RECORD_ALIGN(len);
+    if (span > ring->capacity) {
+        return NULL;
+    }
+
+    TickType_t start = xTaskGetTickCount();
+    while (true) {
+        xSemaphoreTake(ring->lock, portMAX_DELAY);
+        int64_t offset = _record_ring_place(ring, span);
+        if (offset >= 0) {
+            record_header_t *header = _record_ring_header(ring, offset);
+            header->len = len;
+            header->tag = tag;
+            header->state = RECORD_RESERVED;
+            ring->head = _record_ring_wrap(ring, offset + span);
+            ring->used += span;
+            uint8_t has_space = ring->used < ring->capacity;
+            xSemaphoreGive(ring->lock);
+
+            // Pass the wake up on in case another producer is waiting for room
+            if (has_space) {
+                xSemaphoreGive(ring->space_ready);
+            }
+            _record_ring_fill(ring, offset, record);
+            return record->data;
+        }
+        xSemaphoreGive(ring->lock);
+
+        TickType_t waited = xTaskGetTickCount() - start;
+        if (ticks_to_wait != portMAX_DELAY && waited >= ticks_to_wait) {
+            return NULL;
+        }
+        xSemaphoreTake(ring->space_ready, (ticks_to_wait == portMAX_DELAY) ? portMAX_DELAY : ticks_to_wait - waited);
+    }
+}
+
+void record_ring_commit(record_ring_t *ring, record_t *record) {
+    if (ring == NULL || record == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(ring->lock, portMAX_DELAY);
+    _record_ring_header(ring, record->_offset)->state = RECORD_COMMITTED;
+    xSemaphoreGive(ring->lock);
+    xSemaphoreGive(ring->data_ready);
+}
+
+void record_ring_abort(record_ring_t *ring, record_t *record) {
+    if (ring == NULL || record == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(ring->lock, portMAX_DELAY);
+    _record_ring_header(ring, record->_offset)->state = RECORD_SKIP;
+    xSemaphoreGive(ring->lock);
+    xSemaphoreGive(ring->data_ready);
+}
+
+/**
+ * @brief Frees skipped records at the tail. Must be called with the lock held.
+ *
+ * @return 1 if any space was freed, 0 otherwise.
+ */
+static uint8_t _record_ring_drop_skipped(record_ring_t *ring) {
+    uint8_t freed = 0;
+    while (ring->used > 0) {
+        record_header_t *header = _record_ring_header(ring, ring->tail);
+        if (header->state != RECORD_SKIP) {
+            break;
+        }
+        uint32_t span = _record_ring_span(header);
+        ring->tail = _record_ring_wrap(ring, ring->tail + span);
+        ring->used -= span;
+        freed = 1;
+    }
+    return freed;
+}
+
+uint8_t record_ring_peek(record_ring_t *ring, record_t *record, TickType_t ticks_to_wait) {
+    if (ring == NULL || record == NULL) {
+        return 1;
+    }
+
+    TickType_t start = xTaskGetTickCount();
+    while (true) {
+        xSemaphoreTake(ring->lock, portMAX_DELAY);
+        uint8_t freed = _record_ring_drop_skipped(ring);
+        uint8_t ready = ring->used > 0 && _record_ring_header(ring, ring->tail)->state == RECORD_COMMITTED;
+        if (ready) {
+            _record_ring_fill(ring, ring->tail, record);
+        }
+        xSemaphoreGive(ring->lock);
+
+        if (freed) {
+            xSemaphoreGive(ring->space_ready);
+        }
+        if (ready) {
+            return 0;
+        }
+
+        TickType_t waited = xTaskGetTickCount() - start;
+        if (ticks_to_wait != portMAX_DELAY && waited >= ticks_to_wait) {
+            return 1;
+        }
+        xSemaphoreTake(ring->data_ready, (ticks_to_wait == portMAX_DELAY) ? portMAX_DELAY : ticks_to_wait - waited);
+    }
+}
+
+uint8_t record_ring_peek_next(record_ring_t *ring, const record_t *prev, record_t *next) {
+    if (ring == NULL || prev == NULL || next == NULL) {
+        return 1;
+    }
+
+    uint8_t err = 1;
+    xSemaphoreTake(ring->lock, portMAX_DELAY);
+    uint32_t offset = prev->_offset;
+    uint32_t consumed = _record_ring_wrap(ring, offset + ring->capacity - ring->tail);
+    while (true) {
+        uint32_t span = _record_ring_span(_record_ring_header(ring, offset));
+        consumed += span;
+        offset = _record_ring_wrap(ring, offset + span);
+        if (consumed >= ring->used) {
+            break;
+        }
+
+        record_header_t *header = _record_ring_header(ring, offset);
+        if (header->state == RECORD_COMMITTED) {
+            _record_ring_fill(ring, offset, next);
+            err = 0;
+            break;
+        }
+        else if (header->state != RECORD_SKIP) {
+            break;
+        }
+    }
+    xSemaphoreGive(ring->lock);
+    return err;
+}
+
+uint32_t record_ring_peek_batch(record_ring_t *ring, record_t *records, uint32_t max_records, uint32_t max_bytes, TickType_t ticks_to_wait, TickType_t linger_ticks) {
+    if (ring == NULL || records == NULL || max_records == 0) {
+        return 0;
+    }
+    if (record_ring_peek(ring, &records[0], ticks_to_wait)) {
+        return 0;
+    }
+
+    uint32_t count = 1;
+    uint32_t bytes = records[0].len;
+    TickType_t start = xTaskGetTickCount();
+    while (count < max_records && bytes < max_bytes) {
+        if (record_ring_peek_next(ring, &records[count - 1], &records[count]) == 0) {
+            bytes += records[count].len;
+            count++;
+            continue;
+        }
+
+        TickType_t waited = xTaskGetTickCount() - start;
+        if (waited >= linger_ticks) {
+            break;
+        }
+        xSemaphoreTake(ring->data_ready, linger_ticks - waited);
+    }
+    return count;
+}
+
+void record_ring_release(record_ring_t *ring, const record_t *record) {
+    if (ring == NULL || record == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(ring->lock, portMAX_DELAY);
+    uint32_t span = _record_ring_span(_record_ring_header(ring, record->_offset));
+    uint32_t released = _record_ring_wrap(ring, record->_offset + ring->capacity - ring->tail) + span;
+    ring->used -= released;
+    ring->tail = _record_ring_wrap(ring, record->_offset + span);
+    xSemaphoreGive(ring->lock);
+    xSemaphoreGive(ring->space_ready);
+}
+
+void record_ring_clear(record_ring_t *ring) {
+    if (ring == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(ring->lock, portMAX_DELAY);
+    while (ring->used > 0) {
+        record_header_t *header = _record_ring_header(ring, ring->tail);
+        if (header->state == RECORD_RESERVED) {
+            break;
+        }
+        uint32_t span = _record_ring_span(header);
+        ring->tail = _record_ring_wrap(ring, ring->tail + span);
+        ring->used -= span;
+    }
+    xSemaphoreGive(ring->lock);
+    xSemaphoreGive(ring->space_ready);
+}
+
+uint32_t record_ring_used(record_ring_t *ring) {
+    if (ring == NULL) {
+        return 0;
+    }
+
+    xSemaphoreTake(ring->lock, portMAX_DELAY);
+    uint32_t used = ring->used;
+    xSemaphoreGive(ring->lock);
+    return used;
+}
+
+uint32_t record_ring_capacity(record_ring_t *ring) {
+    if (ring == NULL) {
+        return 0;
+    }
+    return ring->capacity;
+}
@@ -0,0 +1,90 @@
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "common.h"
+
+#include "containers/triple_buffer.h"
+
+#define TRIPLE_BUFFER_INDEX     0x03
+#define TRIPLE_BUFFER_FRESH     0x04    /**< Set in the shared slot when it holds an unread snapshot */
+
+struct triple_buffer_t {
+    uint8_t *buffers[3];
+    uint32_t size;
+    uint8_t back;                       /**< Owned by the writer */
+    uint8_t front;                      /**< Owned by the reader */
+    _Atomic uint8_t middle;             /**< Exchanged by both, index plus fresh flag */
+};
+
+triple_buffer_t *triple_buffer_create(uint32_t size) {
+    triple_buffer_t *tb = calloc(1, sizeof(triple_buffer_t));
+    if (tb == NULL) {
+        return NULL;
+    }
+
+    for (int i = 0; i < 3; i++) {
+        tb->buffers[i] = calloc(1, size);
+        if (tb->buffers[i] == NULL) {
+            triple_buffer_free(tb);
+            return NULL;
+        }
+    }
+    tb->size = size;
+    tb->back = 0;
+    tb->front = 1;
+    atomic_init(&tb->middle, 2);
+    return tb;
+}
+
+void triple_buffer_free(triple_buffer_t *tb) {
+    if (tb == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < 3; i++) {
+        free(tb->buffers[i]);
+    }
+    free(tb);
+}
+
+void *triple_buffer_write_buffer(triple_buffer_t *tb) {
+    if (tb == NULL) {
+        return NULL;
+    }
+    return tb->buffers[tb->back];
+}
+
+void triple_buffer_publish(triple_buffer_t *tb) {
+    if (tb == NULL) {
+        return;
+    }
+
+    // Release orders the writes to the snapshot before the swap that hands it over
+    uint8_t prev = atomic_exchange_explicit(&tb->middle, tb->back | TRIPLE_BUFFER_FRESH, memory_order_acq_rel);
+    tb->back = prev & TRIPLE_BUFFER_INDEX;
+}
+
+const void *triple_buffer_read(triple_buffer_t *tb, uint8_t *is_new) {
+    if (tb == NULL) {
+        return NULL;
+    }
+
+    uint8_t fresh = (atomic_load_explicit(&tb->middle, memory_order_relaxed) & TRIPLE_BUFFER_FRESH) != 0;
+    if (fresh) {
+        uint8_t prev = atomic_exchange_explicit(&tb->middle, tb->front, memory_order_acq_rel);
+        tb->front = prev & TRIPLE_BUFFER_INDEX;
+    }
+    if (is_new != NULL) {
+        *is_new = fresh;
+    }
+    return tb->buffers[tb->front];
+}
+
+uint32_t triple_buffer_size(triple_buffer_t *tb) {
+    if (tb == NULL) {
+        return 0;
+    }
+    return tb->size;
+}
@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_log.h"
+
+#include "task_topology.h"
+
+#define TASK_TOPOLOGY_TAG "TASK_TOPOLOGY"
+
+static uint8_t _task_spec_start(const task_spec_t *spec) {
+    // A core the chip does not have would assert in the scheduler
+    BaseType_t core = spec->core;
+    if (!TASK_TOPOLOGY_PINNED || core < 0 || core >= portNUM_PROCESSORS) {
+        core = tskNO_AFFINITY;
+    }
+
+    uint8_t created;
+    if (spec->static_stack != NULL && spec->static_tcb != NULL) {
+        created = xTaskCreateStaticPinnedToCore(spec->entry, spec->name, spec->stack_size, spec->args, spec->priority,
+                                                spec->static_stack, spec->static_tcb, core) != NULL;
+    }
+    else {
+        created = xTaskCreatePinnedToCore(spec->entry, spec->name, spec->stack_size, spec->args, spec->priority,
+                                          NULL, core) == pdPASS;
+    }
+
+    if (!created) {
+        ESP_LOGE(TASK_TOPOLOGY_TAG, "Failed to create %s", spec->name);
+        return 1;
+    }
+    ESP_LOGI(TASK_TOPOLOGY_TAG, "Started %s: priority %d, core %d, %lu byte %s stack", spec->name, (int)spec->priority,
+             core == tskNO_AFFINITY ? -1 : (int)core, (unsigned long)spec->stack_size,
+             spec->static_stack != NULL ? "static" : "heap");
+    return 0;
+}
+
+uint8_t task_topology_start(const task_spec_t *tasks, uint32_t count, uint8_t group) {
+    uint8_t failed = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (tasks[i].group == group) {
+            failed += _task_spec_start(&tasks[i]);
+        }
+    }
+    return failed;
+}
+
+uint8_t task_topology_start_task(const task_spec_t *tasks, uint32_t count, const char *name) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (strcmp(tasks[i].name, name) == 0) {
+            return _task_spec_start(&tasks[i]);
+        }
+    }
+    ESP_LOGE(TASK_TOPOLOGY_TAG, "No task named %s", name);
+    return 1;
+}
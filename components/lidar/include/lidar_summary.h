@@ -0,0 +1,49 @@
+/**
+ * @file lidar_summary.h
+ * @brief Reduces a 360 degree lidar scan to what obstacle avoidance needs.
+ *
+ * The scan is split into equal sectors starting at 0 degrees, and the nearest return of each
+ * sector is kept along with the nearest return overall. Ranges are in millimeters, 0 means no
+ * return, as produced by lidar_get_scan_360.
+ */
+
+#include <stdint.h>
+
+#ifndef LIDAR_SUMMARY_H
+#define LIDAR_SUMMARY_H
+
+#define LIDAR_SUMMARY_POINTS        360
+
+/**
+ * @brief The nearest obstacles of a scan.
+ */
+typedef struct lidar_summary_t {
+    uint16_t nearest_range;         /**< Nearest return in mm, 0 if there is none */
+    uint16_t nearest_bearing;       /**< Bearing of the nearest return in degrees */
+    uint8_t num_sectors;
+    uint16_t *sector_min;           /**< Nearest return per sector in mm, 0 if the sector has none */
+} lidar_summary_t;
+
+/**
+ * @brief Computes sector minima and the nearest obstacle of a scan.
+ *
+ * @param ranges The scan, one range per degree.
+ * @param min_valid_mm Returns closer than this are ignored, e.g. the robot's own body.
+ * @param summary The summary to fill. sector_min must hold num_sectors values and num_sectors
+ *                must divide 360.
+ * @return 0 if successful, 1 if the number of sectors is invalid.
+ */
+uint8_t lidar_summarize(const uint16_t ranges[LIDAR_SUMMARY_POINTS], uint16_t min_valid_mm, lidar_summary_t *summary);
+
+/**
+ * @brief Downsamples a scan, keeping the nearest valid return of every step degrees.
+ *
+ * @param ranges The scan, one range per degree.
+ * @param min_valid_mm Returns closer than this are ignored.
+ * @param step Degrees per output point, must divide 360.
+ * @param points Receives 360 / step ranges.
+ * @return The number of points written, 0 if step is invalid.
+ */
+uint16_t lidar_downsample(const uint16_t ranges[LIDAR_SUMMARY_POINTS], uint16_t min_valid_mm, uint8_t step, uint16_t *points);
+
+#endif
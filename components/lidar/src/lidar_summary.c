@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "lidar_summary.h"
+
+/**
+ * @brief Gets the nearest valid return in [start, start + len), or 0 if there is none.
+ */
+static uint16_t _lidar_window_min(const uint16_t *ranges, uint16_t start, uint16_t len, uint16_t min_valid_mm, uint16_t *bearing)
+{
+    uint16_t nearest = 0;
+    for (uint16_t i = start; i < start + len; i++)
+    {
+        uint16_t range = ranges[i];
+        if (range == 0 || range < min_valid_mm)
+        {
+            continue;
+        }
+        if (nearest == 0 || range < nearest)
+        {
+            nearest = range;
+            if (bearing != NULL)
+            {
+                *bearing = i;
+            }
+        }
+    }
+    return nearest;
+}
+
+uint8_t lidar_summarize(const uint16_t ranges[LIDAR_SUMMARY_POINTS], uint16_t min_valid_mm, lidar_summary_t *summary)
+{
+    if (summary == NULL || summary->sector_min == NULL || summary->num_sectors == 0 ||
+        LIDAR_SUMMARY_POINTS % summary->num_sectors != 0)
+    {
+        return 1;
+    }
+
+    uint16_t width = LIDAR_SUMMARY_POINTS / summary->num_sectors;
+    summary->nearest_range = 0;
+    summary->nearest_bearing = 0;
+    for (uint8_t sector = 0; sector < summary->num_sectors; sector++)
+    {
+        uint16_t bearing = 0;
+        uint16_t nearest = _lidar_window_min(ranges, sector * width, width, min_valid_mm, &bearing);
+        summary->sector_min[sector] = nearest;
+        if (nearest != 0 && (summary->nearest_range == 0 || nearest < summary->nearest_range))
+        {
+            summary->nearest_range = nearest;
+            summary->nearest_bearing = bearing;
+        }
+    }
+    return 0;
+}
+
+uint16_t lidar_downsample(const uint16_t ranges[LIDAR_SUMMARY_POINTS], uint16_t min_valid_mm, uint8_t step, uint16_t *points)
+{
+    if (points == NULL || step == 0 || LIDAR_SUMMARY_POINTS % step != 0)
+    {
+        return 0;
+    }
+
+    uint16_t count = LIDAR_SUMMARY_POINTS / step;
+    for (uint16_t i = 0; i < count; i++)
+    {
+        points[i] = _lidar_window_min(ranges, i * step, step, min_valid_mm, NULL);
+    }
+    return count;
+}
@@ -0,0 +1,171 @@
+/**
+ * @file metrics.h
+ * @brief Lightweight metrics registry for counters, gauges and histograms.
+ * All metrics live in static memory and are updated with atomic operations so they can be
+ * used from hot paths (and from multiple tasks) without locks or console I/O. A low priority
+ * reporter task periodically logs the metrics or hands a serialized snapshot to a sink.
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "lcm_types.h"
+
+#define METRICS_MAX_COUNTERS            16                  /**< Maximum number of registered counters */
+#define METRICS_MAX_GAUGES              8                   /**< Maximum number of registered gauges */
+#define METRICS_MAX_HISTOGRAMS          8                   /**< Maximum number of registered histograms */
+#define METRICS_MAX_ENTRIES             (METRICS_MAX_COUNTERS + METRICS_MAX_GAUGES + METRICS_MAX_HISTOGRAMS)
+#define METRICS_HISTOGRAM_BUCKETS       32                  /**< One bucket per power of two of a uint32_t value */
+
+#define METRICS_REPORTER_STACK_SIZE     4096
+#define METRICS_REPORTER_PRIORITY       1                   /**< Just above idle, below every data path task */
+
+/**
+ * @brief A monotonically increasing counter.
+ */
+typedef struct metrics_counter_t {
+    const char *name;
+    atomic_uint_least32_t value;
+} metrics_counter_t;
+
+/**
+ * @brief A value that can go up and down (queue depth, free heap, ...).
+ */
+typedef struct metrics_gauge_t {
+    const char *name;
+    atomic_int_least32_t value;
+} metrics_gauge_t;
+
+/**
+ * @brief A log2 bucketed histogram of unsigned values (latencies in us, sizes in bytes, ...).
+ */
+typedef struct metrics_histogram_t {
+    const char *name;
+    atomic_uint_least32_t count;
+    atomic_uint_least32_t max;
+    atomic_uint_least32_t buckets[METRICS_HISTOGRAM_BUCKETS];
+} metrics_histogram_t;
+
+/**
+ * @brief Callback that receives a serialized metrics snapshot from the reporter task.
+ *
+ * @param data Pointer to a serial_metrics_t followed by num_entries serial_metric_t entries.
+ * @param len The length of the snapshot in bytes.
+ * @param ctx The context pointer passed to metrics_reporter_start.
+ */
+typedef void (*metrics_sink_t)(uint8_t *data, uint16_t len, void *ctx);
+
+/**
+ * @brief Registers a new counter.
+ *
+ * The name is not copied and must outlive the counter (string literals are fine).
+ *
+ * @param name The name of the counter.
+ * @return A pointer to the counter, or NULL if the registry is full.
+ */
+metrics_counter_t *metrics_counter_register(const char *name);
+
+/**
+ * @brief Increments a counter by one.
+ *
+ * @param counter A pointer to the counter. NULL is ignored.
+ */
+void metrics_counter_inc(metrics_counter_t *counter);
+
+/**
+ * @brief Increments a counter by the specified amount.
+ *
+ * @param counter A pointer to the counter. NULL is ignored.
+ * @param n The amount to add.
+ */
+void metrics_counter_add(metrics_counter_t *counter, uint32_t n);
+
+/**
+ * @brief Gets the current value of a counter.
+ *
+ * @param counter A pointer to the counter.
+ * @return The current value, or 0 if the counter is NULL.
+ */
+uint32_t metrics_counter_get(metrics_counter_t *counter);
+
+/**
+ * @brief Registers a new gauge.
+ *
+ * @param name The name of the gauge.
+ * @return A pointer to the gauge, or NULL if the registry is full.
+ */
+metrics_gauge_t *metrics_gauge_register(const char *name);
+
+/**
+ * @brief Sets the value of a gauge.
+ *
+ * @param gauge A pointer to the gauge. NULL is ignored.
+ * @param value The new value.
+ */
+void metrics_gauge_set(metrics_gauge_t *gauge, int32_t value);
+
+/**
+ * @brief Gets the current value of a gauge.
+ *
+ * @param gauge A pointer to the gauge.
+ * @return The current value, or 0 if the gauge is NULL.
+ */
+int32_t metrics_gauge_get(metrics_gauge_t *gauge);
+
+/**
+ * @brief Registers a new histogram.
+ *
+ * @param name The name of the histogram.
+ * @return A pointer to the histogram, or NULL if the registry is full.
+ */
+metrics_histogram_t *metrics_histogram_register(const char *name);
+
+/**
+ * @brief Records a value in a histogram.
+ *
+ * @param histogram A pointer to the histogram. NULL is ignored.
+ * @param value The value to record.
+ */
+void metrics_histogram_record(metrics_histogram_t *histogram, uint32_t value);
+
+/**
+ * @brief Estimates a percentile of a histogram.
+ *
+ * The estimate is the upper bound of the bucket that contains the percentile, so it is
+ * accurate to within a factor of two.
+ *
+ * @param histogram A pointer to the histogram.
+ * @param percentile The percentile to estimate in the range [0, 100].
+ * @return The estimated value, or 0 if the histogram is empty.
+ */
+uint32_t metrics_histogram_percentile(metrics_histogram_t *histogram, uint8_t percentile);
+
+/**
+ * @brief Serializes a snapshot of every registered metric.
+ *
+ * @param buffer The buffer to write the snapshot into.
+ * @param buffer_len The length of the buffer.
+ * @return The number of bytes written. Entries that do not fit are dropped.
+ */
+uint16_t metrics_serialize(uint8_t *buffer, uint16_t buffer_len);
+
+/**
+ * @brief Starts the metrics reporter task.
+ *
+ * Every period the reporter either logs every metric (with the rate of change of counters
+ * over the period) or, if a sink is given, passes a serialized snapshot to the sink.
+ *
+ * @param period_ms The reporting period in milliseconds.
+ * @param sink The sink to send snapshots to, or NULL to log them.
+ * @param ctx An optional context pointer passed to the sink.
+ * @return 0 if successful, non-zero otherwise.
+ */
+uint8_t metrics_reporter_start(uint32_t period_ms, metrics_sink_t sink, void *ctx);
@@ -0,0 +1,358 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "lcm_types.h"
+
+#include "metrics.h"
+
+#define METRICS_TAG "METRICS"
+
+typedef enum {
+    METRICS_TYPE_COUNTER,
+    METRICS_TYPE_GAUGE,
+    METRICS_TYPE_HISTOGRAM
+} metrics_type_t;
+
+typedef struct metrics_reporter_args_t {
+    uint32_t period_ms;
+    metrics_sink_t sink;
+    void *ctx;
+} metrics_reporter_args_t;
+
+static metrics_counter_t counters[METRICS_MAX_COUNTERS];
+static metrics_gauge_t gauges[METRICS_MAX_GAUGES];
+static metrics_histogram_t histograms[METRICS_MAX_HISTOGRAMS];
+
+static atomic_int num_counters = 0;
+static atomic_int num_gauges = 0;
+static atomic_int num_histograms = 0;
+
+static portMUX_TYPE metrics_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static metrics_reporter_args_t reporter_args;
+static uint32_t reporter_last_counts[METRICS_MAX_COUNTERS];
+
+/**
+ * @brief Returns the index of the log2 bucket for a value.
+ *
+ * Bucket 0 holds 0 and 1, bucket i holds values in [2^i, 2^(i+1)).
+ *
+ * @param value The value to bucket.
+ * @return The bucket index.
+ */
+static uint8_t _metrics_bucket(uint32_t value)
+{
+    if (value < 2)
+    {
+        return 0;
+    }
+    return 31 - __builtin_clz(value);
+}
+
+metrics_counter_t *metrics_counter_register(const char *name)
+{
+    metrics_counter_t *counter = NULL;
+    taskENTER_CRITICAL(&metrics_mux);
+    int idx = atomic_load(&num_counters);
+    if (idx < METRICS_MAX_COUNTERS)
+    {
+        counter = &counters[idx];
+        counter->name = name;
+        atomic_init(&counter->value, 0);
+        atomic_store(&num_counters, idx + 1);
+    }
+    taskEXIT_CRITICAL(&metrics_mux);
+
+    if (counter == NULL)
+    {
+        ESP_LOGE(METRICS_TAG, "Unable to register counter %s, registry is full", name);
+    }
+    return counter;
+}
+
+void metrics_counter_inc(metrics_counter_t *counter)
+{
+    if (counter == NULL)
+    {
+        return;
+    }
+    atomic_fetch_add_explicit(&counter->value, 1, memory_order_relaxed);
+}
+
+void metrics_counter_add(metrics_counter_t *counter, uint32_t n)
+{
+    if (counter == NULL)
+    {
+        return;
+    }
+    atomic_fetch_add_explicit(&counter->value, n, memory_order_relaxed);
+}
+
+uint32_t metrics_counter_get(metrics_counter_t *counter)
+{
+    if (counter == NULL)
+    {
+        return 0;
+    }
+    return atomic_load_explicit(&counter->value, memory_order_relaxed);
+}
+
+metrics_gauge_t *metrics_gauge_register(const char *name)
+{
+    metrics_gauge_t *gauge = NULL;
+    taskENTER_CRITICAL(&metrics_mux);
+    int idx = atomic_load(&num_gauges);
+    if (idx < METRICS_MAX_GAUGES)
+    {
+        gauge = &gauges[idx];
+        gauge->name = name;
+        atomic_init(&gauge->value, 0);
+        atomic_store(&num_gauges, idx + 1);
+    }
+    taskEXIT_CRITICAL(&metrics_mux);
+
+    if (gauge == NULL)
+    {
+        ESP_LOGE(METRICS_TAG, "Unable to register gauge %s, registry is full", name);
+    }
+    return gauge;
+}
+
+void metrics_gauge_set(metrics_gauge_t *gauge, int32_t value)
+{
+    if (gauge == NULL)
+    {
+        return;
+    }
+    atomic_store_explicit(&gauge->value, value, memory_order_relaxed);
+}
+
+int32_t metrics_gauge_get(metrics_gauge_t *gauge)
+{
+    if (gauge == NULL)
+    {
+        return 0;
+    }
+    return atomic_load_explicit(&gauge->value, memory_order_relaxed);
+}
+
+metrics_histogram_t *metrics_histogram_register(const char *name)
+{
+    metrics_histogram_t *histogram = NULL;
+    taskENTER_CRITICAL(&metrics_mux);
+    int idx = atomic_load(&num_histograms);
+    if (idx < METRICS_MAX_HISTOGRAMS)
+    {
+        histogram = &histograms[idx];
+        histogram->name = name;
+        atomic_init(&histogram->count, 0);
+        atomic_init(&histogram->max, 0);
+        for (int i = 0; i < METRICS_HISTOGRAM_BUCKETS; i++)
+        {
+            atomic_init(&histogram->buckets[i], 0);
+        }
+        atomic_store(&num_histograms, idx + 1);
+    }
+    taskEXIT_CRITICAL(&metrics_mux);
+
+    if (histogram == NULL)
+    {
+        ESP_LOGE(METRICS_TAG, "Unable to register histogram %s, registry is full", name);
+    }
+    return histogram;
+}
+
+void metrics_histogram_record(metrics_histogram_t *histogram, uint32_t value)
+{
+    if (histogram == NULL)
+    {
+        return;
+    }
+    atomic_fetch_add_explicit(&histogram->buckets[_metrics_bucket(value)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->count, 1, memory_order_relaxed);
+
+    uint32_t max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+    while (value > max && !atomic_compare_exchange_weak_explicit(&histogram->max, &max, value, memory_order_relaxed, memory_order_relaxed))
+    {
+    }
+}
+
+uint32_t metrics_histogram_percentile(metrics_histogram_t *histogram, uint8_t percentile)
+{
+    if (histogram == NULL)
+    {
+        return 0;
+    }
+
+    uint32_t count = atomic_load_explicit(&histogram->count, memory_order_relaxed);
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    uint32_t target = ((uint64_t)count * percentile + 99) / 100;
+    uint32_t seen = 0;
+    for (int i = 0; i < METRICS_HISTOGRAM_BUCKETS; i++)
+    {
+        seen += atomic_load_explicit(&histogram->buckets[i], memory_order_relaxed);
+        if (seen >= target)
+        {
+            uint32_t upper = (i == METRICS_HISTOGRAM_BUCKETS - 1) ? UINT32_MAX : (2u << i) - 1;
+            uint32_t max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+            return (upper < max) ? upper : max;
+        }
+    }
+    return atomic_load_explicit(&histogram->max, memory_order_relaxed);
+}
+
+uint16_t metrics_serialize(uint8_t *buffer, uint16_t buffer_len)
+{
+    if (buffer == NULL || buffer_len < sizeof(serial_metrics_t))
+    {
+        return 0;
+    }
+
+    serial_metrics_t *snapshot = (serial_metrics_t *)buffer;
+    snapshot->utime = esp_timer_get_time();
+    snapshot->num_entries = 0;
+
+    uint16_t len = sizeof(serial_metrics_t);
+    int n_counters = atomic_load(&num_counters);
+    int n_gauges = atomic_load(&num_gauges);
+    int n_histograms = atomic_load(&num_histograms);
+
+    for (int i = 0; i < n_counters + n_gauges + n_histograms; i++)
+    {
+        if (len + sizeof(serial_metric_t) > buffer_len)
+        {
+            break;
+        }
+
+        // Zeroed, so names are terminated even when cut to fit
+        serial_metric_t entry = {0};
+        if (i < n_counters)
+        {
+            strncpy(entry.name, counters[i].name, sizeof(entry.name) - 1);
+            entry.type = METRICS_TYPE_COUNTER;
+            entry.count = metrics_counter_get(&counters[i]);
+        }
+        else if (i < n_counters + n_gauges)
+        {
+            metrics_gauge_t *gauge = &gauges[i - n_counters];
+            strncpy(entry.name, gauge->name, sizeof(entry.name) - 1);
+            entry.type = METRICS_TYPE_GAUGE;
+            entry.count = (uint32_t)metrics_gauge_get(gauge);
+        }
+        else
+        {
+            metrics_histogram_t *histogram = &histograms[i - n_counters - n_gauges];
+            strncpy(entry.name, histogram->name, sizeof(entry.name) - 1);
+            entry.type = METRICS_TYPE_HISTOGRAM;
+            entry.count = atomic_load_explicit(&histogram->count, memory_order_relaxed);
+            entry.p50 = metrics_histogram_percentile(histogram, 50);
+            entry.p99 = metrics_histogram_percentile(histogram, 99);
+            entry.max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+        }
+
+        memcpy(buffer + len, &entry, sizeof(serial_metric_t));
+        len += sizeof(serial_metric_t);
+        snapshot->num_entries++;
+    }
+    return len;
+}
+
+/**
+ * @brief Logs every registered metric.
+ *
+ * Counters are logged with their rate over the last reporting period.
+ *
+ * @param period_ms The reporting period in milliseconds.
+ */
+static void _metrics_log(uint32_t period_ms)
+{
+    int n_counters = atomic_load(&num_counters);
+    for (int i = 0; i < n_counters; i++)
+    {
+        uint32_t value = metrics_counter_get(&counters[i]);
+        uint32_t delta = value - reporter_last_counts[i];
+        reporter_last_counts[i] = value;
+        ESP_LOGI(METRICS_TAG, "%s: %lu (%.2f/s)", counters[i].name, (unsigned long)value, delta * 1000.0f / period_ms);
+    }
+
+    int n_gauges = atomic_load(&num_gauges);
+    for (int i = 0; i < n_gauges; i++)
+    {
+        ESP_LOGI(METRICS_TAG, "%s: %ld", gauges[i].name, (long)metrics_gauge_get(&gauges[i]));
+    }
+
+    int n_histograms = atomic_load(&num_histograms);
+    for (int i = 0; i < n_histograms; i++)
+    {
+        metrics_histogram_t *histogram = &histograms[i];
+        ESP_LOGI(METRICS_TAG, "%s: n=%lu p50=%lu p99=%lu max=%lu", histogram->name,
+                 (unsigned long)atomic_load(&histogram->count),
+                 (unsigned long)metrics_histogram_percentile(histogram, 50),
+                 (unsigned long)metrics_histogram_percentile(histogram, 99),
+                 (unsigned long)atomic_load(&histogram->max));
+    }
+}
+
+static void _metrics_reporter_task(void *args)
+{
+    metrics_reporter_args_t *reporter = (metrics_reporter_args_t *)args;
+    uint16_t buffer_len = sizeof(serial_metrics_t) + METRICS_MAX_ENTRIES * sizeof(serial_metric_t);
+    uint8_t *buffer = NULL;
+    if (reporter->sink != NULL)
+    {
+        buffer = (uint8_t *)malloc(buffer_len);
+        if (buffer == NULL)
+        {
+            ESP_LOGE(METRICS_TAG, "Failed to allocate memory for metrics snapshot, logging instead");
+        }
+    }
+
+    TickType_t xLastWakeTime = xTaskGetTickCount();
+    while (true)
+    {
+        xTaskDelayUntil(&xLastWakeTime, reporter->period_ms / portTICK_PERIOD_MS);
+
+        if (buffer == NULL)
+        {
+            _metrics_log(reporter->period_ms);
+            continue;
+        }
+
+        uint16_t len = metrics_serialize(buffer, buffer_len);
+        reporter->sink(buffer, len, reporter->ctx);
+    }
+}
+
+uint8_t metrics_reporter_start(uint32_t period_ms, metrics_sink_t sink, void *ctx)
+{
+    if (period_ms == 0)
+    {
+        ESP_LOGE(METRICS_TAG, "Invalid reporting period");
+        return 1;
+    }
+
+    reporter_args.period_ms = period_ms;
+    reporter_args.sink = sink;
+    reporter_args.ctx = ctx;
+
+    BaseType_t err = xTaskCreate(_metrics_reporter_task, "metrics_task", METRICS_REPORTER_STACK_SIZE, &reporter_args, METRICS_REPORTER_PRIORITY, NULL);
+    if (err != pdPASS)
+    {
+        ESP_LOGE(METRICS_TAG, "Failed to create metrics reporter task");
+        return 1;
+    }
+    return 0;
+}
@@ -19,6 +19,10 @@
 
 #include "common.h"
 
+#define DIRECT_SEND_WINDOW      4       /**< Default number of fragments direct_send keeps in flight */
+#define DIRECT_MAX_SEND_WINDOW  8
+#define DIRECT_SEND_TIMEOUT_MS  25      /**< Default time a fragment may take from its send to its send callback */
+
 typedef struct direct_peer_t {
     uint8_t mac[6];
 } direct_peer_t;
@@ -100,10 +104,23 @@ void direct_get_mac(uint8_t *mac);
  */
 void direct_get_peers(direct_peer_t *peers, uint8_t *num_peers);
 
+/**
+ * @brief Sets how many fragments direct_send keeps in flight and how long each may take.
+ *
+ * A window of 1 sends each fragment only once the previous one was confirmed.
+ *
+ * @param window The number of fragments in flight, clamped to 1 to DIRECT_MAX_SEND_WINDOW.
+ * @param timeout_ms The time a fragment may take from its send to its send callback.
+ */
+void direct_set_send_window(uint8_t window, uint32_t timeout_ms);
+
 /**
  * @brief Sends data to a specific peer.
  *
  * This function sends data to a specific peer identified by their MAC address.
+ * Messages longer than an ESP-NOW frame are split into fragments, up to the send window of
+ * them are handed to the driver before the first is confirmed. Fails on the first fragment
+ * that is not confirmed, or not confirmed in time.
  *
  * @param mac The MAC address of the peer.
  * @param buffer The buffer containing the data to send.
@@ -116,6 +133,7 @@ uint8_t direct_send(const uint8_t *mac, uint8_t *buffer, uint32_t buffer_len);
  * @brief Receives data from a peer.
  *
  * This function receives data from a peer and stores it in the provided buffer.
+ * Fails if a fragment of a longer message is missing or out of order.
  *
  * @param mac The buffer to store the MAC address of the sender.
  * @param buffer The buffer to store the received data.
@@ -15,8 +15,37 @@
 #include "freertos/task.h"
 
 #include "common.h"
+#include "udp_socket.h"
 
 #define tcp_TIMEOUT_MS      5000
+#define tcp_CONNECT_TIMEOUT_MS  1000    /**< Longest tcp_client_create waits for the server to accept */
+#define tcp_LISTEN_BACKLOG  8       /**< Pending connections queued by the server, robots tend to connect all at once */
+#define tcp_SEND_TIMEOUT_MS 20      /**< Default time a send waits for room in the send window before buffering the rest */
+#define tcp_TX_BUFFER_SIZE  8192    /**< Bytes a connection or client buffers when the send window stays full, allocated on first use */
+#define tcp_RX_BUFFER_SIZE  2048    /**< Bytes a connection or client reads ahead with a single recv, allocated on first use */
+
+#define tcp_DSCP_EF         46      /**< Expedited forwarding, Wi-Fi WMM sends it in the video access category ahead of best effort */
+#define tcp_TOS(dscp)       ((dscp) << 2)   /**< IP type of service byte carrying a DSCP */
+
+/**
+ * @brief Socket options of a client, a connection or every connection a server accepts.
+ *
+ * Zero fields keep the stack's defaults.
+ */
+typedef struct tcp_options_t {
+    uint8_t nodelay;                /**< Send small writes at once instead of holding them until earlier data is acknowledged (Nagle) */
+    uint8_t keepalive;              /**< Probe the peer while the connection is idle */
+    uint32_t keepalive_idle_s;      /**< Idle time before the first probe */
+    uint32_t keepalive_interval_s;  /**< Time between unanswered probes */
+    uint32_t keepalive_count;       /**< Unanswered probes before the connection is dropped */
+    uint32_t send_buffer;           /**< SO_SNDBUF in bytes. lwIP has none, there it is CONFIG_LWIP_TCP_SND_BUF_DEFAULT */
+    uint32_t recv_buffer;           /**< SO_RCVBUF in bytes, lwIP needs CONFIG_LWIP_SO_RCVBUF */
+    uint8_t tos;                    /**< IP type of service, see tcp_TOS */
+} tcp_options_t;
+
+#define tcp_READY_READABLE  (1 << 0)  /**< Data to read, buffered or on the socket, or the peer closed and the next read reports it */
+#define tcp_READY_WRITABLE  (1 << 1)  /**< Room in the send window for data left in the TX buffer */
+#define tcp_READY_CLOSED    (1 << 2)  /**< Closed, by an error or after tcp_TIMEOUT_MS of silence, and should be freed */
 
 /**
  * @brief Represents a tcp server.
@@ -92,6 +121,15 @@ void tcp_server_get_ip(tcp_server_t *server, char ip[INET6_ADDRSTRLEN]);
  */
 uint32_t tcp_server_get_port(tcp_server_t *server);
 
+/**
+ * @brief Sets the options of the server's listening socket and of every connection it accepts from now on.
+ *
+ * @param server A pointer to the tcp_server_t object.
+ * @param options The options, copied.
+ * @return The number of options that could not be set, 0 on success.
+ */
+uint8_t tcp_server_set_options(tcp_server_t *server, const tcp_options_t *options);
+
 /**
  * @brief Checks if a tcp server is closed.
  *
@@ -102,30 +140,130 @@ uint32_t tcp_server_get_port(tcp_server_t *server);
  */
 uint8_t tcp_server_is_closed(tcp_server_t *server);
 
+/**
+ * @brief The sockets tcp_server_wait watches and, once it returns, which of them are ready.
+ */
+typedef struct tcp_wait_t {
+    tcp_connection_t **connections;     /**< Connections accepted by the server, NULL entries are skipped */
+    uint32_t count;
+    udp_socket_t *udp;                  /**< Optional datagram socket serviced by the same task, NULL if none */
+    uint8_t *ready;                     /**< Filled with the tcp_READY_ flags of each connection, count entries */
+    int32_t wake_fd;                    /**< Optional descriptor other tasks make readable to end the wait, e.g. an eventfd, 0 if none */
+    uint8_t acceptable;                 /**< Set if a connection is waiting to be accepted */
+    uint8_t datagrams;                  /**< Set if a datagram is waiting on udp */
+    uint8_t woken;                      /**< Set if wake_fd is readable, the caller drains it */
+} tcp_wait_t;
+
+/**
+ * @brief Waits until the server, one of its connections or the datagram socket needs service.
+ *
+ * A single select covers the listening socket, every connection and the datagram socket, so
+ * one task can accept and service any number of peers without polling each of them or sleeping
+ * between passes. Connections are watched for writing only while their TX buffer holds data.
+ * Returns at once if a connection already has data in its RX buffer or is closed, closing those
+ * that timed out on the way.
+ *
+ * @param server A pointer to the tcp_server_t object, may be NULL to only watch connections.
+ * @param wait The sockets to watch, its ready fields are filled in.
+ * @param timeout_ms The maximum time to wait.
+ * @return The number of ready sockets, 0 on timeout, or -1 on failure.
+ */
+int32_t tcp_server_wait(tcp_server_t *server, tcp_wait_t *wait, uint32_t timeout_ms);
+
 void tcp_connection_set_blocking(tcp_connection_t *connection, uint8_t blocking);
 
 /**
  * Sends data over a tcp connection.
  *
+ * Waits up to the connection's send timeout for room in the send window, then buffers what is
+ * left in the connection's TX buffer. The buffer is sent ahead of the next send, or by
+ * tcp_connection_flush. Data is sent or dropped whole, a send is never cut short.
+ *
  * @param connection The tcp connection to send data through.
  * @param data The data to send.
  * @param data_len The length of the data to send.
- * @return The number of bytes sent, or -1 if an error occurred.
+ * @return data_len if the data was sent or buffered, 0 if the TX buffer had no room for it or an error occurred.
  */
 uint32_t tcp_connection_send(tcp_connection_t *connection, uint8_t *buffer, uint32_t buffer_len);
 
+/**
+ * @brief Sends data left in the TX buffer of a tcp connection.
+ *
+ * @param connection The tcp connection to flush.
+ * @param timeout_ms The maximum time to wait for room in the send window, 0 to only send what fits now.
+ * @return The number of bytes still buffered.
+ */
+uint32_t tcp_connection_flush(tcp_connection_t *connection, uint32_t timeout_ms);
+
+/**
+ * @brief Sets the options of a tcp connection, replacing those inherited from its server.
+ *
+ * @param connection The tcp connection.
+ * @param options The options, copied.
+ * @return The number of options that could not be set, 0 on success.
+ */
+uint8_t tcp_connection_set_options(tcp_connection_t *connection, const tcp_options_t *options);
+
+/**
+ * @brief Sets how long sends on a tcp connection wait for room in the send window before buffering.
+ *
+ * @param connection The tcp connection.
+ * @param timeout_ms The timeout in milliseconds, tcp_SEND_TIMEOUT_MS by default.
+ */
+void tcp_connection_set_send_timeout(tcp_connection_t *connection, uint32_t timeout_ms);
+
 /**
  * @brief Receives data from a tcp connection.
  *
  * This function receives data from the specified tcp connection and stores it in the provided buffer.
+ * Data comes out of the connection's RX buffer, which is refilled with one large recv once empty,
+ * so small reads do not each cost a recv.
  *
  * @param connection A pointer to the tcp connection.
  * @param buffer A pointer to the buffer where the received data will be stored.
  * @param buffer_len The length of the buffer.
- * @return The number of bytes received, or -1 if an error occurred.
+ * @return The number of bytes received, 0 if none are available or an error occurred.
  */
 uint32_t tcp_connection_recv(tcp_connection_t *connection, uint8_t *buffer, uint32_t buffer_len);
 
+/**
+ * @brief Receives exactly len bytes from a tcp connection, waiting for them up to a deadline.
+ *
+ * @param connection A pointer to the tcp connection.
+ * @param buffer A pointer to the buffer where the received data will be stored.
+ * @param len The number of bytes to receive.
+ * @param timeout_ms The maximum time to wait for the data.
+ * @return The number of bytes received, len on success. Bytes received before a timeout are consumed.
+ */
+uint32_t tcp_connection_recv_exact(tcp_connection_t *connection, uint8_t *buffer, uint32_t len, uint32_t timeout_ms);
+
+/**
+ * @brief Copies up to len bytes from a tcp connection without consuming them.
+ *
+ * @param connection A pointer to the tcp connection.
+ * @param buffer A pointer to the buffer where the data will be copied.
+ * @param len The number of bytes wanted, at most tcp_RX_BUFFER_SIZE can be peeked.
+ * @return The number of bytes copied, fewer than len if no more have arrived yet.
+ */
+uint32_t tcp_connection_peek(tcp_connection_t *connection, uint8_t *buffer, uint32_t len);
+
+/**
+ * @brief Discards received data up to the next occurrence of a byte, which is kept.
+ *
+ * @param connection A pointer to the tcp connection.
+ * @param byte The byte to stop at, e.g. a sync flag.
+ * @return The number of bytes discarded. If the byte is not found every buffered byte is discarded.
+ */
+uint32_t tcp_connection_skip_until(tcp_connection_t *connection, uint8_t byte);
+
+/**
+ * @brief Gets the number of bytes that can be read from a tcp connection without waiting.
+ *
+ * @param connection A pointer to the tcp connection.
+ * @return The number of buffered bytes, after a recv if none were.
+ */
+uint32_t tcp_connection_readable(tcp_connection_t *connection);
+
 /**
  * @brief Closes a tcp connection.
  *
@@ -145,6 +283,16 @@ void tcp_connection_close(tcp_connection_t *connection);
  */
 void tcp_connection_free(tcp_connection_t *connection);
 
+/**
+ * @brief Gets the IPv4 address of the other end of a tcp connection.
+ *
+ * Lets datagrams from the same peer be matched to the connection.
+ *
+ * @param connection A pointer to the tcp connection.
+ * @return The address in network byte order, 0 if the peer is not IPv4.
+ */
+uint32_t tcp_connection_get_peer_ip(tcp_connection_t *connection);
+
 /**
  * @brief Checks if a tcp connection is closed.
  *
@@ -156,45 +304,141 @@ void tcp_connection_free(tcp_connection_t *connection);
 uint8_t tcp_connection_is_closed(tcp_connection_t *connection);
 
 /**
- * @brief Represents a tcp client.
+ * @brief Creates a tcp client and connects it to a server.
+ *
+ * Waits at most tcp_CONNECT_TIMEOUT_MS for the server to accept.
  *
- * This structure is used to create and manage a tcp client connection.
- * It provides functions for creating a tcp client and connecting to a server.
- * 
  * @param host_ip The IP address of the server to connect to.
  * @param port The port number of the server to connect to.
+ * @return A pointer to the connected client, or NULL if the connection failed.
  */
 tcp_client_t *tcp_client_create(const char *host_ip, uint32_t port);
 
+/**
+ * @brief Creates a tcp client without connecting it.
+ *
+ * The server address is resolved once here, tcp_client_connect then (re)connects the same
+ * client as often as needed without allocating.
+ *
+ * @param host_ip The IP address of the server to connect to.
+ * @param port The port number of the server to connect to.
+ * @return A pointer to the closed client, or NULL on failure.
+ */
+tcp_client_t *tcp_client_init(const char *host_ip, uint32_t port);
+
+/**
+ * @brief Connects a tcp client, closing its current connection first if it has one.
+ *
+ * @param client The tcp client to connect.
+ * @param timeout_ms The maximum time to wait for the server to accept.
+ * @return 0 if connected, 1 on failure or timeout. The client stays closed on failure.
+ */
+uint8_t tcp_client_connect(tcp_client_t *client, uint32_t timeout_ms);
+
 void tcp_client_set_blocking(tcp_client_t *client, uint8_t blocking);
 
 /**
  * Sends data over a tcp client.
  *
+ * Like tcp_connection_send, data the send window has no room for within the send timeout is buffered.
+ *
  * @param client    The tcp client to send data through.
  * @param data      The data to send.
  * @param data_len  The length of the data to send.
  *
- * @return          The number of bytes sent, or -1 if an error occurred.
+ * @return          data_len if the data was sent or buffered, 0 if the TX buffer had no room for it or an error occurred.
  */
 uint32_t tcp_client_send(tcp_client_t *client, uint8_t *buffer, uint32_t buffer_len);
 
+/**
+ * @brief Sends several buffers over a tcp client with a single sendmsg.
+ *
+ * Gathering the buffers lets lwIP pack them into as few segments (and Wi-Fi frames) as possible.
+ * Data the send window has no room for within the send timeout is buffered, see tcp_connection_send.
+ * Buffers are taken whole and in order: once one does not fit in the TX buffer it and the rest are dropped.
+ *
+ * @param client The tcp client to send data through.
+ * @param iov The buffers to send, in order. Modified as data is sent.
+ * @param iovcnt The number of buffers.
+ * @return The total length of the leading buffers sent or buffered, 0 if none were or an error occurred.
+ */
+uint32_t tcp_client_sendv(tcp_client_t *client, struct iovec *iov, int iovcnt);
+
+/**
+ * @brief Sends data left in the TX buffer of a tcp client.
+ *
+ * @param client The tcp client to flush.
+ * @param timeout_ms The maximum time to wait for room in the send window, 0 to only send what fits now.
+ * @return The number of bytes still buffered.
+ */
+uint32_t tcp_client_flush(tcp_client_t *client, uint32_t timeout_ms);
+
+/**
+ * @brief Sets the options of a tcp client, applied now if it is connected and again on every connect.
+ *
+ * @param client The tcp client.
+ * @param options The options, copied.
+ * @return The number of options that could not be set, 0 on success.
+ */
+uint8_t tcp_client_set_options(tcp_client_t *client, const tcp_options_t *options);
+
+/**
+ * @brief Sets how long sends on a tcp client wait for room in the send window before buffering.
+ *
+ * @param client The tcp client.
+ * @param timeout_ms The timeout in milliseconds, tcp_SEND_TIMEOUT_MS by default.
+ */
+void tcp_client_set_send_timeout(tcp_client_t *client, uint32_t timeout_ms);
+
+/**
+ * @brief Waits until the tcp client has data to read.
+ *
+ * Returns at once while data is left in the client's RX buffer. Also returns when the connection
+ * is closed by the peer, the next recv then reports it.
+ *
+ * @param client The tcp client to wait on.
+ * @param timeout_ms The maximum time to wait in milliseconds.
+ * @return 1 if the client is readable, 0 on timeout or if the client is closed.
+ */
+uint8_t tcp_client_wait_readable(tcp_client_t *client, uint32_t timeout_ms);
+
 /**
  * @brief Receives data from the tcp client.
  *
  * This function receives data from the specified tcp client and stores it in the provided buffer.
+ * Like tcp_connection_recv, data comes out of the client's RX buffer.
  *
  * @param client The tcp client to receive data from.
  * @param buffer The buffer to store the received data.
  * @param buffer_len The length of the buffer.
- * @return The number of bytes received, or -1 if an error occurred.
+ * @return The number of bytes received, 0 if none are available or an error occurred.
  */
 uint32_t tcp_client_recv(tcp_client_t *client, uint8_t *buffer, uint32_t buffer_len);
 
+/**
+ * @brief Receives exactly len bytes from the tcp client, see tcp_connection_recv_exact.
+ */
+uint32_t tcp_client_recv_exact(tcp_client_t *client, uint8_t *buffer, uint32_t len, uint32_t timeout_ms);
+
+/**
+ * @brief Copies up to len bytes from the tcp client without consuming them, see tcp_connection_peek.
+ */
+uint32_t tcp_client_peek(tcp_client_t *client, uint8_t *buffer, uint32_t len);
+
+/**
+ * @brief Discards received data up to the next occurrence of a byte, see tcp_connection_skip_until.
+ */
+uint32_t tcp_client_skip_until(tcp_client_t *client, uint8_t byte);
+
+/**
+ * @brief Gets the number of bytes that can be read from the tcp client without waiting, see tcp_connection_readable.
+ */
+uint32_t tcp_client_readable(tcp_client_t *client);
+
 /**
  * @brief Closes the tcp client connection.
  *
- * This function closes the connection of the specified tcp client.
+ * This function closes the connection of the specified tcp client. Closing a closed client does nothing.
  *
  * @param client A pointer to the tcp_client_t structure representing the tcp client.
  */
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "lwip/opt.h"
+#include "lwip/err.h"
+#include "lwip/sockets.h"
+#include "lwip/sys.h"
+#include "lwip/netdb.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "common.h"
+
+#define udp_MAX_DATAGRAM_LEN    (16 * 1024)     /**< Largest datagram sent or received, larger ones are IP fragmented */
+
+/**
+ * @brief Represents a udp socket.
+ *
+ * Datagrams are sent without waiting and without retransmission. Used for sensor streams
+ * where a lost message is better skipped than waited for.
+ */
+typedef struct udp_socket_t udp_socket_t;
+
+/**
+ * @brief Creates a new non-blocking udp socket.
+ *
+ * @param port The port to bind to, 0 for any free port.
+ * @return A pointer to the newly created udp_socket_t object, or NULL on failure.
+ */
+udp_socket_t *udp_socket_create(uint32_t port);
+
+/**
+ * @brief Sets the address datagrams are sent to.
+ *
+ * @param sock A pointer to the udp socket.
+ * @param host_ip The IP address of the peer.
+ * @param port The port of the peer.
+ * @return 0 if successful, 1 otherwise.
+ */
+uint8_t udp_socket_set_peer(udp_socket_t *sock, const char *host_ip, uint32_t port);
+
+/**
+ * @brief Sends several buffers to the peer as a single datagram.
+ *
+ * Never blocks. If lwIP has no room for the datagram it is dropped.
+ *
+ * @param sock A pointer to the udp socket.
+ * @param iov The buffers to send, in order.
+ * @param iovcnt The number of buffers.
+ * @return The number of bytes sent, 0 if the datagram was dropped.
+ */
+uint32_t udp_socket_sendv(udp_socket_t *sock, struct iovec *iov, int iovcnt);
+
+/**
+ * @brief Waits until the udp socket has a datagram to read.
+ *
+ * @param sock A pointer to the udp socket.
+ * @param timeout_ms The maximum time to wait in milliseconds.
+ * @return 1 if the socket is readable, 0 on timeout or if the socket is closed.
+ */
+uint8_t udp_socket_wait_readable(udp_socket_t *sock, uint32_t timeout_ms);
+
+/**
+ * @brief Receives one datagram, if one is waiting.
+ *
+ * @param sock A pointer to the udp socket.
+ * @param buffer The buffer to store the datagram in, the rest of a longer datagram is discarded.
+ * @param buffer_len The length of the buffer.
+ * @param source_ip Receives the IPv4 address of the sender in network byte order, may be NULL.
+ * @return The number of bytes received, 0 if no datagram was waiting or an error occurred.
+ */
+uint32_t udp_socket_recv(udp_socket_t *sock, uint8_t *buffer, uint32_t buffer_len, uint32_t *source_ip);
+
+/**
+ * @brief Gets the port the udp socket is bound to.
+ *
+ * @param sock A pointer to the udp socket.
+ * @return The port number of the udp socket.
+ */
+uint32_t udp_socket_get_port(udp_socket_t *sock);
+
+/**
+ * @brief Gets the descriptor of the udp socket, to wait on it together with other sockets.
+ *
+ * @param sock A pointer to the udp socket.
+ * @return The descriptor, or -1 if the socket is closed.
+ */
+int32_t udp_socket_get_fd(udp_socket_t *sock);
+
+/**
+ * @brief Closes the udp socket.
+ *
+ * @param sock A pointer to the udp socket.
+ */
+void udp_socket_close(udp_socket_t *sock);
+
+/**
+ * @brief Closes the udp socket if needed and frees it.
+ *
+ * @param sock A pointer to the udp socket.
+ */
+void udp_socket_free(udp_socket_t *sock);
+
+/**
+ * @brief Checks if a udp socket is closed.
+ *
+ * @param sock A pointer to the udp socket.
+ * @return Returns 1 if the udp socket is closed, 0 otherwise.
+ */
+uint8_t udp_socket_is_closed(udp_socket_t *sock);
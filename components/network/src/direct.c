@@ -19,6 +19,8 @@
 #define DIRECT_TAG "DIRECT"
 
 #define DIRECT_MAX_PACKET_SIZE 250
+#define DIRECT_FRAGMENT_HEADER_LEN 2    // [TYPE, INDEX]
+#define DIRECT_FRAGMENT_DATA_LEN (DIRECT_MAX_PACKET_SIZE - DIRECT_FRAGMENT_HEADER_LEN)
 #define DIRECT_MAX_PEERS 5
 #define DIRECT_WIFI_CHANNEL 11
 
@@ -26,9 +28,15 @@
 #define DIRECT_DISCONNECT 0x02
 
 #define DIRECT_QUEUE_SIZE 64
+#define DIRECT_CONTROL_QUEUE_SIZE 8
+#define DIRECT_CONTROL_STACK_SIZE 2048
+#define DIRECT_CONTROL_PRIORITY 5
 
 #define DIRECT_CONNECT_BIT BIT0
 
+#define DIRECT_TAG_RING_SIZE 32     // Sends whose callback has not run yet, more than the driver queues
+#define DIRECT_TAG_CONTROL 0        // Tag of acks and disconnects, which nobody waits for
+
 typedef struct direct_packet_t
 {
     uint8_t mac[6];
@@ -36,6 +44,15 @@ typedef struct direct_packet_t
     uint8_t len;
 } direct_packet_t;
 
+/**
+ * @brief An ack or disconnect waiting for the control task to send it.
+ */
+typedef struct direct_control_t
+{
+    uint8_t mac[6];
+    uint8_t type;
+} direct_control_t;
+
 typedef enum direct_state_t
 {
     DIRECT_CLIENT,
@@ -51,8 +68,34 @@ typedef enum direct_message_type_t
     DIRECT_SINGLE
 } direct_message_type_t;
 
+/**
+ * @brief Result of one fragment, passed from the send callback to direct_send.
+ */
+typedef struct direct_send_status_t
+{
+    uint16_t send_id;
+    esp_now_send_status_t status;
+} direct_send_status_t;
+
 static QueueHandle_t direct_queue = NULL;
 static QueueHandle_t direct_send_status_queue = NULL;
+static QueueHandle_t direct_control_queue = NULL;
+static TaskHandle_t direct_control_task = NULL;
+
+// ESP-NOW runs the send callback once per esp_now_send, in order. Each send pushes a tag, the
+// callback pops the oldest one to tell which direct_send, if any, the status belongs to. The tag
+// is pushed and the frame sent under send_tags_lock so tags stay in the order of the sends, which
+// is why nothing is sent from the Wi-Fi task: acks are queued for the control task instead.
+static uint16_t send_tags[DIRECT_TAG_RING_SIZE];
+static uint32_t send_tags_head = 0;
+static uint32_t send_tags_tail = 0;
+static portMUX_TYPE send_tags_mux = portMUX_INITIALIZER_UNLOCKED;
+static SemaphoreHandle_t send_tags_lock = NULL;
+static SemaphoreHandle_t send_lock = NULL;          // One direct_send at a time, fragments of two messages must not interleave
+static uint16_t send_id = DIRECT_TAG_CONTROL;
+
+static uint8_t send_window = DIRECT_SEND_WINDOW;
+static uint32_t send_timeout_ms = DIRECT_SEND_TIMEOUT_MS;
 
 static direct_state_t direct_state = DIRECT_NONE;
 
@@ -67,16 +110,71 @@ static uint8_t host_num_connections = 0;
 static char direct_username[9] = {0};
 static char direct_password[16] = {0};
 
+/**
+ * @brief Hands a frame to ESP-NOW, recording whose status its send callback will carry.
+ *
+ * May wait for the driver, never call it from the Wi-Fi task.
+ *
+ * @param tag The id of the direct_send sending the frame, or DIRECT_TAG_CONTROL.
+ * @return The result of esp_now_send, ESP_ERR_ESPNOW_NO_MEM if too many sends are outstanding.
+ */
+static esp_err_t _direct_esp_now_send(const uint8_t *mac, const uint8_t *data, uint32_t len, uint16_t tag)
+{
+    xSemaphoreTake(send_tags_lock, portMAX_DELAY);
+    taskENTER_CRITICAL(&send_tags_mux);
+    uint8_t full = send_tags_tail - send_tags_head == DIRECT_TAG_RING_SIZE;
+    if (!full)
+    {
+        send_tags[send_tags_tail % DIRECT_TAG_RING_SIZE] = tag;
+        send_tags_tail++;
+    }
+    taskEXIT_CRITICAL(&send_tags_mux);
+
+    esp_err_t err = full ? ESP_ERR_ESPNOW_NO_MEM : esp_now_send(mac, data, len);
+    if (!full && err != ESP_OK)
+    {
+        // No callback will come for it, and being the newest it cannot have been popped
+        taskENTER_CRITICAL(&send_tags_mux);
+        send_tags_tail--;
+        taskEXIT_CRITICAL(&send_tags_mux);
+    }
+    xSemaphoreGive(send_tags_lock);
+    return err;
+}
+
+static void _direct_send_control(const uint8_t *mac, uint8_t type)
+{
+    uint8_t control[2] = { DIRECT_SINGLE, type };
+    _direct_esp_now_send(mac, control, sizeof(control), DIRECT_TAG_CONTROL);
+}
+
+static void _direct_control_task(void *args)
+{
+    direct_control_t control;
+    while (1)
+    {
+        if (xQueueReceive(direct_control_queue, &control, portMAX_DELAY) == pdTRUE)
+        {
+            _direct_send_control(control.mac, control.type);
+        }
+    }
+}
+
+// Acks are sent from the receive callback, which runs in the Wi-Fi task that also runs the send
+// callback, so they are handed to the control task rather than sent here
 void _direct_send_ack(const uint8_t *mac)
 {
-    uint8_t ack = DIRECT_ACK;
-    direct_send(mac, &ack, 1);
+    direct_control_t control = { .type = DIRECT_ACK };
+    memcpy(control.mac, mac, 6);
+    if (xQueueSend(direct_control_queue, &control, 0) != pdTRUE)
+    {
+        ESP_LOGW(DIRECT_TAG, "Control queue full, dropped ack to " MACSTR, MAC2STR(mac));
+    }
 }
 
 void _direct_send_disconnect(const uint8_t *mac)
 {
-    uint8_t disconnect = DIRECT_DISCONNECT;
-    direct_send(mac, &disconnect, 1);
+    _direct_send_control(mac, DIRECT_DISCONNECT);
 }
 
 void _direct_add_peer(const uint8_t *mac)
@@ -228,7 +326,26 @@ static void _direct_host_recv_cb(const esp_now_recv_info_t *recv_info, const uin
 
 static void _direct_send_cb(const uint8_t *mac, esp_now_send_status_t status)
 {
-    BaseType_t err = xQueueSend(direct_send_status_queue, &status, 10 / portTICK_PERIOD_MS);
+    direct_send_status_t send_status = { .status = status };
+    taskENTER_CRITICAL(&send_tags_mux);
+    if (send_tags_head != send_tags_tail)
+    {
+        send_status.send_id = send_tags[send_tags_head % DIRECT_TAG_RING_SIZE];
+        send_tags_head++;
+    }
+    taskEXIT_CRITICAL(&send_tags_mux);
+
+    if (send_status.send_id == DIRECT_TAG_CONTROL)
+    {
+        if (status != ESP_NOW_SEND_SUCCESS)
+        {
+            ESP_LOGW(DIRECT_TAG, "Failed to send control message to " MACSTR, MAC2STR(mac));
+        }
+        return;
+    }
+
+    // Runs in the Wi-Fi task, never wait here
+    BaseType_t err = xQueueSend(direct_send_status_queue, &send_status, 0);
     if (err != pdTRUE)
     {
         ESP_LOGE(DIRECT_TAG, "Failed to send send status to direct queue");
@@ -255,7 +372,13 @@ uint8_t _direct_init(void)
     esp_now_init();
 
     direct_queue = xQueueCreate(DIRECT_QUEUE_SIZE, sizeof(direct_packet_t));
-    direct_send_status_queue = xQueueCreate(DIRECT_QUEUE_SIZE, sizeof(esp_now_send_status_t));
+    direct_send_status_queue = xQueueCreate(DIRECT_QUEUE_SIZE, sizeof(direct_send_status_t));
+    direct_control_queue = xQueueCreate(DIRECT_CONTROL_QUEUE_SIZE, sizeof(direct_control_t));
+    send_lock = xSemaphoreCreateMutex();
+    send_tags_lock = xSemaphoreCreateMutex();
+    send_tags_head = 0;
+    send_tags_tail = 0;
+    xTaskCreate(_direct_control_task, "direct_control", DIRECT_CONTROL_STACK_SIZE, NULL, DIRECT_CONTROL_PRIORITY, &direct_control_task);
 
     esp_now_register_send_cb(_direct_send_cb);
 
@@ -269,8 +392,14 @@ void _direct_deinit(void)
     esp_now_unregister_send_cb();
     esp_now_unregister_recv_cb();
 
+    vTaskDelete(direct_control_task);
+    direct_control_task = NULL;
+
     vQueueDelete(direct_queue);
     vQueueDelete(direct_send_status_queue);
+    vQueueDelete(direct_control_queue);
+    vSemaphoreDelete(send_lock);
+    vSemaphoreDelete(send_tags_lock);
 
     esp_now_deinit();
     esp_wifi_stop();
@@ -294,8 +423,8 @@ uint8_t direct_host_init(const char *user, const char *password)
     }
 
     direct_state = DIRECT_HOST;
-    strncpy(direct_username, user, 9);
-    strncpy(direct_password, password, 16);
+    strncpy(direct_username, user, sizeof(direct_username) - 1);
+    strncpy(direct_password, password, sizeof(direct_password) - 1);
 
     uint8_t err = _direct_init();
     if (err)
@@ -368,8 +497,8 @@ uint8_t direct_client_connect(const char *user, const char *password, int64_t ti
     }
 
     pair_config_t pair_cfg = {0};
-    strncpy(pair_cfg.ssid, user, 9);
-    strncpy(pair_cfg.password, password, 16);
+    strncpy(pair_cfg.ssid, user, sizeof(pair_cfg.ssid) - 1);
+    strncpy(pair_cfg.password, password, sizeof(pair_cfg.password) - 1);
 
     xEventGroupClearBits(connect_event_group, DIRECT_CONNECT_BIT);
 
@@ -441,6 +570,41 @@ void direct_get_peers(direct_peer_t *peers, uint8_t *num_peers)
     *num_peers = j;
 }
 
+void direct_set_send_window(uint8_t window, uint32_t timeout_ms)
+{
+    send_window = (window < 1) ? 1 : (window > DIRECT_MAX_SEND_WINDOW) ? DIRECT_MAX_SEND_WINDOW : window;
+    send_timeout_ms = timeout_ms;
+}
+
+/**
+ * @brief Writes fragment index of a message into out_buffer, [TYPE, INDEX, DATA].
+ *
+ * The index wraps at 256, it lets direct_receive tell a missing fragment from the next one.
+ *
+ * @return The length of the fragment including its header.
+ */
+static uint32_t _direct_fragment(uint8_t *out_buffer, const uint8_t *buffer, uint32_t buffer_len, uint32_t index)
+{
+    uint32_t offset = index * DIRECT_FRAGMENT_DATA_LEN;
+    uint32_t bytes_left = buffer_len - offset;
+    uint32_t len = (bytes_left > DIRECT_FRAGMENT_DATA_LEN) ? DIRECT_FRAGMENT_DATA_LEN : bytes_left;
+
+    uint8_t type;
+    if (offset == 0)
+    {
+        type = (bytes_left == len) ? DIRECT_SINGLE : DIRECT_FIRST;
+    }
+    else
+    {
+        type = (bytes_left == len) ? DIRECT_LAST : DIRECT_MIDDLE;
+    }
+
+    out_buffer[0] = type;
+    out_buffer[1] = (uint8_t)index;
+    memcpy(out_buffer + DIRECT_FRAGMENT_HEADER_LEN, buffer + offset, len);
+    return len + DIRECT_FRAGMENT_HEADER_LEN;
+}
+
 uint8_t direct_send(const uint8_t *mac, uint8_t *buffer, uint32_t buffer_len)
 {
     if (direct_state == DIRECT_NONE)
@@ -448,51 +612,81 @@ uint8_t direct_send(const uint8_t *mac, uint8_t *buffer, uint32_t buffer_len)
         ESP_LOGE(DIRECT_TAG, "Direct communication not initialized");
         return 1;
     }
-    uint8_t out_buffer[DIRECT_MAX_PACKET_SIZE];
+    if (buffer_len == 0)
+    {
+        return 0;
+    }
 
-    uint32_t bytes_left = buffer_len;
-    uint32_t offset = 0;
-    while (bytes_left > 0)
+    xSemaphoreTake(send_lock, portMAX_DELAY);
+    do
     {
-        uint32_t len = (bytes_left > DIRECT_MAX_PACKET_SIZE - 1) ? DIRECT_MAX_PACKET_SIZE - 1 : bytes_left;
+        send_id++;
+    } while (send_id == DIRECT_TAG_CONTROL);
 
-        uint8_t type;
-        if (bytes_left == buffer_len)
+    uint8_t out_buffer[DIRECT_MAX_PACKET_SIZE];
+    uint32_t num_fragments = (buffer_len + DIRECT_FRAGMENT_DATA_LEN - 1) / DIRECT_FRAGMENT_DATA_LEN;
+    uint32_t sent_time[DIRECT_MAX_SEND_WINDOW];     // Indexed by fragment % window while the fragment is in flight
+    uint8_t window = send_window;
+    uint32_t timeout_ms = send_timeout_ms;
+    uint32_t next = 0;          // Next fragment to send
+    uint32_t acked = 0;         // Fragments confirmed, callbacks come in send order
+    uint8_t err = 0;
+
+    while (acked < num_fragments && !err)
+    {
+        // ESP-NOW copies the frame, so the whole window is filled from one buffer
+        while (next < num_fragments && next - acked < window)
         {
-            if (bytes_left == len)
+            uint32_t len = _direct_fragment(out_buffer, buffer, buffer_len, next);
+            esp_err_t send_err = _direct_esp_now_send(mac, out_buffer, len, send_id);
+            if (send_err == ESP_ERR_ESPNOW_NO_MEM && next > acked)
             {
-                type = DIRECT_SINGLE;
+                // The driver's queue is full, wait for a fragment to go out first
+                break;
             }
-            else
+            if (send_err != ESP_OK)
             {
-                type = DIRECT_FIRST;
+                ESP_LOGE(DIRECT_TAG, "Failed to queue fragment %lu of %lu: %s", (unsigned long)next,
+                         (unsigned long)num_fragments, esp_err_to_name(send_err));
+                err = 1;
+                break;
             }
+            sent_time[next % window] = get_time_ms();
+            next++;
         }
-        else if (bytes_left == len)
+        if (err)
         {
-            type = DIRECT_LAST;
+            break;
         }
-        else
+
+        // Wait for the oldest fragment in flight, each gets timeout_ms from its own send
+        uint32_t elapsed = get_time_ms() - sent_time[acked % window];
+        uint32_t remaining = (elapsed < timeout_ms) ? timeout_ms - elapsed : 0;
+        TickType_t ticks = (remaining + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS;
+        direct_send_status_t status;
+        if (xQueueReceive(direct_send_status_queue, &status, ticks) != pdTRUE)
         {
-            type = DIRECT_MIDDLE;
+            ESP_LOGE(DIRECT_TAG, "Timed out sending fragment %lu of %lu", (unsigned long)acked, (unsigned long)num_fragments);
+            err = 1;
+            break;
         }
 
-        out_buffer[0] = type;
-        memcpy(out_buffer + 1, buffer + offset, len);
-        esp_now_send(mac, out_buffer, len + 1);
-
-        esp_now_send_status_t status;
-        xQueueReceive(direct_send_status_queue, &status, 25 / portTICK_PERIOD_MS);
-        if (status != ESP_NOW_SEND_SUCCESS)
+        // A late status of an earlier send that timed out
+        if (status.send_id != send_id)
         {
-            ESP_LOGE(DIRECT_TAG, "Failed to send packet");
-            return 1;
+            continue;
         }
-
-        bytes_left -= len;
-        offset += len;
+        if (status.status != ESP_NOW_SEND_SUCCESS)
+        {
+            ESP_LOGE(DIRECT_TAG, "Failed to send fragment %lu of %lu", (unsigned long)acked, (unsigned long)num_fragments);
+            err = 1;
+            break;
+        }
+        acked++;
     }
-    return 0;
+
+    xSemaphoreGive(send_lock);
+    return err;
 }
 
 uint8_t direct_receive(uint8_t *mac, uint8_t *buffer, uint32_t *buffer_len)
@@ -510,23 +704,30 @@ uint8_t direct_receive(uint8_t *mac, uint8_t *buffer, uint32_t *buffer_len)
         return 1;
     }
 
-    uint32_t offset = 0;
-    uint8_t type = packet.data[0];
-    uint32_t len = packet.len - 1;
-    memcpy(buffer + offset, packet.data + 1, len);
-    *buffer_len = len;
     memcpy(mac, packet.mac, 6);
+    if (packet.len < DIRECT_FRAGMENT_HEADER_LEN)
+    {
+        free(packet.data);
+        return 1;
+    }
+    uint8_t type = packet.data[0];
+    uint8_t index = packet.data[1];
+    *buffer_len = packet.len - DIRECT_FRAGMENT_HEADER_LEN;
+    memcpy(buffer, packet.data + DIRECT_FRAGMENT_HEADER_LEN, *buffer_len);
     free(packet.data);
 
     if (type == DIRECT_SINGLE)
     {
         return 0;
     }
-    else if (type != DIRECT_FIRST)
+    else if (type != DIRECT_FIRST || index != 0)
     {
         return 1;
     }
 
+    // A sender with several fragments in flight may have its last one delivered after a middle
+    // one was lost, so every fragment must be the next index from the same peer
+    uint8_t expected = 1;
     while (type != DIRECT_LAST)
     {
         BaseType_t err = xQueueReceive(direct_queue, &packet, 10 / portTICK_PERIOD_MS);
@@ -535,17 +736,24 @@ uint8_t direct_receive(uint8_t *mac, uint8_t *buffer, uint32_t *buffer_len)
             return 1;
         }
 
+        if (packet.len < DIRECT_FRAGMENT_HEADER_LEN || memcmp(packet.mac, mac, 6) != 0)
+        {
+            free(packet.data);
+            return 1;
+        }
         type = packet.data[0];
-        len = packet.len - 1;
-        memcpy(buffer + offset, packet.data + 1, len);
-        *buffer_len += len;
-        offset += len;
-        free(packet.data);
-
-        if (type != DIRECT_MIDDLE && type != DIRECT_LAST)
+        index = packet.data[1];
+        if ((type != DIRECT_MIDDLE && type != DIRECT_LAST) || index != expected)
         {
+            ESP_LOGW(DIRECT_TAG, "Expected fragment %u from " MACSTR ", got %u", expected, MAC2STR(mac), index);
+            free(packet.data);
             return 1;
         }
+        uint32_t len = packet.len - DIRECT_FRAGMENT_HEADER_LEN;
+        memcpy(buffer + *buffer_len, packet.data + DIRECT_FRAGMENT_HEADER_LEN, len);
+        *buffer_len += len;
+        expected++;
+        free(packet.data);
     }
 
     return 0;
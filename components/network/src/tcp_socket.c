@@ -15,6 +15,15 @@ typedef struct tcp_t {
     int32_t _fd;
     int32_t _port;
     uint8_t _closed;
+    uint32_t _send_timeout_ms;
+    uint8_t *_tx_buf;           /**< Data accepted by a send that timed out, allocated on first use */
+    uint32_t _tx_len;
+    uint32_t _tx_size;          /**< tcp_TX_BUFFER_SIZE, or more while holding the end of a larger buffer */
+    uint8_t *_rx_buf;           /**< Received data not yet read, bytes _rx_head to _rx_tail, allocated on first use */
+    uint32_t _rx_head;
+    uint32_t _rx_tail;
+    uint32_t _last_recv_time;
+    tcp_options_t _options;     /**< Applied to every socket the tcp opens, and by a server to every connection it accepts */
 } tcp_t;
 
 struct tcp_server_t 
@@ -23,37 +32,258 @@ struct tcp_server_t
 
 struct tcp_connection_t 
 {   tcp_t _tcp;
-    uint32_t _last_recv_time;
+    uint32_t _peer_ip;
 };
 
 struct tcp_client_t 
 {   tcp_t _tcp;
-    uint32_t _last_recv_time;
+    struct sockaddr_storage _addr;  /**< Resolved once, reconnects reuse it */
+    socklen_t _addr_len;
 };
 
+static void _tcp_init(tcp_t *tcp, uint32_t port)
+{
+    memset(&tcp->_options, 0, sizeof(tcp_options_t));
+    tcp->_port = port;
+    tcp->_closed = 1;
+    tcp->_send_timeout_ms = tcp_SEND_TIMEOUT_MS;
+    tcp->_tx_buf = NULL;
+    tcp->_tx_len = 0;
+    tcp->_tx_size = 0;
+    tcp->_rx_buf = NULL;
+    tcp->_rx_head = 0;
+    tcp->_rx_tail = 0;
+}
+
+static uint8_t _tcp_would_block(int err)
+{
+    return err == EINPROGRESS || err == EAGAIN || err == EWOULDBLOCK;
+}
+
+static uint8_t _tcp_setsockopt(int32_t fd, int level, int name, int value, const char *name_str)
+{
+    if (setsockopt(fd, level, name, &value, sizeof(value)) < 0) {
+        ESP_LOGW(SOCKET_TAG, "Unable to set %s: errno %d", name_str, errno);
+        return 1;
+    }
+    return 0;
+}
+
 /**
- * @brief Sends data over a tcp.
+ * @brief Sets the non-zero options on a socket.
  *
- * This function sends the specified buffer of data over the tcp with the given file descriptor.
- * It sends the data in chunks until the entire buffer is sent.
+ * @return The number of options that could not be set.
+ */
+static uint8_t _tcp_apply_options(int32_t fd, const tcp_options_t *options)
+{
+    uint8_t failed = 0;
+    if (options->nodelay) {
+        failed += _tcp_setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+    }
+    if (options->keepalive) {
+        failed += _tcp_setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, 1, "SO_KEEPALIVE");
+        if (options->keepalive_idle_s) {
+            failed += _tcp_setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, options->keepalive_idle_s, "TCP_KEEPIDLE");
+        }
+        if (options->keepalive_interval_s) {
+            failed += _tcp_setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, options->keepalive_interval_s, "TCP_KEEPINTVL");
+        }
+        if (options->keepalive_count) {
+            failed += _tcp_setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, options->keepalive_count, "TCP_KEEPCNT");
+        }
+    }
+    if (options->send_buffer) {
+        failed += _tcp_setsockopt(fd, SOL_SOCKET, SO_SNDBUF, options->send_buffer, "SO_SNDBUF");
+    }
+    if (options->recv_buffer) {
+        failed += _tcp_setsockopt(fd, SOL_SOCKET, SO_RCVBUF, options->recv_buffer, "SO_RCVBUF");
+    }
+    if (options->tos) {
+        failed += _tcp_setsockopt(fd, IPPROTO_IP, IP_TOS, options->tos, "IP_TOS");
+    }
+    return failed;
+}
+
+/**
+ * @brief Waits until a tcp has data to read or can take more data, without spinning.
  *
  * @param fd The file descriptor of the tcp.
- * @param buffer Pointer to the buffer containing the data to be sent.
- * @param buffer_len The length of the buffer in bytes.
- * @return The number of bytes sent on success, or -1 on failure.
+ * @param write 1 to wait until writable, 0 until readable.
+ * @param start The time the operation started, from get_time_ms.
+ * @param timeout_ms The time the operation may take in total.
+ * @return 1 if the tcp is ready, 0 once the time is up, or -1 on failure.
+ */
+static int8_t _tcp_wait(int32_t fd, uint8_t write, uint32_t start, uint32_t timeout_ms)
+{
+    uint32_t elapsed = get_time_ms() - start;
+    if (elapsed >= timeout_ms) {
+        return 0;
+    }
+
+    fd_set fdset;
+    FD_ZERO(&fdset);
+    FD_SET(fd, &fdset);
+    uint32_t remaining = timeout_ms - elapsed;
+    struct timeval timeout = { .tv_sec = remaining / 1000, .tv_usec = (remaining % 1000) * 1000 };
+
+    int res = select(fd + 1, write ? NULL : &fdset, write ? &fdset : NULL, NULL, &timeout);
+    if (res < 0) {
+        ESP_LOGE(SOCKET_TAG, "Error occurred during select: errno %d", errno);
+        return -1;
+    }
+    return res > 0;
+}
+
+/**
+ * @brief Sends data left in the TX buffer of a tcp by an earlier send.
+ *
+ * @param tcp Pointer to the tcp object.
+ * @param start The time the send started, from get_time_ms.
+ * @param timeout_ms The time the send may take in total.
+ * @return 0 on success, whether or not the buffer emptied in time, or -1 on failure.
+ */
+static int8_t _tcp_flush(tcp_t *tcp, uint32_t start, uint32_t timeout_ms)
+{
+    while (tcp->_tx_len > 0) {
+        int written = send(tcp->_fd, tcp->_tx_buf, tcp->_tx_len, 0);
+        if (written < 0) {
+            if (!_tcp_would_block(errno)) {
+                ESP_LOGE(SOCKET_TAG, "Error occurred during sending: errno %d", errno);
+                return -1;
+            }
+            int8_t res = _tcp_wait(tcp->_fd, 1, start, timeout_ms);
+            if (res <= 0) {
+                return res;
+            }
+            continue;
+        }
+        memmove(tcp->_tx_buf, tcp->_tx_buf + written, tcp->_tx_len - written);
+        tcp->_tx_len -= written;
+    }
+    if (tcp->_tx_size > tcp_TX_BUFFER_SIZE) {
+        // Grown for the end of a large buffer, back to the usual size with the next use
+        free(tcp->_tx_buf);
+        tcp->_tx_buf = NULL;
+        tcp->_tx_size = 0;
+    }
+    return 0;
+}
+
+/**
+ * @brief Advances a message past n sent bytes, skipping buffers that are done and trimming a partial one.
  */
-int64_t _tcp_send(int32_t fd, uint8_t *buffer, uint32_t buffer_len)
-{
-    int to_write = buffer_len;
-    while (to_write > 0) {
-        int written = send(fd, buffer + (buffer_len - to_write), to_write, 0);
-        if (written < 0 && errno != EINPROGRESS && errno != EAGAIN && errno != EWOULDBLOCK) {
-            ESP_LOGE(SOCKET_TAG, "Error occurred during sending: errno %d", errno);
-            return -1;
+static void _tcp_msg_advance(struct msghdr *msg, size_t n)
+{
+    while (msg->msg_iovlen > 0 && n >= msg->msg_iov->iov_len) {
+        n -= msg->msg_iov->iov_len;
+        msg->msg_iov++;
+        msg->msg_iovlen--;
+    }
+    if (msg->msg_iovlen > 0) {
+        msg->msg_iov->iov_base = (uint8_t *)msg->msg_iov->iov_base + n;
+        msg->msg_iov->iov_len -= n;
+    }
+}
+
+/**
+ * @brief Sends several buffers over a tcp with sendmsg.
+ *
+ * Data left in the TX buffer goes out first to keep the stream in order. While the send window
+ * is full the task sleeps in select instead of retrying. Whatever is not sent by the end of the
+ * tcp's send timeout is copied into the TX buffer and goes out with the next send or flush.
+ * Buffers are only ever taken whole, so a frame is never cut: the end of a buffer already partly
+ * sent is always kept, the following buffers only if they fit in tcp_TX_BUFFER_SIZE.
+ *
+ * @param tcp Pointer to the tcp object.
+ * @param iov The buffers to send. Modified as data is sent.
+ * @param iovcnt The number of buffers.
+ * @return The number of bytes sent or buffered, the length of the buffers taken whole, or -1 on failure.
+ */
+int64_t _tcp_sendv(tcp_t *tcp, struct iovec *iov, int iovcnt)
+{
+    uint32_t start = get_time_ms();
+    if (_tcp_flush(tcp, start, tcp->_send_timeout_ms) < 0) {
+        return -1;
+    }
+
+    int64_t total = 0;
+    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = iovcnt };
+    while (msg.msg_iovlen > 0 && tcp->_tx_len == 0) {
+        int written = sendmsg(tcp->_fd, &msg, 0);
+        if (written < 0) {
+            if (!_tcp_would_block(errno)) {
+                ESP_LOGE(SOCKET_TAG, "Error occurred during sending: errno %d", errno);
+                return -1;
+            }
+            int8_t res = _tcp_wait(tcp->_fd, 1, start, tcp->_send_timeout_ms);
+            if (res < 0) {
+                return -1;
+            }
+            else if (res == 0) {
+                break;
+            }
+            continue;
+        }
+        total += written;
+        _tcp_msg_advance(&msg, written);
+    }
+
+    if (msg.msg_iovlen == 0) {
+        return total;
+    }
+
+    // Buffers before the current one went out whole, anything beyond them is part of the current one
+    int64_t whole = 0;
+    for (struct iovec *sent = iov; sent < msg.msg_iov; sent++) {
+        whole += sent->iov_len;
+    }
+    uint32_t size = tcp_TX_BUFFER_SIZE;
+    if (total > whole && msg.msg_iov->iov_len > size) {
+        size = msg.msg_iov->iov_len;
+    }
+    if (tcp->_tx_buf == NULL || tcp->_tx_size < size) {
+        uint8_t *tx_buf = (uint8_t *)realloc(tcp->_tx_buf, size);
+        if (tx_buf == NULL) {
+            ESP_LOGE(SOCKET_TAG, "Unable to allocate memory for TX buffer");
+            // The peer already has the start of the current buffer, the stream cannot be resumed
+            return (total > whole) ? -1 : total;
         }
-        to_write -= written;
+        tcp->_tx_buf = tx_buf;
+        tcp->_tx_size = size;
+    }
+
+    if (total > whole) {
+        memcpy(tcp->_tx_buf, msg.msg_iov->iov_base, msg.msg_iov->iov_len);
+        tcp->_tx_len = msg.msg_iov->iov_len;
+        total += msg.msg_iov->iov_len;
+        _tcp_msg_advance(&msg, msg.msg_iov->iov_len);
     }
-    return buffer_len;
+    while (msg.msg_iovlen > 0 && msg.msg_iov->iov_len <= tcp->_tx_size - tcp->_tx_len) {
+        memcpy(tcp->_tx_buf + tcp->_tx_len, msg.msg_iov->iov_base, msg.msg_iov->iov_len);
+        tcp->_tx_len += msg.msg_iov->iov_len;
+        total += msg.msg_iov->iov_len;
+        _tcp_msg_advance(&msg, msg.msg_iov->iov_len);
+    }
+    if (msg.msg_iovlen > 0) {
+        ESP_LOGW(SOCKET_TAG, "TX buffer full, dropped %d buffers of a send", (int)msg.msg_iovlen);
+    }
+    return total;
+}
+
+/**
+ * @brief Sends data over a tcp.
+ *
+ * See _tcp_sendv.
+ *
+ * @param tcp Pointer to the tcp object.
+ * @param buffer Pointer to the buffer containing the data to be sent.
+ * @param buffer_len The length of the buffer in bytes.
+ * @return The number of bytes sent or buffered, buffer_len or 0 if the TX buffer had no room, or -1 on failure.
+ */
+int64_t _tcp_send(tcp_t *tcp, uint8_t *buffer, uint32_t buffer_len)
+{
+    struct iovec iov = { .iov_base = buffer, .iov_len = buffer_len };
+    return _tcp_sendv(tcp, &iov, 1);
 }
 
 /**
@@ -81,6 +311,10 @@ int64_t _tcp_recv(int32_t fd, uint8_t *buffer, uint32_t buffer_len)
         ESP_LOGE(SOCKET_TAG, "Error occurred during receiving: errno %d", errno);
         return -1;
     }
+    else if (len == 0 && buffer_len > 0) {
+        ESP_LOGW(SOCKET_TAG, "Connection closed by peer");
+        return -2;  // Orderly shutdown, without this a dead peer is only noticed after tcp_TIMEOUT_MS
+    }
 
     return len;
 }
@@ -88,14 +322,185 @@ int64_t _tcp_recv(int32_t fd, uint8_t *buffer, uint32_t buffer_len)
 /**
  * @brief Closes a tcp.
  *
- * This function closes the tcp associated with the given tcp object.
+ * This function closes the tcp associated with the given tcp object. Buffered data is discarded
+ * but the buffers are kept for the next connection, a client reconnecting often would otherwise
+ * fragment the heap. Closing a closed tcp does nothing, its fd may already belong to another socket.
  *
  * @param tcp Pointer to the tcp object.
  */
 void _tcp_close(tcp_t *tcp)
 {
+    if (tcp->_closed) {
+        return;
+    }
     close(tcp->_fd);
     tcp->_closed = 1;
+    tcp->_tx_len = 0;
+    tcp->_rx_head = 0;
+    tcp->_rx_tail = 0;
+}
+
+/**
+ * @brief Frees the TX and RX buffers of a closed tcp.
+ */
+static void _tcp_free_buffers(tcp_t *tcp)
+{
+    free(tcp->_tx_buf);
+    tcp->_tx_buf = NULL;
+    tcp->_tx_size = 0;
+    free(tcp->_rx_buf);
+    tcp->_rx_buf = NULL;
+}
+
+/**
+ * @brief Checks that a tcp can be used, closing it once the peer has been silent for tcp_TIMEOUT_MS.
+ */
+static uint8_t _tcp_is_usable(tcp_t *tcp)
+{
+    if (tcp->_closed) {
+        return 0;
+    }
+    if (get_time_ms() - tcp->_last_recv_time > tcp_TIMEOUT_MS) {
+        ESP_LOGW(SOCKET_TAG, "Connection timeout");
+        _tcp_close(tcp);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Makes sure at least want bytes are buffered, reading as much as fits with a single recv if not.
+ *
+ * The RX buffer is filled with large reads so a parser asking for a few bytes at a time
+ * does not cost a recv each.
+ *
+ * @param tcp Pointer to the tcp object.
+ * @param want The number of bytes the caller needs.
+ * @return The number of bytes buffered, which may be fewer than want. 0 if the tcp failed and was closed.
+ */
+static uint32_t _tcp_rx_fill(tcp_t *tcp, uint32_t want)
+{
+    uint32_t buffered = tcp->_rx_tail - tcp->_rx_head;
+    if (buffered >= want || buffered == tcp_RX_BUFFER_SIZE) {
+        return buffered;
+    }
+
+    if (tcp->_rx_buf == NULL) {
+        tcp->_rx_buf = (uint8_t *)malloc(tcp_RX_BUFFER_SIZE);
+        if (tcp->_rx_buf == NULL) {
+            ESP_LOGE(SOCKET_TAG, "Unable to allocate memory for RX buffer");
+            _tcp_close(tcp);
+            return 0;
+        }
+    }
+    if (tcp->_rx_head > 0) {
+        memmove(tcp->_rx_buf, tcp->_rx_buf + tcp->_rx_head, buffered);
+        tcp->_rx_head = 0;
+        tcp->_rx_tail = buffered;
+    }
+
+    int64_t len = _tcp_recv(tcp->_fd, tcp->_rx_buf + tcp->_rx_tail, tcp_RX_BUFFER_SIZE - tcp->_rx_tail);
+    if (len < 0) {
+        _tcp_close(tcp);
+        return 0;
+    }
+    else if (len > 0) {
+        tcp->_rx_tail += len;
+        tcp->_last_recv_time = get_time_ms();
+    }
+    return tcp->_rx_tail - tcp->_rx_head;
+}
+
+/**
+ * @brief Copies up to len buffered bytes out of the RX buffer of a tcp, consuming them.
+ */
+static uint32_t _tcp_rx_take(tcp_t *tcp, uint8_t *buffer, uint32_t len)
+{
+    uint32_t buffered = tcp->_rx_tail - tcp->_rx_head;
+    if (len > buffered) {
+        len = buffered;
+    }
+    if (len > 0) {
+        memcpy(buffer, tcp->_rx_buf + tcp->_rx_head, len);
+        tcp->_rx_head += len;
+    }
+    return len;
+}
+
+static uint32_t _tcp_read(tcp_t *tcp, uint8_t *buffer, uint32_t buffer_len)
+{
+    if (buffer_len == 0 || !_tcp_is_usable(tcp)) {
+        return 0;
+    }
+
+    // Reads too large for the RX buffer skip it once it is empty
+    if (tcp->_rx_tail == tcp->_rx_head && buffer_len >= tcp_RX_BUFFER_SIZE) {
+        int64_t len = _tcp_recv(tcp->_fd, buffer, buffer_len);
+        if (len < 0) {
+            _tcp_close(tcp);
+            return 0;
+        }
+        else if (len > 0) {
+            tcp->_last_recv_time = get_time_ms();
+        }
+        return (uint32_t)len;
+    }
+
+    _tcp_rx_fill(tcp, 1);
+    return _tcp_rx_take(tcp, buffer, buffer_len);
+}
+
+static uint32_t _tcp_read_exact(tcp_t *tcp, uint8_t *buffer, uint32_t len, uint32_t timeout_ms)
+{
+    uint32_t start = get_time_ms();
+    uint32_t total = 0;
+    while (total < len && _tcp_is_usable(tcp)) {
+        // Take what is buffered before reading more, a recv that finds the peer gone discards the buffer
+        total += _tcp_rx_take(tcp, buffer + total, len - total);
+        if (total < len && _tcp_rx_fill(tcp, len - total) == 0) {
+            if (tcp->_closed || _tcp_wait(tcp->_fd, 0, start, timeout_ms) <= 0) {
+                break;
+            }
+        }
+    }
+    return total;
+}
+
+static uint32_t _tcp_peek(tcp_t *tcp, uint8_t *buffer, uint32_t len)
+{
+    if (!_tcp_is_usable(tcp)) {
+        return 0;
+    }
+
+    uint32_t buffered = _tcp_rx_fill(tcp, len);
+    if (len > buffered) {
+        len = buffered;
+    }
+    if (len > 0) {
+        memcpy(buffer, tcp->_rx_buf + tcp->_rx_head, len);
+    }
+    return len;
+}
+
+static uint32_t _tcp_skip_until(tcp_t *tcp, uint8_t byte)
+{
+    if (!_tcp_is_usable(tcp)) {
+        return 0;
+    }
+
+    uint32_t buffered = _tcp_rx_fill(tcp, 1);
+    uint8_t *found = (buffered > 0) ? memchr(tcp->_rx_buf + tcp->_rx_head, byte, buffered) : NULL;
+    uint32_t skipped = (found != NULL) ? (uint32_t)(found - (tcp->_rx_buf + tcp->_rx_head)) : buffered;
+    tcp->_rx_head += skipped;
+    return skipped;
+}
+
+static uint32_t _tcp_readable(tcp_t *tcp)
+{
+    if (!_tcp_is_usable(tcp)) {
+        return 0;
+    }
+    return _tcp_rx_fill(tcp, 1);
 }
 
 tcp_server_t *tcp_server_create(uint32_t port)
@@ -105,10 +510,9 @@ tcp_server_t *tcp_server_create(uint32_t port)
         ESP_LOGE(SOCKET_TAG, "Unable to allocate memory for server");
         return NULL;
     }
-    server->_tcp._port = port;
-    server->_tcp._closed = 1;
-    char port_str[6];
-    snprintf(port_str, 6, "%lu", port);
+    _tcp_init(&server->_tcp, port);
+    char port_str[11];     // Fits any uint32_t
+    snprintf(port_str, sizeof(port_str), "%lu", (unsigned long)port);
 
     // Set the server address and port
     struct addrinfo hints = { .ai_socktype = SOCK_STREAM };
@@ -147,10 +551,10 @@ tcp_server_t *tcp_server_create(uint32_t port)
         tcp_server_free(server);
         return NULL;
     }
-    ESP_LOGI(SOCKET_TAG, "tcp bound, port %lu", port);
+    ESP_LOGI(SOCKET_TAG, "tcp bound, port %lu", (unsigned long)port);
  
     // Start listening
-    err = listen(server->_tcp._fd, 1);
+    err = listen(server->_tcp._fd, tcp_LISTEN_BACKLOG);
     if (err != 0) {
         ESP_LOGE(SOCKET_TAG, "Error occurred during listen: errno %d", errno);
         tcp_server_free(server);
@@ -173,19 +577,24 @@ tcp_connection_t *tcp_server_accept(tcp_server_t *server)
 
     struct sockaddr_storage source_addr;
     socklen_t addr_len = sizeof(source_addr);
-    connection->_tcp._closed = 1;
+    _tcp_init(&connection->_tcp, server->_tcp._port);
     connection->_tcp._fd = accept(server->_tcp._fd, (struct sockaddr *)&source_addr, &addr_len);
 
     if (connection->_tcp._fd < 0) {
         if (errno == EWOULDBLOCK) 
         {
             ESP_LOGV(SOCKET_TAG, "No pending connections...");
+            free(connection);
             return NULL;
         }
         ESP_LOGE(SOCKET_TAG, "Unable to accept connection: errno %s", esp_err_to_name(errno));
+        free(connection);
         return NULL;
     }
     connection->_tcp._closed = 0;
+    connection->_peer_ip = (source_addr.ss_family == AF_INET) ? ((struct sockaddr_in *)&source_addr)->sin_addr.s_addr : 0;
+    connection->_tcp._options = server->_tcp._options;
+    _tcp_apply_options(connection->_tcp._fd, &connection->_tcp._options);
 
     int flags = fcntl(connection->_tcp._fd, F_GETFL);
     if (fcntl(connection->_tcp._fd, F_SETFL, flags | O_NONBLOCK) == -1) {
@@ -195,7 +604,7 @@ tcp_connection_t *tcp_server_accept(tcp_server_t *server)
     }
 
     ESP_LOGI(SOCKET_TAG, "tcp accepted!");
-    connection->_last_recv_time = get_time_ms();
+    connection->_tcp._last_recv_time = get_time_ms();
     return connection;
 }
 
@@ -217,6 +626,7 @@ void tcp_server_free(tcp_server_t *server)
         tcp_server_close(server);
     }
 
+    _tcp_free_buffers(&server->_tcp);
     free(server);
 }
 
@@ -239,6 +649,15 @@ uint32_t tcp_server_get_port(tcp_server_t *server)
     return server->_tcp._port;
 }
 
+uint8_t tcp_server_set_options(tcp_server_t *server, const tcp_options_t *options)
+{
+    if (server == NULL || options == NULL) {
+        return 1;
+    }
+    server->_tcp._options = *options;
+    return server->_tcp._closed ? 0 : _tcp_apply_options(server->_tcp._fd, options);
+}
+
 uint8_t tcp_server_is_closed(tcp_server_t *server)
 {
     if (server == NULL) {
@@ -247,6 +666,113 @@ uint8_t tcp_server_is_closed(tcp_server_t *server)
     return server->_tcp._closed;
 }
 
+static void _tcp_wait_add(int32_t fd, fd_set *fdset, int32_t *max_fd)
+{
+    FD_SET(fd, fdset);
+    if (fd > *max_fd) {
+        *max_fd = fd;
+    }
+}
+
+int32_t tcp_server_wait(tcp_server_t *server, tcp_wait_t *wait, uint32_t timeout_ms)
+{
+    if (wait == NULL || (wait->count > 0 && (wait->connections == NULL || wait->ready == NULL))) {
+        return -1;
+    }
+
+    fd_set readset, writeset;
+    FD_ZERO(&readset);
+    FD_ZERO(&writeset);
+    int32_t max_fd = -1;
+    int32_t num_ready = 0;
+
+    wait->acceptable = 0;
+    wait->datagrams = 0;
+    wait->woken = 0;
+    if (server != NULL && !server->_tcp._closed) {
+        _tcp_wait_add(server->_tcp._fd, &readset, &max_fd);
+    }
+    if (wait->wake_fd > 0) {
+        _tcp_wait_add(wait->wake_fd, &readset, &max_fd);
+    }
+    int32_t udp_fd = udp_socket_get_fd(wait->udp);
+    if (udp_fd >= 0) {
+        _tcp_wait_add(udp_fd, &readset, &max_fd);
+    }
+
+    for (uint32_t i = 0; i < wait->count; i++) {
+        wait->ready[i] = 0;
+        tcp_connection_t *connection = wait->connections[i];
+        if (connection == NULL) {
+            continue;
+        }
+
+        // Nothing else reads a silent peer, so this is where it times out
+        tcp_t *tcp = &connection->_tcp;
+        if (!_tcp_is_usable(tcp)) {
+            wait->ready[i] = tcp_READY_CLOSED;
+            num_ready++;
+            continue;
+        }
+        if (tcp->_rx_tail > tcp->_rx_head) {
+            wait->ready[i] = tcp_READY_READABLE;
+            num_ready++;
+        }
+        _tcp_wait_add(tcp->_fd, &readset, &max_fd);
+        if (tcp->_tx_len > 0) {
+            _tcp_wait_add(tcp->_fd, &writeset, &max_fd);
+        }
+    }
+
+    if (max_fd < 0) {
+        return num_ready;
+    }
+
+    // Still poll the sockets when something is ready already, just without waiting
+    uint32_t wait_ms = (num_ready > 0) ? 0 : timeout_ms;
+    struct timeval timeout = { .tv_sec = wait_ms / 1000, .tv_usec = (wait_ms % 1000) * 1000 };
+    int res = select(max_fd + 1, &readset, &writeset, NULL, &timeout);
+    if (res < 0) {
+        ESP_LOGE(SOCKET_TAG, "Error occurred during select: errno %d", errno);
+        return -1;
+    }
+    if (res == 0) {
+        return num_ready;
+    }
+
+    if (server != NULL && !server->_tcp._closed && FD_ISSET(server->_tcp._fd, &readset)) {
+        wait->acceptable = 1;
+        num_ready++;
+    }
+    if (udp_fd >= 0 && FD_ISSET(udp_fd, &readset)) {
+        wait->datagrams = 1;
+        num_ready++;
+    }
+    if (wait->wake_fd > 0 && FD_ISSET(wait->wake_fd, &readset)) {
+        wait->woken = 1;
+        num_ready++;
+    }
+    for (uint32_t i = 0; i < wait->count; i++) {
+        tcp_connection_t *connection = wait->connections[i];
+        if (connection == NULL || wait->ready[i] & tcp_READY_CLOSED) {
+            continue;
+        }
+
+        uint8_t ready = wait->ready[i];
+        if (FD_ISSET(connection->_tcp._fd, &readset)) {
+            ready |= tcp_READY_READABLE;
+        }
+        if (FD_ISSET(connection->_tcp._fd, &writeset)) {
+            ready |= tcp_READY_WRITABLE;
+        }
+        if (ready && !wait->ready[i]) {
+            num_ready++;
+        }
+        wait->ready[i] = ready;
+    }
+    return num_ready;
+}
+
 uint32_t tcp_connection_send(tcp_connection_t *connection, uint8_t *buffer, uint32_t buffer_len)
 {
     if (connection == NULL) {
@@ -257,13 +783,13 @@ uint32_t tcp_connection_send(tcp_connection_t *connection, uint8_t *buffer, uint
         return 0;
     }
 
-    if (get_time_ms() - connection->_last_recv_time > tcp_TIMEOUT_MS) {
+    if (get_time_ms() - connection->_tcp._last_recv_time > tcp_TIMEOUT_MS) {
         ESP_LOGW(SOCKET_TAG, "Connection timeout");
         tcp_connection_close(connection);
         return 0;
     }
 
-    int64_t bytes_sent = _tcp_send(connection->_tcp._fd, buffer, buffer_len);
+    int64_t bytes_sent = _tcp_send(&connection->_tcp, buffer, buffer_len);
     if (bytes_sent < 0) {
         tcp_connection_close(connection);
         return 0;
@@ -271,32 +797,74 @@ uint32_t tcp_connection_send(tcp_connection_t *connection, uint8_t *buffer, uint
     return (uint32_t)bytes_sent;
 }
 
+uint32_t tcp_connection_flush(tcp_connection_t *connection, uint32_t timeout_ms)
+{
+    if (connection == NULL || connection->_tcp._closed) {
+        return 0;
+    }
+
+    if (_tcp_flush(&connection->_tcp, get_time_ms(), timeout_ms) < 0) {
+        tcp_connection_close(connection);
+        return 0;
+    }
+    return connection->_tcp._tx_len;
+}
+
+uint8_t tcp_connection_set_options(tcp_connection_t *connection, const tcp_options_t *options)
+{
+    if (connection == NULL || options == NULL) {
+        return 1;
+    }
+    connection->_tcp._options = *options;
+    return connection->_tcp._closed ? 0 : _tcp_apply_options(connection->_tcp._fd, options);
+}
+
+void tcp_connection_set_send_timeout(tcp_connection_t *connection, uint32_t timeout_ms)
+{
+    if (connection == NULL) {
+        return;
+    }
+    connection->_tcp._send_timeout_ms = timeout_ms;
+}
+
 uint32_t tcp_connection_recv(tcp_connection_t *connection, uint8_t *buffer, uint32_t buffer_len)
 {
     if (connection == NULL) {
         return 0;
     }
+    return _tcp_read(&connection->_tcp, buffer, buffer_len);
+}
 
-    if (connection->_tcp._closed) {
+uint32_t tcp_connection_recv_exact(tcp_connection_t *connection, uint8_t *buffer, uint32_t len, uint32_t timeout_ms)
+{
+    if (connection == NULL) {
         return 0;
     }
+    return _tcp_read_exact(&connection->_tcp, buffer, len, timeout_ms);
+}
 
-    if (get_time_ms() - connection->_last_recv_time > tcp_TIMEOUT_MS) {
-        ESP_LOGW(SOCKET_TAG, "Connection timeout");
-        tcp_connection_close(connection);
+uint32_t tcp_connection_peek(tcp_connection_t *connection, uint8_t *buffer, uint32_t len)
+{
+    if (connection == NULL) {
         return 0;
     }
+    return _tcp_peek(&connection->_tcp, buffer, len);
+}
 
-    int64_t bytes_read = _tcp_recv(connection->_tcp._fd, buffer, buffer_len);
-    if (bytes_read < 0) {
-        tcp_connection_close(connection);
+uint32_t tcp_connection_skip_until(tcp_connection_t *connection, uint8_t byte)
+{
+    if (connection == NULL) {
         return 0;
     }
-    else if (bytes_read == 0) {
+    return _tcp_skip_until(&connection->_tcp, byte);
+}
+
+uint32_t tcp_connection_readable(tcp_connection_t *connection)
+{
+    if (connection == NULL) {
         return 0;
     }
-    connection->_last_recv_time = get_time_ms();
-    return (uint32_t)bytes_read;
+    return _tcp_readable(&connection->_tcp);
 }
 
 void tcp_connection_close(tcp_connection_t *connection)
@@ -307,6 +875,14 @@ void tcp_connection_close(tcp_connection_t *connection)
     _tcp_close(&connection->_tcp);
 }
 
+uint32_t tcp_connection_get_peer_ip(tcp_connection_t *connection)
+{
+    if (connection == NULL) {
+        return 0;
+    }
+    return connection->_peer_ip;
+}
+
 uint8_t tcp_connection_is_closed(tcp_connection_t *connection)
 {
     if (connection == NULL) {
@@ -325,86 +901,112 @@ void tcp_connection_free(tcp_connection_t *connection)
         tcp_connection_close(connection);
     }
 
+    _tcp_free_buffers(&connection->_tcp);
     free(connection);
 }
 
-tcp_client_t *tcp_client_create(const char *host_ip, uint32_t port)
+tcp_client_t *tcp_client_init(const char *host_ip, uint32_t port)
 {
     tcp_client_t *client = (tcp_client_t *)malloc(sizeof(tcp_client_t));
     if (client == NULL) {
         ESP_LOGE(SOCKET_TAG, "Unable to allocate memory for client");
         return NULL;
     }
-    client->_tcp._port = port;
-    client->_tcp._closed = 1;
+    _tcp_init(&client->_tcp, port);
 
     struct addrinfo hints = { .ai_socktype = SOCK_STREAM };
     struct addrinfo *address_info;
 
-    char port_str[6];
-    snprintf(port_str, 6, "%lu", port);
+    char port_str[11];     // Fits any uint32_t
+    snprintf(port_str, sizeof(port_str), "%lu", (unsigned long)port);
     int res = getaddrinfo(host_ip, port_str, &hints, &address_info);
     if (res != 0 || address_info == NULL) {
         ESP_LOGE(SOCKET_TAG, "Unable to resolve hostname for `%s` getaddrinfo() returns %d, addrinfo=%p", host_ip, res, address_info);
-        goto error;
+        free(client);
+        return NULL;
     }
+    memcpy(&client->_addr, address_info->ai_addr, address_info->ai_addrlen);
+    client->_addr_len = address_info->ai_addrlen;
+    freeaddrinfo(address_info);
+    return client;
+}
 
-    client->_tcp._fd = socket(address_info->ai_family, address_info->ai_socktype, address_info->ai_protocol);
-    if (client->_tcp._fd < 0) {
+uint8_t tcp_client_connect(tcp_client_t *client, uint32_t timeout_ms)
+{
+    if (client == NULL) {
+        return 1;
+    }
+    if (client->_tcp._closed == 0) {
+        tcp_client_close(client);
+    }
+
+    int32_t fd = socket(client->_addr.ss_family, SOCK_STREAM, 0);
+    if (fd < 0) {
         ESP_LOGE(SOCKET_TAG, "Unable to create tcp: errno %d", errno);
-        goto error;
+        return 1;
     }
-    client->_tcp._closed = 0;
 
-    int flags = fcntl(client->_tcp._fd, F_GETFL);
-    if (fcntl(client->_tcp._fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+    // Before connecting, so the receive buffer already shapes the window in the handshake
+    _tcp_apply_options(fd, &client->_tcp._options);
+
+    int flags = fcntl(fd, F_GETFL);
+    if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
         ESP_LOGE(SOCKET_TAG, "Unable to set non-blocking: errno %d", errno);
         goto error;
     }
 
-    ESP_LOGI(SOCKET_TAG, "tcp created, connecting to %s:%lu", host_ip, port);
+    ESP_LOGI(SOCKET_TAG, "tcp created, connecting to port %lu", (unsigned long)client->_tcp._port);
 
-    // Connecting to the server
-    if (connect(client->_tcp._fd, address_info->ai_addr, address_info->ai_addrlen)) {
-        if (errno == EINPROGRESS) {
-            fd_set fdset;
-            FD_ZERO(&fdset);
-            FD_SET(client->_tcp._fd, &fdset);
+    // Connection in progress -> wait until the connecting socket is marked as writable, i.e. connection completes
+    if (connect(fd, (struct sockaddr *)&client->_addr, client->_addr_len)) {
+        if (errno != EINPROGRESS) {
+            ESP_LOGE(SOCKET_TAG, "tcp is unable to connect: errno %d", errno);
+            goto error;
+        }
 
-            // Connection in progress -> have to wait until the connecting socket is marked as writable, i.e. connection completes
-            res = select(client->_tcp._fd+1, NULL, &fdset, NULL, NULL);
-            if (res < 0) {
-                ESP_LOGE(SOCKET_TAG, "Error during connection: poll for tcp to be writable");
-                goto error;
-            } else if (res == 0) {
-                ESP_LOGE(SOCKET_TAG, "Connection timeout: poll for tcp to be writable");
-                goto error;
-            } else {
-                int sockerr;
-                socklen_t len = (socklen_t)sizeof(int);
-                if (getsockopt(client->_tcp._fd, SOL_SOCKET, SO_ERROR, (void*)(&sockerr), &len) < 0) {
-                    ESP_LOGE(SOCKET_TAG, "Error when getting tcp error using getsockopt()");
-                    goto error;
-                }
-                if (sockerr) {
-                    ESP_LOGE(SOCKET_TAG, "Connection error");
-                    goto error;
-                }
-            }
-        } else {
-            ESP_LOGE(SOCKET_TAG, "tcp is unable to connect");
+        int8_t res = _tcp_wait(fd, 1, get_time_ms(), timeout_ms);
+        if (res < 0) {
+            ESP_LOGE(SOCKET_TAG, "Error during connection: poll for tcp to be writable");
+            goto error;
+        } else if (res == 0) {
+            ESP_LOGW(SOCKET_TAG, "Connection timeout after %lu ms", (unsigned long)timeout_ms);
+            goto error;
+        }
+
+        int sockerr;
+        socklen_t len = (socklen_t)sizeof(int);
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, (void*)(&sockerr), &len) < 0) {
+            ESP_LOGE(SOCKET_TAG, "Error when getting tcp error using getsockopt()");
+            goto error;
+        }
+        if (sockerr) {
+            ESP_LOGW(SOCKET_TAG, "Connection error: %d", sockerr);
             goto error;
         }
     }
+
     ESP_LOGI(SOCKET_TAG, "Successfully connected");
-    free(address_info);
-    client->_last_recv_time = get_time_ms();
-    return client;
+    client->_tcp._fd = fd;
+    client->_tcp._closed = 0;
+    client->_tcp._last_recv_time = get_time_ms();
+    return 0;
 
     error:
+        close(fd);
+        return 1;
+}
+
+tcp_client_t *tcp_client_create(const char *host_ip, uint32_t port)
+{
+    tcp_client_t *client = tcp_client_init(host_ip, port);
+    if (client == NULL) {
+        return NULL;
+    }
+    if (tcp_client_connect(client, tcp_CONNECT_TIMEOUT_MS)) {
         tcp_client_free(client);
-        free(address_info);
         return NULL;
+    }
+    return client;
 }
 
 uint32_t tcp_client_send(tcp_client_t *client, uint8_t *buffer, uint32_t buffer_len)
@@ -417,13 +1019,13 @@ uint32_t tcp_client_send(tcp_client_t *client, uint8_t *buffer, uint32_t buffer_
         return 0;
     }
     
-    if (get_time_ms() - client->_last_recv_time > tcp_TIMEOUT_MS) {
+    if (get_time_ms() - client->_tcp._last_recv_time > tcp_TIMEOUT_MS) {
         ESP_LOGW(SOCKET_TAG, "Connection timeout");
         tcp_client_close(client);
         return 0;
     }
     
-    int64_t bytes_sent = _tcp_send(client->_tcp._fd, buffer, buffer_len);
+    int64_t bytes_sent = _tcp_send(&client->_tcp, buffer, buffer_len);
     if (bytes_sent < 0) {
         tcp_client_close(client);
         return 0;
@@ -431,32 +1033,117 @@ uint32_t tcp_client_send(tcp_client_t *client, uint8_t *buffer, uint32_t buffer_
     return (uint32_t)bytes_sent;
 }
 
-uint32_t tcp_client_recv(tcp_client_t *client, uint8_t *buffer, uint32_t buffer_len)
+uint32_t tcp_client_sendv(tcp_client_t *client, struct iovec *iov, int iovcnt)
 {
-    if (client == NULL) {
+    if (client == NULL || iov == NULL || iovcnt <= 0) {
         return 0;
     }
 
     if (client->_tcp._closed) {
         return 0;
     }
-    
-    if (get_time_ms() - client->_last_recv_time > tcp_TIMEOUT_MS) {
+
+    if (get_time_ms() - client->_tcp._last_recv_time > tcp_TIMEOUT_MS) {
         ESP_LOGW(SOCKET_TAG, "Connection timeout");
         tcp_client_close(client);
         return 0;
     }
-    
-    int64_t bytes_read = _tcp_recv(client->_tcp._fd, buffer, buffer_len);
-    if (bytes_read < 0) {
+
+    int64_t bytes_sent = _tcp_sendv(&client->_tcp, iov, iovcnt);
+    if (bytes_sent < 0) {
+        tcp_client_close(client);
+        return 0;
+    }
+    return (uint32_t)bytes_sent;
+}
+
+uint32_t tcp_client_flush(tcp_client_t *client, uint32_t timeout_ms)
+{
+    if (client == NULL || client->_tcp._closed) {
+        return 0;
+    }
+
+    if (_tcp_flush(&client->_tcp, get_time_ms(), timeout_ms) < 0) {
+        tcp_client_close(client);
+        return 0;
+    }
+    return client->_tcp._tx_len;
+}
+
+uint8_t tcp_client_set_options(tcp_client_t *client, const tcp_options_t *options)
+{
+    if (client == NULL || options == NULL) {
+        return 1;
+    }
+    client->_tcp._options = *options;
+    return client->_tcp._closed ? 0 : _tcp_apply_options(client->_tcp._fd, options);
+}
+
+void tcp_client_set_send_timeout(tcp_client_t *client, uint32_t timeout_ms)
+{
+    if (client == NULL) {
+        return;
+    }
+    client->_tcp._send_timeout_ms = timeout_ms;
+}
+
+uint8_t tcp_client_wait_readable(tcp_client_t *client, uint32_t timeout_ms)
+{
+    if (client == NULL || client->_tcp._closed) {
+        return 0;
+    }
+
+    // Data left in the RX buffer is readable whether or not the socket is
+    if (client->_tcp._rx_tail > client->_tcp._rx_head) {
+        return 1;
+    }
+
+    int8_t res = _tcp_wait(client->_tcp._fd, 0, get_time_ms(), timeout_ms);
+    if (res < 0) {
         tcp_client_close(client);
         return 0;
     }
-    else if (bytes_read == 0) {
+    return res > 0;
+}
+
+uint32_t tcp_client_recv(tcp_client_t *client, uint8_t *buffer, uint32_t buffer_len)
+{
+    if (client == NULL) {
+        return 0;
+    }
+    return _tcp_read(&client->_tcp, buffer, buffer_len);
+}
+
+uint32_t tcp_client_recv_exact(tcp_client_t *client, uint8_t *buffer, uint32_t len, uint32_t timeout_ms)
+{
+    if (client == NULL) {
+        return 0;
+    }
+    return _tcp_read_exact(&client->_tcp, buffer, len, timeout_ms);
+}
+
+uint32_t tcp_client_peek(tcp_client_t *client, uint8_t *buffer, uint32_t len)
+{
+    if (client == NULL) {
+        return 0;
+    }
+    return _tcp_peek(&client->_tcp, buffer, len);
+}
+
+uint32_t tcp_client_skip_until(tcp_client_t *client, uint8_t byte)
+{
+    if (client == NULL) {
+        return 0;
+    }
+    return _tcp_skip_until(&client->_tcp, byte);
+}
+
+uint32_t tcp_client_readable(tcp_client_t *client)
+{
+    if (client == NULL) {
         return 0;
     }
-    client->_last_recv_time = get_time_ms();
-    return (uint32_t)bytes_read;
+    return _tcp_readable(&client->_tcp);
 }
 
 void tcp_client_close(tcp_client_t *client)
@@ -477,6 +1164,7 @@ void tcp_client_free(tcp_client_t *client)
         tcp_client_close(client);
     }
 
+    _tcp_free_buffers(&client->_tcp);
     free(client);
 }
 
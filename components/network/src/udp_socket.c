@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include "esp_log.h"
+#include "lwip/err.h"
+#include "lwip/sockets.h"
+#include "lwip/sys.h"
+#include "lwip/netdb.h"
+
+#include "common.h"
+
+#include "udp_socket.h"
+
+const char *UDP_SOCKET_TAG = "udps";
+
+struct udp_socket_t 
+{   int32_t _fd;
+    int32_t _port;
+    uint8_t _closed;
+};
+
+udp_socket_t *udp_socket_create(uint32_t port)
+{
+    udp_socket_t *sock = (udp_socket_t *)malloc(sizeof(udp_socket_t));
+    if (sock == NULL) {
+        ESP_LOGE(UDP_SOCKET_TAG, "Unable to allocate memory for udp socket");
+        return NULL;
+    }
+    sock->_port = port;
+    sock->_closed = 1;
+
+    sock->_fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock->_fd < 0) {
+        ESP_LOGE(UDP_SOCKET_TAG, "Unable to create udp socket: errno %d", errno);
+        udp_socket_free(sock);
+        return NULL;
+    }
+    sock->_closed = 0;
+
+    int flags = fcntl(sock->_fd, F_GETFL);
+    if (fcntl(sock->_fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        ESP_LOGE(UDP_SOCKET_TAG, "Unable to set non-blocking: errno %d", errno);
+        udp_socket_free(sock);
+        return NULL;
+    }
+
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_ANY) };
+    if (bind(sock->_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        ESP_LOGE(UDP_SOCKET_TAG, "udp socket unable to bind: errno %d", errno);
+        udp_socket_free(sock);
+        return NULL;
+    }
+
+    // Find out which port was picked when binding to any
+    socklen_t addr_len = sizeof(addr);
+    if (getsockname(sock->_fd, (struct sockaddr *)&addr, &addr_len) == 0) {
+        sock->_port = ntohs(addr.sin_port);
+    }
+    ESP_LOGI(UDP_SOCKET_TAG, "udp socket bound, port %lu", (unsigned long)sock->_port);
+    return sock;
+}
+
+uint8_t udp_socket_set_peer(udp_socket_t *sock, const char *host_ip, uint32_t port)
+{
+    if (sock == NULL || sock->_closed) {
+        return 1;
+    }
+
+    struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_DGRAM };
+    struct addrinfo *address_info;
+
+    char port_str[11];     // Fits any uint32_t
+    snprintf(port_str, sizeof(port_str), "%lu", (unsigned long)port);
+    int res = getaddrinfo(host_ip, port_str, &hints, &address_info);
+    if (res != 0 || address_info == NULL) {
+        ESP_LOGE(UDP_SOCKET_TAG, "Unable to resolve hostname for `%s` getaddrinfo() returns %d, addrinfo=%p", host_ip, res, address_info);
+        return 1;
+    }
+
+    // A connected udp socket sends to its peer without an address per datagram
+    res = connect(sock->_fd, address_info->ai_addr, address_info->ai_addrlen);
+    freeaddrinfo(address_info);
+    if (res != 0) {
+        ESP_LOGE(UDP_SOCKET_TAG, "Unable to set udp peer: errno %d", errno);
+        return 1;
+    }
+    ESP_LOGI(UDP_SOCKET_TAG, "udp peer set to %s:%lu", host_ip, (unsigned long)port);
+    return 0;
+}
+
+uint32_t udp_socket_sendv(udp_socket_t *sock, struct iovec *iov, int iovcnt)
+{
+    if (sock == NULL || iov == NULL || iovcnt <= 0) {
+        return 0;
+    }
+
+    if (sock->_closed) {
+        return 0;
+    }
+
+    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = iovcnt };
+    int written = sendmsg(sock->_fd, &msg, 0);
+    if (written < 0) {
+        // Out of buffers or nobody listening yet, the datagram is simply lost
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOMEM && errno != ECONNREFUSED) {
+            ESP_LOGE(UDP_SOCKET_TAG, "Error occurred during sending: errno %d", errno);
+        }
+        return 0;
+    }
+    return (uint32_t)written;
+}
+
+uint8_t udp_socket_wait_readable(udp_socket_t *sock, uint32_t timeout_ms)
+{
+    if (sock == NULL || sock->_closed) {
+        return 0;
+    }
+
+    fd_set fdset;
+    FD_ZERO(&fdset);
+    FD_SET(sock->_fd, &fdset);
+    struct timeval timeout = { .tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000 };
+
+    int res = select(sock->_fd + 1, &fdset, NULL, NULL, &timeout);
+    if (res < 0) {
+        ESP_LOGE(UDP_SOCKET_TAG, "Error occurred during select: errno %d", errno);
+        return 0;
+    }
+    return res > 0;
+}
+
+uint32_t udp_socket_recv(udp_socket_t *sock, uint8_t *buffer, uint32_t buffer_len, uint32_t *source_ip)
+{
+    if (sock == NULL || buffer == NULL) {
+        return 0;
+    }
+
+    if (sock->_closed) {
+        return 0;
+    }
+
+    struct sockaddr_in source_addr;
+    socklen_t addr_len = sizeof(source_addr);
+    int len = recvfrom(sock->_fd, buffer, buffer_len, 0, (struct sockaddr *)&source_addr, &addr_len);
+    if (len < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNREFUSED) {
+            ESP_LOGE(UDP_SOCKET_TAG, "Error occurred during receiving: errno %d", errno);
+        }
+        return 0;
+    }
+
+    if (source_ip != NULL) {
+        *source_ip = (source_addr.sin_family == AF_INET) ? source_addr.sin_addr.s_addr : 0;
+    }
+    return (uint32_t)len;
+}
+
+uint32_t udp_socket_get_port(udp_socket_t *sock)
+{
+    if (sock == NULL) {
+        return 0;
+    }
+    return sock->_port;
+}
+
+int32_t udp_socket_get_fd(udp_socket_t *sock)
+{
+    if (sock == NULL || sock->_closed) {
+        return -1;
+    }
+    return sock->_fd;
+}
+
+void udp_socket_close(udp_socket_t *sock)
+{
+    if (sock == NULL) {
+        return;
+    }
+    close(sock->_fd);
+    sock->_closed = 1;
+}
+
+void udp_socket_free(udp_socket_t *sock)
+{
+    if (sock == NULL) {
+        return;
+    }
+
+    if (sock->_closed == 0) {
+        udp_socket_close(sock);
+    }
+
+    free(sock);
+}
+
+uint8_t udp_socket_is_closed(udp_socket_t *sock)
+{
+    if (sock == NULL) {
+        return 1;
+    }
+    return sock->_closed;
+}
@@ -0,0 +1,60 @@
+/**
+ * @file profiling.h
+ * @brief Periodic task, stack and heap diagnostics.
+ *
+ * A low priority reporter samples every task's share of CPU time since the previous sample
+ * and the unused part of its stack, plus the heap's free space, lowest free space since boot
+ * and largest free block. Snapshots are logged or handed to a sink as a serial_diagnostics_t.
+ *
+ * CPU shares need CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS and the per task entries need
+ * CONFIG_FREERTOS_USE_TRACE_FACILITY, without them only the heap is reported.
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "lcm_types.h"
+
+#define PROFILING_MAX_TASKS             32                  /**< With more tasks only the heap is reported */
+#define PROFILING_MAX_LEN               (sizeof(serial_diagnostics_t) + PROFILING_MAX_TASKS * sizeof(serial_task_stats_t))
+
+#define PROFILING_REPORTER_STACK_SIZE   4096
+#define PROFILING_REPORTER_PRIORITY     1                   /**< Just above idle, below every data path task */
+
+/**
+ * @brief Callback that receives a serialized diagnostics snapshot from the reporter task.
+ *
+ * @param data Pointer to a serial_diagnostics_t followed by num_tasks serial_task_stats_t entries.
+ * @param len The length of the snapshot in bytes.
+ * @param ctx The context pointer passed to profiling_reporter_start.
+ */
+typedef void (*profiling_sink_t)(uint8_t *data, uint16_t len, void *ctx);
+
+/**
+ * @brief Takes a diagnostics snapshot.
+ *
+ * CPU shares are measured since the previous call, the first call measures since boot.
+ * Not thread safe, called from the reporter task once it is started.
+ *
+ * @param buffer The buffer to write the snapshot into.
+ * @param buffer_len The length of the buffer, PROFILING_MAX_LEN fits every entry.
+ * @return The number of bytes written. Tasks that do not fit are dropped.
+ */
+uint16_t profiling_sample(uint8_t *buffer, uint16_t buffer_len);
+
+/**
+ * @brief Starts the profiling reporter task.
+ *
+ * @param period_ms The reporting period in milliseconds.
+ * @param sink The sink to send snapshots to, or NULL to log them.
+ * @param ctx An optional context pointer passed to the sink.
+ * @return 0 if successful, non-zero otherwise.
+ */
+uint8_t profiling_reporter_start(uint32_t period_ms, profiling_sink_t sink, void *ctx);
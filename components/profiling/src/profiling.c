@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+
+#include "lcm_types.h"
+
+#include "profiling.h"
+
+#define PROFILING_TAG "PROFILING"
+
+typedef struct profiling_reporter_args_t {
+    uint32_t period_ms;
+    profiling_sink_t sink;
+    void *ctx;
+} profiling_reporter_args_t;
+
+/**
+ * @brief Run time counter of a task at the previous sample.
+ */
+typedef struct profiling_last_t {
+    UBaseType_t task_number;
+    uint32_t run_time;
+} profiling_last_t;
+
+static profiling_reporter_args_t reporter_args;
+
+#if configUSE_TRACE_FACILITY
+static TaskStatus_t task_status[PROFILING_MAX_TASKS];
+static profiling_last_t last[PROFILING_MAX_TASKS];
+static UBaseType_t num_last = 0;
+static uint32_t last_total_run_time = 0;
+
+/**
+ * @brief Gets a task's run time counter at the previous sample, 0 for a task started since.
+ */
+static uint32_t _profiling_last_run_time(UBaseType_t task_number)
+{
+    for (UBaseType_t i = 0; i < num_last; i++)
+    {
+        if (last[i].task_number == task_number)
+        {
+            return last[i].run_time;
+        }
+    }
+    return 0;
+}
+#endif
+
+uint16_t profiling_sample(uint8_t *buffer, uint16_t buffer_len)
+{
+    if (buffer == NULL || buffer_len < sizeof(serial_diagnostics_t))
+    {
+        return 0;
+    }
+
+    serial_diagnostics_t *snapshot = (serial_diagnostics_t *)buffer;
+    snapshot->utime = esp_timer_get_time();
+    snapshot->period_us = 0;
+    snapshot->heap_free = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    snapshot->heap_min_free = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+    snapshot->heap_largest_block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    snapshot->num_tasks = 0;
+    uint16_t len = sizeof(serial_diagnostics_t);
+
+#if configUSE_TRACE_FACILITY
+    uint32_t total_run_time = 0;
+    UBaseType_t num_tasks = uxTaskGetSystemState(task_status, PROFILING_MAX_TASKS, &total_run_time);
+    if (num_tasks == 0)
+    {
+        ESP_LOGW(PROFILING_TAG, "More than %d tasks, only reporting the heap", PROFILING_MAX_TASKS);
+    }
+    uint32_t period = total_run_time - last_total_run_time;
+#if configGENERATE_RUN_TIME_STATS
+    // The run time clock is esp_timer's, in microseconds
+    snapshot->period_us = period;
+#endif
+
+    for (UBaseType_t i = 0; i < num_tasks; i++)
+    {
+        if (len + sizeof(serial_task_stats_t) > buffer_len)
+        {
+            break;
+        }
+
+        TaskStatus_t *status = &task_status[i];
+        // Zeroed, so names are terminated even when cut to fit
+        serial_task_stats_t entry = {0};
+        strncpy(entry.name, status->pcTaskName, sizeof(entry.name) - 1);
+        entry.priority = status->uxCurrentPriority;
+        entry.state = status->eCurrentState;
+        entry.stack_free = status->usStackHighWaterMark * sizeof(StackType_t);
+        if (period > 0)
+        {
+            uint64_t used = status->ulRunTimeCounter - _profiling_last_run_time(status->xTaskNumber);
+            entry.cpu_permille = (uint16_t)(used * 1000 / period);
+        }
+
+        memcpy(buffer + len, &entry, sizeof(serial_task_stats_t));
+        len += sizeof(serial_task_stats_t);
+        snapshot->num_tasks++;
+    }
+
+    for (UBaseType_t i = 0; i < num_tasks; i++)
+    {
+        last[i].task_number = task_status[i].xTaskNumber;
+        last[i].run_time = task_status[i].ulRunTimeCounter;
+    }
+    num_last = num_tasks;
+    last_total_run_time = total_run_time;
+#endif
+    return len;
+}
+
+/**
+ * @brief Logs a snapshot.
+ */
+static void _profiling_log(const serial_diagnostics_t *snapshot)
+{
+    ESP_LOGI(PROFILING_TAG, "heap: %lu free, %lu min free, %lu largest block", (unsigned long)snapshot->heap_free,
+             (unsigned long)snapshot->heap_min_free, (unsigned long)snapshot->heap_largest_block);
+    for (uint8_t i = 0; i < snapshot->num_tasks; i++)
+    {
+        const serial_task_stats_t *task = &snapshot->tasks[i];
+        ESP_LOGI(PROFILING_TAG, "%-16.16s prio %2d cpu %5.1f%% stack free %lu", task->name, task->priority,
+                 task->cpu_permille / 10.0f, (unsigned long)task->stack_free);
+    }
+}
+
+static void _profiling_reporter_task(void *args)
+{
+    profiling_reporter_args_t *reporter = (profiling_reporter_args_t *)args;
+    uint8_t *buffer = (uint8_t *)malloc(PROFILING_MAX_LEN);
+    if (buffer == NULL)
+    {
+        ESP_LOGE(PROFILING_TAG, "Failed to allocate diagnostics buffer");
+        vTaskDelete(NULL);
+    }
+
+    // Start the first period now rather than at boot
+    profiling_sample(buffer, PROFILING_MAX_LEN);
+
+    TickType_t xLastWakeTime = xTaskGetTickCount();
+    while (true)
+    {
+        xTaskDelayUntil(&xLastWakeTime, reporter->period_ms / portTICK_PERIOD_MS);
+
+        uint16_t len = profiling_sample(buffer, PROFILING_MAX_LEN);
+        if (reporter->sink == NULL)
+        {
+            _profiling_log((serial_diagnostics_t *)buffer);
+            continue;
+        }
+        reporter->sink(buffer, len, reporter->ctx);
+    }
+}
+
+uint8_t profiling_reporter_start(uint32_t period_ms, profiling_sink_t sink, void *ctx)
+{
+    if (period_ms == 0)
+    {
+        ESP_LOGE(PROFILING_TAG, "Invalid reporting period");
+        return 1;
+    }
+
+    reporter_args.period_ms = period_ms;
+    reporter_args.sink = sink;
+    reporter_args.ctx = ctx;
+
+    BaseType_t err = xTaskCreate(_profiling_reporter_task, "profiling_task", PROFILING_REPORTER_STACK_SIZE, &reporter_args, PROFILING_REPORTER_PRIORITY, NULL);
+    if (err != pdPASS)
+    {
+        ESP_LOGE(PROFILING_TAG, "Failed to create profiling reporter task");
+        return 1;
+    }
+    return 0;
+}
@@ -21,6 +21,11 @@ enum message_topics {
     MBOT_VEL = 234,
     MBOT_LIDAR_SCAN = 240,
     MBOT_CAMERA_FRAME = 241,
+    MBOT_METRICS = 242,
+    MBOT_TOPIC_RATE = 243,
+    MBOT_LIDAR_SUMMARY = 244,
+    MBOT_TELEMETRY = 245,
+    MBOT_DIAGNOSTICS = 246,
     MBOT_ERROR = 250,
 };
 
@@ -149,10 +154,22 @@ typedef struct __attribute__((__packed__)) serial_mbot_slam_reset_t {
 } serial_mbot_slam_reset_t;
 
 typedef struct __attribute__((__packed__)) serial_lidar_scan_t {
-    int64_t utime;
+    int64_t utime; // time the revolution completed
     uint16_t ranges[360];
+    uint32_t seq; // revolution counter, gaps mean revolutions were skipped
 } serial_lidar_scan_t;
 
+// Nearest obstacles of a lidar revolution, a compact stand-in for serial_lidar_scan_t
+typedef struct __attribute__((__packed__)) serial_lidar_summary_t {
+    int64_t utime; // time the revolution completed
+    uint32_t seq; // revolution counter, matches the full scan's
+    uint16_t nearest_range; // mm, 0 if there is no return
+    uint16_t nearest_bearing; // degrees
+    uint16_t sector_min[16]; // nearest return per 22.5 degree sector starting at 0 degrees, mm, 0 if none
+    uint8_t downsample_step; // degrees per point that follows, 0 if no points follow
+    uint16_t points[0]; // 360 / downsample_step nearest returns, mm
+} serial_lidar_summary_t;
+
 typedef struct __attribute__((__packed__)) serial_camera_frame_t {
     int64_t utime;
     uint16_t width;
@@ -166,6 +183,74 @@ typedef struct __attribute__((__packed__)) serial_mbot_error_t {
     uint16_t error_code;
 } serial_mbot_error_t;
 
+// Sent by the host to a node to throttle a topic the node forwards to the host, consumed by the node
+typedef struct __attribute__((__packed__)) serial_topic_rate_t {
+    uint16_t topic; // topic to configure, 0 restores the defaults of every topic
+    uint8_t enabled; // 0 drops the topic entirely
+    uint8_t decimation; // forward every nth message, 0 and 1 forward all
+    uint16_t min_period_ms; // minimum time between forwarded messages, 0 for no limit
+} serial_topic_rate_t;
+
+// Bits of serial_telemetry_t's valid and fresh masks, one per mbot message
+enum telemetry_fields {
+    TELEMETRY_ENCODERS = 1 << 0,
+    TELEMETRY_ODOMETRY = 1 << 1,
+    TELEMETRY_IMU = 1 << 2,
+    TELEMETRY_MBOT_VEL = 1 << 3,
+    TELEMETRY_MOTOR_VEL = 1 << 4,
+    TELEMETRY_MOTOR_PWM = 1 << 5,
+};
+
+// Latest mbot messages at one tick of a node, sent instead of the individual topics when the node's telemetry mux is on
+typedef struct __attribute__((__packed__)) serial_telemetry_t {
+    int64_t utime; // time of the tick
+    uint32_t seq; // tick counter, gaps mean ticks without new messages
+    uint8_t valid; // telemetry_fields holding a message
+    uint8_t fresh; // telemetry_fields received since the previous tick
+    serial_mbot_encoders_t encoders;
+    serial_pose2D_t odom;
+    serial_mbot_imu_t imu;
+    serial_twist2D_t mbot_vel;
+    serial_mbot_motor_vel_t motor_vel;
+    serial_mbot_motor_pwm_t motor_pwm;
+    uint8_t num_imu; // IMU samples that follow, oldest first, 0 unless the node batches IMU
+    serial_mbot_imu_t imu_batch[0];
+} serial_telemetry_t;
+
+typedef struct __attribute__((__packed__)) serial_task_stats_t {
+    char name[16];
+    uint8_t priority;
+    uint8_t state; // running=0, ready=1, blocked=2, suspended=3, deleted=4
+    uint16_t cpu_permille; // share of one core's time since the previous snapshot, tasks sum to cores * 1000
+    uint32_t stack_free; // bytes of stack never used since the task started
+} serial_task_stats_t;
+
+// Task and heap diagnostics of a node or the command link, sent every few seconds
+typedef struct __attribute__((__packed__)) serial_diagnostics_t {
+    int64_t utime;
+    uint32_t period_us; // time the CPU shares were measured over, 0 if run time stats are off
+    uint32_t heap_free; // bytes
+    uint32_t heap_min_free; // lowest heap_free since boot
+    uint32_t heap_largest_block; // largest block that can be allocated, far below heap_free means fragmentation
+    uint8_t num_tasks;
+    serial_task_stats_t tasks[0];
+} serial_diagnostics_t;
+
+typedef struct __attribute__((__packed__)) serial_metric_t {
+    char name[16];
+    uint8_t type; // counter=0, gauge=1, histogram=2
+    uint32_t count; // counter total, gauge value, histogram sample count
+    uint32_t p50; // histograms only
+    uint32_t p99; // histograms only
+    uint32_t max; // histograms only
+} serial_metric_t;
+
+typedef struct __attribute__((__packed__)) serial_metrics_t {
+    int64_t utime;
+    uint8_t num_entries;
+    serial_metric_t entries[0];
+} serial_metrics_t;
+
 void pose2D_t_deserialize(uint8_t* src, serial_pose2D_t* dest);
 void pose2D_t_serialize(serial_pose2D_t* src, uint8_t* dest);
 void mbot_motor_vel_t_deserialize(uint8_t* src, serial_mbot_motor_vel_t* dest);
@@ -13,6 +13,7 @@
 #define ROS_HEADER_LEN  7
 #define ROS_FOOTER_LEN  1
 #define ROS_PKG_LEN     (ROS_HEADER_LEN + ROS_FOOTER_LEN)
+#define DATAGRAM_HEADER_LEN 4   // Little endian sequence number in front of every ROS packet sent over UDP
 
 typedef struct __attribute__((__packed__)) packets_wrapper {
     serial_mbot_encoders_t encoders;
@@ -25,6 +26,8 @@ typedef struct __attribute__((__packed__)) packets_wrapper {
 
 uint8_t checksum(uint8_t* addends, int len);
 void encode_rospkt(uint8_t* data, uint16_t len, uint16_t topic, uint8_t* pkt);
+// Same as encode_rospkt for a message already written at pkt + ROS_HEADER_LEN
+void encode_rospkt_inplace(uint16_t len, uint16_t topic, uint8_t* pkt);
 int decode_rospkt(uint8_t* pkt, uint8_t* data, uint16_t* len, uint16_t* topic);
 void encode_botpkt(packets_wrapper_t* data, uint8_t* mac, uint8_t* pkt);
 int decode_botpkt(uint8_t* pkt, packets_wrapper_t* data, uint8_t* mac);
@@ -141,6 +141,11 @@ void mbot_error_t_serialize(serial_mbot_error_t* src, uint8_t* dest) {
 }
 
 void encode_rospkt(uint8_t* data, uint16_t len, uint16_t topic, uint8_t* pkt) {
+    memcpy(pkt+7, data, len);
+    encode_rospkt_inplace(len, topic, pkt);
+}
+
+void encode_rospkt_inplace(uint16_t len, uint16_t topic, uint8_t* pkt) {
     // CREATE ROS PACKET
     //for ROS protocol and packet format see link: http://wiki.ros.org/rosserial/Overview/Protocol
     pkt[0] = SYNC_FLAG;
@@ -153,20 +158,8 @@ void encode_rospkt(uint8_t* data, uint16_t len, uint16_t topic, uint8_t* pkt) {
     pkt[5] = (uint8_t) (topic & 0xFF); //message topic lower 8/16b via modulus and cast
     pkt[6] = (uint8_t) (topic >> 8); //message length higher 8/16b via bitshift and cast
 
-    // for (int i = 0; i<len; i++) { //write message bytes
-    //     pkt[i+7] = data[i];
-    // }
-    memcpy(pkt+7, data, len);
-    
-    uint8_t cs2_addends[len+2]; //create array for the checksum over topic and message content
-    cs2_addends[0] = pkt[5];
-    cs2_addends[1] = pkt[6];
-    // for (int i = 0; i<len; i++) {
-    //     cs2_addends[i+2] = data[i];
-    // }
-    memcpy(cs2_addends+2, data, len);
-
-    pkt[len+ROS_PKG_LEN-1] = checksum(cs2_addends, len+2); //checksum over message data and topic
+    // topic and message are contiguous, so the checksum can be taken in place
+    pkt[len+ROS_PKG_LEN-1] = checksum(pkt+5, len+2); //checksum over message data and topic
 }
 
 int decode_rospkt(uint8_t* pkt, uint8_t* data, uint16_t* len, uint16_t* topic) {
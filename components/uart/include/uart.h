@@ -101,6 +101,20 @@ uint32_t uart_write_string(uart_t *uart, char *data);
  */
 uint32_t uart_read(uart_t *uart, uint8_t *data, uint32_t len, uint32_t timeout_ms);
 
+/**
+ * @brief Waits for data on the UART port and reads whatever has arrived.
+ *
+ * Blocks until at least one byte is received or the timeout expires, then returns everything
+ * buffered so far without waiting for the rest of len.
+ *
+ * @param uart A pointer to the UART structure.
+ * @param data A pointer to the buffer to store the read data.
+ * @param len The maximum number of bytes to read.
+ * @param timeout_ms The maximum time to wait for the first byte in milliseconds.
+ * @return The number of bytes read, 0 on timeout.
+ */
+uint32_t uart_read_available(uart_t *uart, uint8_t *data, uint32_t len, uint32_t timeout_ms);
+
 /**
  * @brief Reads a single byte from the UART port.
  *
@@ -136,6 +136,27 @@ uint32_t uart_read(uart_t *uart, uint8_t *data, uint32_t len, uint32_t timeout_m
     return bytes_read;
 }
 
+uint32_t uart_read_available(uart_t *uart, uint8_t *data, uint32_t len, uint32_t timeout_ms) {
+    if (uart == NULL || len == 0) {
+        return 0;
+    }
+
+    // The driver blocks on its RX ring buffer, so this sleeps until the first byte arrives
+    uint32_t bytes_read = uart_read(uart, data, 1, timeout_ms);
+    if (bytes_read == 0) {
+        return 0;
+    }
+
+    uint32_t waiting = uart_in_waiting(uart);
+    if (waiting > len - 1) {
+        waiting = len - 1;
+    }
+    if (waiting > 0) {
+        bytes_read += uart_read(uart, data + 1, waiting, 0);
+    }
+    return bytes_read;
+}
+
 uint8_t uart_read_byte(uart_t *uart, uint8_t *data) {
     if (uart == NULL) {
         return 0;
@@ -21,6 +21,9 @@ typedef struct usb_device_t usb_device_t;
 /**
  * @brief Creates a new USB device.
  *
+ * The first device is bound to CDC-ACM interface 0 and the second to interface 1, so two
+ * independent serial ports can be exposed to the host (requires CONFIG_TINYUSB_CDC_COUNT=2).
+ *
  * @return A pointer to the newly created USB device.
  */
 usb_device_t *usb_device_create(void);
@@ -23,6 +23,7 @@ struct usb_device_t
 
 usb_device_t usb_devs[2];
 uint8_t usb_dev_count = 0;
+uint8_t usb_driver_installed = 0;
 
 void _usb_device_rx_cb(int itf, cdcacm_event_t *event)
 {
@@ -54,17 +55,23 @@ usb_device_t *usb_device_create(void)
 
     usb_device_t *dev = &usb_devs[usb_dev_count++];
 
-    const tinyusb_config_t tusb_cfg = {
-        .device_descriptor = NULL,
-        .string_descriptor = NULL,
-        .external_phy = false,
-        .configuration_descriptor = NULL,
-    };
-    esp_err_t err = tinyusb_driver_install(&tusb_cfg);
-    if (err != ESP_OK)
-    {
-        ESP_LOGE("USB", "Failed to install tinyusb driver. Error: %s", esp_err_to_name(err));
-        return NULL;
+    // The driver is shared by both CDC-ACM interfaces and can only be installed once
+    esp_err_t err;
+    if (!usb_driver_installed)
+    {
+        const tinyusb_config_t tusb_cfg = {
+            .device_descriptor = NULL,
+            .string_descriptor = NULL,
+            .external_phy = false,
+            .configuration_descriptor = NULL,
+        };
+        err = tinyusb_driver_install(&tusb_cfg);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE("USB", "Failed to install tinyusb driver. Error: %s", esp_err_to_name(err));
+            return NULL;
+        }
+        usb_driver_installed = 1;
     }
 
     dev->_tx_lock = xSemaphoreCreateBinary();
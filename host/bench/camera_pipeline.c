@@ -0,0 +1,165 @@
+/**
+ * @file camera_pipeline.c
+ * @brief Compares sequential and pipelined camera streaming on the host.
+ *
+ * Runs the firmware's camera_source.c and camera_stream.c on top of the host shims. The sink
+ * stands in for the node's send path: it holds each frame for as long as the link would need
+ * to transmit it. The sequential run grabs, sends and releases one frame at a time from a
+ * single frame buffer, like the old camera_task. The pipelined run uses camera_stream with
+ * three frame buffers so the sensor keeps capturing while a frame is being sent.
+ *
+ * Usage: camera_pipeline [-p capture ms] [-s frame bytes] [-b link kB/s] [-d seconds] [-f jpeg file]
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+
+#include "camera_source.h"
+#include "camera_stream.h"
+
+#define BENCH_MAX_FRAMES        100000
+
+typedef struct bench_sink_t {
+    uint32_t frames;
+    uint64_t bytes;
+    uint32_t out_of_order;
+    uint32_t last_seq;
+    uint32_t ages_us[BENCH_MAX_FRAMES];
+} bench_sink_t;
+
+static uint32_t capture_ms = 33;
+static uint32_t frame_len = 12000;
+static uint32_t link_kbps = 400;
+static uint32_t duration_s = 3;
+static const char *file_path = NULL;
+
+static int _compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static camera_source_t *_create_source(uint8_t fb_count) {
+    if (file_path != NULL) {
+        return camera_source_file_create(file_path, 320, 240, capture_ms);
+    }
+    return camera_source_synthetic_create(320, 240, frame_len, capture_ms, fb_count);
+}
+
+static void _sink(const camera_frame_t *frame, void *ctx) {
+    bench_sink_t *sink = (bench_sink_t *)ctx;
+
+    // Synthetic frames start with their sequence number, file frames carry none
+    if (file_path == NULL) {
+        uint32_t seq;
+        memcpy(&seq, frame->buf, sizeof(seq));
+        if (sink->frames > 0 && seq <= sink->last_seq) {
+            sink->out_of_order++;
+        }
+        sink->last_seq = seq;
+    }
+
+    usleep((uint64_t)frame->len * 1000 / link_kbps);
+    if (sink->frames < BENCH_MAX_FRAMES) {
+        sink->ages_us[sink->frames] = (uint32_t)(esp_timer_get_time() - frame->utime);
+    }
+    sink->frames++;
+    sink->bytes += frame->len;
+}
+
+static void _report(const char *name, bench_sink_t *sink, uint32_t dropped) {
+    uint32_t n = (sink->frames < BENCH_MAX_FRAMES) ? sink->frames : BENCH_MAX_FRAMES;
+    qsort(sink->ages_us, n, sizeof(uint32_t), _compare_u32);
+    printf("%-12s %6.1f frames/s  %7.1f kB/s  age p50 %5u us  p99 %6u us  dropped %u  out of order %u\n",
+           name, (double)sink->frames / duration_s, (double)sink->bytes / 1000 / duration_s,
+           n ? sink->ages_us[n / 2] : 0, n ? sink->ages_us[n * 99 / 100] : 0, dropped, sink->out_of_order);
+}
+
+static void _run_sequential(bench_sink_t *sink) {
+    camera_source_t *source = _create_source(1);
+    if (source == NULL) {
+        fprintf(stderr, "failed to create source\n");
+        exit(1);
+    }
+
+    int64_t end = esp_timer_get_time() + (int64_t)duration_s * 1000000;
+    while (esp_timer_get_time() < end) {
+        camera_frame_t frame;
+        if (camera_source_grab(source, &frame, CAMERA_STREAM_GRAB_TIMEOUT_MS)) {
+            continue;
+        }
+        _sink(&frame, sink);
+        camera_source_release(source, &frame);
+    }
+    camera_source_free(source);
+    _report("sequential", sink, 0);
+}
+
+static void _run_pipelined(bench_sink_t *sink) {
+    camera_source_t *source = _create_source(3);
+    if (source == NULL) {
+        fprintf(stderr, "failed to create source\n");
+        exit(1);
+    }
+
+    camera_stream_t *stream = camera_stream_start(source, _sink, sink, 0);
+    if (stream == NULL) {
+        fprintf(stderr, "failed to start stream\n");
+        exit(1);
+    }
+    sleep(duration_s);
+
+    camera_stream_stats_t stats;
+    camera_stream_get_stats(stream, &stats);
+    camera_stream_stop(stream);
+    camera_source_free(source);
+    _report("pipelined", sink, stats.dropped);
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "p:s:b:d:f:")) != -1) {
+        switch (opt) {
+        case 'p':
+            capture_ms = atoi(optarg);
+            break;
+        case 's':
+            frame_len = atoi(optarg);
+            break;
+        case 'b':
+            link_kbps = atoi(optarg);
+            break;
+        case 'd':
+            duration_s = atoi(optarg);
+            break;
+        case 'f':
+            file_path = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-p capture ms] [-s frame bytes] [-b link kB/s] [-d seconds] [-f jpeg file]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (capture_ms == 0 || frame_len < sizeof(uint32_t) || link_kbps == 0 || duration_s == 0) {
+        fprintf(stderr, "capture period, link rate and duration must be non zero, frames at least 4 bytes\n");
+        return 1;
+    }
+
+    printf("capture %u ms, %s, link %u kB/s, %u s per run\n", capture_ms,
+           file_path ? file_path : "synthetic frames", link_kbps, duration_s);
+
+    bench_sink_t *sink = calloc(1, sizeof(bench_sink_t));
+    _run_sequential(sink);
+    memset(sink, 0, sizeof(bench_sink_t));
+    _run_pipelined(sink);
+    free(sink);
+    return 0;
+}
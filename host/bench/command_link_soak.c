@@ -0,0 +1,387 @@
+/**
+ * @file command_link_soak.c
+ * @brief Soak benchmark of the command link's robot table with many simulated robots.
+ *
+ * The command link side runs the firmware's robots.c and tcp_socket.c on top of the host
+ * shims, with the same event loop as command_link.c's connection_task. Each simulated robot is
+ * a thread with a plain POSIX socket on loopback that streams lidar scans and poses, reads
+ * heartbeats, and periodically disconnects and reconnects so robot state is allocated and
+ * freed over and over. Every forwarded frame is checked and its latency recorded.
+ *
+ * With -u the robots send their lidar scans as UDP datagrams like the node does. Each robot
+ * then uses its own loopback address (127.0.0.2, 127.0.0.3, ...) so the command link can tell
+ * the datagrams apart.
+ *
+ * Usage: command_link_soak [-r robots] [-d seconds] [-l lidar Hz] [-p pose Hz] [-c churn s] [-u]
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "tcp_socket.h"
+#include "udp_socket.h"
+#include "serializer.h"
+#include "lcm_types.h"
+#include "metrics.h"
+#include "robots.h"
+
+#define SOAK_MAX_ROBOTS         64
+#define SOAK_HEARTBEAT_MS       500
+
+typedef struct soak_robot_t {
+    int index;
+    pthread_t thread;
+    uint64_t packets_sent;
+    uint64_t heartbeats_recv;
+    uint64_t reconnects;
+} soak_robot_t;
+
+static uint16_t port;
+static uint32_t num_robots = 15;
+static uint32_t duration_s = 10;
+static uint32_t lidar_hz = 10;
+static uint32_t pose_hz = 50;
+static uint32_t churn_s = 3;
+static bool lidar_over_udp = false;
+
+static tcp_server_t *server;
+static udp_socket_t *udp;
+static soak_robot_t sim_robots[SOAK_MAX_ROBOTS];
+static atomic_bool running = true;
+
+static atomic_uint_least64_t frames_ok;
+static atomic_uint_least64_t frames_bad;
+static atomic_uint_least64_t lidar_frames;
+static atomic_uint_least64_t pose_frames;
+static atomic_uint_least32_t peak_connected;
+static metrics_histogram_t *latency_us;
+
+static void on_robot_packet(uint8_t robot_id, uint16_t topic, uint8_t *frame, uint32_t frame_len, void *ctx) {
+    uint8_t *rospkt = frame + ROBOT_FRAME_HEADER_LEN;
+    uint32_t msg_len = frame_len - ROBOT_FRAME_HEADER_LEN - ROS_PKG_LEN;
+    uint8_t ok = frame[0] == SYNC_FLAG && frame[1] == robot_id
+              && rospkt[ROS_HEADER_LEN + msg_len] == checksum(rospkt + 5, msg_len + 2);
+
+    int64_t utime = 0;
+    if (ok && topic == MBOT_LIDAR_SCAN && msg_len == sizeof(serial_lidar_scan_t)) {
+        memcpy(&utime, rospkt + ROS_HEADER_LEN + offsetof(serial_lidar_scan_t, utime), sizeof(utime));
+        atomic_fetch_add(&lidar_frames, 1);
+    }
+    else if (ok && topic == MBOT_ODOMETRY && msg_len == sizeof(serial_pose2D_t)) {
+        memcpy(&utime, rospkt + ROS_HEADER_LEN + offsetof(serial_pose2D_t, utime), sizeof(utime));
+        atomic_fetch_add(&pose_frames, 1);
+    }
+    else {
+        ok = 0;
+    }
+
+    if (ok) {
+        atomic_fetch_add(&frames_ok, 1);
+        metrics_histogram_record(latency_us, (uint32_t)(esp_timer_get_time() - utime));
+    }
+    else {
+        atomic_fetch_add(&frames_bad, 1);
+    }
+    free(frame);
+}
+
+/* Command link side, mirrors connection_task and heartbeat_task */
+
+static void accept_robots(void) {
+    tcp_connection_t *connection;
+    while ((connection = tcp_server_accept(server)) != NULL) {
+        if (robots_add(connection) < 0) {
+            tcp_connection_free(connection);
+        }
+    }
+    uint32_t connected = robots_count();
+    if (connected > atomic_load(&peak_connected)) {
+        atomic_store(&peak_connected, connected);
+    }
+}
+
+static uint32_t datagrams_service(void) {
+    static uint8_t datagram[udp_MAX_DATAGRAM_LEN];
+    uint32_t total = 0;
+    while (total < ROBOT_RX_BUDGET) {
+        uint32_t source_ip;
+        uint32_t len = udp_socket_recv(udp, datagram, sizeof(datagram), &source_ip);
+        if (len == 0) {
+            break;
+        }
+        robots_recv_datagram(source_ip, datagram, len);
+        total += len;
+    }
+    return total;
+}
+
+static void connection_task(void *args) {
+    while (atomic_load(&running)) {
+        uint8_t events = robots_wait(server, udp, 100);
+        if (events & ROBOTS_ACCEPT) {
+            accept_robots();
+        }
+        robots_service();
+        if (events & ROBOTS_DATAGRAMS) {
+            datagrams_service();
+        }
+    }
+    vTaskDelete(NULL);
+}
+
+static void heartbeat_task(void *args) {
+    TickType_t last_wake = xTaskGetTickCount();
+    while (atomic_load(&running)) {
+        for (int i = 0; i < robots_max(); i++) {
+            if (!robots_is_connected(i)) {
+                continue;
+            }
+            serial_timestamp_t timestamp = { .utime = esp_timer_get_time() };
+            packet_t packet;
+            packet.len = sizeof(serial_timestamp_t) + ROS_PKG_LEN;
+            packet.data = (uint8_t *)malloc(packet.len);
+            encode_rospkt((uint8_t *)&timestamp, sizeof(timestamp), MBOT_TIMESYNC, packet.data);
+            if (robots_send(i, &packet)) {
+                free(packet.data);
+            }
+        }
+        xTaskDelayUntil(&last_wake, SOAK_HEARTBEAT_MS / portTICK_PERIOD_MS);
+    }
+    vTaskDelete(NULL);
+}
+
+/* Simulated robots */
+
+static void robot_bind(int fd, int index) {
+    if (lidar_over_udp) {
+        struct sockaddr_in local = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK + 2 + index) };
+        bind(fd, (struct sockaddr *)&local, sizeof(local));
+    }
+}
+
+static int robot_connect(int index) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    robot_bind(fd, index);
+    while (atomic_load(&running)) {
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            return fd;
+        }
+        close(fd);
+        usleep(10000);
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        robot_bind(fd, index);
+    }
+    close(fd);
+    return -1;
+}
+
+static int robot_send(int fd, uint16_t topic, uint8_t *msg, uint16_t len) {
+    uint8_t pkt[sizeof(serial_lidar_scan_t) + ROS_PKG_LEN];
+    encode_rospkt(msg, len, topic, pkt);
+    for (uint32_t sent = 0; sent < len + ROS_PKG_LEN;) {
+        ssize_t n = send(fd, pkt + sent, len + ROS_PKG_LEN - sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            return -1;
+        }
+        sent += n;
+    }
+    return 0;
+}
+
+static int robot_send_datagram(int fd, uint32_t seq, uint16_t topic, uint8_t *msg, uint16_t len) {
+    uint8_t datagram[DATAGRAM_HEADER_LEN + sizeof(serial_lidar_scan_t) + ROS_PKG_LEN];
+    for (int i = 0; i < DATAGRAM_HEADER_LEN; i++) {
+        datagram[i] = (seq >> (8 * i)) & 0xFF;
+    }
+    encode_rospkt(msg, len, topic, datagram + DATAGRAM_HEADER_LEN);
+    send(fd, datagram, DATAGRAM_HEADER_LEN + len + ROS_PKG_LEN, 0);
+    return 0;   // Lost datagrams are not an error
+}
+
+static void *robot_thread(void *args) {
+    soak_robot_t *robot = (soak_robot_t *)args;
+    serial_lidar_scan_t scan = {0};
+    serial_pose2D_t pose = {0};
+    uint8_t rx[1024];
+    uint32_t seq = 0;
+    bool heard = false;     // A heartbeat arrived, so the command link has added this robot
+
+    int udp_fd = -1;
+    if (lidar_over_udp) {
+        udp_fd = socket(AF_INET, SOCK_DGRAM, 0);
+        robot_bind(udp_fd, robot->index);
+        struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+        connect(udp_fd, (struct sockaddr *)&addr, sizeof(addr));
+    }
+
+    int64_t lidar_period = 1000000 / lidar_hz;
+    int64_t pose_period = 1000000 / pose_hz;
+    int64_t churn_period = (int64_t)churn_s * 1000000;
+    // Stagger robots so they do not all reconnect at once
+    int64_t start = esp_timer_get_time();
+    int64_t next_lidar = start + robot->index * lidar_period / num_robots;
+    int64_t next_pose = start + robot->index * pose_period / num_robots;
+    int64_t next_churn = start + churn_period + robot->index * churn_period / num_robots;
+
+    int fd = robot_connect(robot->index);
+    while (fd >= 0 && atomic_load(&running)) {
+        int64_t now = esp_timer_get_time();
+        int err = 0;
+
+        if (now >= next_lidar) {
+            scan.utime = esp_timer_get_time();
+            for (int i = 0; i < 360; i++) {
+                scan.ranges[i] = (uint16_t)(robot->packets_sent + i);
+            }
+            // Datagrams sent before the connection is accepted cannot be matched to a robot
+            if (udp_fd >= 0 && heard) {
+                err |= robot_send_datagram(udp_fd, seq++, MBOT_LIDAR_SCAN, (uint8_t *)&scan, sizeof(scan));
+                robot->packets_sent++;
+            }
+            else if (udp_fd < 0) {
+                err |= robot_send(fd, MBOT_LIDAR_SCAN, (uint8_t *)&scan, sizeof(scan));
+                robot->packets_sent++;
+            }
+            next_lidar += lidar_period;
+        }
+        if (now >= next_pose) {
+            pose.utime = esp_timer_get_time();
+            pose.x += 0.01f;
+            err |= robot_send(fd, MBOT_ODOMETRY, (uint8_t *)&pose, sizeof(pose));
+            robot->packets_sent++;
+            next_pose += pose_period;
+        }
+
+        ssize_t n = recv(fd, rx, sizeof(rx), MSG_DONTWAIT);
+        if (n > 0) {
+            heard = true;
+            for (ssize_t i = 0; i < n; i++) {
+                robot->heartbeats_recv += (rx[i] == SYNC_FLAG);
+            }
+        }
+
+        if (err || (churn_period > 0 && now >= next_churn)) {
+            close(fd);
+            robot->reconnects++;
+            next_churn += churn_period;
+            fd = robot_connect(robot->index);
+            heard = false;
+            continue;
+        }
+
+        int64_t next = (next_lidar < next_pose) ? next_lidar : next_pose;
+        int64_t wait = next - esp_timer_get_time();
+        if (wait > 0) {
+            usleep(wait < 2000 ? wait : 2000);
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (udp_fd >= 0) {
+        close(udp_fd);
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "r:d:l:p:c:u")) != -1) {
+        switch (opt) {
+        case 'r':
+            num_robots = strtoul(optarg, NULL, 10);
+            break;
+        case 'd':
+            duration_s = strtoul(optarg, NULL, 10);
+            break;
+        case 'l':
+            lidar_hz = strtoul(optarg, NULL, 10);
+            break;
+        case 'p':
+            pose_hz = strtoul(optarg, NULL, 10);
+            break;
+        case 'c':
+            churn_s = strtoul(optarg, NULL, 10);
+            break;
+        case 'u':
+            lidar_over_udp = true;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-r robots] [-d seconds] [-l lidar Hz] [-p pose Hz] [-c churn s] [-u]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (num_robots == 0 || num_robots > SOAK_MAX_ROBOTS || lidar_hz == 0 || pose_hz == 0) {
+        fprintf(stderr, "robots must be between 1 and %d, rates must be non zero\n", SOAK_MAX_ROBOTS);
+        return 2;
+    }
+
+    esp_log_level_set("*", ESP_LOG_ERROR);
+    port = 20000 + getpid() % 20000;
+    server = tcp_server_create(port);
+    udp = udp_socket_create(port);
+    if (server == NULL || udp == NULL) {
+        return 1;
+    }
+    latency_us = metrics_histogram_register("latency_us");
+    robots_init(num_robots, on_robot_packet, NULL);
+
+    xTaskCreate(connection_task, "connection_task", 4096, NULL, 4, NULL);
+    xTaskCreate(heartbeat_task, "heartbeat_task", 4096, NULL, 5, NULL);
+
+    for (uint32_t i = 0; i < num_robots; i++) {
+        sim_robots[i].index = i;
+        pthread_create(&sim_robots[i].thread, NULL, robot_thread, &sim_robots[i]);
+    }
+
+    sleep(duration_s);
+    atomic_store(&running, false);
+
+    uint64_t sent = 0, heartbeats = 0, reconnects = 0;
+    for (uint32_t i = 0; i < num_robots; i++) {
+        pthread_join(sim_robots[i].thread, NULL);
+        sent += sim_robots[i].packets_sent;
+        heartbeats += sim_robots[i].heartbeats_recv;
+        reconnects += sim_robots[i].reconnects;
+    }
+    usleep(100000);
+
+    uint64_t ok = atomic_load(&frames_ok);
+    uint64_t bad = atomic_load(&frames_bad);
+    printf("robots:          %u (peak %u connected at once)\n", num_robots, (unsigned)atomic_load(&peak_connected));
+    printf("duration:        %u s, %u reconnects\n", duration_s, (unsigned)reconnects);
+    printf("frames:          %lu forwarded of %lu sent (%lu lidar, %lu pose), %lu bad\n",
+           (unsigned long)ok, (unsigned long)sent, (unsigned long)atomic_load(&lidar_frames),
+           (unsigned long)atomic_load(&pose_frames), (unsigned long)bad);
+    printf("throughput:      %.0f frames/s\n", (double)ok / duration_s);
+    printf("latency:         p50 %lu us, p99 %lu us, max %lu us\n",
+           (unsigned long)metrics_histogram_percentile(latency_us, 50),
+           (unsigned long)metrics_histogram_percentile(latency_us, 99),
+           (unsigned long)atomic_load(&latency_us->max));
+    printf("heartbeats:      %lu received\n", (unsigned long)heartbeats);
+
+    // Frames in flight when a robot disconnects are lost, anything else is a failure
+    return (bad != 0 || ok + reconnects * 2 < sent * 99 / 100) ? 1 : 0;
+}
@@ -0,0 +1,432 @@
+/**
+ * @file network_loopback.c
+ * @brief Loopback throughput and latency of the network component with many simulated robots.
+ *
+ * Both ends run the firmware's tcp_socket.c and udp_socket.c on top of the host shims. Each
+ * simulated robot is a task with a tcp_client that sends ROS packets of a fixed size at a
+ * fixed rate, like a node streaming lidar scans. The command link side is a single task that
+ * accepts the robots and reads every connection through tcp_server_wait, and sends each robot
+ * a small command packet every BENCH_COMMAND_MS like the command link's heartbeat. Frames carry
+ * their send time, so the latency is measured from the robot's send to the packet being parsed.
+ *
+ * With -u the robots send their frames as UDP datagrams instead and only the commands use TCP.
+ * Use it to measure changes to the send or receive path without flashing a board.
+ *
+ * Usage: network_loopback [-r robots] [-s frame bytes] [-f frames/s per robot, 0 = flat out] [-d seconds] [-u]
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "tcp_socket.h"
+#include "udp_socket.h"
+#include "serializer.h"
+
+#define BENCH_MAX_ROBOTS        64
+#define BENCH_MAX_FRAMES        2000000
+#define BENCH_MAX_FRAME_LEN     (16 * 1024)
+#define BENCH_TOPIC             0xbe01
+#define BENCH_COMMAND_MS        100
+#define BENCH_COMMAND_LEN       16
+#define BENCH_WAIT_MS           10
+#define BENCH_RX_BUDGET         4096    /**< Bytes read from a robot per pass, ROBOT_RX_BUDGET on the command link */
+#define BENCH_CONNECT_MS        5000    /**< Time every robot gets to connect before the run starts */
+#define BENCH_DRAIN_MS          200     /**< Time the command link keeps reading once the robots stop */
+
+typedef struct bench_payload_t {
+    int64_t utime;
+    uint32_t robot;
+    uint32_t seq;
+} bench_payload_t;
+
+typedef struct bench_robot_t {
+    uint32_t index;
+    atomic_uint_least64_t frames_sent;
+    atomic_uint_least64_t short_sends;
+    atomic_uint_least64_t command_bytes;
+    atomic_bool done;
+} bench_robot_t;
+
+/* Stream parser of one connection on the command link side */
+typedef struct bench_peer_t {
+    tcp_connection_t *connection;
+    uint8_t frame[BENCH_MAX_FRAME_LEN + ROS_PKG_LEN];
+    uint32_t frame_fill;        /**< 0 while looking for a header */
+} bench_peer_t;
+
+static uint16_t port;
+static uint32_t num_robots = 8;
+static uint32_t frame_len = 720;
+static uint32_t frame_rate = 100;
+static uint32_t duration_s = 5;
+static uint8_t over_udp = 0;
+
+static udp_socket_t *udp = NULL;
+static bench_robot_t robots[BENCH_MAX_ROBOTS];
+static atomic_uint_least32_t connected;
+static atomic_bool started = false;
+static atomic_bool running = true;
+static atomic_bool serving = true;
+static atomic_bool served = false;
+
+/* Written by the command link task only, read once it is done */
+static uint32_t *latencies_us;
+static uint64_t frames_recv;
+static uint64_t frames_bad;
+static uint64_t sync_errors;
+static uint64_t commands_sent;
+
+static int _compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void _record_frame(const uint8_t *pkt, uint32_t msg_len) {
+    uint8_t ok = msg_len == frame_len && pkt[1] == VERSION_FLAG
+              && pkt[ROS_HEADER_LEN + msg_len] == checksum((uint8_t *)pkt + 5, msg_len + 2);
+    if (!ok) {
+        frames_bad++;
+        return;
+    }
+
+    bench_payload_t payload;
+    memcpy(&payload, pkt + ROS_HEADER_LEN, sizeof(payload));
+    if (frames_recv < BENCH_MAX_FRAMES) {
+        latencies_us[frames_recv] = (uint32_t)(esp_timer_get_time() - payload.utime);
+    }
+    frames_recv++;
+}
+
+/* Command link side */
+
+/**
+ * @brief Reads up to BENCH_RX_BUDGET bytes of a connection, parsing frames the way robots.c does.
+ */
+static void _peer_read(bench_peer_t *peer) {
+    uint32_t pkt_len = frame_len + ROS_PKG_LEN;
+    uint32_t total = 0;
+    while (total < BENCH_RX_BUDGET) {
+        if (peer->frame_fill == 0) {
+            sync_errors += tcp_connection_skip_until(peer->connection, SYNC_FLAG);
+            if (tcp_connection_peek(peer->connection, peer->frame, ROS_HEADER_LEN) < ROS_HEADER_LEN) {
+                return;
+            }
+            uint16_t msg_len = peer->frame[2] + ((uint16_t)peer->frame[3] << 8);
+            if (peer->frame[1] != VERSION_FLAG || msg_len != frame_len) {
+                uint8_t flag;
+                tcp_connection_recv(peer->connection, &flag, 1);
+                sync_errors++;
+                continue;
+            }
+        }
+
+        uint32_t len = tcp_connection_recv(peer->connection, peer->frame + peer->frame_fill, pkt_len - peer->frame_fill);
+        if (len == 0) {
+            return;
+        }
+        total += len;
+        peer->frame_fill += len;
+        if (peer->frame_fill == pkt_len) {
+            _record_frame(peer->frame, frame_len);
+            peer->frame_fill = 0;
+        }
+    }
+}
+
+static void _send_commands(bench_peer_t **peers) {
+    uint8_t msg[BENCH_COMMAND_LEN - ROS_PKG_LEN] = { 0 };
+    uint8_t pkt[BENCH_COMMAND_LEN];
+    encode_rospkt(msg, sizeof(msg), BENCH_TOPIC, pkt);
+    for (uint32_t i = 0; i < num_robots; i++) {
+        if (peers[i] != NULL && tcp_connection_send(peers[i]->connection, pkt, sizeof(pkt)) == sizeof(pkt)) {
+            commands_sent++;
+        }
+    }
+}
+
+static void command_link_task(void *args) {
+    tcp_server_t *server = (tcp_server_t *)args;
+    bench_peer_t *peers[BENCH_MAX_ROBOTS] = { 0 };
+    tcp_connection_t *connections[BENCH_MAX_ROBOTS] = { 0 };
+    uint8_t ready[BENCH_MAX_ROBOTS];
+    uint8_t *datagram = malloc(udp_MAX_DATAGRAM_LEN);
+    int64_t next_command = esp_timer_get_time();
+
+    while (atomic_load(&serving)) {
+        tcp_wait_t wait = { .connections = connections, .count = num_robots, .udp = udp, .ready = ready };
+        if (tcp_server_wait(server, &wait, BENCH_WAIT_MS) < 0) {
+            break;
+        }
+
+        if (wait.acceptable) {
+            tcp_connection_t *connection;
+            while ((connection = tcp_server_accept(server)) != NULL) {
+                uint32_t i = 0;
+                while (i < num_robots && peers[i] != NULL) {
+                    i++;
+                }
+                if (i == num_robots) {
+                    tcp_connection_free(connection);
+                    continue;
+                }
+                tcp_connection_set_send_timeout(connection, 0);
+                peers[i] = calloc(1, sizeof(bench_peer_t));
+                peers[i]->connection = connection;
+                connections[i] = connection;
+                // It may have sent something before it was accepted
+                ready[i] = tcp_READY_READABLE;
+            }
+        }
+
+        for (uint32_t i = 0; i < num_robots; i++) {
+            if (peers[i] == NULL) {
+                continue;
+            }
+            if (ready[i] & tcp_READY_WRITABLE) {
+                tcp_connection_flush(peers[i]->connection, 0);
+            }
+            if (ready[i] & (tcp_READY_READABLE | tcp_READY_CLOSED)) {
+                _peer_read(peers[i]);
+            }
+            if (tcp_connection_is_closed(peers[i]->connection)) {
+                tcp_connection_free(peers[i]->connection);
+                free(peers[i]);
+                peers[i] = NULL;
+                connections[i] = NULL;
+            }
+        }
+
+        if (wait.datagrams) {
+            uint32_t len, source_ip;
+            while ((len = udp_socket_recv(udp, datagram, udp_MAX_DATAGRAM_LEN, &source_ip)) > 0) {
+                uint16_t msg_len = datagram[2] + ((uint16_t)datagram[3] << 8);
+                if (len == msg_len + ROS_PKG_LEN && datagram[0] == SYNC_FLAG) {
+                    _record_frame(datagram, msg_len);
+                }
+                else {
+                    frames_bad++;
+                }
+            }
+        }
+
+        if (esp_timer_get_time() >= next_command) {
+            _send_commands(peers);
+            next_command += BENCH_COMMAND_MS * 1000;
+        }
+    }
+
+    for (uint32_t i = 0; i < num_robots; i++) {
+        if (peers[i] != NULL) {
+            tcp_connection_free(peers[i]->connection);
+            free(peers[i]);
+        }
+    }
+    free(datagram);
+    atomic_store(&served, true);
+    vTaskDelete(NULL);
+}
+
+/* Robot side */
+
+static void robot_task(void *args) {
+    bench_robot_t *robot = (bench_robot_t *)args;
+    // Retry like the node does, the listen backlog overflows when every robot connects at once
+    tcp_client_t *client = tcp_client_init("127.0.0.1", port);
+    int64_t deadline = esp_timer_get_time() + BENCH_CONNECT_MS * 1000;
+    while (client != NULL && tcp_client_connect(client, tcp_CONNECT_TIMEOUT_MS) && esp_timer_get_time() < deadline) {
+        vTaskDelay(10 / portTICK_PERIOD_MS);
+    }
+    atomic_fetch_add(&connected, 1);
+    if (client == NULL || tcp_client_is_closed(client)) {
+        fprintf(stderr, "robot %u failed to connect\n", robot->index);
+        tcp_client_free(client);
+        atomic_store(&robot->done, true);
+        vTaskDelete(NULL);
+    }
+    tcp_options_t options = { .nodelay = 1 };
+    tcp_client_set_options(client, &options);
+    // Flat out, the robot waits for the window instead of dropping what does not fit
+    if (frame_rate == 0) {
+        tcp_client_set_send_timeout(client, tcp_TIMEOUT_MS);
+    }
+
+    udp_socket_t *datagrams = NULL;
+    if (over_udp) {
+        datagrams = udp_socket_create(0);
+        udp_socket_set_peer(datagrams, "127.0.0.1", port);
+    }
+
+    uint8_t *msg = calloc(1, frame_len);
+    uint8_t *pkt = malloc(frame_len + ROS_PKG_LEN);
+    uint8_t commands[256];
+    while (!atomic_load(&started)) {
+        vTaskDelay(1);
+    }
+    int64_t period_us = frame_rate ? 1000000 / frame_rate : 0;
+    int64_t next = esp_timer_get_time() + (int64_t)robot->index * period_us / num_robots;
+    bench_payload_t payload = { .robot = robot->index };
+
+    while (atomic_load(&running) && !tcp_client_is_closed(client)) {
+        uint32_t len;
+        while ((len = tcp_client_recv(client, commands, sizeof(commands))) > 0) {
+            atomic_fetch_add(&robot->command_bytes, len);
+        }
+
+        int64_t now = esp_timer_get_time();
+        if (period_us > 0) {
+            if (now < next) {
+                usleep((useconds_t)(next - now < 1000 ? next - now : 1000));
+                continue;
+            }
+            next += period_us;
+        }
+
+        payload.utime = now;
+        payload.seq++;
+        memcpy(msg, &payload, sizeof(payload));
+        encode_rospkt(msg, frame_len, BENCH_TOPIC, pkt);
+
+        uint32_t pkt_len = frame_len + ROS_PKG_LEN;
+        if (datagrams != NULL) {
+            struct iovec iov = { .iov_base = pkt, .iov_len = pkt_len };
+            len = udp_socket_sendv(datagrams, &iov, 1);
+        }
+        else {
+            len = tcp_client_send(client, pkt, pkt_len);
+        }
+        if (len == pkt_len) {
+            atomic_fetch_add(&robot->frames_sent, 1);
+        }
+        else {
+            atomic_fetch_add(&robot->short_sends, 1);
+        }
+    }
+
+    tcp_client_flush(client, 100);
+    free(msg);
+    free(pkt);
+    udp_socket_free(datagrams);
+    // Keep the connection and count the commands still arriving until the command link has drained it
+    while (!atomic_load(&served)) {
+        uint32_t len;
+        while ((len = tcp_client_recv(client, commands, sizeof(commands))) > 0) {
+            atomic_fetch_add(&robot->command_bytes, len);
+        }
+        vTaskDelay(10 / portTICK_PERIOD_MS);
+    }
+    uint32_t len;
+    while ((len = tcp_client_recv(client, commands, sizeof(commands))) > 0) {
+        atomic_fetch_add(&robot->command_bytes, len);
+    }
+    tcp_client_free(client);
+    atomic_store(&robot->done, true);
+    vTaskDelete(NULL);
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "r:s:f:d:u")) != -1) {
+        switch (opt) {
+        case 'r':
+            num_robots = atoi(optarg);
+            break;
+        case 's':
+            frame_len = atoi(optarg);
+            break;
+        case 'f':
+            frame_rate = atoi(optarg);
+            break;
+        case 'd':
+            duration_s = atoi(optarg);
+            break;
+        case 'u':
+            over_udp = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-r robots] [-s frame bytes] [-f frames/s per robot, 0 = flat out] [-d seconds] [-u]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (num_robots == 0 || num_robots > BENCH_MAX_ROBOTS || duration_s == 0) {
+        fprintf(stderr, "robots must be between 1 and %d, duration non zero\n", BENCH_MAX_ROBOTS);
+        return 2;
+    }
+    if (frame_len < sizeof(bench_payload_t) || frame_len > BENCH_MAX_FRAME_LEN
+        || (over_udp && frame_len + ROS_PKG_LEN > udp_MAX_DATAGRAM_LEN)) {
+        fprintf(stderr, "frames must be between %zu and %d bytes\n", sizeof(bench_payload_t), BENCH_MAX_FRAME_LEN);
+        return 2;
+    }
+
+    esp_log_level_set("*", ESP_LOG_ERROR);
+    port = 20000 + getpid() % 20000;
+    tcp_server_t *server = tcp_server_create(port);
+    udp = over_udp ? udp_socket_create(port) : NULL;
+    if (server == NULL || (over_udp && udp == NULL)) {
+        return 1;
+    }
+    latencies_us = malloc(BENCH_MAX_FRAMES * sizeof(uint32_t));
+
+    printf("%u robots, %u byte frames %s, %s, %u s\n", num_robots, frame_len, over_udp ? "over udp" : "over tcp",
+           frame_rate ? "paced" : "flat out", duration_s);
+    if (frame_rate) {
+        printf("rate:            %u frames/s per robot\n", frame_rate);
+    }
+
+    xTaskCreate(command_link_task, "command_link", 4096, server, 4, NULL);
+    for (uint32_t i = 0; i < num_robots; i++) {
+        robots[i].index = i;
+        xTaskCreate(robot_task, "robot", 4096, &robots[i], 4, NULL);
+    }
+
+    // The clock starts once every robot connected or gave up
+    while (atomic_load(&connected) < num_robots) {
+        usleep(1000);
+    }
+    atomic_store(&started, true);
+    sleep(duration_s);
+    atomic_store(&running, false);
+    usleep(BENCH_DRAIN_MS * 1000);
+    atomic_store(&serving, false);
+    for (uint32_t i = 0; i < num_robots; i++) {
+        while (!atomic_load(&robots[i].done)) {
+            usleep(1000);
+        }
+    }
+    tcp_server_free(server);
+    udp_socket_free(udp);
+
+    uint64_t sent = 0, short_sends = 0, command_bytes = 0;
+    for (uint32_t i = 0; i < num_robots; i++) {
+        sent += robots[i].frames_sent;
+        short_sends += robots[i].short_sends;
+        command_bytes += robots[i].command_bytes;
+    }
+
+    uint32_t n = (frames_recv < BENCH_MAX_FRAMES) ? (uint32_t)frames_recv : BENCH_MAX_FRAMES;
+    qsort(latencies_us, n, sizeof(uint32_t), _compare_u32);
+    printf("frames:          %llu received of %llu sent, %llu bad, %llu short sends, %llu sync errors\n",
+           (unsigned long long)frames_recv, (unsigned long long)sent, (unsigned long long)frames_bad,
+           (unsigned long long)short_sends, (unsigned long long)sync_errors);
+    printf("throughput:      %.0f frames/s, %.1f kB/s\n", (double)frames_recv / duration_s,
+           (double)frames_recv * (frame_len + ROS_PKG_LEN) / 1000 / duration_s);
+    printf("latency:         p50 %u us, p99 %u us, max %u us\n", n ? latencies_us[n / 2] : 0,
+           n ? latencies_us[(uint64_t)n * 99 / 100] : 0, n ? latencies_us[n - 1] : 0);
+    printf("commands:        %llu received of %llu sent\n", (unsigned long long)(command_bytes / BENCH_COMMAND_LEN),
+           (unsigned long long)commands_sent);
+    free(latencies_us);
+
+    // Datagrams may be dropped when the receive buffer overflows, the stream must arrive whole
+    uint8_t failed = frames_bad > 0 || (!over_udp && frames_recv != sent);
+    return failed ? 1 : 0;
+}
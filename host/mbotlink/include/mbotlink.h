@@ -0,0 +1,168 @@
+/**
+ * @file mbotlink.h
+ * @brief Host (Linux) library for the command link USB serial protocol.
+ *
+ * The command link forwards every robot packet to the host as
+ * [SYNC_FLAG, ROBOT_ID, LEN_LSB, LEN_MSB, [ROS PACKET]] and accepts the same framing for
+ * packets going to a robot. A link owns a reader thread that pulls large chunks from the
+ * device into a ring buffer and a dispatch thread that runs a streaming parser over the
+ * ring and hands each packet to the callbacks subscribed to its topic.
+ *
+ * The command link exposes two CDC-ACM ports: a control port (commands, heartbeats and its
+ * own metrics, sent with robot id 0xFF) and a bulk port (lidar scans and camera frames).
+ * Open one link per port, commands should be sent on the control port.
+ *
+ * The ring is mapped twice back to back in virtual memory, so every packet is contiguous
+ * and callbacks receive a pointer straight into the ring (no copies). The pointer is only
+ * valid for the duration of the callback.
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "serializer.h"
+#include "lcm_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MBOTLINK_RING_SIZE              (1 << 20)           /**< Receive ring size in bytes, must be a multiple of the page size */
+#define MBOTLINK_READ_CHUNK             (64 * 1024)         /**< Maximum number of bytes requested per read() */
+#define MBOTLINK_MAX_SUBSCRIPTIONS      64
+#define MBOTLINK_FRAME_HEADER_LEN       4                   /**< [SYNC_FLAG, ROBOT_ID, LEN_LSB, LEN_MSB] */
+#define MBOTLINK_MAX_FRAME_LEN          (MBOTLINK_FRAME_HEADER_LEN + UINT16_MAX)
+#define MBOTLINK_ANY_TOPIC              0xFFFFFFFF          /**< Subscribe to every topic */
+#define MBOTLINK_ANY_ROBOT              0xFF                /**< Subscribe to every robot */
+
+/**
+ * @brief Represents a link to a command link (or anything speaking its framing).
+ */
+typedef struct mbotlink_t mbotlink_t;
+
+/**
+ * @brief Callback invoked on the dispatch thread for every packet of a subscribed topic.
+ *
+ * @param robot_id The id of the robot the packet came from.
+ * @param topic The topic of the packet.
+ * @param data Pointer to the message payload inside the ring. Only valid during the callback.
+ * @param len The length of the payload in bytes.
+ * @param ctx The context pointer passed to mbotlink_subscribe.
+ */
+typedef void (*mbotlink_callback_t)(uint8_t robot_id, uint16_t topic, const uint8_t *data, uint16_t len, void *ctx);
+
+/**
+ * @brief Counters describing the health of a link.
+ */
+typedef struct mbotlink_stats_t {
+    uint64_t bytes_read;                /**< Bytes read from the device. */
+    uint64_t bytes_sent;                /**< Bytes written to the device. */
+    uint64_t frames;                    /**< Valid frames parsed. */
+    uint64_t dispatched;                /**< Callback invocations. */
+    uint64_t sync_errors;               /**< Bytes skipped while looking for a frame. */
+    uint64_t checksum_errors;           /**< Frames dropped because of a bad checksum. */
+    uint64_t reads;                     /**< Number of read() calls that returned data. */
+    uint64_t ring_full_waits;           /**< Times the reader had to wait for ring space. */
+    uint32_t ring_high_water;           /**< Maximum number of unparsed bytes in the ring. */
+} mbotlink_stats_t;
+
+/**
+ * @brief Opens a serial device (e.g. /dev/ttyACM0) in raw mode.
+ *
+ * @param device The path of the serial device.
+ * @return A pointer to the link, or NULL on failure.
+ */
+mbotlink_t *mbotlink_open(const char *device);
+
+/**
+ * @brief Wraps an already open file descriptor (serial port, pipe, socket, ...).
+ *
+ * The link takes ownership of the file descriptor and closes it in mbotlink_close.
+ *
+ * @param fd The file descriptor to read from and write to.
+ * @return A pointer to the link, or NULL on failure.
+ */
+mbotlink_t *mbotlink_open_fd(int fd);
+
+/**
+ * @brief Opens a link on a new pseudo terminal for loopback testing.
+ *
+ * The link reads from and writes to the master side. The path of the slave side is
+ * written to peer_path so a test (or a simulated command link) can open it like a device.
+ *
+ * @param peer_path Buffer that receives the path of the slave side.
+ * @param peer_path_len The length of the buffer.
+ * @return A pointer to the link, or NULL on failure.
+ */
+mbotlink_t *mbotlink_open_pty(char *peer_path, size_t peer_path_len);
+
+/**
+ * @brief Subscribes a callback to a topic.
+ *
+ * Subscriptions must be made before mbotlink_start.
+ *
+ * @param link A pointer to the link.
+ * @param robot_id The robot to subscribe to, or MBOTLINK_ANY_ROBOT.
+ * @param topic The topic to subscribe to, or MBOTLINK_ANY_TOPIC.
+ * @param callback The callback to invoke.
+ * @param ctx An optional context pointer passed to the callback.
+ * @return 0 if successful, -1 otherwise.
+ */
+int mbotlink_subscribe(mbotlink_t *link, uint8_t robot_id, uint32_t topic, mbotlink_callback_t callback, void *ctx);
+
+/**
+ * @brief Starts the reader and dispatch threads.
+ *
+ * @param link A pointer to the link.
+ * @return 0 if successful, -1 otherwise.
+ */
+int mbotlink_start(mbotlink_t *link);
+
+/**
+ * @brief Encodes a frame without sending it.
+ *
+ * @param robot_id The id of the robot the frame is addressed to (or came from).
+ * @param topic The topic of the message.
+ * @param data The message payload.
+ * @param len The length of the payload.
+ * @param frame Buffer of at least len + MBOTLINK_FRAME_HEADER_LEN + ROS_PKG_LEN bytes.
+ * @return The length of the frame in bytes.
+ */
+uint32_t mbotlink_encode(uint8_t robot_id, uint16_t topic, const uint8_t *data, uint16_t len, uint8_t *frame);
+
+/**
+ * @brief Sends a message to a robot through the command link.
+ *
+ * Safe to call from any thread, including from a callback.
+ *
+ * @param link A pointer to the link.
+ * @param robot_id The id of the robot.
+ * @param topic The topic of the message.
+ * @param data The message payload.
+ * @param len The length of the payload.
+ * @return 0 if successful, -1 otherwise.
+ */
+int mbotlink_send(mbotlink_t *link, uint8_t robot_id, uint16_t topic, const uint8_t *data, uint16_t len);
+
+/**
+ * @brief Copies the current statistics of a link.
+ *
+ * @param link A pointer to the link.
+ * @param stats The structure to copy the statistics into.
+ */
+void mbotlink_get_stats(mbotlink_t *link, mbotlink_stats_t *stats);
+
+/**
+ * @brief Stops the threads, closes the device and frees the link.
+ *
+ * @param link A pointer to the link.
+ */
+void mbotlink_close(mbotlink_t *link);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,529 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "serializer.h"
+#include "lcm_types.h"
+
+#include "mbotlink.h"
+
+#define MBOTLINK_TAG "mbotlink"
+
+typedef struct mbotlink_subscription_t {
+    uint8_t robot_id;
+    uint32_t topic;
+    mbotlink_callback_t callback;
+    void *ctx;
+} mbotlink_subscription_t;
+
+struct mbotlink_t {
+    int _fd;
+    int _peer_fd;                       /**< Keeps the slave side of a pty open so the master never sees a hangup. */
+    int _wake_pipe[2];                  /**< Wakes the reader thread from poll() on close. */
+
+    uint8_t *_ring;                     /**< Ring buffer mapped twice back to back. */
+    uint32_t _ring_size;
+    _Atomic uint64_t _head;             /**< Total bytes written into the ring by the reader thread. */
+    _Atomic uint64_t _tail;             /**< Total bytes consumed from the ring by the dispatch thread. */
+
+    pthread_mutex_t _lock;
+    pthread_cond_t _data_cond;
+    pthread_cond_t _space_cond;
+    pthread_mutex_t _send_lock;
+
+    pthread_t _reader;
+    pthread_t _dispatcher;
+    _Atomic uint8_t _running;
+    _Atomic uint8_t _eof;
+    uint8_t _started;
+
+    mbotlink_subscription_t _subs[MBOTLINK_MAX_SUBSCRIPTIONS];
+    uint32_t _num_subs;
+
+    _Atomic uint64_t _bytes_read;
+    _Atomic uint64_t _bytes_sent;
+    _Atomic uint64_t _frames;
+    _Atomic uint64_t _dispatched;
+    _Atomic uint64_t _sync_errors;
+    _Atomic uint64_t _checksum_errors;
+    _Atomic uint64_t _reads;
+    _Atomic uint64_t _ring_full_waits;
+    _Atomic uint32_t _ring_high_water;
+};
+
+/**
+ * @brief Computes the rosserial checksum (same as checksum() in serializer.c).
+ */
+static uint8_t _mbotlink_checksum(const uint8_t *addends, uint32_t len) {
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        sum += addends[i];
+    }
+    return 255 - (sum % 256);
+}
+
+/**
+ * @brief Maps a ring of the given size twice in a row so that any span of up to size
+ * bytes starting anywhere in the first mapping is contiguous in memory.
+ *
+ * @param size The size of the ring, a multiple of the page size.
+ * @return The base address of the ring, or NULL on failure.
+ */
+static uint8_t *_mbotlink_ring_map(uint32_t size) {
+    int mfd = memfd_create("mbotlink_ring", MFD_CLOEXEC);
+    if (mfd < 0) {
+        fprintf(stderr, "%s: memfd_create failed: %s\n", MBOTLINK_TAG, strerror(errno));
+        return NULL;
+    }
+    if (ftruncate(mfd, size) != 0) {
+        fprintf(stderr, "%s: ftruncate failed: %s\n", MBOTLINK_TAG, strerror(errno));
+        close(mfd);
+        return NULL;
+    }
+
+    uint8_t *base = mmap(NULL, 2 * (size_t)size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        close(mfd);
+        return NULL;
+    }
+
+    if (mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, mfd, 0) == MAP_FAILED ||
+        mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, mfd, 0) == MAP_FAILED) {
+        fprintf(stderr, "%s: mirroring ring failed: %s\n", MBOTLINK_TAG, strerror(errno));
+        munmap(base, 2 * (size_t)size);
+        close(mfd);
+        return NULL;
+    }
+    close(mfd);
+    return base;
+}
+
+static void _mbotlink_dispatch(mbotlink_t *link, uint8_t robot_id, uint16_t topic, const uint8_t *data, uint16_t len) {
+    for (uint32_t i = 0; i < link->_num_subs; i++) {
+        mbotlink_subscription_t *sub = &link->_subs[i];
+        if (sub->robot_id != MBOTLINK_ANY_ROBOT && sub->robot_id != robot_id) {
+            continue;
+        }
+        if (sub->topic != MBOTLINK_ANY_TOPIC && sub->topic != topic) {
+            continue;
+        }
+        sub->callback(robot_id, topic, data, len, sub->ctx);
+        atomic_fetch_add_explicit(&link->_dispatched, 1, memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Parses as many complete frames as possible from a contiguous span of the ring.
+ *
+ * Frame layout: [SYNC_FLAG, ROBOT_ID, LEN_LSB, LEN_MSB, SYNC_FLAG, VERSION_FLAG,
+ * MSG_LEN_LSB, MSG_LEN_MSB, CS1, TOPIC_LSB, TOPIC_MSB, [MSG], CS2].
+ * Anything that does not validate is skipped one byte at a time until the parser is back
+ * in sync.
+ *
+ * @param link A pointer to the link.
+ * @param buf The start of the unparsed bytes.
+ * @param avail The number of unparsed bytes.
+ * @return The number of bytes consumed.
+ */
+static uint64_t _mbotlink_parse(mbotlink_t *link, const uint8_t *buf, uint64_t avail) {
+    const uint32_t header_len = MBOTLINK_FRAME_HEADER_LEN + ROS_HEADER_LEN;
+    uint64_t pos = 0;
+    uint64_t skipped = 0;
+
+    while (avail - pos >= header_len) {
+        const uint8_t *frame = buf + pos;
+        const uint8_t *pkt = frame + MBOTLINK_FRAME_HEADER_LEN;
+        uint16_t frame_len = frame[2] | ((uint16_t)frame[3] << 8);
+        uint16_t msg_len = pkt[2] | ((uint16_t)pkt[3] << 8);
+
+        if (frame[0] != SYNC_FLAG || pkt[0] != SYNC_FLAG || pkt[1] != VERSION_FLAG ||
+            (uint32_t)msg_len + ROS_PKG_LEN != frame_len || pkt[4] != _mbotlink_checksum(pkt + 2, 2)) {
+            pos++;
+            skipped++;
+            continue;
+        }
+
+        if (avail - pos < (uint64_t)MBOTLINK_FRAME_HEADER_LEN + frame_len) {
+            break;
+        }
+
+        // Topic and message are contiguous in the packet so the checksum runs in place
+        if (pkt[ROS_HEADER_LEN + msg_len] != _mbotlink_checksum(pkt + 5, msg_len + 2)) {
+            atomic_fetch_add_explicit(&link->_checksum_errors, 1, memory_order_relaxed);
+            pos++;
+            continue;
+        }
+
+        uint16_t topic = pkt[5] | ((uint16_t)pkt[6] << 8);
+        atomic_fetch_add_explicit(&link->_frames, 1, memory_order_relaxed);
+        _mbotlink_dispatch(link, frame[1], topic, pkt + ROS_HEADER_LEN, msg_len);
+        pos += MBOTLINK_FRAME_HEADER_LEN + frame_len;
+    }
+
+    if (skipped) {
+        atomic_fetch_add_explicit(&link->_sync_errors, skipped, memory_order_relaxed);
+    }
+    return pos;
+}
+
+static void *_mbotlink_reader_thread(void *args) {
+    mbotlink_t *link = (mbotlink_t *)args;
+    struct pollfd fds[2] = {
+        { .fd = link->_fd, .events = POLLIN },
+        { .fd = link->_wake_pipe[0], .events = POLLIN },
+    };
+
+    while (atomic_load(&link->_running)) {
+        int res = poll(fds, 2, -1);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "%s: poll failed: %s\n", MBOTLINK_TAG, strerror(errno));
+            break;
+        }
+        if (fds[1].revents) {
+            break;
+        }
+
+        uint64_t head = atomic_load_explicit(&link->_head, memory_order_relaxed);
+        uint64_t tail = atomic_load_explicit(&link->_tail, memory_order_acquire);
+        if (head - tail == link->_ring_size) {
+            pthread_mutex_lock(&link->_lock);
+            atomic_fetch_add_explicit(&link->_ring_full_waits, 1, memory_order_relaxed);
+            while (atomic_load(&link->_running) && head - atomic_load(&link->_tail) == link->_ring_size) {
+                pthread_cond_wait(&link->_space_cond, &link->_lock);
+            }
+            pthread_mutex_unlock(&link->_lock);
+            continue;
+        }
+
+        uint64_t space = link->_ring_size - (head - tail);
+        if (space > MBOTLINK_READ_CHUNK) {
+            space = MBOTLINK_READ_CHUNK;
+        }
+
+        // The mirror mapping makes [head % size, head % size + space) contiguous
+        ssize_t n = read(link->_fd, link->_ring + (head % link->_ring_size), space);
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) {
+                continue;
+            }
+            if (errno != EIO) {
+                fprintf(stderr, "%s: read failed: %s\n", MBOTLINK_TAG, strerror(errno));
+            }
+            break;
+        }
+        else if (n == 0) {
+            break;
+        }
+
+        atomic_fetch_add_explicit(&link->_bytes_read, n, memory_order_relaxed);
+        atomic_fetch_add_explicit(&link->_reads, 1, memory_order_relaxed);
+        atomic_store_explicit(&link->_head, head + n, memory_order_release);
+
+        pthread_mutex_lock(&link->_lock);
+        pthread_cond_signal(&link->_data_cond);
+        pthread_mutex_unlock(&link->_lock);
+    }
+
+    pthread_mutex_lock(&link->_lock);
+    atomic_store(&link->_eof, 1);
+    pthread_cond_signal(&link->_data_cond);
+    pthread_mutex_unlock(&link->_lock);
+    return NULL;
+}
+
+static void *_mbotlink_dispatch_thread(void *args) {
+    mbotlink_t *link = (mbotlink_t *)args;
+    uint64_t parsed_head = 0;
+
+    while (true) {
+        pthread_mutex_lock(&link->_lock);
+        while (atomic_load(&link->_running) && !atomic_load(&link->_eof) &&
+               atomic_load_explicit(&link->_head, memory_order_acquire) == parsed_head) {
+            pthread_cond_wait(&link->_data_cond, &link->_lock);
+        }
+        pthread_mutex_unlock(&link->_lock);
+
+        uint64_t head = atomic_load_explicit(&link->_head, memory_order_acquire);
+        if (!atomic_load(&link->_running) || head == parsed_head) {
+            break;
+        }
+
+        uint64_t tail = atomic_load_explicit(&link->_tail, memory_order_relaxed);
+        uint32_t pending = (uint32_t)(head - tail);
+        if (pending > atomic_load_explicit(&link->_ring_high_water, memory_order_relaxed)) {
+            atomic_store_explicit(&link->_ring_high_water, pending, memory_order_relaxed);
+        }
+
+        uint64_t consumed = _mbotlink_parse(link, link->_ring + (tail % link->_ring_size), head - tail);
+        parsed_head = head;
+
+        if (consumed) {
+            atomic_store_explicit(&link->_tail, tail + consumed, memory_order_release);
+            pthread_mutex_lock(&link->_lock);
+            pthread_cond_signal(&link->_space_cond);
+            pthread_mutex_unlock(&link->_lock);
+        }
+    }
+    return NULL;
+}
+
+mbotlink_t *mbotlink_open_fd(int fd) {
+    if (fd < 0) {
+        return NULL;
+    }
+
+    mbotlink_t *link = (mbotlink_t *)calloc(1, sizeof(mbotlink_t));
+    if (link == NULL) {
+        fprintf(stderr, "%s: unable to allocate memory for link\n", MBOTLINK_TAG);
+        close(fd);
+        return NULL;
+    }
+    link->_fd = fd;
+    link->_peer_fd = -1;
+    link->_ring_size = MBOTLINK_RING_SIZE;
+
+    link->_ring = _mbotlink_ring_map(link->_ring_size);
+    if (link->_ring == NULL) {
+        close(fd);
+        free(link);
+        return NULL;
+    }
+
+    if (pipe(link->_wake_pipe) != 0) {
+        fprintf(stderr, "%s: unable to create wake pipe: %s\n", MBOTLINK_TAG, strerror(errno));
+        munmap(link->_ring, 2 * (size_t)link->_ring_size);
+        close(fd);
+        free(link);
+        return NULL;
+    }
+
+    pthread_mutex_init(&link->_lock, NULL);
+    pthread_mutex_init(&link->_send_lock, NULL);
+    pthread_cond_init(&link->_data_cond, NULL);
+    pthread_cond_init(&link->_space_cond, NULL);
+    return link;
+}
+
+mbotlink_t *mbotlink_open(const char *device) {
+    int fd = open(device, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "%s: unable to open %s: %s\n", MBOTLINK_TAG, device, strerror(errno));
+        return NULL;
+    }
+
+    struct termios tty;
+    if (tcgetattr(fd, &tty) == 0) {
+        cfmakeraw(&tty);
+        tty.c_cc[VMIN] = 1;
+        tty.c_cc[VTIME] = 0;
+        tcsetattr(fd, TCSANOW, &tty);
+    }
+    return mbotlink_open_fd(fd);
+}
+
+mbotlink_t *mbotlink_open_pty(char *peer_path, size_t peer_path_len) {
+    int fd = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "%s: unable to open pty: %s\n", MBOTLINK_TAG, strerror(errno));
+        return NULL;
+    }
+    if (grantpt(fd) != 0 || unlockpt(fd) != 0 || ptsname_r(fd, peer_path, peer_path_len) != 0) {
+        fprintf(stderr, "%s: unable to set up pty: %s\n", MBOTLINK_TAG, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    // Raw mode on the master applies to the shared line discipline, so the slave is raw too
+    struct termios tty;
+    if (tcgetattr(fd, &tty) == 0) {
+        cfmakeraw(&tty);
+        tcsetattr(fd, TCSANOW, &tty);
+    }
+
+    int peer_fd = open(peer_path, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (peer_fd < 0) {
+        fprintf(stderr, "%s: unable to open %s: %s\n", MBOTLINK_TAG, peer_path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    mbotlink_t *link = mbotlink_open_fd(fd);
+    if (link == NULL) {
+        close(peer_fd);
+        return NULL;
+    }
+    link->_peer_fd = peer_fd;
+    return link;
+}
+
+int mbotlink_subscribe(mbotlink_t *link, uint8_t robot_id, uint32_t topic, mbotlink_callback_t callback, void *ctx) {
+    if (link == NULL || callback == NULL || link->_started) {
+        return -1;
+    }
+    if (link->_num_subs == MBOTLINK_MAX_SUBSCRIPTIONS) {
+        fprintf(stderr, "%s: maximum number of subscriptions reached\n", MBOTLINK_TAG);
+        return -1;
+    }
+
+    mbotlink_subscription_t *sub = &link->_subs[link->_num_subs++];
+    sub->robot_id = robot_id;
+    sub->topic = topic;
+    sub->callback = callback;
+    sub->ctx = ctx;
+    return 0;
+}
+
+int mbotlink_start(mbotlink_t *link) {
+    if (link == NULL || link->_started) {
+        return -1;
+    }
+
+    atomic_store(&link->_running, 1);
+    if (pthread_create(&link->_dispatcher, NULL, _mbotlink_dispatch_thread, link) != 0) {
+        atomic_store(&link->_running, 0);
+        return -1;
+    }
+    if (pthread_create(&link->_reader, NULL, _mbotlink_reader_thread, link) != 0) {
+        atomic_store(&link->_running, 0);
+        pthread_mutex_lock(&link->_lock);
+        pthread_cond_broadcast(&link->_data_cond);
+        pthread_mutex_unlock(&link->_lock);
+        pthread_join(link->_dispatcher, NULL);
+        return -1;
+    }
+    link->_started = 1;
+    return 0;
+}
+
+uint32_t mbotlink_encode(uint8_t robot_id, uint16_t topic, const uint8_t *data, uint16_t len, uint8_t *frame) {
+    uint32_t pkt_len = (uint32_t)len + ROS_PKG_LEN;
+    uint8_t *pkt = frame + MBOTLINK_FRAME_HEADER_LEN;
+
+    frame[0] = SYNC_FLAG;
+    frame[1] = robot_id;
+    frame[2] = pkt_len & 0xFF;
+    frame[3] = (pkt_len >> 8) & 0xFF;
+
+    pkt[0] = SYNC_FLAG;
+    pkt[1] = VERSION_FLAG;
+    pkt[2] = len & 0xFF;
+    pkt[3] = (len >> 8) & 0xFF;
+    pkt[4] = _mbotlink_checksum(pkt + 2, 2);
+    pkt[5] = topic & 0xFF;
+    pkt[6] = (topic >> 8) & 0xFF;
+    if (len) {
+        memcpy(pkt + ROS_HEADER_LEN, data, len);
+    }
+    pkt[ROS_HEADER_LEN + len] = _mbotlink_checksum(pkt + 5, (uint32_t)len + 2);
+    return MBOTLINK_FRAME_HEADER_LEN + pkt_len;
+}
+
+int mbotlink_send(mbotlink_t *link, uint8_t robot_id, uint16_t topic, const uint8_t *data, uint16_t len) {
+    if (link == NULL || (data == NULL && len != 0)) {
+        return -1;
+    }
+    if ((uint32_t)len + ROS_PKG_LEN > UINT16_MAX) {
+        fprintf(stderr, "%s: message of %u bytes does not fit in a frame\n", MBOTLINK_TAG, len);
+        return -1;
+    }
+
+    uint8_t small[512];
+    uint32_t frame_len = (uint32_t)len + MBOTLINK_FRAME_HEADER_LEN + ROS_PKG_LEN;
+    uint8_t *frame = (frame_len <= sizeof(small)) ? small : (uint8_t *)malloc(frame_len);
+    if (frame == NULL) {
+        return -1;
+    }
+    mbotlink_encode(robot_id, topic, data, len, frame);
+
+    int ret = 0;
+    uint32_t written = 0;
+    pthread_mutex_lock(&link->_send_lock);
+    while (written < frame_len) {
+        ssize_t n = write(link->_fd, frame + written, frame_len - written);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                struct pollfd pfd = { .fd = link->_fd, .events = POLLOUT };
+                poll(&pfd, 1, 100);
+                continue;
+            }
+            fprintf(stderr, "%s: write failed: %s\n", MBOTLINK_TAG, strerror(errno));
+            ret = -1;
+            break;
+        }
+        written += n;
+    }
+    pthread_mutex_unlock(&link->_send_lock);
+    atomic_fetch_add_explicit(&link->_bytes_sent, written, memory_order_relaxed);
+
+    if (frame != small) {
+        free(frame);
+    }
+    return ret;
+}
+
+void mbotlink_get_stats(mbotlink_t *link, mbotlink_stats_t *stats) {
+    if (link == NULL || stats == NULL) {
+        return;
+    }
+    stats->bytes_read = atomic_load(&link->_bytes_read);
+    stats->bytes_sent = atomic_load(&link->_bytes_sent);
+    stats->frames = atomic_load(&link->_frames);
+    stats->dispatched = atomic_load(&link->_dispatched);
+    stats->sync_errors = atomic_load(&link->_sync_errors);
+    stats->checksum_errors = atomic_load(&link->_checksum_errors);
+    stats->reads = atomic_load(&link->_reads);
+    stats->ring_full_waits = atomic_load(&link->_ring_full_waits);
+    stats->ring_high_water = atomic_load(&link->_ring_high_water);
+}
+
+void mbotlink_close(mbotlink_t *link) {
+    if (link == NULL) {
+        return;
+    }
+
+    if (link->_started) {
+        atomic_store(&link->_running, 0);
+        uint8_t wake = 1;
+        ssize_t res = write(link->_wake_pipe[1], &wake, 1);
+        (void)res;
+
+        pthread_mutex_lock(&link->_lock);
+        pthread_cond_broadcast(&link->_data_cond);
+        pthread_cond_broadcast(&link->_space_cond);
+        pthread_mutex_unlock(&link->_lock);
+
+        pthread_join(link->_reader, NULL);
+        pthread_join(link->_dispatcher, NULL);
+    }
+
+    close(link->_wake_pipe[0]);
+    close(link->_wake_pipe[1]);
+    close(link->_fd);
+    if (link->_peer_fd >= 0) {
+        close(link->_peer_fd);
+    }
+    munmap(link->_ring, 2 * (size_t)link->_ring_size);
+
+    pthread_mutex_destroy(&link->_lock);
+    pthread_mutex_destroy(&link->_send_lock);
+    pthread_cond_destroy(&link->_data_cond);
+    pthread_cond_destroy(&link->_space_cond);
+    free(link);
+}
@@ -0,0 +1,215 @@
+/**
+ * @file mbotlink_loopback.c
+ * @brief Loopback self test and throughput benchmark for libmbotlink.
+ *
+ * A writer thread plays the part of a command link on the slave side of a pseudo terminal
+ * and streams lidar scans from several simulated robots, with junk bytes injected every
+ * so often to exercise resynchronization. The link on the master side checks that every
+ * scan arrives intact and in order, then the send path is checked in the other direction.
+ *
+ * Usage: mbotlink_loopback [-n frames] [-r robots]
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mbotlink.h"
+
+#define LOOPBACK_MAX_ROBOTS     32
+#define LOOPBACK_JUNK_PERIOD    97
+#define LOOPBACK_WRITE_BATCH    (256 * 1024)
+
+typedef struct loopback_t {
+    char peer_path[64];
+    uint32_t num_frames;
+    uint32_t num_robots;
+    uint64_t next_seq[LOOPBACK_MAX_ROBOTS];
+    _Atomic uint64_t received;
+    _Atomic uint64_t corrupted;
+} loopback_t;
+
+static double _now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void _fill_scan(serial_lidar_scan_t *scan, uint64_t seq) {
+    memset(scan, 0, sizeof(serial_lidar_scan_t));
+    scan->utime = (int64_t)seq;
+    for (int i = 0; i < 360; i++) {
+        scan->ranges[i] = (uint16_t)(seq + i);
+    }
+}
+
+static void _on_scan(uint8_t robot_id, uint16_t topic, const uint8_t *data, uint16_t len, void *ctx) {
+    loopback_t *lb = (loopback_t *)ctx;
+    serial_lidar_scan_t expected;
+
+    if (robot_id >= lb->num_robots || len != sizeof(serial_lidar_scan_t)) {
+        atomic_fetch_add(&lb->corrupted, 1);
+        return;
+    }
+
+    _fill_scan(&expected, lb->next_seq[robot_id]);
+    if (memcmp(data, &expected, len) != 0) {
+        atomic_fetch_add(&lb->corrupted, 1);
+    }
+    lb->next_seq[robot_id]++;
+    atomic_fetch_add(&lb->received, 1);
+}
+
+static void *_writer_thread(void *args) {
+    loopback_t *lb = (loopback_t *)args;
+    int fd = open(lb->peer_path, O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        fprintf(stderr, "unable to open %s: %s\n", lb->peer_path, strerror(errno));
+        return NULL;
+    }
+
+    uint8_t *batch = (uint8_t *)malloc(LOOPBACK_WRITE_BATCH);
+    uint32_t batch_len = 0;
+    uint64_t seq[LOOPBACK_MAX_ROBOTS] = {0};
+    const uint8_t junk[] = { SYNC_FLAG, 0x00, 0x10, SYNC_FLAG, VERSION_FLAG, 0x42 };
+
+    for (uint32_t i = 0; i < lb->num_frames; i++) {
+        uint8_t robot_id = i % lb->num_robots;
+        serial_lidar_scan_t scan;
+        _fill_scan(&scan, seq[robot_id]++);
+
+        if (batch_len + sizeof(junk) + MBOTLINK_FRAME_HEADER_LEN + ROS_PKG_LEN + sizeof(scan) > LOOPBACK_WRITE_BATCH) {
+            for (uint32_t written = 0; written < batch_len;) {
+                ssize_t n = write(fd, batch + written, batch_len - written);
+                if (n < 0 && errno != EINTR) {
+                    fprintf(stderr, "write failed: %s\n", strerror(errno));
+                    goto done;
+                }
+                written += (n > 0) ? n : 0;
+            }
+            batch_len = 0;
+        }
+
+        if (i % LOOPBACK_JUNK_PERIOD == LOOPBACK_JUNK_PERIOD - 1) {
+            memcpy(batch + batch_len, junk, sizeof(junk));
+            batch_len += sizeof(junk);
+        }
+        batch_len += mbotlink_encode(robot_id, MBOT_LIDAR_SCAN, (uint8_t *)&scan, sizeof(scan), batch + batch_len);
+    }
+
+    for (uint32_t written = 0; written < batch_len;) {
+        ssize_t n = write(fd, batch + written, batch_len - written);
+        if (n < 0 && errno != EINTR) {
+            fprintf(stderr, "write failed: %s\n", strerror(errno));
+            break;
+        }
+        written += (n > 0) ? n : 0;
+    }
+
+done:
+    free(batch);
+    close(fd);
+    return NULL;
+}
+
+/**
+ * @brief Sends a velocity command through the link and checks the bytes on the peer side.
+ *
+ * @return 0 if the frame arrived intact, 1 otherwise.
+ */
+static int _check_send_path(mbotlink_t *link, const char *peer_path) {
+    int fd = open(peer_path, O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        return 1;
+    }
+
+    serial_twist2D_t cmd = { .utime = 42, .vx = 0.25f, .vy = 0.0f, .wz = -1.0f };
+    uint8_t expected[MBOTLINK_FRAME_HEADER_LEN + ROS_PKG_LEN + sizeof(cmd)];
+    uint32_t expected_len = mbotlink_encode(3, MBOT_VEL_CMD, (uint8_t *)&cmd, sizeof(cmd), expected);
+
+    if (mbotlink_send(link, 3, MBOT_VEL_CMD, (uint8_t *)&cmd, sizeof(cmd)) != 0) {
+        close(fd);
+        return 1;
+    }
+
+    uint8_t actual[sizeof(expected)];
+    uint32_t got = 0;
+    while (got < expected_len) {
+        ssize_t n = read(fd, actual + got, expected_len - got);
+        if (n <= 0) {
+            break;
+        }
+        got += n;
+    }
+    close(fd);
+    return (got != expected_len || memcmp(actual, expected, expected_len) != 0);
+}
+
+int main(int argc, char **argv) {
+    loopback_t lb = { .num_frames = 100000, .num_robots = 4 };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+        switch (opt) {
+        case 'n':
+            lb.num_frames = strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            lb.num_robots = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n frames] [-r robots]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (lb.num_robots == 0 || lb.num_robots > LOOPBACK_MAX_ROBOTS) {
+        fprintf(stderr, "robots must be between 1 and %d\n", LOOPBACK_MAX_ROBOTS);
+        return 2;
+    }
+
+    mbotlink_t *link = mbotlink_open_pty(lb.peer_path, sizeof(lb.peer_path));
+    if (link == NULL) {
+        return 1;
+    }
+    mbotlink_subscribe(link, MBOTLINK_ANY_ROBOT, MBOT_LIDAR_SCAN, _on_scan, &lb);
+    mbotlink_start(link);
+
+    double start = _now_s();
+    pthread_t writer;
+    pthread_create(&writer, NULL, _writer_thread, &lb);
+
+    while (atomic_load(&lb.received) + atomic_load(&lb.corrupted) < lb.num_frames && _now_s() - start < 30.0) {
+        usleep(1000);
+    }
+    double elapsed = _now_s() - start;
+    pthread_join(writer, NULL);
+
+    int send_err = _check_send_path(link, lb.peer_path);
+
+    mbotlink_stats_t stats;
+    mbotlink_get_stats(link, &stats);
+    mbotlink_close(link);
+
+    uint64_t received = atomic_load(&lb.received);
+    uint64_t corrupted = atomic_load(&lb.corrupted);
+    printf("frames:          %lu/%u from %u robots\n", (unsigned long)received, lb.num_frames, lb.num_robots);
+    printf("corrupted:       %lu\n", (unsigned long)corrupted);
+    printf("elapsed:         %.3f s\n", elapsed);
+    printf("throughput:      %.0f frames/s, %.2f MB/s\n", received / elapsed, stats.bytes_read / elapsed / 1e6);
+    printf("reads:           %lu (%.1f frames/read)\n", (unsigned long)stats.reads, stats.reads ? (double)stats.frames / stats.reads : 0.0);
+    printf("sync errors:     %lu bytes skipped\n", (unsigned long)stats.sync_errors);
+    printf("checksum errors: %lu\n", (unsigned long)stats.checksum_errors);
+    printf("ring high water: %u bytes\n", stats.ring_high_water);
+    printf("send path:       %s\n", send_err ? "FAILED" : "ok");
+
+    return (received != lb.num_frames || corrupted != 0 || send_err) ? 1 : 0;
+}
@@ -0,0 +1,74 @@
+/**
+ * @file mbotlink_stat.c
+ * @brief Prints per robot, per topic packet rates from a command link once per second.
+ *
+ * The command link exposes a control port and a bulk port, pass both to see every topic.
+ *
+ * Usage: mbotlink_stat [control device] [bulk device]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "mbotlink.h"
+
+#define STAT_MAX_ROBOTS     256
+#define STAT_MAX_TOPICS     256
+#define STAT_MAX_LINKS      2
+
+static _Atomic uint32_t counts[STAT_MAX_ROBOTS][STAT_MAX_TOPICS];
+
+static void _on_packet(uint8_t robot_id, uint16_t topic, const uint8_t *data, uint16_t len, void *ctx) {
+    if (topic < STAT_MAX_TOPICS) {
+        atomic_fetch_add_explicit(&counts[robot_id][topic], 1, memory_order_relaxed);
+    }
+}
+
+int main(int argc, char **argv) {
+    const char *default_device = "/dev/ttyACM0";
+    const char **devices = (argc > 1) ? (const char **)argv + 1 : &default_device;
+    int num_links = (argc > 1) ? argc - 1 : 1;
+    if (num_links > STAT_MAX_LINKS) {
+        num_links = STAT_MAX_LINKS;
+    }
+
+    mbotlink_t *links[STAT_MAX_LINKS];
+    for (int i = 0; i < num_links; i++) {
+        links[i] = mbotlink_open(devices[i]);
+        if (links[i] == NULL) {
+            return 1;
+        }
+        mbotlink_subscribe(links[i], MBOTLINK_ANY_ROBOT, MBOTLINK_ANY_TOPIC, _on_packet, NULL);
+        mbotlink_start(links[i]);
+    }
+
+    while (true) {
+        sleep(1);
+        for (int robot = 0; robot < STAT_MAX_ROBOTS; robot++) {
+            for (int topic = 0; topic < STAT_MAX_TOPICS; topic++) {
+                uint32_t n = atomic_exchange_explicit(&counts[robot][topic], 0, memory_order_relaxed);
+                if (n) {
+                    printf("robot %3d topic %3d: %5u Hz\n", robot, topic, n);
+                }
+            }
+        }
+
+        for (int i = 0; i < num_links; i++) {
+            mbotlink_stats_t stats;
+            mbotlink_get_stats(links[i], &stats);
+            printf("%s: %lu frames, %lu bytes, %lu sync errors, %lu checksum errors\n",
+                   devices[i], (unsigned long)stats.frames, (unsigned long)stats.bytes_read,
+                   (unsigned long)stats.sync_errors, (unsigned long)stats.checksum_errors);
+        }
+        printf("\n");
+    }
+
+    for (int i = 0; i < num_links; i++) {
+        mbotlink_close(links[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,73 @@
+/**
+ * @file mbotlink_top.c
+ * @brief Prints the task and heap diagnostics of the robots and the command link as they arrive.
+ *
+ * Diagnostics are sent on the control port every few seconds, tasks are listed by CPU share.
+ *
+ * Usage: mbotlink_top [control device]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "mbotlink.h"
+
+static const char *task_states[] = { "running", "ready", "blocked", "suspended", "deleted" };
+
+static int _compare_cpu(const void *a, const void *b) {
+    const serial_task_stats_t *x = (const serial_task_stats_t *)a, *y = (const serial_task_stats_t *)b;
+    return (int)y->cpu_permille - (int)x->cpu_permille;
+}
+
+static void _on_diagnostics(uint8_t robot_id, uint16_t topic, const uint8_t *data, uint16_t len, void *ctx) {
+    serial_diagnostics_t diag;
+    if (len < sizeof(diag)) {
+        return;
+    }
+    memcpy(&diag, data, sizeof(diag));
+    if (len < sizeof(diag) + diag.num_tasks * sizeof(serial_task_stats_t)) {
+        return;
+    }
+
+    serial_task_stats_t tasks[256];
+    memcpy(tasks, data + sizeof(diag), diag.num_tasks * sizeof(serial_task_stats_t));
+    qsort(tasks, diag.num_tasks, sizeof(serial_task_stats_t), _compare_cpu);
+
+    // The command link reports its own diagnostics with robot id 0xFF
+    if (robot_id == 0xFF) {
+        printf("command link");
+    }
+    else {
+        printf("robot %d", robot_id);
+    }
+    printf(": heap %u free, %u min free, %u largest block, cpu over %.1f s\n", diag.heap_free, diag.heap_min_free,
+           diag.heap_largest_block, diag.period_us / 1e6);
+    for (int i = 0; i < diag.num_tasks; i++) {
+        char name[sizeof(tasks[i].name) + 1] = {0};
+        memcpy(name, tasks[i].name, sizeof(tasks[i].name));
+        printf("  %-16s prio %2u %-9s cpu %5.1f%%  stack free %6u\n", name, tasks[i].priority,
+               tasks[i].state < 5 ? task_states[tasks[i].state] : "?", tasks[i].cpu_permille / 10.0, tasks[i].stack_free);
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    const char *device = (argc > 1) ? argv[1] : "/dev/ttyACM0";
+    mbotlink_t *link = mbotlink_open(device);
+    if (link == NULL) {
+        return 1;
+    }
+    mbotlink_subscribe(link, MBOTLINK_ANY_ROBOT, MBOT_DIAGNOSTICS, _on_diagnostics, NULL);
+    mbotlink_start(link);
+
+    while (true) {
+        sleep(1);
+    }
+
+    mbotlink_close(link);
+    return 0;
+}
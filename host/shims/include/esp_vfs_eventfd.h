@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stddef.h>
+#include <sys/eventfd.h>
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    size_t max_fds;
+} esp_vfs_eventfd_config_t;
+
+#define ESP_VFS_EVENTD_CONFIG_DEFAULT() (esp_vfs_eventfd_config_t) { .max_fds = 5 }
+
+/* Linux has eventfd built in, nothing to register */
+static inline esp_err_t esp_vfs_eventfd_register(const esp_vfs_eventfd_config_t *config) {
+    (void)config;
+    return ESP_OK;
+}
+
+#ifdef __cplusplus
+}
+#endif
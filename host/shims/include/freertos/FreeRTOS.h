@@ -0,0 +1,69 @@
+/**
+ * @file FreeRTOS.h
+ * @brief Host (POSIX) stand-in for the subset of FreeRTOS used by the firmware components.
+ *
+ * Tasks are pthreads, queues and semaphores are mutex/condition variable backed, and one
+ * tick is one millisecond. Priorities and core affinity are accepted and ignored. This
+ * exists so components can be built and benchmarked on a Linux host, it is not a port.
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t StackType_t;
+typedef void (*TaskFunction_t)(void *);
+typedef struct shim_static_task_t { int _unused; } StaticTask_t;
+
+typedef struct shim_mux_t { int _unused; } portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED    { 0 }
+#define portMAX_DELAY                   ((TickType_t)0xffffffffUL)
+#define configTICK_RATE_HZ              1000
+#define portTICK_PERIOD_MS              ((TickType_t)1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms)               ((TickType_t)(ms) / portTICK_PERIOD_MS)
+#define configMAX_TASK_NAME_LEN         16
+#define tskIDLE_PRIORITY                0
+#define tskNO_AFFINITY                  0x7FFFFFFF
+#define portNUM_PROCESSORS              2
+
+#define pdFALSE                         0
+#define pdTRUE                          1
+#define pdFAIL                          pdFALSE
+#define pdPASS                          pdTRUE
+
+#define BIT0    0x00000001
+#define BIT1    0x00000002
+#define BIT2    0x00000004
+#define BIT3    0x00000008
+#define BIT4    0x00000010
+#define BIT5    0x00000020
+#define BIT6    0x00000040
+#define BIT7    0x00000080
+
+/* Critical sections map onto one process wide recursive mutex */
+void shim_enter_critical(void);
+void shim_exit_critical(void);
+
+#define taskENTER_CRITICAL(mux)         ((void)(mux), shim_enter_critical())
+#define taskEXIT_CRITICAL(mux)          ((void)(mux), shim_exit_critical())
+#define portENTER_CRITICAL(mux)         taskENTER_CRITICAL(mux)
+#define portEXIT_CRITICAL(mux)          taskEXIT_CRITICAL(mux)
+#define xPortInIsrContext()             0
+#define portYIELD_FROM_ISR(x)           ((void)(x))
+
+#ifdef __cplusplus
+}
+#endif
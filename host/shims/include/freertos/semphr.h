@@ -0,0 +1,26 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Semaphores are queues of zero sized items, as in FreeRTOS (without priority inheritance) */
+typedef QueueHandle_t SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count);
+
+#define xSemaphoreCreateBinary()                xSemaphoreCreateCounting(1, 0)
+#define xSemaphoreCreateMutex()                 xSemaphoreCreateCounting(1, 1)
+#define xSemaphoreTake(sem, ticks)              xQueueReceive(sem, NULL, ticks)
+#define xSemaphoreGive(sem)                     xQueueSend(sem, NULL, 0)
+#define xSemaphoreTakeFromISR(sem, woken)       ((void)(woken), xQueueReceive(sem, NULL, 0))
+#define xSemaphoreGiveFromISR(sem, woken)       ((void)(woken), xQueueSend(sem, NULL, 0))
+#define uxSemaphoreGetCount(sem)                uxQueueMessagesWaiting(sem)
+#define vSemaphoreDelete(sem)                   vQueueDelete(sem)
+
+#ifdef __cplusplus
+}
+#endif
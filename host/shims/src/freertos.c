@@ -0,0 +1,314 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+struct shim_task_t {
+    pthread_t thread;
+    TaskFunction_t function;
+    void *params;
+    char name[configMAX_TASK_NAME_LEN];
+};
+
+struct shim_queue_t {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    uint8_t *items;
+    UBaseType_t item_size;
+    UBaseType_t length;
+    UBaseType_t head;
+    UBaseType_t count;
+};
+
+static pthread_mutex_t critical_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+static __thread struct shim_task_t *current_task = NULL;
+
+void shim_enter_critical(void) {
+    pthread_mutex_lock(&critical_lock);
+}
+
+void shim_exit_critical(void) {
+    pthread_mutex_unlock(&critical_lock);
+}
+
+/* Tasks */
+
+static void *_shim_task_entry(void *args) {
+    struct shim_task_t *task = (struct shim_task_t *)args;
+    current_task = task;
+    task->function(task->params);
+    // FreeRTOS tasks must not return, treat it like vTaskDelete(NULL)
+    free(task);
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stack_depth, void *params, UBaseType_t priority, TaskHandle_t *handle) {
+    struct shim_task_t *task = (struct shim_task_t *)calloc(1, sizeof(struct shim_task_t));
+    if (task == NULL) {
+        return pdFAIL;
+    }
+    task->function = function;
+    task->params = params;
+    strncpy(task->name, name ? name : "", sizeof(task->name) - 1);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int err = pthread_create(&task->thread, &attr, _shim_task_entry, task);
+    pthread_attr_destroy(&attr);
+    if (err != 0) {
+        free(task);
+        return pdFAIL;
+    }
+    pthread_setname_np(task->thread, task->name);
+    if (handle != NULL) {
+        *handle = task;
+    }
+    return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stack_depth, void *params, UBaseType_t priority, TaskHandle_t *handle, BaseType_t core_id) {
+    return xTaskCreate(function, name, stack_depth, params, priority, handle);
+}
+
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t function, const char *name, uint32_t stack_depth, void *params, UBaseType_t priority,
+                                           StackType_t *stack, StaticTask_t *tcb, BaseType_t core_id) {
+    TaskHandle_t handle = NULL;
+    if (xTaskCreate(function, name, stack_depth, params, priority, &handle) != pdPASS) {
+        return NULL;
+    }
+    return handle;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    if (task == NULL || task == current_task) {
+        free(current_task);
+        current_task = NULL;
+        pthread_exit(NULL);
+    }
+    // Deleting another task is not supported on the host
+}
+
+TickType_t xTaskGetTickCount(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (TickType_t)((uint64_t)ts.tv_sec * configTICK_RATE_HZ + (uint64_t)ts.tv_nsec / (1000000000 / configTICK_RATE_HZ));
+}
+
+void vTaskDelay(TickType_t ticks) {
+    if (ticks == 0) {
+        sched_yield();
+        return;
+    }
+    struct timespec ts = {
+        .tv_sec = ticks / configTICK_RATE_HZ,
+        .tv_nsec = (long)(ticks % configTICK_RATE_HZ) * (1000000000 / configTICK_RATE_HZ)
+    };
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+}
+
+BaseType_t xTaskDelayUntil(TickType_t *previous_wake_time, TickType_t increment) {
+    TickType_t wake_time = *previous_wake_time + increment;
+    TickType_t now = xTaskGetTickCount();
+    *previous_wake_time = wake_time;
+    if ((int32_t)(wake_time - now) <= 0) {
+        return pdFALSE;
+    }
+    vTaskDelay(wake_time - now);
+    return pdTRUE;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    return current_task;
+}
+
+/* Queues */
+
+static void _shim_deadline(struct timespec *deadline, TickType_t ticks) {
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    uint64_t ns = (uint64_t)deadline->tv_nsec + (uint64_t)ticks * (1000000000 / configTICK_RATE_HZ);
+    deadline->tv_sec += ns / 1000000000;
+    deadline->tv_nsec = ns % 1000000000;
+}
+
+/**
+ * @brief Waits on a condition variable with FreeRTOS timeout semantics.
+ *
+ * @return 0 if woken, ETIMEDOUT if the wait timed out (immediately for ticks == 0).
+ */
+static int _shim_wait(pthread_cond_t *cond, pthread_mutex_t *lock, TickType_t ticks, const struct timespec *deadline) {
+    if (ticks == 0) {
+        return ETIMEDOUT;
+    }
+    if (ticks == portMAX_DELAY) {
+        return pthread_cond_wait(cond, lock);
+    }
+    return pthread_cond_timedwait(cond, lock, deadline);
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    if (length == 0) {
+        return NULL;
+    }
+    struct shim_queue_t *queue = (struct shim_queue_t *)calloc(1, sizeof(struct shim_queue_t));
+    if (queue == NULL) {
+        return NULL;
+    }
+    if (item_size > 0) {
+        queue->items = (uint8_t *)malloc((size_t)length * item_size);
+        if (queue->items == NULL) {
+            free(queue);
+            return NULL;
+        }
+    }
+    queue->item_size = item_size;
+    queue->length = length;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->not_empty, &attr);
+    pthread_cond_init(&queue->not_full, &attr);
+    pthread_condattr_destroy(&attr);
+    return queue;
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count) {
+    QueueHandle_t queue = xQueueCreate(max_count, 0);
+    if (queue != NULL) {
+        queue->count = initial_count;
+    }
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+    if (queue == NULL) {
+        return;
+    }
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_cond_destroy(&queue->not_full);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue->items);
+    free(queue);
+}
+
+static BaseType_t _shim_queue_send(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait, uint8_t to_front) {
+    if (queue == NULL) {
+        return pdFAIL;
+    }
+    struct timespec deadline;
+    _shim_deadline(&deadline, ticks_to_wait);
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == queue->length) {
+        if (_shim_wait(&queue->not_full, &queue->lock, ticks_to_wait, &deadline) == ETIMEDOUT) {
+            pthread_mutex_unlock(&queue->lock);
+            return pdFAIL;
+        }
+    }
+
+    if (queue->item_size > 0) {
+        UBaseType_t idx;
+        if (to_front) {
+            queue->head = (queue->head + queue->length - 1) % queue->length;
+            idx = queue->head;
+        }
+        else {
+            idx = (queue->head + queue->count) % queue->length;
+        }
+        memcpy(queue->items + (size_t)idx * queue->item_size, item, queue->item_size);
+    }
+    queue->count++;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+    return pdPASS;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait) {
+    return _shim_queue_send(queue, item, ticks_to_wait, 0);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait) {
+    return _shim_queue_send(queue, item, ticks_to_wait, 1);
+}
+
+static BaseType_t _shim_queue_receive(QueueHandle_t queue, void *buffer, TickType_t ticks_to_wait, uint8_t remove) {
+    if (queue == NULL) {
+        return pdFAIL;
+    }
+    struct timespec deadline;
+    _shim_deadline(&deadline, ticks_to_wait);
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0) {
+        if (_shim_wait(&queue->not_empty, &queue->lock, ticks_to_wait, &deadline) == ETIMEDOUT) {
+            pthread_mutex_unlock(&queue->lock);
+            return pdFAIL;
+        }
+    }
+
+    if (queue->item_size > 0 && buffer != NULL) {
+        memcpy(buffer, queue->items + (size_t)queue->head * queue->item_size, queue->item_size);
+    }
+    if (remove) {
+        queue->head = (queue->item_size > 0) ? (queue->head + 1) % queue->length : 0;
+        queue->count--;
+        pthread_cond_signal(&queue->not_full);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticks_to_wait) {
+    return _shim_queue_receive(queue, buffer, ticks_to_wait, 1);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void *buffer, TickType_t ticks_to_wait) {
+    return _shim_queue_receive(queue, buffer, ticks_to_wait, 0);
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue) {
+    if (queue == NULL) {
+        return pdFAIL;
+    }
+    pthread_mutex_lock(&queue->lock);
+    queue->head = 0;
+    queue->count = 0;
+    pthread_cond_broadcast(&queue->not_full);
+    pthread_mutex_unlock(&queue->lock);
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+    if (queue == NULL) {
+        return 0;
+    }
+    pthread_mutex_lock(&queue->lock);
+    UBaseType_t count = queue->count;
+    pthread_mutex_unlock(&queue->lock);
+    return count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue) {
+    if (queue == NULL) {
+        return 0;
+    }
+    pthread_mutex_lock(&queue->lock);
+    UBaseType_t spaces = queue->length - queue->count;
+    pthread_mutex_unlock(&queue->lock);
+    return spaces;
+}
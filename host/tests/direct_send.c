@@ -0,0 +1,205 @@
+/**
+ * @file direct_send.c
+ * @brief Tests of direct_send and direct_receive against the mock ESP-NOW driver.
+ *
+ * Sends messages with every send window and checks the fragments the driver was handed, that a
+ * failed or late fragment fails the send and the next send still works, that acks sent while a
+ * message is in flight never take its statuses, and that direct_receive rejects a message with a
+ * fragment missing.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "direct.h"
+#include "esp_now_mock.h"
+
+#define TEST_MESSAGE_LEN    2000    // 9 fragments
+#define TEST_FRAGMENT_LEN   248
+#define TEST_HEADER_LEN     2
+#define TEST_ACK_ROUNDS     50
+
+// Not in direct.h, the receive callbacks call it
+void _direct_send_ack(const uint8_t *mac);
+
+static uint32_t failures = 0;
+
+static const uint8_t peer[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x02 };
+static const uint8_t other_peer[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x03 };
+static uint8_t message[TEST_MESSAGE_LEN];
+
+#define TEST_CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+static uint32_t num_fragments(uint32_t len) {
+    return (len + TEST_FRAGMENT_LEN - 1) / TEST_FRAGMENT_LEN;
+}
+
+// Each fragment is [TYPE, INDEX, DATA] and together they hold the message in order
+static void check_fragments(uint32_t len) {
+    uint32_t count = num_fragments(len);
+    TEST_CHECK(esp_now_mock_data_frames() == count);
+    uint32_t offset = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        esp_now_mock_frame_t frame;
+        TEST_CHECK(esp_now_mock_frame(i, &frame) == 0);
+        uint8_t type = (count == 1) ? 3 : (i == 0) ? 0 : (i == count - 1) ? 2 : 1;
+        TEST_CHECK(frame.data[0] == type);
+        TEST_CHECK(frame.data[1] == (uint8_t)i);
+        uint32_t data_len = frame.len - TEST_HEADER_LEN;
+        TEST_CHECK(offset + data_len <= len && memcmp(frame.data + TEST_HEADER_LEN, message + offset, data_len) == 0);
+        offset += data_len;
+    }
+    TEST_CHECK(offset == len);
+}
+
+static void test_windows(void) {
+    for (uint8_t window = 1; window <= DIRECT_MAX_SEND_WINDOW; window *= 2) {
+        esp_now_mock_reset(4, 1, -1);
+        direct_set_send_window(window, 25);
+        TEST_CHECK(direct_send(peer, message, TEST_MESSAGE_LEN) == 0);
+        check_fragments(TEST_MESSAGE_LEN);
+        uint32_t in_flight = esp_now_mock_max_in_flight();
+        TEST_CHECK(in_flight <= window && in_flight <= 4);
+        TEST_CHECK(window == 1 || in_flight > 1);
+    }
+
+    esp_now_mock_reset(4, 1, -1);
+    TEST_CHECK(direct_send(peer, message, 100) == 0);
+    check_fragments(100);
+
+    esp_now_mock_reset(4, 1, -1);
+    TEST_CHECK(direct_send(peer, message, 0) == 0);
+    TEST_CHECK(esp_now_mock_data_frames() == 0);
+}
+
+static void test_failures(void) {
+    direct_set_send_window(4, 25);
+
+    // The status of fragment 3 is a failure, the send stops there
+    esp_now_mock_reset(4, 1, 3);
+    TEST_CHECK(direct_send(peer, message, TEST_MESSAGE_LEN) == 1);
+    TEST_CHECK(esp_now_mock_data_frames() < num_fragments(TEST_MESSAGE_LEN));
+    esp_now_mock_reset(4, 1, -1);
+    TEST_CHECK(direct_send(peer, message, TEST_MESSAGE_LEN) == 0);
+    check_fragments(TEST_MESSAGE_LEN);
+
+    // Callbacks 5 ms apart with 3 ms allowed per fragment, the late statuses must not leak into the next send
+    esp_now_mock_reset(8, 5, -1);
+    direct_set_send_window(4, 3);
+    TEST_CHECK(direct_send(peer, message, TEST_MESSAGE_LEN) == 1);
+    esp_now_mock_reset(4, 1, -1);
+    direct_set_send_window(4, 25);
+    TEST_CHECK(direct_send(peer, message, TEST_MESSAGE_LEN) == 0);
+    check_fragments(TEST_MESSAGE_LEN);
+}
+
+static volatile uint8_t acking = 0;
+
+static void *ack_thread(void *args) {
+    while (acking) {
+        _direct_send_ack(other_peer);
+        usleep(2000);
+    }
+    return NULL;
+}
+
+// The mock fails every ack, so a swapped status fails the fragment it lands on
+static void test_concurrent_acks(void) {
+    esp_now_mock_reset(6, 1, -1);
+    direct_set_send_window(4, 25);
+    acking = 1;
+    pthread_t thread;
+    pthread_create(&thread, NULL, ack_thread, NULL);
+    uint32_t failed = 0;
+    for (uint32_t i = 0; i < TEST_ACK_ROUNDS; i++) {
+        failed += direct_send(peer, message, TEST_MESSAGE_LEN);
+    }
+    acking = 0;
+    pthread_join(thread, NULL);
+    TEST_CHECK(failed == 0);
+    TEST_CHECK(esp_now_mock_control_frames() > 0);
+}
+
+static void receive_frames(const uint8_t *src, uint32_t skip) {
+    uint32_t count = esp_now_mock_data_frames();
+    for (uint32_t i = 0; i < count; i++) {
+        esp_now_mock_frame_t frame;
+        if (i != skip && esp_now_mock_frame(i, &frame) == 0) {
+            esp_now_mock_receive(src, frame.data, frame.len);
+        }
+    }
+}
+
+static void flush_receive(void) {
+    uint8_t mac[6];
+    uint8_t buffer[TEST_MESSAGE_LEN];
+    uint32_t len;
+    for (uint32_t i = 0; i < 2 * num_fragments(TEST_MESSAGE_LEN); i++) {
+        direct_receive(mac, buffer, &len);
+    }
+}
+
+static void test_receive(void) {
+    esp_now_mock_reset(4, 1, -1);
+    direct_set_send_window(4, 25);
+    TEST_CHECK(direct_send(peer, message, TEST_MESSAGE_LEN) == 0);
+
+    uint8_t mac[6];
+    uint8_t buffer[TEST_MESSAGE_LEN];
+    uint32_t len = 0;
+    receive_frames(peer, UINT32_MAX);
+    TEST_CHECK(direct_receive(mac, buffer, &len) == 0);
+    TEST_CHECK(len == TEST_MESSAGE_LEN && memcmp(buffer, message, len) == 0);
+    TEST_CHECK(memcmp(mac, peer, 6) == 0);
+
+    // A middle fragment lost while the last one still arrived
+    receive_frames(peer, 4);
+    TEST_CHECK(direct_receive(mac, buffer, &len) == 1);
+    flush_receive();
+
+    // A fragment of another peer in the middle of the message
+    uint32_t count = esp_now_mock_data_frames();
+    for (uint32_t i = 0; i < count; i++) {
+        esp_now_mock_frame_t frame;
+        TEST_CHECK(esp_now_mock_frame(i, &frame) == 0);
+        esp_now_mock_receive((i == 2) ? other_peer : peer, frame.data, frame.len);
+    }
+    TEST_CHECK(direct_receive(mac, buffer, &len) == 1);
+    flush_receive();
+
+    receive_frames(peer, UINT32_MAX);
+    TEST_CHECK(direct_receive(mac, buffer, &len) == 0);
+    TEST_CHECK(len == TEST_MESSAGE_LEN && memcmp(buffer, message, len) == 0);
+}
+
+int main(void) {
+    for (uint32_t i = 0; i < TEST_MESSAGE_LEN; i++) {
+        message[i] = (uint8_t)(i * 7 + i / 256);
+    }
+    esp_log_level_set("*", ESP_LOG_NONE);
+    if (direct_client_init()) {
+        printf("direct_send: direct_client_init failed\n");
+        return 1;
+    }
+
+    test_windows();
+    test_failures();
+    test_concurrent_acks();
+    test_receive();
+    if (failures > 0) {
+        printf("direct_send: %u checks failed\n", failures);
+        return 1;
+    }
+    printf("direct_send: ok\n");
+    return 0;
+}
@@ -0,0 +1,295 @@
+/**
+ * @file esp_now_mock.c
+ * @brief Mock ESP-NOW driver and event groups for running direct.c on the host.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "esp_now.h"
+#include "esp_now_mock.h"
+
+#define MOCK_MAX_PENDING 256
+#define MOCK_SEND_US 200
+
+// Acks and disconnects are [DIRECT_SINGLE, type], a data frame always carries data after its header
+#define MOCK_IS_CONTROL(data, len) ((len) == 2 && (data)[0] == 3)
+
+static pthread_mutex_t mock_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mock_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t driver_thread;
+static uint8_t driver_started = 0;
+
+static esp_now_send_cb_t send_cb = NULL;
+static esp_now_recv_cb_t recv_cb = NULL;
+
+static uint8_t peer_mac[ESP_NOW_ETH_ALEN];
+static esp_now_send_status_t pending[MOCK_MAX_PENDING];
+static uint32_t pending_head = 0;
+static uint32_t pending_tail = 0;
+static uint32_t in_callback = 0;
+
+static uint32_t depth = 4;
+static uint32_t delay_ms = 1;
+static int32_t fail_at = -1;
+
+static esp_now_mock_frame_t frames[ESP_NOW_MOCK_MAX_FRAMES];
+static uint32_t data_frames = 0;
+static uint32_t control_frames = 0;
+static uint32_t max_in_flight = 0;
+
+// Runs the send callbacks in send order, like the Wi-Fi task
+static void *_mock_driver(void *args) {
+    while (1) {
+        usleep(delay_ms * 1000);
+        pthread_mutex_lock(&mock_lock);
+        if (pending_head == pending_tail) {
+            pthread_mutex_unlock(&mock_lock);
+            continue;
+        }
+        // The frame is out once its callback runs, the sender may queue the next one from there
+        esp_now_send_status_t status = pending[pending_head % MOCK_MAX_PENDING];
+        pending_head++;
+        in_callback = 1;
+        pthread_mutex_unlock(&mock_lock);
+
+        if (send_cb != NULL) {
+            send_cb(peer_mac, status);
+        }
+
+        pthread_mutex_lock(&mock_lock);
+        in_callback = 0;
+        pthread_cond_broadcast(&mock_cond);
+        pthread_mutex_unlock(&mock_lock);
+    }
+    return NULL;
+}
+
+esp_err_t esp_now_init(void) {
+    pthread_mutex_lock(&mock_lock);
+    if (!driver_started) {
+        pthread_create(&driver_thread, NULL, _mock_driver, NULL);
+        pthread_detach(driver_thread);
+        driver_started = 1;
+    }
+    pthread_mutex_unlock(&mock_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_now_deinit(void) {
+    return ESP_OK;
+}
+
+esp_err_t esp_now_send(const uint8_t *peer_addr, const uint8_t *data, size_t len) {
+    if (len == 0 || len > ESP_NOW_MAX_DATA_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // Takes a while like the driver does, so two senders racing to it are likely to overtake
+    usleep(MOCK_SEND_US);
+    pthread_mutex_lock(&mock_lock);
+    uint32_t in_flight = pending_tail - pending_head;
+    if (in_flight >= depth) {
+        pthread_mutex_unlock(&mock_lock);
+        return ESP_ERR_ESPNOW_NO_MEM;
+    }
+
+    esp_now_send_status_t status = ESP_NOW_SEND_FAIL;
+    if (!MOCK_IS_CONTROL(data, len)) {
+        status = ((int32_t)data_frames == fail_at) ? ESP_NOW_SEND_FAIL : ESP_NOW_SEND_SUCCESS;
+        esp_now_mock_frame_t *frame = &frames[data_frames % ESP_NOW_MOCK_MAX_FRAMES];
+        memcpy(frame->data, data, len);
+        frame->len = len;
+        data_frames++;
+    } else {
+        control_frames++;
+    }
+    memcpy(peer_mac, peer_addr, ESP_NOW_ETH_ALEN);
+    pending[pending_tail % MOCK_MAX_PENDING] = status;
+    pending_tail++;
+    if (in_flight + 1 > max_in_flight) {
+        max_in_flight = in_flight + 1;
+    }
+    pthread_mutex_unlock(&mock_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_now_register_send_cb(esp_now_send_cb_t cb) {
+    send_cb = cb;
+    return ESP_OK;
+}
+
+esp_err_t esp_now_register_recv_cb(esp_now_recv_cb_t cb) {
+    recv_cb = cb;
+    return ESP_OK;
+}
+
+esp_err_t esp_now_unregister_send_cb(void) {
+    send_cb = NULL;
+    return ESP_OK;
+}
+
+esp_err_t esp_now_unregister_recv_cb(void) {
+    recv_cb = NULL;
+    return ESP_OK;
+}
+
+// Every peer is known, the tests do not go through pairing
+esp_err_t esp_now_add_peer(const esp_now_peer_info_t *peer) {
+    return ESP_OK;
+}
+
+esp_err_t esp_now_del_peer(const uint8_t *peer_addr) {
+    return ESP_OK;
+}
+
+bool esp_now_is_peer_exist(const uint8_t *peer_addr) {
+    return true;
+}
+
+esp_err_t esp_now_get_peer_num(esp_now_peer_num_t *num) {
+    num->total_num = 0;
+    num->encrypt_num = 0;
+    return ESP_OK;
+}
+
+esp_err_t esp_now_fetch_peer(bool from_head, esp_now_peer_info_t *peer) {
+    return ESP_ERR_NOT_FOUND;
+}
+
+void esp_now_mock_reset(uint32_t new_depth, uint32_t new_delay_ms, int32_t new_fail_at) {
+    esp_now_mock_drain();
+    pthread_mutex_lock(&mock_lock);
+    depth = (new_depth > MOCK_MAX_PENDING) ? MOCK_MAX_PENDING : new_depth;
+    delay_ms = new_delay_ms;
+    fail_at = new_fail_at;
+    data_frames = 0;
+    control_frames = 0;
+    max_in_flight = 0;
+    pthread_mutex_unlock(&mock_lock);
+}
+
+void esp_now_mock_drain(void) {
+    pthread_mutex_lock(&mock_lock);
+    while (pending_head != pending_tail || in_callback) {
+        pthread_cond_wait(&mock_cond, &mock_lock);
+    }
+    pthread_mutex_unlock(&mock_lock);
+}
+
+uint8_t esp_now_mock_frame(uint32_t index, esp_now_mock_frame_t *frame) {
+    pthread_mutex_lock(&mock_lock);
+    uint8_t err = index >= data_frames || data_frames - index > ESP_NOW_MOCK_MAX_FRAMES;
+    if (!err) {
+        *frame = frames[index % ESP_NOW_MOCK_MAX_FRAMES];
+    }
+    pthread_mutex_unlock(&mock_lock);
+    return err;
+}
+
+uint32_t esp_now_mock_data_frames(void) {
+    pthread_mutex_lock(&mock_lock);
+    uint32_t count = data_frames;
+    pthread_mutex_unlock(&mock_lock);
+    return count;
+}
+
+uint32_t esp_now_mock_control_frames(void) {
+    pthread_mutex_lock(&mock_lock);
+    uint32_t count = control_frames;
+    pthread_mutex_unlock(&mock_lock);
+    return count;
+}
+
+uint32_t esp_now_mock_max_in_flight(void) {
+    pthread_mutex_lock(&mock_lock);
+    uint32_t count = max_in_flight;
+    pthread_mutex_unlock(&mock_lock);
+    return count;
+}
+
+void esp_now_mock_receive(const uint8_t *src, const uint8_t *data, int len) {
+    static uint8_t own_mac[ESP_NOW_ETH_ALEN] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+    uint8_t src_mac[ESP_NOW_ETH_ALEN];
+    memcpy(src_mac, src, ESP_NOW_ETH_ALEN);
+    esp_now_recv_info_t info = {
+        .src_addr = src_mac,
+        .des_addr = own_mac,
+    };
+    if (recv_cb != NULL) {
+        recv_cb(&info, data, len);
+    }
+}
+
+struct mock_event_group_t {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    EventBits_t bits;
+};
+
+EventGroupHandle_t xEventGroupCreate(void) {
+    EventGroupHandle_t group = (EventGroupHandle_t)calloc(1, sizeof(struct mock_event_group_t));
+    if (group != NULL) {
+        pthread_mutex_init(&group->lock, NULL);
+        pthread_cond_init(&group->cond, NULL);
+    }
+    return group;
+}
+
+void vEventGroupDelete(EventGroupHandle_t group) {
+    pthread_mutex_destroy(&group->lock);
+    pthread_cond_destroy(&group->cond);
+    free(group);
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+    pthread_mutex_lock(&group->lock);
+    group->bits |= bits;
+    EventBits_t value = group->bits;
+    pthread_cond_broadcast(&group->cond);
+    pthread_mutex_unlock(&group->lock);
+    return value;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits) {
+    pthread_mutex_lock(&group->lock);
+    EventBits_t value = group->bits;
+    group->bits &= ~bits;
+    pthread_mutex_unlock(&group->lock);
+    return value;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit,
+                                BaseType_t wait_for_all, TickType_t ticks_to_wait) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    if (ticks_to_wait != portMAX_DELAY) {
+        uint64_t ns = (uint64_t)deadline.tv_nsec + (uint64_t)ticks_to_wait * portTICK_PERIOD_MS * 1000000;
+        deadline.tv_sec += ns / 1000000000;
+        deadline.tv_nsec = ns % 1000000000;
+    }
+
+    pthread_mutex_lock(&group->lock);
+    while (1) {
+        EventBits_t set = group->bits & bits;
+        if ((wait_for_all && set == bits) || (!wait_for_all && set != 0)) {
+            break;
+        }
+        int err = (ticks_to_wait == portMAX_DELAY) ? pthread_cond_wait(&group->cond, &group->lock)
+                                                   : pthread_cond_timedwait(&group->cond, &group->lock, &deadline);
+        if (err != 0) {
+            break;
+        }
+    }
+    EventBits_t value = group->bits;
+    if (clear_on_exit && ((wait_for_all && (value & bits) == bits) || (!wait_for_all && (value & bits) != 0))) {
+        group->bits &= ~bits;
+    }
+    pthread_mutex_unlock(&group->lock);
+    return value;
+}
@@ -0,0 +1,65 @@
+/**
+ * @file esp_now.h
+ * @brief Host stand-in for the ESP-NOW API, backed by the mock driver in esp_now_mock.c.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ESP_NOW_ETH_ALEN            6
+#define ESP_NOW_MAX_DATA_LEN        250
+#define ESP_NOW_MAX_TOTAL_PEER_NUM  20
+
+#define ESP_ERR_ESPNOW_BASE         0x3066
+#define ESP_ERR_ESPNOW_NO_MEM       (ESP_ERR_ESPNOW_BASE + 1)
+
+typedef enum {
+    ESP_NOW_SEND_SUCCESS = 0,
+    ESP_NOW_SEND_FAIL
+} esp_now_send_status_t;
+
+typedef struct esp_now_recv_info {
+    uint8_t *src_addr;
+    uint8_t *des_addr;
+} esp_now_recv_info_t;
+
+typedef struct esp_now_peer_info {
+    uint8_t peer_addr[ESP_NOW_ETH_ALEN];
+    uint8_t channel;
+    int ifidx;
+    bool encrypt;
+} esp_now_peer_info_t;
+
+typedef struct esp_now_peer_num {
+    int total_num;
+    int encrypt_num;
+} esp_now_peer_num_t;
+
+typedef void (*esp_now_send_cb_t)(const uint8_t *mac_addr, esp_now_send_status_t status);
+typedef void (*esp_now_recv_cb_t)(const esp_now_recv_info_t *recv_info, const uint8_t *data, int data_len);
+
+esp_err_t esp_now_init(void);
+esp_err_t esp_now_deinit(void);
+esp_err_t esp_now_send(const uint8_t *peer_addr, const uint8_t *data, size_t len);
+esp_err_t esp_now_register_send_cb(esp_now_send_cb_t cb);
+esp_err_t esp_now_register_recv_cb(esp_now_recv_cb_t cb);
+esp_err_t esp_now_unregister_send_cb(void);
+esp_err_t esp_now_unregister_recv_cb(void);
+esp_err_t esp_now_add_peer(const esp_now_peer_info_t *peer);
+esp_err_t esp_now_del_peer(const uint8_t *peer_addr);
+bool esp_now_is_peer_exist(const uint8_t *peer_addr);
+esp_err_t esp_now_get_peer_num(esp_now_peer_num_t *num);
+esp_err_t esp_now_fetch_peer(bool from_head, esp_now_peer_info_t *peer);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,59 @@
+/**
+ * @file esp_now_mock.h
+ * @brief Controls of the mock ESP-NOW driver the direct.c tests run against.
+ *
+ * esp_now_send queues the frame and a driver thread runs the send callback for one frame every
+ * few milliseconds, in send order, like the Wi-Fi task does. Acks and disconnects always report
+ * ESP_NOW_SEND_FAIL, so a status handed to the wrong sender fails the fragment it lands on.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_now.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ESP_NOW_MOCK_MAX_FRAMES 64  /**< Frames kept for esp_now_mock_frame, older ones are dropped */
+
+typedef struct esp_now_mock_frame_t {
+    uint8_t data[ESP_NOW_MAX_DATA_LEN];
+    uint32_t len;
+} esp_now_mock_frame_t;
+
+/**
+ * @brief Forgets the frames sent so far and sets how the driver behaves from now on.
+ *
+ * @param depth Frames the driver holds before esp_now_send returns ESP_ERR_ESPNOW_NO_MEM.
+ * @param delay_ms Time between two send callbacks.
+ * @param fail_at Index of the data frame, counted from this call, whose status is a failure, -1 for none.
+ */
+void esp_now_mock_reset(uint32_t depth, uint32_t delay_ms, int32_t fail_at);
+
+/**
+ * @brief Returns once every frame sent so far had its send callback.
+ */
+void esp_now_mock_drain(void);
+
+/**
+ * @brief Copies a data frame sent since the last reset.
+ *
+ * @return 0 on success, 1 if there is no such frame.
+ */
+uint8_t esp_now_mock_frame(uint32_t index, esp_now_mock_frame_t *frame);
+
+uint32_t esp_now_mock_data_frames(void);
+uint32_t esp_now_mock_control_frames(void);
+uint32_t esp_now_mock_max_in_flight(void);
+
+/**
+ * @brief Runs the registered receive callback as if src sent data to this device.
+ */
+void esp_now_mock_receive(const uint8_t *src, const uint8_t *data, int len);
+
+#ifdef __cplusplus
+}
+#endif
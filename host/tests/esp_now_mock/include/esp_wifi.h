@@ -0,0 +1,52 @@
+/**
+ * @file esp_wifi.h
+ * @brief Host stand-in for the Wi-Fi calls direct.c makes, they all succeed and do nothing.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MACSTR      "%02x:%02x:%02x:%02x:%02x:%02x"
+#define MAC2STR(a)  (a)[0], (a)[1], (a)[2], (a)[3], (a)[4], (a)[5]
+
+typedef struct {
+    int _unused;
+} wifi_init_config_t;
+
+#define WIFI_INIT_CONFIG_DEFAULT()  { 0 }
+#define WIFI_STORAGE_RAM            1
+#define ESP_IF_WIFI_STA             0
+#define WIFI_SECOND_CHAN_NONE       0
+
+static inline esp_err_t esp_netif_init(void) { return ESP_OK; }
+static inline esp_err_t esp_netif_deinit(void) { return ESP_OK; }
+static inline esp_err_t esp_event_loop_create_default(void) { return ESP_OK; }
+static inline esp_err_t esp_event_loop_delete_default(void) { return ESP_OK; }
+static inline esp_err_t esp_wifi_init(const wifi_init_config_t *config) { return ESP_OK; }
+static inline esp_err_t esp_wifi_deinit(void) { return ESP_OK; }
+static inline esp_err_t esp_wifi_set_storage(int storage) { return ESP_OK; }
+static inline esp_err_t esp_wifi_set_mode(int mode) { return ESP_OK; }
+static inline esp_err_t esp_wifi_start(void) { return ESP_OK; }
+static inline esp_err_t esp_wifi_stop(void) { return ESP_OK; }
+static inline esp_err_t esp_wifi_set_channel(uint8_t primary, int second) { return ESP_OK; }
+
+static inline esp_err_t esp_wifi_get_mac(int interface, uint8_t *mac) {
+    static const uint8_t own_mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+    for (int i = 0; i < 6; i++) {
+        mac[i] = own_mac[i];
+    }
+    return ESP_OK;
+}
+
+#ifdef __cplusplus
+}
+#endif
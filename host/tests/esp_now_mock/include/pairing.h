@@ -0,0 +1,11 @@
+/**
+ * @file pairing.h
+ * @brief The part of the wifi component's pairing.h that direct.c uses.
+ */
+
+#pragma once
+
+typedef struct pair_config_t {
+    char ssid[9];
+    char password[16];
+} pair_config_t;
@@ -0,0 +1,145 @@
+/**
+ * @file record_ring_wrap.c
+ * @brief Wrap-around test of the record ring.
+ *
+ * Fills small rings with records of every length so records are placed against the end of the
+ * buffer, skipped past it and wrapped to the start, and checks every record comes back whole and
+ * in order. Build with -DCMAKE_C_FLAGS=-fsanitize=address to catch writes past the buffer.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "containers/record_ring.h"
+
+#define TEST_MAX_LEN        40
+#define TEST_ROUNDS         20000
+#define TEST_MAX_PENDING    16
+
+static uint32_t failures = 0;
+
+#define TEST_CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+static void fill(uint8_t *data, uint32_t len, uint32_t seq) {
+    for (uint32_t i = 0; i < len; i++) {
+        data[i] = (uint8_t)(seq * 31 + i);
+    }
+}
+
+static uint8_t matches(const record_t *record, uint32_t len, uint32_t seq) {
+    if (record->len != len || record->tag != (uint8_t)seq) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < len; i++) {
+        if (record->data[i] != (uint8_t)(seq * 31 + i)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// A gap of 4 bytes at the end of the buffer, smaller than a record header
+static void test_small_end_gap(void) {
+    record_ring_t *ring = record_ring_create(64);
+    TEST_CHECK(ring != NULL);
+    record_t record;
+    uint32_t count = 0;
+    while (count < 5 && record_ring_reserve(ring, 4, count, 0, &record) != NULL) {
+        fill(record.data, 4, count);
+        record_ring_commit(ring, &record);
+        count++;
+    }
+    TEST_CHECK(count >= 3);
+
+    record_t first;
+    record_t second;
+    TEST_CHECK(record_ring_peek(ring, &first, 0) == 0);
+    TEST_CHECK(matches(&first, 4, 0));
+    TEST_CHECK(record_ring_peek_next(ring, &first, &second) == 0);
+    TEST_CHECK(matches(&second, 4, 1));
+    record_ring_release(ring, &second);
+
+    uint8_t *data = record_ring_reserve(ring, 8, count, 0, &record);
+    TEST_CHECK(data != NULL);
+    if (data != NULL) {
+        fill(data, 8, count);
+        record_ring_commit(ring, &record);
+    }
+    TEST_CHECK(record_ring_used(ring) <= 64);
+
+    uint32_t seq = 2;
+    while (record_ring_peek(ring, &record, 0) == 0) {
+        TEST_CHECK(matches(&record, (seq == count) ? 8 : 4, seq));
+        record_ring_release(ring, &record);
+        seq++;
+    }
+    TEST_CHECK(seq == count + 1);
+    record_ring_free(ring);
+}
+
+// Random lengths on rings of every small capacity, so every gap size shows up at the end
+static void test_random_wrap(void) {
+    srand(1);
+    for (uint32_t capacity = 16; capacity <= 160; capacity += 4) {
+        record_ring_t *ring = record_ring_create(capacity);
+        TEST_CHECK(ring != NULL);
+        uint32_t lens[256];
+        uint32_t produced = 0;
+        uint32_t consumed = 0;
+
+        for (uint32_t round = 0; round < TEST_ROUNDS; round++) {
+            if (rand() % 2 && produced - consumed < TEST_MAX_PENDING) {
+                uint32_t len = rand() % (TEST_MAX_LEN + 1);
+                record_t record;
+                uint8_t *data = record_ring_reserve(ring, len, produced, 0, &record);
+                if (data != NULL) {
+                    fill(data, len, produced);
+                    lens[produced % 256] = len;
+                    if (rand() % 8) {
+                        record_ring_commit(ring, &record);
+                    } else {
+                        // Aborted records are skipped by the consumer
+                        record_ring_abort(ring, &record);
+                        lens[produced % 256] = UINT32_MAX;
+                    }
+                    produced++;
+                }
+            } else {
+                record_t record;
+                while (consumed < produced && lens[consumed % 256] == UINT32_MAX) {
+                    consumed++;
+                }
+                if (record_ring_peek(ring, &record, 0) == 0) {
+                    TEST_CHECK(consumed < produced && matches(&record, lens[consumed % 256], consumed));
+                    record_ring_release(ring, &record);
+                    consumed++;
+                }
+            }
+            TEST_CHECK(record_ring_used(ring) <= capacity + 8);
+        }
+        record_ring_free(ring);
+        if (failures > 0) {
+            fprintf(stderr, "failed with capacity %u\n", capacity);
+            return;
+        }
+    }
+}
+
+int main(void) {
+    test_small_end_gap();
+    test_random_wrap();
+    if (failures > 0) {
+        printf("record_ring_wrap: %u checks failed\n", failures);
+        return 1;
+    }
+    printf("record_ring_wrap: ok\n");
+    return 0;
+}
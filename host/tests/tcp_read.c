@@ -0,0 +1,252 @@
+/**
+ * @file tcp_read.c
+ * @brief Loopback test of the buffered tcp read calls, recv_exact, peek, skip_until and readable.
+ *
+ * The far end of each connection is a plain socket, so the test decides when every byte arrives
+ * and when the peer closes. Covers data arriving in parts while recv_exact waits, recv_exact
+ * giving up at its timeout with what arrived, peeking and skipping without losing data, and
+ * reading up to and past a close by the peer.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "lwip/sockets.h"
+
+#include "common.h"
+#include "tcp_socket.h"
+
+static uint32_t failures = 0;
+static uint32_t port = 0;
+
+#define TEST_CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+/**
+ * @brief Connects a tcp_client to a plain listening socket.
+ *
+ * @return The accepted end, -1 on failure.
+ */
+static int open_client(tcp_client_t **client) {
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, 1) != 0) {
+        close(listen_fd);
+        return -1;
+    }
+    *client = tcp_client_create("127.0.0.1", port);
+    int fd = (*client != NULL) ? accept(listen_fd, NULL, NULL) : -1;
+    close(listen_fd);
+    return fd;
+}
+
+/**
+ * @brief Connects a plain socket to a tcp_server and accepts it as a tcp_connection.
+ *
+ * @return The connecting end, -1 on failure.
+ */
+static int open_connection(tcp_server_t **server, tcp_connection_t **connection) {
+    // tcp_server does not reuse addresses, the clients' port may still be in TIME_WAIT
+    uint32_t server_port = port + 1;
+    *server = tcp_server_create(server_port);
+    if (*server == NULL) {
+        return -1;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(server_port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    *connection = NULL;
+    for (int i = 0; i < 100 && *connection == NULL; i++) {
+        *connection = tcp_server_accept(*server);
+        if (*connection == NULL) {
+            usleep(1000);
+        }
+    }
+    return fd;
+}
+
+static void write_all(int fd, const char *data, uint32_t len) {
+    TEST_CHECK(write(fd, data, len) == (ssize_t)len);
+}
+
+typedef struct late_write_t {
+    int fd;
+    const char *data;
+    uint32_t len;
+    uint32_t delay_ms;
+} late_write_t;
+
+static void *late_write(void *args) {
+    late_write_t *write = (late_write_t *)args;
+    usleep(write->delay_ms * 1000);
+    write_all(write->fd, write->data, write->len);
+    return NULL;
+}
+
+// The rest of the message arrives while recv_exact waits for it
+static void test_partial_arrival(void) {
+    tcp_client_t *client;
+    int fd = open_client(&client);
+    TEST_CHECK(fd >= 0);
+    if (fd < 0) {
+        return;
+    }
+
+    write_all(fd, "0123", 4);
+    late_write_t rest = { .fd = fd, .data = "456789", .len = 6, .delay_ms = 30 };
+    pthread_t thread;
+    pthread_create(&thread, NULL, late_write, &rest);
+
+    uint8_t buffer[16] = {0};
+    uint32_t start = get_time_ms();
+    TEST_CHECK(tcp_client_recv_exact(client, buffer, 10, 1000) == 10);
+    TEST_CHECK(memcmp(buffer, "0123456789", 10) == 0);
+    TEST_CHECK(get_time_ms() - start >= 20);
+    pthread_join(thread, NULL);
+
+    tcp_client_free(client);
+    close(fd);
+}
+
+// recv_exact gives up at its deadline with the bytes that arrived, which are consumed
+static void test_timeout(void) {
+    tcp_client_t *client;
+    int fd = open_client(&client);
+    TEST_CHECK(fd >= 0);
+    if (fd < 0) {
+        return;
+    }
+
+    write_all(fd, "abcd", 4);
+    uint8_t buffer[16] = {0};
+    uint32_t start = get_time_ms();
+    TEST_CHECK(tcp_client_recv_exact(client, buffer, 10, 50) == 4);
+    uint32_t elapsed = get_time_ms() - start;
+    TEST_CHECK(elapsed >= 45 && elapsed < 500);
+    TEST_CHECK(memcmp(buffer, "abcd", 4) == 0);
+    TEST_CHECK(!tcp_client_is_closed(client));
+
+    write_all(fd, "efghij", 6);
+    TEST_CHECK(tcp_client_recv_exact(client, buffer, 6, 500) == 6);
+    TEST_CHECK(memcmp(buffer, "efghij", 6) == 0);
+
+    tcp_client_free(client);
+    close(fd);
+}
+
+static void test_peek_and_skip(void) {
+    tcp_client_t *client;
+    int fd = open_client(&client);
+    TEST_CHECK(fd >= 0);
+    if (fd < 0) {
+        return;
+    }
+
+    write_all(fd, "xyz\xff" "ABC", 7);
+    TEST_CHECK(tcp_client_wait_readable(client, 500));
+    uint8_t buffer[16] = {0};
+    TEST_CHECK(tcp_client_peek(client, buffer, 3) == 3 && memcmp(buffer, "xyz", 3) == 0);
+    TEST_CHECK(tcp_client_readable(client) == 7);
+
+    // Fewer bytes than asked for have arrived, peek returns what there is
+    TEST_CHECK(tcp_client_peek(client, buffer, 12) == 7);
+
+    TEST_CHECK(tcp_client_skip_until(client, 0xff) == 3);
+    TEST_CHECK(tcp_client_peek(client, buffer, 1) == 1 && buffer[0] == 0xff);
+    TEST_CHECK(tcp_client_recv_exact(client, buffer, 4, 500) == 4 && memcmp(buffer, "\xff" "ABC", 4) == 0);
+
+    // Without the byte everything buffered is discarded
+    write_all(fd, "abc", 3);
+    TEST_CHECK(tcp_client_wait_readable(client, 500));
+    TEST_CHECK(tcp_client_skip_until(client, 0xff) == 3);
+    TEST_CHECK(tcp_client_readable(client) == 0);
+    TEST_CHECK(!tcp_client_is_closed(client));
+
+    tcp_client_free(client);
+    close(fd);
+}
+
+// Bytes sent before the close are still read, then the client reports it closed
+static void test_peer_close(void) {
+    tcp_client_t *client;
+    int fd = open_client(&client);
+    TEST_CHECK(fd >= 0);
+    if (fd < 0) {
+        return;
+    }
+
+    write_all(fd, "abc", 3);
+    close(fd);
+    uint8_t buffer[16] = {0};
+    uint32_t start = get_time_ms();
+    TEST_CHECK(tcp_client_recv_exact(client, buffer, 10, 1000) == 3);
+    TEST_CHECK(get_time_ms() - start < 500);
+    TEST_CHECK(memcmp(buffer, "abc", 3) == 0);
+    TEST_CHECK(tcp_client_is_closed(client));
+    TEST_CHECK(tcp_client_peek(client, buffer, 1) == 0);
+    TEST_CHECK(tcp_client_skip_until(client, 0xff) == 0);
+    TEST_CHECK(tcp_client_readable(client) == 0);
+    TEST_CHECK(tcp_client_recv_exact(client, buffer, 1, 50) == 0);
+
+    tcp_client_free(client);
+}
+
+// The connection calls share the client's implementation, check they reach it
+static void test_connection(void) {
+    tcp_server_t *server;
+    tcp_connection_t *connection;
+    int fd = open_connection(&server, &connection);
+    TEST_CHECK(fd >= 0 && connection != NULL);
+    if (fd < 0 || connection == NULL) {
+        tcp_server_free(server);
+        return;
+    }
+
+    write_all(fd, "\x01\x02\xff\x03", 4);
+    usleep(10000);
+    uint8_t buffer[16] = {0};
+    TEST_CHECK(tcp_connection_recv_exact(connection, buffer, 1, 500) == 1 && buffer[0] == 0x01);
+    TEST_CHECK(tcp_connection_readable(connection) == 3);
+    TEST_CHECK(tcp_connection_skip_until(connection, 0xff) == 1);
+    TEST_CHECK(tcp_connection_peek(connection, buffer, 2) == 2 && buffer[0] == 0xff && buffer[1] == 0x03);
+
+    close(fd);
+    TEST_CHECK(tcp_connection_recv_exact(connection, buffer, 4, 1000) == 2);
+    TEST_CHECK(tcp_connection_is_closed(connection));
+
+    tcp_connection_free(connection);
+    tcp_server_free(server);
+}
+
+int main(void) {
+    esp_log_level_set("*", ESP_LOG_NONE);
+    // Ports of earlier runs may linger in TIME_WAIT
+    port = 40000 + getpid() % 20000;
+
+    test_partial_arrival();
+    test_timeout();
+    test_peek_and_skip();
+    test_peer_close();
+    test_connection();
+    if (failures > 0) {
+        printf("tcp_read: %u checks failed\n", failures);
+        return 1;
+    }
+    printf("tcp_read: ok\n");
+    return 0;
+}
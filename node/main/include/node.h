@@ -23,14 +23,21 @@
 
 #include "buttons.h"
 #include "tcp_socket.h"
+#include "udp_socket.h"
 #include "uart.h"
 #include "serializer.h"
 #include "lcm_types.h"
 #include "lidar.h"
+#include "lidar_summary.h"
 #include "camera.h"
+#include "camera_stream.h"
 #include "usb_device.h"
 #include "pairing.h"
 #include "wifi.h"
+#include "metrics.h"
+#include "profiling.h"
+#include "containers/record_ring.h"
+#include "containers/triple_buffer.h"
 
 #define CAM_MCLK_PIN                18                  /**< GPIO Pin for I2S master clock */
 #define CAM_PCLK_PIN                8                   /**< GPIO Pin for I2S peripheral clock */
@@ -53,16 +60,46 @@
 #define LIDAR_TX_PIN                44                  /**< GPIO Pin for UART transmit line */
 #define LIDAR_RX_PIN                43                  /**< GPIO Pin for UART receive line */
 #define LIDAR_PWM_PIN               1                   /**< GPIO Pin for LIDAR PWM signal */
+#define LIDAR_SCAN_POINTS           360                 /**< Distances in a full lidar revolution */
+#define LIDAR_SECTORS               16                  /**< Sectors of the lidar summary, must match serial_lidar_summary_t */
+#define LIDAR_MIN_VALID_MM          50                  /**< Closer lidar returns are the robot itself or noise */
+#define LIDAR_SUMMARY_DOWNSAMPLE    0                   /**< Degrees per point of the ranges appended to the summary, 0 for none */
+#define LIDAR_WAIT_MS               100                 /**< Longest the lidar task waits for a scan before checking the connection */
 
 #define PAIR_PIN                    17
 
 #define AP_CHANNEL                  11
 #define AP_IP_ADDR                  "192.168.4.2"
 #define AP_PORT                     8000
+#define SENSORS_OVER_UDP            1                   /**< Send lidar and camera data as UDP datagrams, 0 keeps everything on TCP */
+#define HOST_LINK_OPTIONS           { .nodelay = 1, .keepalive = 1, .keepalive_idle_s = 2, .keepalive_interval_s = 1, \
+                                      .keepalive_count = 3, .tos = tcp_TOS(tcp_DSCP_EF) }
+                                                        /**< Control profile of the TCP link: the sender task coalesces already so Nagle only adds delay,
+                                                             keepalive notices a vanished host in about 5 s and commands and telemetry go ahead of sensor data on the air */
+
+#define CONNECT_TIMEOUT_MS          500                 /**< Longest a connection attempt waits for the host to accept */
+#define RECONNECT_RETRY_MS          250                 /**< Time before the second attempt to connect to the host, doubled after every failure */
+#define RECONNECT_MAX_BACKOFF_MS    2000                /**< Longest time between attempts to connect to the host */
+#define METRICS_PERIOD_MS           1000                /**< Period at which metrics are sent to the host */
+#define PROFILING_PERIOD_MS         5000                /**< Period at which task and heap diagnostics are sent to the host */
+
+#define MESSAGE_RING_SIZE           (32 * 1024)         /**< Bytes shared by every message waiting for the sender task */
+#define SENDER_WAIT_MS              100                 /**< Longest the sender task sleeps before checking the connection */
+#define SENDER_LINGER_MS            2                   /**< Longest the sender task waits for more messages to coalesce */
+#define SENDER_BATCH_RECORDS        16                  /**< Maximum number of messages coalesced into one write */
+#define SENDER_BATCH_BYTES          (8 * 1024)          /**< Stop coalescing once this many bytes are batched */
+#define SENDER_UART_STAGING_SIZE    1024                /**< UART bound messages are copied here and written at once */
+#define CAMERA_ENABLED              0                   /**< Start the camera task, 1 on robots with a camera attached */
+#define CAMERA_RESERVE_TIMEOUT_MS   20                  /**< Longest the camera task waits for room for a frame */
+#define RX_WAIT_MS                  100                 /**< Longest the receiving tasks block on data before checking the connection */
+#define RX_CHUNK_SIZE               512                 /**< Bytes read from the UART or socket at once */
+#define ROS_STREAM_MAX_LEN          1024                /**< Largest packet relayed between the host and the MBot, a longer length is taken as corrupted */
 
 typedef enum {
     CONNECT = BIT0,
-    DISCONNECT = BIT1
+    DISCONNECT = BIT1,
+    SENDER_PAUSED = BIT2,       /**< The sender task stopped using the client */
+    SOCKET_PAUSED = BIT3        /**< The socket task stopped using the client */
 } connect_bits_t;
 
 typedef enum {
@@ -86,14 +123,35 @@ typedef enum {
     MBOT
 } destination_t;
 
-typedef struct packet_t {
-    destination_t dest;
-    uint16_t len;
-    uint8_t *data;
-} packet_t;
+/**
+ * @brief A completed lidar revolution, handed from lidar_read_task to lidar_task.
+ */
+typedef struct lidar_snapshot_t {
+    int64_t utime;              /**< Time the revolution completed */
+    uint32_t seq;               /**< Counts revolutions since the scan started */
+    uint16_t ranges[LIDAR_SCAN_POINTS];
+} lidar_snapshot_t;
+
+/**
+ * @brief Incremental parser of a ROS packet stream, copying complete packets into the message ring.
+ *
+ * Packets are assembled in the stream until their last byte arrives, so a packet trickling in
+ * over the UART never holds up the messages queued behind it in the ring.
+ */
+typedef struct ros_stream_t {
+    const char *log_tag;
+    destination_t destination;
+    uint8_t header[ROS_HEADER_LEN];
+    uint8_t header_len;
+    uint16_t topic;
+    uint8_t pkt[ROS_STREAM_MAX_LEN];
+    uint32_t pkt_len;           /**< Length of the packet being received, 0 while looking for a header */
+    uint32_t pkt_fill;
+} ros_stream_t;
 
 void sender_task(void *args);
 void mbot_task(void *args);
 void socket_task(void *args);
 void lidar_task(void *args);
-void camera_task(void *args);
\ No newline at end of file
+void camera_task(void *args);
+void telemetry_task(void *args);
\ No newline at end of file
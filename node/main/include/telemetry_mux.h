@@ -0,0 +1,42 @@
+/**
+ * @file telemetry_mux.h
+ * @brief Combines the mbot's telemetry topics into one MBOT_TELEMETRY message per tick.
+ *
+ * The mbot sends encoders, odometry, IMU, body and motor velocities and motor PWM as separate
+ * packets, each paying for its own header and send. The mux keeps the latest message of each,
+ * a telemetry task emits them together once per tick, so the host gets one packet and one
+ * consistent snapshot. IMU samples between ticks can optionally be batched instead of only
+ * the latest one being kept.
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "lcm_types.h"
+
+#define TELEMETRY_PERIOD_MS         20              /**< Tick of the combined message, 0 forwards every topic separately */
+#define TELEMETRY_IMU_BATCH         0               /**< IMU samples kept between ticks and appended, 0 for the latest only */
+#define TELEMETRY_MAX_LEN           (sizeof(serial_telemetry_t) + TELEMETRY_IMU_BATCH * sizeof(serial_mbot_imu_t))
+
+/**
+ * @brief Stores a message if its topic is combined.
+ *
+ * @param topic The topic of the message.
+ * @param msg The message.
+ * @param len The length of the message.
+ * @return 1 if the message was taken, 0 if it should be forwarded as is.
+ */
+uint8_t telemetry_mux_update(uint16_t topic, const uint8_t *msg, uint16_t len);
+
+/**
+ * @brief Builds the combined message of a tick and starts the next one.
+ *
+ * @param msg Buffer of at least TELEMETRY_MAX_LEN bytes.
+ * @param now_us The current time in microseconds.
+ * @return The length of the message, 0 if nothing arrived since the previous tick.
+ */
+uint32_t telemetry_mux_emit(uint8_t *msg, int64_t now_us);
@@ -0,0 +1,47 @@
+/**
+ * @file topic_rates.h
+ * @brief Runtime rate control of the topics a node forwards to the host.
+ *
+ * Every topic can be switched off, decimated (forward every nth message) and limited to a
+ * minimum period. The host changes the settings at runtime with MBOT_TOPIC_RATE messages,
+ * so lidar rate can be traded for camera rate as more robots share the channel. Admission
+ * happens once per message, in the task producing it for sensor topics so a dropped message is
+ * never copied, and in the sender task for everything else.
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+
+#include "lcm_types.h"
+
+#define TOPIC_RATES_MAX     16          /**< Topics with non default settings */
+
+/**
+ * @brief Initializes the table with the node's default settings.
+ */
+void topic_rates_init(void);
+
+/**
+ * @brief Applies a rate control message from the host.
+ *
+ * @param rate The new settings of a topic, a topic of 0 restores the defaults.
+ * @return 0 if applied, 1 if the table is full.
+ */
+uint8_t topic_rates_apply(const serial_topic_rate_t *rate);
+
+/**
+ * @brief Decides whether a message is forwarded and updates the topic's decimation and timing.
+ *
+ * Call exactly once per message.
+ *
+ * @param topic The topic of the message.
+ * @param now_us The current time in microseconds.
+ * @return 1 if the message should be forwarded, 0 if it is dropped.
+ */
+uint8_t topic_rates_admit(uint16_t topic, int64_t now_us);
@@ -0,0 +1,53 @@
+/**
+ * @file vel_gate.h
+ * @brief Node-local safety gate for velocity commands, based on the latest lidar summary.
+ *
+ * Each MBOT_VEL_CMD from the host is checked against the nearest obstacle in its direction of
+ * travel before it reaches the mbot. Translation is scaled down inside VEL_GATE_SLOW_MM and
+ * stopped inside VEL_GATE_STOP_MM, rotation always passes, so the robot can turn away. The
+ * check takes microseconds, so the reaction to an obstacle does not depend on Wi-Fi latency.
+ *
+ * Without a recent scan (no lidar, or the lidar stalled) commands pass unchanged.
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "lcm_types.h"
+#include "lidar_summary.h"
+
+#define VEL_GATE_ENABLED            1               /**< Set to 0 to forward velocity commands untouched */
+#define VEL_GATE_STOP_MM            200             /**< Translation toward an obstacle this close is stopped */
+#define VEL_GATE_SLOW_MM            600             /**< Translation toward an obstacle this close is scaled down */
+#define VEL_GATE_HALF_ANGLE_DEG     30              /**< Half width of the cone checked around the direction of travel */
+#define VEL_GATE_MAX_SCAN_AGE_MS    500             /**< Older lidar data is not trusted */
+#define VEL_GATE_MIN_SPEED          0.01f           /**< Slower translation in m/s is not checked */
+#define VEL_GATE_LIDAR_OFFSET_DEG   0               /**< Lidar bearing of the robot's forward direction */
+#define VEL_GATE_LIDAR_CLOCKWISE    1               /**< Lidar bearings increase clockwise seen from above */
+
+typedef enum {
+    VEL_GATE_PASSED,
+    VEL_GATE_SLOWED,
+    VEL_GATE_STOPPED
+} vel_gate_result_t;
+
+/**
+ * @brief Stores the sector minima of the latest scan.
+ *
+ * @param summary The summary of the scan.
+ * @param utime The time the scan completed.
+ */
+void vel_gate_update(const lidar_summary_t *summary, int64_t utime);
+
+/**
+ * @brief Checks a velocity command and clamps its translation if needed.
+ *
+ * @param cmd The command, modified in place.
+ * @param now_us The current time in microseconds.
+ * @return Whether the command was passed, slowed or stopped.
+ */
+vel_gate_result_t vel_gate_apply(serial_twist2D_t *cmd, int64_t now_us);
@@ -21,6 +21,7 @@
 
 #include "buttons.h"
 #include "tcp_socket.h"
+#include "udp_socket.h"
 #include "uart.h"
 #include "serializer.h"
 #include "lcm_types.h"
@@ -29,220 +30,524 @@
 #include "usb_device.h"
 #include "pairing.h"
 #include "wifi.h"
+#include "metrics.h"
+#include "profiling.h"
+#include "task_topology.h"
 
 #include "node.h"
+#include "topic_rates.h"
+#include "vel_gate.h"
+#include "telemetry_mux.h"
 
-static QueueHandle_t message_queue;
+static record_ring_t *message_ring;
 
 static EventGroupHandle_t connection_event_group;
 
-static SemaphoreHandle_t lidar_sem;
-
-static uint16_t ranges[360];
+static triple_buffer_t *lidar_scans;
+static SemaphoreHandle_t lidar_scan_ready;
 
 static button_t *pair_btn;
 tcp_client_t *client;
+udp_socket_t *udp;
 uart_t *uart;
 usb_device_t *usb_dev;
 
+static metrics_counter_t *host_packets_sent;
+static metrics_counter_t *host_bytes_sent;
+static metrics_counter_t *host_writes;
+static metrics_counter_t *host_short_writes;
+static metrics_counter_t *host_drops;
+static metrics_counter_t *udp_packets_sent;
+static metrics_counter_t *udp_drops;
+static metrics_counter_t *mbot_packets_sent;
+static metrics_counter_t *lidar_scans_sent;
+static metrics_counter_t *lidar_scans_skipped;
+static metrics_counter_t *camera_frames_sent;
+static metrics_counter_t *rate_drops;
+static metrics_counter_t *vel_cmds_slowed;
+static metrics_counter_t *vel_cmds_stopped;
+static metrics_counter_t *telemetry_merged;
+static metrics_counter_t *telemetry_sent;
+static metrics_counter_t *queue_send_errors;
+static metrics_histogram_t *lidar_latency;
+static metrics_histogram_t *telemetry_jitter;
+
 void tasks_init(void)
 {
-    message_queue = xQueueCreate(128, sizeof(packet_t));
+    message_ring = record_ring_create(MESSAGE_RING_SIZE);
 
     connection_event_group = xEventGroupCreate();
+    xEventGroupSetBits(connection_event_group, DISCONNECT);
+
+    lidar_scans = triple_buffer_create(sizeof(lidar_snapshot_t));
+    lidar_scan_ready = xSemaphoreCreateBinary();
+
+    host_packets_sent = metrics_counter_register("host_pkts");
+    host_bytes_sent = metrics_counter_register("host_bytes");
+    host_writes = metrics_counter_register("host_writes");
+    host_short_writes = metrics_counter_register("host_short");
+    host_drops = metrics_counter_register("host_drops");
+    udp_packets_sent = metrics_counter_register("udp_pkts");
+    udp_drops = metrics_counter_register("udp_drops");
+    mbot_packets_sent = metrics_counter_register("mbot_pkts");
+    lidar_scans_sent = metrics_counter_register("lidar_scans");
+    lidar_scans_skipped = metrics_counter_register("lidar_skips");
+    camera_frames_sent = metrics_counter_register("cam_frames");
+    rate_drops = metrics_counter_register("rate_drops");
+    vel_cmds_slowed = metrics_counter_register("vel_slowed");
+    vel_cmds_stopped = metrics_counter_register("vel_stopped");
+    telemetry_merged = metrics_counter_register("telem_merged");
+    telemetry_sent = metrics_counter_register("telem_sent");
+
+    topic_rates_init();
+    queue_send_errors = metrics_counter_register("queue_errs");
+
+    // Scheduling delays of the two periodic data paths, to compare task layouts
+    lidar_latency = metrics_histogram_register("lidar_lat_us");
+    telemetry_jitter = metrics_histogram_register("telem_jit_us");
+}
+
+/**
+ * @brief Checks whether the host connection is up. Producers drop host-bound data while it is not.
+ */
+static inline uint8_t is_connected(void)
+{
+    return (xEventGroupGetBits(connection_event_group) & CONNECT) != 0;
+}
+
+/**
+ * @brief Parks a task that uses the client until app_main has swapped in a new one.
+ *
+ * @param paused_bit The bit telling app_main this task no longer touches the old client.
+ */
+static void wait_for_connection(EventBits_t paused_bit)
+{
+    xEventGroupSetBits(connection_event_group, paused_bit);
+    xEventGroupWaitBits(connection_event_group, CONNECT, pdFALSE, pdFALSE, portMAX_DELAY);
+}
+
+/**
+ * @brief Queues one of the node's own reports for the host.
+ */
+static void report_to_host(uint16_t topic, uint8_t *data, uint16_t len)
+{
+    if (!is_connected())
+    {
+        return;
+    }
+
+    // Never block a reporter on a full ring, reports are not worth delaying sensor data for
+    record_t record;
+    uint8_t *pkt = record_ring_reserve(message_ring, len + ROS_PKG_LEN, HOST, 0, &record);
+    if (pkt == NULL)
+    {
+        metrics_counter_inc(queue_send_errors);
+        return;
+    }
+
+    encode_rospkt(data, len, topic, pkt);
+    record_ring_commit(message_ring, &record);
+}
+
+void metrics_sink(uint8_t *data, uint16_t len, void *ctx)
+{
+    report_to_host(MBOT_METRICS, data, len);
+}
+
+void diagnostics_sink(uint8_t *data, uint16_t len, void *ctx)
+{
+    report_to_host(MBOT_DIAGNOSTICS, data, len);
+}
+
+/**
+ * @brief Writes the UART staging buffer out in one go.
+ */
+static void sender_flush_uart(uint8_t *staging, uint32_t *staging_len, uint32_t staged_packets)
+{
+    if (*staging_len == 0)
+    {
+        return;
+    }
+    uart_write(uart, staging, *staging_len);
+    metrics_counter_add(mbot_packets_sent, staged_packets);
+    *staging_len = 0;
+}
+
+/**
+ * @brief Checks whether a topic's rate is applied by the task producing it, before it is copied into
+ * the message ring. The sender forwards these as they come.
+ */
+static uint8_t is_producer_rated_topic(uint16_t topic)
+{
+    switch (topic)
+    {
+    case MBOT_LIDAR_SCAN:
+    case MBOT_LIDAR_SUMMARY:
+    case MBOT_CAMERA_FRAME:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Checks whether a topic is sent over UDP, where a lost message is skipped instead of holding up the rest.
+ */
+static uint8_t is_udp_topic(uint16_t topic)
+{
+    switch (topic)
+    {
+    case MBOT_LIDAR_SCAN:
+    case MBOT_LIDAR_SUMMARY:
+    case MBOT_CAMERA_FRAME:
+        return SENSORS_OVER_UDP;
+    default:
+        return 0;
+    }
+}
 
-    lidar_sem = xSemaphoreCreateBinary();
-    xSemaphoreGive(lidar_sem);
+/**
+ * @brief Sends a packet as its own datagram, prefixed with the next sequence number.
+ */
+static void sender_send_datagram(uint8_t *pkt, uint32_t len)
+{
+    static uint32_t seq = 0;
+    uint8_t header[DATAGRAM_HEADER_LEN] = { seq & 0xFF, (seq >> 8) & 0xFF, (seq >> 16) & 0xFF, (seq >> 24) & 0xFF };
+    seq++;
+
+    struct iovec iov[2] = {
+        { .iov_base = header, .iov_len = DATAGRAM_HEADER_LEN },
+        { .iov_base = pkt, .iov_len = len },
+    };
+    if (udp_socket_sendv(udp, iov, 2) == 0)
+    {
+        metrics_counter_inc(udp_drops);
+        return;
+    }
+    metrics_counter_inc(udp_packets_sent);
 }
 
 void sender_task(void *args)
 {
+    static record_t batch[SENDER_BATCH_RECORDS];
+    static uint8_t uart_staging[SENDER_UART_STAGING_SIZE];
+    struct iovec iov[SENDER_BATCH_RECORDS];
+
     while (true)
     {
         if (xEventGroupGetBits(connection_event_group) & DISCONNECT)
         {
             ESP_LOGI("SENDER_TASK", "Waiting for reconnection.");
-            xQueueReset(message_queue);
-            vTaskDelete(NULL);
+            record_ring_clear(message_ring);
+            wait_for_connection(SENDER_PAUSED);
+
+            // Whatever was queued while paused is stale by now
+            record_ring_clear(message_ring);
+            continue;
         }
 
-        packet_t message;
-        // ESP_LOGI("SENDER_TASK", "Waiting for message from queue, length: %d", uxQueueMessagesWaiting(message_queue));
-        BaseType_t err = xQueueReceive(message_queue, &message, portMAX_DELAY);
-        if (err != pdTRUE)
+        // Drain everything queued (lingering briefly for more) and send it straight out of the ring,
+        // so telemetry, a heartbeat and metrics go out in one TCP write instead of several
+        uint32_t count = record_ring_peek_batch(message_ring, batch, SENDER_BATCH_RECORDS, SENDER_BATCH_BYTES,
+                                                SENDER_WAIT_MS / portTICK_PERIOD_MS, pdMS_TO_TICKS(SENDER_LINGER_MS));
+        if (count == 0)
         {
+            // A quiet moment, push out whatever a congested send left buffered
+            tcp_client_flush(client, 0);
             continue;
         }
 
-        switch (message.dest)
+        int iovcnt = 0;
+        uint16_t topic;
+        uint32_t uart_len = 0, uart_packets = 0;
+        int64_t now = esp_timer_get_time();
+        for (uint32_t i = 0; i < count; i++)
         {
-        case HOST:
-            ESP_LOGI("SENDER_TASK", "Sending message to host of length: %d", message.len);
-            uint32_t bytes_sent = tcp_client_send(client, message.data, message.len);
-            break;
-        case MBOT:
-            // ESP_LOGI("SENDER_TASK", "Sending message to mbot of length: %d", message.len);
-            uart_write(uart, message.data, message.len);
-            break;
-        default:
-            break;
+            switch (batch[i].tag)
+            {
+            case HOST:
+                topic = batch[i].data[5] + ((uint16_t)batch[i].data[6] << 8);
+                if (!is_producer_rated_topic(topic) && !topic_rates_admit(topic, now))
+                {
+                    metrics_counter_inc(rate_drops);
+                    break;
+                }
+                if (udp != NULL && is_udp_topic(topic) && batch[i].len + DATAGRAM_HEADER_LEN <= udp_MAX_DATAGRAM_LEN)
+                {
+                    sender_send_datagram(batch[i].data, batch[i].len);
+                    break;
+                }
+                iov[iovcnt].iov_base = batch[i].data;
+                iov[iovcnt].iov_len = batch[i].len;
+                iovcnt++;
+                break;
+            case MBOT:
+                if (uart_len + batch[i].len > SENDER_UART_STAGING_SIZE)
+                {
+                    sender_flush_uart(uart_staging, &uart_len, uart_packets);
+                    uart_packets = 0;
+                }
+                if (batch[i].len > SENDER_UART_STAGING_SIZE)
+                {
+                    uart_write(uart, batch[i].data, batch[i].len);
+                    metrics_counter_inc(mbot_packets_sent);
+                    break;
+                }
+                memcpy(uart_staging + uart_len, batch[i].data, batch[i].len);
+                uart_len += batch[i].len;
+                uart_packets++;
+                break;
+            default:
+                break;
+            }
+        }
+
+        sender_flush_uart(uart_staging, &uart_len, uart_packets);
+        if (iovcnt > 0)
+        {
+            uint32_t batch_len = 0;
+            for (int i = 0; i < iovcnt; i++)
+            {
+                batch_len += iov[i].iov_len;
+            }
+
+            // Blocks for at most the send timeout, a congested link buffers or drops instead of stalling the ring.
+            // The batch is released whole since its UART and UDP messages are already out, so messages the
+            // client had no room for are dropped. They are always whole and at the end of the batch.
+            uint32_t bytes_sent = tcp_client_sendv(client, iov, iovcnt);
+            int dropped = 0;
+            if (bytes_sent < batch_len)
+            {
+                uint32_t dropped_len = 0;
+                while (dropped < iovcnt && dropped_len < batch_len - bytes_sent)
+                {
+                    dropped_len += iov[iovcnt - 1 - dropped].iov_len;
+                    dropped++;
+                }
+                metrics_counter_inc(host_short_writes);
+                metrics_counter_add(host_drops, dropped);
+            }
+            metrics_counter_add(host_packets_sent, iovcnt - dropped);
+            metrics_counter_add(host_bytes_sent, bytes_sent);
+            metrics_counter_inc(host_writes);
         }
-        free(message.data);
-        // ESP_LOGI("SENDER_TASK", "Sent message to destination: %d", message.dest);
+        record_ring_release(message_ring, &batch[count - 1]);
     }
 }
 
-void mbot_task(void *args)
+/**
+ * @brief Drops the start of a stream's header buffer up to the next sync flag at or after from.
+ */
+static void ros_stream_resync(ros_stream_t *stream, uint8_t from)
 {
-    while (true)
+    uint8_t idx = from;
+    while (idx < stream->header_len && stream->header[idx] != SYNC_FLAG)
     {
-        if (xEventGroupGetBits(connection_event_group) & DISCONNECT)
-        {
-            ESP_LOGI("MBOT_TASK", "Waiting for reconnection.");
-            vTaskDelete(NULL);
-        }
+        idx++;
+    }
+    memmove(stream->header, stream->header + idx, stream->header_len - idx);
+    stream->header_len -= idx;
+}
+
+/**
+ * @brief Validates a complete header and starts assembling the packet.
+ */
+static void ros_stream_accept_header(ros_stream_t *stream)
+{
+    uint16_t msg_len = stream->header[2] + ((uint16_t)stream->header[3] << 8);
 
-        uint8_t header[ROS_HEADER_LEN] = {0};
+    if (stream->header[1] != VERSION_FLAG)
+    {
+        ESP_LOGE(stream->log_tag, "Error: Version flag is incompatible.");
+        ros_stream_resync(stream, 1);
+        return;
+    }
+    else if (stream->header[4] != checksum(stream->header + 2, 2))
+    {
+        ESP_LOGE(stream->log_tag, "Error: Checksum over message length failed.");
+        ros_stream_resync(stream, 1);
+        return;
+    }
+    else if (msg_len + ROS_PKG_LEN > ROS_STREAM_MAX_LEN)
+    {
+        ESP_LOGE(stream->log_tag, "Error: Packet of %d bytes is longer than any relayed message.", msg_len + ROS_PKG_LEN);
+        ros_stream_resync(stream, 1);
+        return;
+    }
 
-        int bytes_read = uart_read(uart, header, 1, 100);
+    memcpy(stream->pkt, stream->header, ROS_HEADER_LEN);
+    stream->topic = stream->header[5] + ((uint16_t)stream->header[6] << 8);
+    stream->pkt_len = msg_len + ROS_PKG_LEN;
+    stream->pkt_fill = ROS_HEADER_LEN;
+    stream->header_len = 0;
+}
 
-        if (bytes_read == 0)
+/**
+ * @brief Copies a complete packet into the message ring, or consumes it if it is meant for the node itself.
+ */
+static void ros_stream_deliver(ros_stream_t *stream)
+{
+    uint32_t msg_len = stream->pkt_len - ROS_PKG_LEN;
+    if (stream->destination == MBOT && stream->topic == MBOT_TOPIC_RATE)
+    {
+        // Rate control from the host is applied here and never reaches the mbot
+        if (msg_len == sizeof(serial_topic_rate_t) && stream->pkt[stream->pkt_len - 1] == checksum(stream->pkt + 5, msg_len + 2))
         {
-            goto delay;
+            serial_topic_rate_t rate;
+            memcpy(&rate, stream->pkt + ROS_HEADER_LEN, sizeof(rate));
+            topic_rates_apply(&rate);
         }
-        else if (bytes_read < 0)
+        else
         {
-            ESP_LOGE("MBOT_TASK", "UART read error");
-            goto delay;
+            ESP_LOGE(stream->log_tag, "Error: Malformed topic rate message.");
         }
-        else if (header[0] == SYNC_FLAG)
+        stream->pkt_len = 0;
+        return;
+    }
+
+    if (stream->destination == HOST && stream->pkt[stream->pkt_len - 1] == checksum(stream->pkt + 5, msg_len + 2) &&
+        telemetry_mux_update(stream->topic, stream->pkt + ROS_HEADER_LEN, msg_len))
+    {
+        // Sent to the host with the other telemetry at the next tick
+        metrics_counter_inc(telemetry_merged);
+        stream->pkt_len = 0;
+        return;
+    }
+
+    // A corrupted command is forwarded as is, re-signing a gated copy would make the MBot accept it
+    if (stream->destination == MBOT && stream->topic == MBOT_VEL_CMD && msg_len == sizeof(serial_twist2D_t) &&
+        stream->pkt[stream->pkt_len - 1] == checksum(stream->pkt + 5, msg_len + 2))
+    {
+        // Checked against the latest lidar sectors here rather than waiting for the host to react
+        serial_twist2D_t cmd;
+        memcpy(&cmd, stream->pkt + ROS_HEADER_LEN, sizeof(cmd));
+        vel_gate_result_t result = vel_gate_apply(&cmd, esp_timer_get_time());
+        if (result != VEL_GATE_PASSED)
         {
-            bytes_read = uart_read(uart, (header + 1), ROS_HEADER_LEN - 1, 0);
-            if (bytes_read < 0)
-            {
-                ESP_LOGE("MBOT_TASK", "UART read error");
-                goto delay;
-            }
+            memcpy(stream->pkt + ROS_HEADER_LEN, &cmd, sizeof(cmd));
+            stream->pkt[stream->pkt_len - 1] = checksum(stream->pkt + 5, msg_len + 2);
+            metrics_counter_inc(result == VEL_GATE_STOPPED ? vel_cmds_stopped : vel_cmds_slowed);
+        }
+    }
 
-            uint16_t msg_len = header[2] + (header[3] << 8);
-            uint16_t topic = header[5] + (header[6] << 8);
-            uint8_t cs = header[4];
-            uint8_t version = header[1];
+    record_t record;
+    uint8_t *pkt = record_ring_reserve(message_ring, stream->pkt_len, stream->destination, portMAX_DELAY, &record);
+    if (pkt == NULL)
+    {
+        ESP_LOGE(stream->log_tag, "Error: Packet of %lu bytes does not fit in message ring.", (unsigned long)stream->pkt_len);
+        metrics_counter_inc(queue_send_errors);
+    }
+    else
+    {
+        memcpy(pkt, stream->pkt, stream->pkt_len);
+        record_ring_commit(message_ring, &record);
+    }
+    stream->pkt_len = 0;
+}
 
-            if (version != VERSION_FLAG)
+/**
+ * @brief Parses received bytes, delivering every packet completed by them.
+ */
+static void ros_stream_feed(ros_stream_t *stream, uint8_t *data, uint32_t len)
+{
+    while (len > 0)
+    {
+        uint32_t chunk;
+        if (stream->pkt_len == 0)
+        {
+            if (stream->header_len == 0)
             {
-                ESP_LOGE("MBOT_TASK", "Error: Version flag is incompatible.");
-                goto delay;
+                uint8_t *sync = memchr(data, SYNC_FLAG, len);
+                if (sync == NULL)
+                {
+                    return;
+                }
+                len -= sync - data;
+                data = sync;
             }
-            else if (cs != checksum(header + 2, 2))
+
+            chunk = ROS_HEADER_LEN - stream->header_len;
+            chunk = (len < chunk) ? len : chunk;
+            memcpy(stream->header + stream->header_len, data, chunk);
+            stream->header_len += chunk;
+            if (stream->header_len == ROS_HEADER_LEN)
             {
-                ESP_LOGE("MBOT_TASK", "Error: Checksum over message length failed.");
-                goto delay;
+                ros_stream_accept_header(stream);
             }
-
-            packet_t packet;
-            packet.dest = HOST;
-            packet.len = msg_len + ROS_PKG_LEN;
-            packet.data = (uint8_t *)malloc(packet.len);
-            if (packet.data == NULL)
+        }
+        else
+        {
+            // The message is followed by the checksum over topic and message
+            chunk = stream->pkt_len - stream->pkt_fill;
+            chunk = (len < chunk) ? len : chunk;
+            memcpy(stream->pkt + stream->pkt_fill, data, chunk);
+            stream->pkt_fill += chunk;
+            if (stream->pkt_fill == stream->pkt_len)
             {
-                ESP_LOGE("MBOT_TASK", "Error: Failed to allocate memory for packet.");
-                goto delay;
+                ros_stream_deliver(stream);
             }
+        }
+        data += chunk;
+        len -= chunk;
+    }
+}
 
-            memcpy(packet.data, header, ROS_HEADER_LEN);
+/**
+ * @brief Drops a partially received packet, e.g. when the connection is lost.
+ */
+static void ros_stream_reset(ros_stream_t *stream)
+{
+    stream->pkt_len = 0;
+    stream->header_len = 0;
+}
 
-            bytes_read = uart_read(uart, (packet.data + ROS_HEADER_LEN), msg_len + 1, 0);
+void mbot_task(void *args)
+{
+    static ros_stream_t stream = { .log_tag = "MBOT_TASK", .destination = HOST };
+    static uint8_t rx_buffer[RX_CHUNK_SIZE];
 
-            if (bytes_read < 0)
-            {
-                ESP_LOGE("MBOT_TASK", "UART read error");
-                goto delay;
-            }
+    while (true)
+    {
+        // Sleeps in the UART driver until bytes arrive, then takes everything buffered
+        uint32_t bytes_read = uart_read_available(uart, rx_buffer, RX_CHUNK_SIZE, RX_WAIT_MS);
 
-            // ESP_LOGI("SOCKET_TASK", "Queue size: %d", uxQueueMessagesWaiting(message_queue));
-            BaseType_t err = xQueueSend(message_queue, &packet, portMAX_DELAY);
-            if (err != pdTRUE)
-            {
-                ESP_LOGE("MBOT_TASK", "Error: Failed to send packet to message queue.");
-                free(packet.data);
-            }
-        delay:
-            vTaskDelay(25 / portTICK_PERIOD_MS);
+        // Keep draining the UART while disconnected so the mbot's data does not go stale in it
+        if (!is_connected())
+        {
+            ros_stream_reset(&stream);
+            continue;
         }
+        ros_stream_feed(&stream, rx_buffer, bytes_read);
     }
 }
 
 void socket_task(void *args)
 {
+    static ros_stream_t stream = { .log_tag = "SOCKET_TASK", .destination = MBOT };
+    static uint8_t rx_buffer[RX_CHUNK_SIZE];
+
     while (true)
     {
         if (xEventGroupGetBits(connection_event_group) & DISCONNECT)
         {
             ESP_LOGI("SOCKET_TASK", "Waiting for reconnection.");
-            vTaskDelete(NULL);
+            ros_stream_reset(&stream);
+            wait_for_connection(SOCKET_PAUSED);
+            continue;
         }
 
-        uint8_t header[ROS_HEADER_LEN] = {0};
-        uint32_t bytes_read = tcp_client_recv(client, header, 1);
-
-        if (bytes_read == 0)
+        if (tcp_client_is_closed(client))
         {
-            goto delay;
+            vTaskDelay(RX_WAIT_MS / portTICK_PERIOD_MS);
+            continue;
         }
-        else if (header[0] == SYNC_FLAG)
-        {
-            bytes_read = 0;
-            do
-            {
-                bytes_read += tcp_client_recv(client, header + 1 + bytes_read, ROS_HEADER_LEN - 1 - bytes_read);
-            } while (bytes_read < ROS_HEADER_LEN - 1);
-
-            uint16_t msg_len = header[2] + ((uint16_t)header[3] << 8);
-            uint16_t topic = header[5] + ((uint16_t)header[6] << 8);
-            uint8_t cs = header[4];
-            uint8_t version = header[1];
-
-            if (version != VERSION_FLAG)
-            {
-                ESP_LOGE("SOCKET_TASK", "Error: Version flag is incompatible.");
-                goto delay;
-            }
-            else if (cs != checksum(header + 2, 2))
-            {
-                ESP_LOGE("SOCKET_TASK", "Error: Checksum over message length failed.");
-                goto delay;
-            }
-
-            packet_t packet;
-            packet.dest = MBOT;
-            packet.len = msg_len + ROS_PKG_LEN;
-            packet.data = (uint8_t *)malloc(packet.len);
-            if (packet.data == NULL)
-            {
-                ESP_LOGE("SOCKET_TASK", "Error: Failed to allocate memory for packet.");
-                goto delay;
-            }
-
-            memcpy(packet.data, header, ROS_HEADER_LEN);
-
-            bytes_read = 0;
-            do
-            {
-                bytes_read += tcp_client_recv(client, packet.data + ROS_HEADER_LEN + bytes_read, msg_len + 1 - bytes_read);
-            } while (bytes_read < msg_len + 1);
 
-            // ESP_LOGI("SOCKET_TASK", "Received message from host of length: %d", packet.len);
-            // ESP_LOGI("SOCKET_TASK", "Queue size: %d", uxQueueMessagesWaiting(message_queue));
-            BaseType_t err = xQueueSend(message_queue, &packet, portMAX_DELAY);
-            if (err != pdTRUE)
-            {
-                ESP_LOGE("SOCKET_TASK", "Error: Failed to send packet to message queue.");
-                free(packet.data);
-            }
-        delay:
-            vTaskDelay(25 / portTICK_PERIOD_MS);
+        if (!tcp_client_wait_readable(client, RX_WAIT_MS))
+        {
+            continue;
         }
+        uint32_t bytes_read = tcp_client_recv(client, rx_buffer, RX_CHUNK_SIZE);
+        ros_stream_feed(&stream, rx_buffer, bytes_read);
     }
 }
 
@@ -271,20 +576,18 @@ void lidar_read_task(void *args)
 
         TickType_t count = 0;
         TickType_t start_time = xTaskGetTickCount();
+        const lidar_snapshot_t *published = NULL;
+        uint32_t seq = 0;
         while (1)
         {
-            if (xEventGroupGetBits(connection_event_group) & DISCONNECT)
+            // Keeps scanning through reconnects, spinning the motor back up takes seconds
+            // A revolution only updates the angles it measured, the rest keep the last published distance
+            lidar_snapshot_t *snapshot = triple_buffer_write_buffer(lidar_scans);
+            if (published != NULL)
             {
-                lidar_stop_scan(lidar);
-                lidar_free(lidar);
-                ESP_LOGI("LIDAR_READ_TASK", "Waiting for reconnection.");
-                vTaskDelete(NULL);
+                memcpy(snapshot->ranges, published->ranges, sizeof(snapshot->ranges));
             }
-
-            // ESP_LOGI("LIDAR_READ_TASK", "Getting scan");
-            xSemaphoreTake(lidar_sem, portMAX_DELAY);
-            error = lidar_get_scan_360(lidar, ranges);
-            xSemaphoreGive(lidar_sem);
+            error = lidar_get_scan_360(lidar, snapshot->ranges);
 
             if (error)
             {
@@ -293,61 +596,160 @@ void lidar_read_task(void *args)
                 lidar_reset(lidar);
                 goto start;
             }
+            snapshot->utime = esp_timer_get_time();
+            snapshot->seq = seq++;
+            triple_buffer_publish(lidar_scans);
+            xSemaphoreGive(lidar_scan_ready);
+            published = snapshot;
         }
     }
 }
 
-void lidar_task(void *args)
+/**
+ * @brief Publishes the obstacle summary of a scan, with its downsampled ranges if enabled.
+ */
+static void lidar_publish_summary(const lidar_snapshot_t *snapshot, const lidar_summary_t *summary)
 {
-    TickType_t xLastWakeTime;
-    serial_lidar_scan_t scan = {0};
+    uint16_t num_points = LIDAR_SUMMARY_DOWNSAMPLE ? LIDAR_SCAN_POINTS / LIDAR_SUMMARY_DOWNSAMPLE : 0;
+    uint32_t msg_len = sizeof(serial_lidar_summary_t) + num_points * sizeof(uint16_t);
 
-    TickType_t count = 0;
-    TickType_t start_time = xTaskGetTickCount();
+    record_t record;
+    uint8_t *pkt = record_ring_reserve(message_ring, msg_len + ROS_PKG_LEN, HOST, portMAX_DELAY, &record);
+    if (pkt == NULL)
+    {
+        ESP_LOGE("LIDAR_TASK", "Error: Failed to reserve room for scan summary in message ring.");
+        metrics_counter_inc(queue_send_errors);
+        return;
+    }
+
+    serial_lidar_summary_t *msg = (serial_lidar_summary_t *)(pkt + ROS_HEADER_LEN);
+    msg->utime = snapshot->utime;
+    msg->seq = snapshot->seq;
+    msg->nearest_range = summary->nearest_range;
+    msg->nearest_bearing = summary->nearest_bearing;
+    memcpy(msg->sector_min, summary->sector_min, sizeof(msg->sector_min));
+    msg->downsample_step = LIDAR_SUMMARY_DOWNSAMPLE;
+    if (num_points > 0)
+    {
+        uint16_t points[LIDAR_SCAN_POINTS];
+        lidar_downsample(snapshot->ranges, LIDAR_MIN_VALID_MM, LIDAR_SUMMARY_DOWNSAMPLE, points);
+        memcpy(msg->points, points, num_points * sizeof(uint16_t));
+    }
+
+    encode_rospkt_inplace(msg_len, MBOT_LIDAR_SUMMARY, pkt);
+    record_ring_commit(message_ring, &record);
+}
+
+/**
+ * @brief Publishes a full scan.
+ */
+static void lidar_publish_scan(const lidar_snapshot_t *snapshot)
+{
+    // The scan is serialized straight into the ring
+    record_t record;
+    uint8_t *pkt = record_ring_reserve(message_ring, sizeof(serial_lidar_scan_t) + ROS_PKG_LEN, HOST, portMAX_DELAY, &record);
+    if (pkt == NULL)
+    {
+        ESP_LOGE("LIDAR_TASK", "Error: Failed to reserve room for scan in message ring.");
+        metrics_counter_inc(queue_send_errors);
+        return;
+    }
+
+    serial_lidar_scan_t *scan = (serial_lidar_scan_t *)(pkt + ROS_HEADER_LEN);
+    scan->utime = snapshot->utime;
+    scan->seq = snapshot->seq;
+    memcpy(scan->ranges, snapshot->ranges, sizeof(scan->ranges));
+
+    encode_rospkt_inplace(sizeof(serial_lidar_scan_t), MBOT_LIDAR_SCAN, pkt);
+    record_ring_commit(message_ring, &record);
+    metrics_counter_inc(lidar_scans_sent);
+}
+
+void lidar_task(void *args)
+{
+    static uint16_t sector_min[LIDAR_SECTORS];
+    lidar_summary_t summary = { .num_sectors = LIDAR_SECTORS, .sector_min = sector_min };
 
     while (1)
     {
-        if (xEventGroupGetBits(connection_event_group) & DISCONNECT)
+        // Woken by lidar_read_task the moment a revolution completes
+        if (xSemaphoreTake(lidar_scan_ready, LIDAR_WAIT_MS / portTICK_PERIOD_MS) != pdTRUE)
         {
-            ESP_LOGI("LIDAR_TASK", "Waiting for reconnection.");
-            vTaskDelete(NULL);
+            continue;
         }
 
-        xLastWakeTime = xTaskGetTickCount();
-        scan.utime = esp_timer_get_time();
-        xSemaphoreTake(lidar_sem, portMAX_DELAY);
-        memcpy(scan.ranges, ranges, sizeof(ranges));
-        xSemaphoreGive(lidar_sem);
-
-        packet_t packet;
-        packet.dest = HOST;
-        packet.len = sizeof(serial_lidar_scan_t) + ROS_PKG_LEN;
-        packet.data = (uint8_t *)malloc(packet.len);
-        if (packet.data == NULL)
+        uint8_t is_new;
+        const lidar_snapshot_t *snapshot = triple_buffer_read(lidar_scans, &is_new);
+        if (!is_new)
         {
-            ESP_LOGE("LIDAR_TASK", "Error: Failed to allocate memory for packet.");
-            goto delay;
+            continue;
         }
+        metrics_histogram_record(lidar_latency, (uint32_t)(esp_timer_get_time() - snapshot->utime));
+        lidar_summarize(snapshot->ranges, LIDAR_MIN_VALID_MM, &summary);
+        vel_gate_update(&summary, snapshot->utime);
 
-        encode_rospkt((uint8_t *)&scan, sizeof(serial_lidar_scan_t), MBOT_LIDAR_SCAN, packet.data);
-        // ESP_LOGI("SOCKET_TASK", "Queue size: %d", uxQueueMessagesWaiting(message_queue));
-        BaseType_t err = xQueueSend(message_queue, &packet, portMAX_DELAY);
-        if (err != pdTRUE)
+        if (!is_connected())
         {
-            ESP_LOGE("LIDAR_TASK", "Error: Failed to send packet to message queue.");
-            free(packet.data);
+            continue;
         }
 
-        count += 1;                
-        ESP_LOGI("HOST", "Receiving lidar at %f Hz", (float)count / (((xTaskGetTickCount() - start_time) * portTICK_PERIOD_MS) / 1000.0));
+        // The summary goes out every revolution by default, the full scan is decimated. Admitted here
+        // rather than in the sender so a decimated scan is never copied into the ring.
+        int64_t now = esp_timer_get_time();
+        if (topic_rates_admit(MBOT_LIDAR_SUMMARY, now))
+        {
+            lidar_publish_summary(snapshot, &summary);
+        }
+        if (topic_rates_admit(MBOT_LIDAR_SCAN, now))
+        {
+            lidar_publish_scan(snapshot);
+        }
+        else
+        {
+            metrics_counter_inc(lidar_scans_skipped);
+        }
+    }
+}
 
-    delay:
-        xTaskDelayUntil(&xLastWakeTime, 125 / portTICK_PERIOD_MS);
-        // vTaskDelay(500 / portTICK_PERIOD_MS);
+/**
+ * @brief Copies a camera frame into the message ring, called from the camera stream's publish task.
+ */
+static void camera_sink(const camera_frame_t *frame, void *ctx)
+{
+    if (!is_connected())
+    {
+        return;
+    }
+    if (!topic_rates_admit(MBOT_CAMERA_FRAME, esp_timer_get_time()))
+    {
+        metrics_counter_inc(rate_drops);
+        return;
+    }
+
+    uint32_t msg_len = sizeof(serial_camera_frame_t) + frame->len;
+
+    // A frame that cannot get room in time is dropped, the next one is newer anyway
+    record_t record;
+    uint8_t *pkt = (msg_len <= UINT16_MAX) ? record_ring_reserve(message_ring, msg_len + ROS_PKG_LEN, HOST, CAMERA_RESERVE_TIMEOUT_MS / portTICK_PERIOD_MS, &record) : NULL;
+    if (pkt == NULL)
+    {
+        ESP_LOGE("CAMERA_TASK", "Error: No room for a %u byte frame in message ring.", (unsigned)frame->len);
+        metrics_counter_inc(queue_send_errors);
+        return;
     }
+
+    serial_camera_frame_t *msg = (serial_camera_frame_t *)(pkt + ROS_HEADER_LEN);
+    memcpy(msg->data, frame->buf, frame->len);
+    msg->utime = frame->utime;
+    msg->width = frame->width;
+    msg->height = frame->height;
+    msg->format = frame->format;
+
+    encode_rospkt_inplace(msg_len, MBOT_CAMERA_FRAME, pkt);
+    record_ring_commit(message_ring, &record);
+    metrics_counter_inc(camera_frames_sent);
 }
 
-// TODO: Need to predetermine frame size for the serial_camera_frame_t object with testing
 void camera_task(void *)
 {
     camera_pins_t camera_pins = {
@@ -365,69 +767,60 @@ void camera_task(void *)
         .vsync = CAM_VSYNC_PIN,
         .href = CAM_HSYNC_PIN,
         .pclk = CAM_PCLK_PIN};
-    while (1)
-    {
-        TickType_t xLastWakeTime;
-        camera_fb_t *frame;
-        esp_err_t esp_err = camera_init(&camera_pins);
-        if (esp_err != ESP_OK)
-        {
-            ESP_LOGE("CAMERA_TASK", "Error initializing camera");
-            vTaskDelete(NULL);
-        }
-        while (1)
-        {
-            xLastWakeTime = xTaskGetTickCount();
 
-            if (xEventGroupGetBits(connection_event_group) & DISCONNECT)
-            {
-                camera_deinit();
-                ESP_LOGE("CAMERA_TASK", "Disconnected from server");
-                vTaskDelete(NULL);
-            }
+    camera_source_t *source = camera_source_esp_create(&camera_pins);
+    if (source == NULL)
+    {
+        ESP_LOGE("CAMERA_TASK", "Error initializing camera");
+        vTaskDelete(NULL);
+    }
 
-            camera_capture_frame(&frame);
+    // Capture and publishing run in their own tasks, this one only owns the stream
+    camera_stream_t *stream = camera_stream_start(source, camera_sink, NULL, 0);
+    if (stream == NULL)
+    {
+        ESP_LOGE("CAMERA_TASK", "Error starting camera stream");
+        camera_source_free(source);
+        vTaskDelete(NULL);
+    }
 
-            size_t frame_size = frame->len;
-            serial_camera_frame_t *msg = (serial_camera_frame_t *)malloc(sizeof(serial_camera_frame_t) + frame_size);
-            if (msg == NULL)
-            {
-                ESP_LOGE("CAMERA_TASK", "Error: Failed to allocate memory for frame data.");
-                camera_return_frame(frame);
-                goto delay;
-            }
-            memcpy(msg->data, frame->buf, frame_size);
-            msg->utime = esp_timer_get_time();
-            msg->width = frame->width;
-            msg->height = frame->height;
-            msg->format = frame->format;
-
-            packet_t packet;
-            packet.dest = HOST;
-            packet.len = sizeof(serial_camera_frame_t) + frame_size + ROS_PKG_LEN;
-            packet.data = (uint8_t *)malloc(packet.len);
-            if (packet.data == NULL)
-            {
-                ESP_LOGE("CAMERA_TASK", "Error: Failed to allocate memory for packet.");
-                camera_return_frame(frame);
-                goto delay;
-            }
+    // The stream keeps running through reconnects, its sink drops frames while disconnected
+    vTaskDelete(NULL);
+}
 
-            encode_rospkt((uint8_t *)msg, sizeof(serial_camera_frame_t) + frame_size, MBOT_CAMERA_FRAME, packet.data);
-            free(msg);
+void telemetry_task(void *args)
+{
+    static uint8_t msg[TELEMETRY_MAX_LEN];
+    TickType_t xLastWakeTime = xTaskGetTickCount();
+    int64_t last_tick = esp_timer_get_time();
+    while (true)
+    {
+        xTaskDelayUntil(&xLastWakeTime, TELEMETRY_PERIOD_MS / portTICK_PERIOD_MS);
 
-            BaseType_t rtos_err = xQueueSend(message_queue, &packet, portMAX_DELAY);
-            if (rtos_err != pdTRUE)
-            {
-                ESP_LOGE("CAMERA_TASK", "Error: Failed to send packet to message queue.");
-                free(packet.data);
-            }
+        int64_t now = esp_timer_get_time();
+        int64_t jitter = now - last_tick - TELEMETRY_PERIOD_MS * 1000;
+        metrics_histogram_record(telemetry_jitter, (uint32_t)(jitter < 0 ? -jitter : jitter));
+        last_tick = now;
 
-            camera_return_frame(frame);
+        // Ticks keep running while disconnected so the first message after a reconnect is fresh
+        uint32_t msg_len = telemetry_mux_emit(msg, now);
+        if (msg_len == 0 || !is_connected())
+        {
+            continue;
+        }
 
-        delay:
-            xTaskDelayUntil(&xLastWakeTime, 100 / portTICK_PERIOD_MS);
+        record_t record;
+        uint8_t *pkt = record_ring_reserve(message_ring, msg_len + ROS_PKG_LEN, HOST, portMAX_DELAY, &record);
+        if (pkt == NULL)
+        {
+            ESP_LOGE("TELEMETRY_TASK", "Error: Failed to reserve room for telemetry in message ring.");
+            metrics_counter_inc(queue_send_errors);
+            continue;
         }
+
+        encode_rospkt(msg, msg_len, MBOT_TELEMETRY, pkt);
+        record_ring_commit(message_ring, &record);
+        metrics_counter_inc(telemetry_sent);
     }
 }
 
@@ -438,35 +831,25 @@ void heartbeat_task(void *args)
     while (true)
     {
         xLastWakeTime = xTaskGetTickCount();
-        if (xEventGroupGetBits(connection_event_group) & DISCONNECT)
+        if (!is_connected())
         {
-            ESP_LOGI("HEARTBEAT_TASK", "Waiting for reconnection.");
-            vTaskDelete(NULL);
+            goto delay;
         }
 
         timestamp.utime = esp_timer_get_time();
         uint8_t msg[sizeof(serial_timestamp_t)];
         timestamp_t_serialize(&timestamp, msg);
 
-        packet_t packet;
-        packet.dest = MBOT;
-        packet.len = sizeof(serial_timestamp_t) + ROS_PKG_LEN;
-        packet.data = (uint8_t *)malloc(packet.len);
-        if (packet.data == NULL)
+        record_t record;
+        uint8_t *pkt = record_ring_reserve(message_ring, sizeof(serial_timestamp_t) + ROS_PKG_LEN, MBOT, portMAX_DELAY, &record);
+        if (pkt == NULL)
         {
-            ESP_LOGE("HEARTBEAT_TASK", "Error: Failed to allocate memory for packet.");
+            ESP_LOGE("HEARTBEAT_TASK", "Error: Failed to reserve room for heartbeat in message ring.");
             goto delay;
         }
 
-        encode_rospkt(msg, sizeof(serial_timestamp_t), MBOT_TIMESYNC, packet.data);
-
-        // ESP_LOGI("SOCKET_TASK", "Queue size: %d", uxQueueMessagesWaiting(message_queue));
-        BaseType_t err = xQueueSend(message_queue, &packet, portMAX_DELAY);
-        if (err != pdTRUE)
-        {
-            ESP_LOGE("HEARTBEAT_TASK", "Error: Failed to send packet to message queue.");
-            free(packet.data);
-        }
+        encode_rospkt(msg, sizeof(serial_timestamp_t), MBOT_TIMESYNC, pkt);
+        record_ring_commit(message_ring, &record);
 
     delay:
         xTaskDelayUntil(&xLastWakeTime, 500 / portTICK_PERIOD_MS);
@@ -522,6 +905,91 @@ pair_config_t pair_wifi()
     return new_pair_cfg;
 }
 
+/**
+ * @brief (Re)connects to the host without restarting any task.
+ *
+ * Parks the tasks using the client, reconnects it and lets them resume. Each attempt is bounded
+ * by CONNECT_TIMEOUT_MS and the wait between attempts doubles up to RECONNECT_MAX_BACKOFF_MS,
+ * so a host that comes back is found within a few seconds without flooding it while it is down.
+ */
+static void connect_to_host(void)
+{
+    xEventGroupClearBits(connection_event_group, CONNECT);
+    xEventGroupSetBits(connection_event_group, DISCONNECT);
+    xEventGroupWaitBits(connection_event_group, SENDER_PAUSED | SOCKET_PAUSED, pdTRUE, pdTRUE, portMAX_DELAY);
+
+    tcp_client_close(client);
+    udp_socket_free(udp);
+    udp = NULL;
+
+    uint32_t backoff_ms = RECONNECT_RETRY_MS;
+    while (true)
+    {
+        station_wait_for_connection(-1);
+
+        // The client is created once and reconnected in place from then on
+        if (client == NULL)
+        {
+            static const tcp_options_t options = HOST_LINK_OPTIONS;
+            client = tcp_client_init(AP_IP_ADDR, AP_PORT);
+            tcp_client_set_options(client, &options);
+        }
+        if (client != NULL && tcp_client_connect(client, CONNECT_TIMEOUT_MS) == 0)
+        {
+            break;
+        }
+
+        vTaskDelay(backoff_ms / portTICK_PERIOD_MS);
+        backoff_ms = (backoff_ms * 2 < RECONNECT_MAX_BACKOFF_MS) ? backoff_ms * 2 : RECONNECT_MAX_BACKOFF_MS;
+    }
+
+    // Without UDP the sensor data goes over TCP with everything else
+    if (SENSORS_OVER_UDP)
+    {
+        udp = udp_socket_create(0);
+        if (udp != NULL && udp_socket_set_peer(udp, AP_IP_ADDR, AP_PORT))
+        {
+            udp_socket_free(udp);
+            udp = NULL;
+        }
+    }
+
+    xEventGroupClearBits(connection_event_group, DISCONNECT);
+    xEventGroupSetBits(connection_event_group, CONNECT);
+}
+
+TASK_STATIC_BUFFERS(sender_task, 8192);
+TASK_STATIC_BUFFERS(socket_task, 8192);
+TASK_STATIC_BUFFERS(heartbeat_task, 4096);
+TASK_STATIC_BUFFERS(lidar_read_task, 8192);
+TASK_STATIC_BUFFERS(lidar_task, 8192);
+TASK_STATIC_BUFFERS(mbot_task, 8192);
+#if TELEMETRY_PERIOD_MS > 0
+TASK_STATIC_BUFFERS(telemetry_task, 4096);
+#endif
+
+/**
+ * @brief Every task of the node. Wi-Fi and lwIP run on core 0 together with the tasks using the
+ * sockets, the UART parsing and sensor processing get core 1 to themselves so Wi-Fi bursts do
+ * not delay reading the lidar and the MBot. The lidar reader is above the tasks sharing its core
+ * since the UART buffer only holds a few packets. All tasks live for the whole run and are static.
+ */
+static const task_spec_t node_tasks[] = {
+    { .name = "sender_task", .entry = sender_task, .priority = 4, .core = 0, TASK_STATIC(sender_task) },
+    { .name = "socket_task", .entry = socket_task, .priority = 3, .core = 0, TASK_STATIC(socket_task) },
+    { .name = "heartbeat_task", .entry = heartbeat_task, .priority = 3, .core = 0, TASK_STATIC(heartbeat_task) },
+    { .name = "lidar_read_task", .entry = lidar_read_task, .priority = 4, .core = 1, TASK_STATIC(lidar_read_task) },
+    { .name = "lidar_task", .entry = lidar_task, .priority = 3, .core = 1, TASK_STATIC(lidar_task) },
+    { .name = "mbot_task", .entry = mbot_task, .priority = 3, .core = 1, TASK_STATIC(mbot_task) },
+#if TELEMETRY_PERIOD_MS > 0
+    { .name = "telemetry_task", .entry = telemetry_task, .priority = 3, .core = 1, TASK_STATIC(telemetry_task) },
+#endif
+#if CAMERA_ENABLED
+    // Only starts the camera stream and deletes itself, so its stack comes from the heap
+    { .name = "camera_task", .entry = camera_task, .stack_size = 8192, .priority = 3, .core = 1 },
+#endif
+};
+
 void app_main(void)
 {
     // Init
@@ -540,6 +1008,9 @@ void app_main(void)
     pair_btn = button_create(PAIR_PIN);
     button_interrupt_enable(pair_btn);
 
+    // Tasks live for the whole run, the lidar spins up while Wi-Fi connects
+    task_topology_start(node_tasks, sizeof(node_tasks) / sizeof(node_tasks[0]), 0);
+
     wifi_init_config_t *wifi_cfg = wifi_start();
 
     int pairing_mode = 0;
@@ -568,60 +1039,17 @@ void app_main(void)
     station_connect(wifi_sta_cfg, pair_cfg.ssid, pair_cfg.password);
     station_wait_for_connection(-1);
 
-    client = tcp_client_create(AP_IP_ADDR, AP_PORT);
-    while (client == NULL)
-    {
-        vTaskDelay(1000 / portTICK_PERIOD_MS);
-        client = tcp_client_create(AP_IP_ADDR, AP_PORT);
-    }
-
-    TaskHandle_t sender_task_handle, lidar_task_handle, lidar_read_task_handle, socket_task_handle, mbot_task_handle, heartbeat_task_handle;
-    xTaskCreate(sender_task, "sender_task", 8192, NULL, 4, &sender_task_handle);
-    xTaskCreate(lidar_read_task, "lidar_read_task", 8192, NULL, 3, &lidar_read_task_handle);
-    xTaskCreate(lidar_task, "lidar_task", 8192, NULL, 3, &lidar_task_handle);
-    xTaskCreate(socket_task, "socket_task", 8192, NULL, 3, &socket_task_handle);
-    xTaskCreate(mbot_task, "mbot_task", 8192, NULL, 3, &mbot_task_handle);
-    xTaskCreate(heartbeat_task, "heartbeat_task", 8192, NULL, 3, &heartbeat_task_handle);
+    connect_to_host();
+    metrics_reporter_start(METRICS_PERIOD_MS, metrics_sink, NULL);
+    profiling_reporter_start(PROFILING_PERIOD_MS, diagnostics_sink, NULL);
 
     while (true)
     {
         if (station_is_disconnected() || tcp_client_is_closed(client))
         {
             ESP_LOGW("CLIENT", "Disconnected from AP. Attempting to reconnect...");
-            xEventGroupSetBits(connection_event_group, DISCONNECT);
-            vTaskDelay(100 / portTICK_PERIOD_MS);
-
-            while (eTaskGetState(sender_task_handle) != eDeleted &&
-                   eTaskGetState(lidar_read_task_handle) != eDeleted &&
-                   eTaskGetState(lidar_task_handle) != eDeleted &&
-                   eTaskGetState(socket_task_handle) != eDeleted &&
-                   eTaskGetState(mbot_task_handle) != eDeleted &&
-                   eTaskGetState(heartbeat_task_handle) != eDeleted)
-            {
-                vTaskDelay(100 / portTICK_PERIOD_MS);
-            }
-
-            xEventGroupClearBits(connection_event_group, DISCONNECT);
-
-            station_wait_for_connection(-1);
-
-            tcp_client_free(client);
-            client = NULL;
-
-            client = tcp_client_create(AP_IP_ADDR, AP_PORT);
-            while (client == NULL)
-            {
-                vTaskDelay(1000 / portTICK_PERIOD_MS);
-                client = tcp_client_create(AP_IP_ADDR, AP_PORT);
-            }
-
-            xTaskCreate(sender_task, "sender_task", 8192, NULL, 4, &sender_task_handle);
-            xTaskCreate(lidar_read_task, "lidar_read_task", 8192, NULL, 3, NULL);
-            xTaskCreate(lidar_task, "lidar_task", 8192, NULL, 3, &lidar_task_handle);
-            xTaskCreate(socket_task, "socket_task", 8192, NULL, 3, &socket_task_handle);
-            xTaskCreate(mbot_task, "mbot_task", 8192, NULL, 3, &mbot_task_handle);
-            xTaskCreate(heartbeat_task, "heartbeat_task", 8192, NULL, 3, &heartbeat_task_handle);
+            connect_to_host();
         }
         vTaskDelay(250 / portTICK_PERIOD_MS);
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "lcm_types.h"
+
+#include "telemetry_mux.h"
+
+typedef struct telemetry_field_t
+{
+    uint16_t topic;
+    uint8_t bit;
+    uint16_t offset;            /**< Offset of the field in serial_telemetry_t */
+    uint16_t len;
+} telemetry_field_t;
+
+static const telemetry_field_t fields[] = {
+    { MBOT_ENCODERS, TELEMETRY_ENCODERS, offsetof(serial_telemetry_t, encoders), sizeof(serial_mbot_encoders_t) },
+    { MBOT_ODOMETRY, TELEMETRY_ODOMETRY, offsetof(serial_telemetry_t, odom), sizeof(serial_pose2D_t) },
+    { MBOT_IMU, TELEMETRY_IMU, offsetof(serial_telemetry_t, imu), sizeof(serial_mbot_imu_t) },
+    { MBOT_VEL, TELEMETRY_MBOT_VEL, offsetof(serial_telemetry_t, mbot_vel), sizeof(serial_twist2D_t) },
+    { MBOT_MOTOR_VEL, TELEMETRY_MOTOR_VEL, offsetof(serial_telemetry_t, motor_vel), sizeof(serial_mbot_motor_vel_t) },
+    { MBOT_MOTOR_PWM, TELEMETRY_MOTOR_PWM, offsetof(serial_telemetry_t, motor_pwm), sizeof(serial_mbot_motor_pwm_t) },
+};
+
+static serial_telemetry_t latest;
+#if TELEMETRY_IMU_BATCH > 0
+static serial_mbot_imu_t imu_batch[TELEMETRY_IMU_BATCH];
+static uint8_t imu_head = 0;            /**< Index of the oldest batched sample */
+#endif
+static uint8_t num_imu = 0;
+static uint32_t seq = 0;
+static portMUX_TYPE mux_lock = portMUX_INITIALIZER_UNLOCKED;
+
+uint8_t telemetry_mux_update(uint16_t topic, const uint8_t *msg, uint16_t len)
+{
+    if (TELEMETRY_PERIOD_MS == 0)
+    {
+        return 0;
+    }
+
+    const telemetry_field_t *field = NULL;
+    for (int i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
+    {
+        if (fields[i].topic == topic)
+        {
+            field = &fields[i];
+            break;
+        }
+    }
+    // Messages of an unexpected size are left for the host to deal with
+    if (field == NULL || field->len != len)
+    {
+        return 0;
+    }
+
+    taskENTER_CRITICAL(&mux_lock);
+    memcpy((uint8_t *)&latest + field->offset, msg, len);
+    latest.valid |= field->bit;
+    latest.fresh |= field->bit;
+#if TELEMETRY_IMU_BATCH > 0
+    if (topic == MBOT_IMU)
+    {
+        // Once the batch is full the oldest sample is overwritten
+        memcpy(&imu_batch[(imu_head + num_imu) % TELEMETRY_IMU_BATCH], msg, len);
+        if (num_imu < TELEMETRY_IMU_BATCH)
+        {
+            num_imu++;
+        }
+        else
+        {
+            imu_head = (imu_head + 1) % TELEMETRY_IMU_BATCH;
+        }
+    }
+#endif
+    taskEXIT_CRITICAL(&mux_lock);
+    return 1;
+}
+
+uint32_t telemetry_mux_emit(uint8_t *msg, int64_t now_us)
+{
+    serial_telemetry_t *telemetry = (serial_telemetry_t *)msg;
+
+    taskENTER_CRITICAL(&mux_lock);
+    uint32_t tick = seq++;
+    if (latest.fresh == 0)
+    {
+        taskEXIT_CRITICAL(&mux_lock);
+        return 0;
+    }
+    latest.utime = now_us;
+    latest.seq = tick;
+    latest.num_imu = num_imu;
+    memcpy(telemetry, &latest, sizeof(serial_telemetry_t));
+#if TELEMETRY_IMU_BATCH > 0
+    for (uint8_t i = 0; i < num_imu; i++)
+    {
+        memcpy(&telemetry->imu_batch[i], &imu_batch[(imu_head + i) % TELEMETRY_IMU_BATCH], sizeof(serial_mbot_imu_t));
+    }
+    imu_head = 0;
+#endif
+    num_imu = 0;
+    latest.fresh = 0;
+    taskEXIT_CRITICAL(&mux_lock);
+
+    return sizeof(serial_telemetry_t) + telemetry->num_imu * sizeof(serial_mbot_imu_t);
+}
@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_log.h"
+
+#include "lcm_types.h"
+
+#include "topic_rates.h"
+
+#define TOPIC_RATES_TAG "TOPIC_RATES"
+
+typedef struct topic_rate_t
+{
+    uint16_t topic;
+    uint8_t enabled;
+    uint8_t decimation;
+    int64_t min_period_us;
+
+    uint32_t skipped;           /**< Messages skipped since the last forwarded one, for decimation */
+    int64_t last_sent_us;
+} topic_rate_t;
+
+/**
+ * @brief Settings applied at boot and on reset. Camera frames are the heaviest topic and start at 10 Hz,
+ * full lidar scans go out every few revolutions since the summary carries the nearest obstacles each one.
+ */
+static const serial_topic_rate_t default_rates[] = {
+    { .topic = MBOT_CAMERA_FRAME, .enabled = 1, .decimation = 1, .min_period_ms = 100 },
+    { .topic = MBOT_LIDAR_SCAN, .enabled = 1, .decimation = 5, .min_period_ms = 0 },
+};
+
+static topic_rate_t rates[TOPIC_RATES_MAX];
+static uint8_t num_rates = 0;
+static portMUX_TYPE rates_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * @brief Finds the entry of a topic, adding one if add is set. Must be called in the critical section.
+ */
+static topic_rate_t *_topic_rates_find(uint16_t topic, uint8_t add)
+{
+    for (int i = 0; i < num_rates; i++)
+    {
+        if (rates[i].topic == topic)
+        {
+            return &rates[i];
+        }
+    }
+    if (!add || num_rates == TOPIC_RATES_MAX)
+    {
+        return NULL;
+    }
+
+    topic_rate_t *rate = &rates[num_rates++];
+    memset(rate, 0, sizeof(topic_rate_t));
+    rate->topic = topic;
+    return rate;
+}
+
+static void _topic_rates_set(topic_rate_t *rate, const serial_topic_rate_t *settings)
+{
+    rate->enabled = settings->enabled;
+    rate->decimation = (settings->decimation > 1) ? settings->decimation : 1;
+    rate->min_period_us = (int64_t)settings->min_period_ms * 1000;
+    rate->skipped = 0;
+}
+
+static void _topic_rates_reset(void)
+{
+    num_rates = 0;
+    for (int i = 0; i < sizeof(default_rates) / sizeof(default_rates[0]); i++)
+    {
+        _topic_rates_set(_topic_rates_find(default_rates[i].topic, 1), &default_rates[i]);
+    }
+}
+
+void topic_rates_init(void)
+{
+    taskENTER_CRITICAL(&rates_mux);
+    _topic_rates_reset();
+    taskEXIT_CRITICAL(&rates_mux);
+}
+
+uint8_t topic_rates_apply(const serial_topic_rate_t *settings)
+{
+    if (settings == NULL)
+    {
+        return 1;
+    }
+
+    uint8_t err = 0;
+    taskENTER_CRITICAL(&rates_mux);
+    if (settings->topic == 0)
+    {
+        _topic_rates_reset();
+    }
+    else
+    {
+        topic_rate_t *rate = _topic_rates_find(settings->topic, 1);
+        if (rate != NULL)
+        {
+            _topic_rates_set(rate, settings);
+        }
+        else
+        {
+            err = 1;
+        }
+    }
+    taskEXIT_CRITICAL(&rates_mux);
+
+    if (err)
+    {
+        ESP_LOGE(TOPIC_RATES_TAG, "No room for settings of topic %d", settings->topic);
+    }
+    else
+    {
+        ESP_LOGI(TOPIC_RATES_TAG, "Topic %d: enabled %d, decimation %d, min period %d ms", settings->topic,
+                 settings->enabled, settings->decimation, settings->min_period_ms);
+    }
+    return err;
+}
+
+uint8_t topic_rates_admit(uint16_t topic, int64_t now_us)
+{
+    uint8_t admit = 1;
+    taskENTER_CRITICAL(&rates_mux);
+    topic_rate_t *rate = _topic_rates_find(topic, 0);
+    if (rate != NULL)
+    {
+        if (!rate->enabled || now_us - rate->last_sent_us < rate->min_period_us)
+        {
+            admit = 0;
+        }
+        else if (++rate->skipped < rate->decimation)
+        {
+            admit = 0;
+        }
+        else
+        {
+            rate->skipped = 0;
+            rate->last_sent_us = now_us;
+        }
+    }
+    taskEXIT_CRITICAL(&rates_mux);
+    return admit;
+}
@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "lcm_types.h"
+#include "lidar_summary.h"
+
+#include "vel_gate.h"
+
+#define VEL_GATE_MAX_SECTORS    32
+
+static uint16_t sector_min[VEL_GATE_MAX_SECTORS];
+static uint8_t num_sectors = 0;
+static int64_t scan_time = 0;
+static portMUX_TYPE gate_mux = portMUX_INITIALIZER_UNLOCKED;
+
+void vel_gate_update(const lidar_summary_t *summary, int64_t utime)
+{
+    if (summary == NULL || summary->num_sectors > VEL_GATE_MAX_SECTORS)
+    {
+        return;
+    }
+
+    taskENTER_CRITICAL(&gate_mux);
+    memcpy(sector_min, summary->sector_min, summary->num_sectors * sizeof(uint16_t));
+    num_sectors = summary->num_sectors;
+    scan_time = utime;
+    taskEXIT_CRITICAL(&gate_mux);
+}
+
+/**
+ * @brief Gets the nearest return within the cone around a lidar bearing, 0 if there is none.
+ */
+static uint16_t _vel_gate_nearest(const uint16_t *sectors, uint8_t count, float bearing)
+{
+    float width = 360.0f / count;
+    uint16_t nearest = 0;
+    for (uint8_t i = 0; i < count; i++)
+    {
+        // A sector counts if any part of it lies inside the cone
+        float diff = fabsf(fmodf((i + 0.5f) * width - bearing + 540.0f, 360.0f) - 180.0f);
+        if (diff > VEL_GATE_HALF_ANGLE_DEG + width / 2)
+        {
+            continue;
+        }
+        if (sectors[i] != 0 && (nearest == 0 || sectors[i] < nearest))
+        {
+            nearest = sectors[i];
+        }
+    }
+    return nearest;
+}
+
+vel_gate_result_t vel_gate_apply(serial_twist2D_t *cmd, int64_t now_us)
+{
+    if (!VEL_GATE_ENABLED || cmd == NULL)
+    {
+        return VEL_GATE_PASSED;
+    }
+
+    float speed = sqrtf(cmd->vx * cmd->vx + cmd->vy * cmd->vy);
+    if (speed < VEL_GATE_MIN_SPEED)
+    {
+        return VEL_GATE_PASSED;
+    }
+
+    uint16_t sectors[VEL_GATE_MAX_SECTORS];
+    taskENTER_CRITICAL(&gate_mux);
+    uint8_t count = num_sectors;
+    int64_t age = now_us - scan_time;
+    memcpy(sectors, sector_min, count * sizeof(uint16_t));
+    taskEXIT_CRITICAL(&gate_mux);
+
+    if (count == 0 || age > VEL_GATE_MAX_SCAN_AGE_MS * 1000LL)
+    {
+        return VEL_GATE_PASSED;
+    }
+
+    // Direction of travel in the robot frame is counter clockwise from forward
+    float heading = atan2f(cmd->vy, cmd->vx) * 180.0f / (float)M_PI;
+    float bearing = VEL_GATE_LIDAR_OFFSET_DEG + (VEL_GATE_LIDAR_CLOCKWISE ? -heading : heading);
+    uint16_t nearest = _vel_gate_nearest(sectors, count, fmodf(bearing + 360.0f, 360.0f));
+    if (nearest == 0 || nearest >= VEL_GATE_SLOW_MM)
+    {
+        return VEL_GATE_PASSED;
+    }
+
+    if (nearest <= VEL_GATE_STOP_MM)
+    {
+        cmd->vx = 0.0f;
+        cmd->vy = 0.0f;
+        return VEL_GATE_STOPPED;
+    }
+
+    float scale = (float)(nearest - VEL_GATE_STOP_MM) / (VEL_GATE_SLOW_MM - VEL_GATE_STOP_MM);
+    cmd->vx *= scale;
+    cmd->vy *= scale;
+    return VEL_GATE_SLOWED;
+}